@@ -627,9 +627,7 @@ gboolean note_save_callback(UserInterface *ui)
 	/* Test, to see if the window is still open */
 	if (ui->note != NULL && GTK_IS_TEXT_BUFFER(ui->buffer)) {
 		if (gtk_text_buffer_get_modified(ui->buffer)) {
-			gtk_text_view_set_editable(ui->view, FALSE);
 			note_save(ui);
-			gtk_text_view_set_editable(ui->view, TRUE);
 		}
 	}
 
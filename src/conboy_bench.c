@@ -0,0 +1,534 @@
+/* This file is part of Conboy.
+ *
+ * Copyright (C) 2009 Cornelius Hald
+ *
+ * Conboy is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Conboy is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Conboy. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Storage benchmark. Generates a deterministic Tomboy corpus and times the
+ * basic operations of every storage plugin given on the command line:
+ *
+ *   conboy-bench --notes 1000 src/plugins/storage_xml/.libs/libstoragexml.so
+ *
+ * Use --parser reader to let the XML plugin parse with the xmlTextReader
+ * instead of SAX2, e.g. to compare both parsers on the same corpus.
+ *
+ * Each measurement is printed to stdout as one JSON object per line. Every
+ * plugin works on its own temporary directory, ~/.conboy is never touched.
+ * Every plugin also runs in its own child process, so that the peak RSS
+ * of one plugin does not show up in the numbers of the next one.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <libxml/xmlIO.h>
+
+#include "conboy_note.h"
+#include "conboy_plugin.h"
+#include "conboy_storage_plugin.h"
+#include "conboy_xml_note.h"
+
+#define BASE_DATE 1230768000 /* 2009-01-01 */
+
+static gint     n_notes      = 500;
+static gint     note_size    = 2000;
+static gint     list_depth   = 2;
+static gdouble  link_density = 0.1;
+static gint     n_tags       = 5;
+static gint     seed         = 1;
+static gboolean compress     = FALSE;
+static gchar   *corpus_dir   = NULL;
+static gchar   *parser       = NULL;
+
+static GOptionEntry entries[] = {
+	{ "notes",        'n', 0, G_OPTION_ARG_INT,      &n_notes,      "Number of notes to generate", "N" },
+	{ "size",         's', 0, G_OPTION_ARG_INT,      &note_size,    "Approximate size of the note content in bytes", "BYTES" },
+	{ "list-depth",   'd', 0, G_OPTION_ARG_INT,      &list_depth,   "Maximal nesting depth of bullet lists", "DEPTH" },
+	{ "link-density", 'l', 0, G_OPTION_ARG_DOUBLE,   &link_density, "Probability of a paragraph containing a note link", "P" },
+	{ "tags",         't', 0, G_OPTION_ARG_INT,      &n_tags,       "Number of notebooks to spread the notes over", "N" },
+	{ "seed",         0,   0, G_OPTION_ARG_INT,      &seed,         "Seed of the corpus generator", "SEED" },
+	{ "compress",     'z', 0, G_OPTION_ARG_NONE,     &compress,     "Let the XML plugin write .note.gz files", NULL },
+	{ "parser",       'p', 0, G_OPTION_ARG_STRING,   &parser,       "XML parser of the XML plugin, sax or reader", "PARSER" },
+	{ "write-corpus", 'w', 0, G_OPTION_ARG_FILENAME, &corpus_dir,   "Write the corpus as .note files to DIR and exit", "DIR" },
+	{ NULL }
+};
+
+static const gchar *words[] = {
+	"note", "conboy", "tomboy", "meeting", "shopping", "list", "remember",
+	"call", "project", "idea", "tomorrow", "maemo", "device", "phone",
+	"write", "read", "book", "travel", "ticket", "dinner", "garden",
+	"release", "bug", "fix", "review", "draft", "budget", "plan", "week",
+	"friday", "morning", "the", "a", "and", "of", "to", "with", "for"
+};
+
+static gchar*
+make_guid (guint i)
+{
+	return g_strdup_printf("%08x-0000-4000-8000-%012x", seed, i);
+}
+
+static gchar*
+make_title (guint i)
+{
+	return g_strdup_printf("Bench note %05u", i);
+}
+
+static void
+append_words (GString *str, GRand *rand, guint count)
+{
+	guint i;
+
+	for (i = 0; i < count; i++) {
+		const gchar *word = words[g_rand_int_range(rand, 0, G_N_ELEMENTS(words))];
+		if (i > 0) {
+			g_string_append_c(str, ' ');
+		}
+		if (g_rand_int_range(rand, 0, 20) == 0) {
+			g_string_append_printf(str, "<bold>%s</bold>", word);
+		} else if (g_rand_int_range(rand, 0, 20) == 0) {
+			g_string_append_printf(str, "<italic>%s</italic>", word);
+		} else {
+			g_string_append(str, word);
+		}
+	}
+}
+
+static void
+append_list (GString *str, GRand *rand, gint depth)
+{
+	gint items = g_rand_int_range(rand, 1, 4);
+	gint i;
+
+	g_string_append(str, "<list>");
+	for (i = 0; i < items; i++) {
+		g_string_append(str, "<list-item dir=\"ltr\">");
+		append_words(str, rand, g_rand_int_range(rand, 2, 8));
+		if (depth > 1 && g_rand_boolean(rand)) {
+			g_string_append_c(str, '\n');
+			append_list(str, rand, depth - 1);
+		}
+		if (i < items - 1) {
+			g_string_append_c(str, '\n');
+		}
+		g_string_append(str, "</list-item>");
+	}
+	g_string_append(str, "</list>");
+}
+
+static ConboyNote*
+make_note (GRand *rand, guint i)
+{
+	ConboyNote *note;
+	GString *content;
+	gchar *guid, *title;
+	time_t date = BASE_DATE + i * 60;
+
+	guid = make_guid(i);
+	title = make_title(i);
+
+	content = g_string_new("<note-content version=\"0.1\">");
+	g_string_append(content, title);
+	g_string_append(content, "\n\n");
+
+	while (content->len < (gsize) note_size) {
+		if (list_depth > 0 && g_rand_int_range(rand, 0, 4) == 0) {
+			append_list(content, rand, list_depth);
+		} else {
+			append_words(content, rand, g_rand_int_range(rand, 10, 40));
+		}
+		if (n_notes > 1 && g_rand_double(rand) < link_density) {
+			gchar *target = make_title((i + g_rand_int_range(rand, 1, n_notes)) % n_notes);
+			g_string_append_printf(content, " <link:internal>%s</link:internal>", target);
+			g_free(target);
+		}
+		g_string_append_c(content, '\n');
+	}
+	g_string_append(content, "</note-content>");
+
+	note = conboy_note_new_with_guid(guid);
+	g_object_set(note,
+			"title", title,
+			"content", content->str,
+			"create-date", date,
+			"change-date", date,
+			"metadata-change-date", date,
+			NULL);
+
+	if (n_tags > 0) {
+		gchar *tag = g_strdup_printf("system:notebook:Notebook %d", g_rand_int_range(rand, 0, n_tags));
+		conboy_note_add_tag(note, tag);
+		g_free(tag);
+	}
+
+	g_string_free(content, TRUE);
+	g_free(title);
+	g_free(guid);
+
+	return note;
+}
+
+static GSList*
+make_corpus (gsize *bytes)
+{
+	GRand *rand = g_rand_new_with_seed(seed);
+	GSList *notes = NULL;
+	gint i;
+
+	*bytes = 0;
+	for (i = 0; i < n_notes; i++) {
+		ConboyNote *note = make_note(rand, i);
+		*bytes += strlen(note->content);
+		notes = g_slist_prepend(notes, note);
+	}
+
+	g_rand_free(rand);
+	return g_slist_reverse(notes);
+}
+
+static void
+free_notes (GSList *notes)
+{
+	g_slist_foreach(notes, (GFunc) g_object_unref, NULL);
+	g_slist_free(notes);
+}
+
+static void
+free_strings (GSList *strings)
+{
+	g_slist_foreach(strings, (GFunc) g_free, NULL);
+	g_slist_free(strings);
+}
+
+static glong
+get_peak_rss (void)
+{
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) != 0) {
+		return -1;
+	}
+
+	/* Kilobytes on Linux. This includes the corpus, see bench_plugin_in_child() */
+	return usage.ru_maxrss;
+}
+
+/*
+ * Sum of the sizes of all files below path, i.e. what the plugin
+ * stores on disk, e.g. to see what --compress saves.
+ */
+static gsize
+get_disk_size (const gchar *path)
+{
+	GDir *dir = g_dir_open(path, 0, NULL);
+	const gchar *name;
+	gsize size = 0;
+
+	if (dir == NULL) {
+		return 0;
+	}
+
+	while ((name = g_dir_read_name(dir)) != NULL) {
+		gchar *file = g_build_filename(path, name, NULL);
+		struct stat file_stat;
+
+		if (g_file_test(file, G_FILE_TEST_IS_DIR)) {
+			size += get_disk_size(file);
+		} else if (g_stat(file, &file_stat) == 0) {
+			size += file_stat.st_size;
+		}
+		g_free(file);
+	}
+	g_dir_close(dir);
+
+	return size;
+}
+
+/*
+ * bytes is the size of the note content handled by the operation,
+ * disk_bytes the size of the notes directory after saving.
+ */
+static void
+report (const gchar *plugin, const gchar *operation, guint count, gsize bytes, gsize disk_bytes, gdouble seconds)
+{
+	g_print("{\"plugin\": \"%s\", \"parser\": \"%s\", \"operation\": \"%s\", \"notes\": %u, \"bytes\": %lu, "
+			"\"disk_bytes\": %lu, \"seconds\": %.6f, \"notes_per_second\": %.1f, \"bytes_per_second\": %.1f, "
+			"\"peak_rss_kb\": %ld}\n",
+			plugin, parser, operation, count, (gulong) bytes,
+			(gulong) disk_bytes, seconds,
+			seconds > 0 ? count / seconds : 0.0,
+			seconds > 0 ? bytes / seconds : 0.0,
+			get_peak_rss());
+}
+
+static void
+remove_dir (const gchar *path)
+{
+	GDir *dir = g_dir_open(path, 0, NULL);
+	const gchar *name;
+
+	if (dir != NULL) {
+		while ((name = g_dir_read_name(dir)) != NULL) {
+			gchar *file = g_build_filename(path, name, NULL);
+			if (g_file_test(file, G_FILE_TEST_IS_DIR)) {
+				remove_dir(file);
+			} else {
+				g_unlink(file);
+			}
+			g_free(file);
+		}
+		g_dir_close(dir);
+	}
+
+	g_rmdir(path);
+}
+
+static gboolean
+write_corpus (GSList *notes, const gchar *path)
+{
+	GSList *iter;
+
+	if (g_mkdir_with_parents(path, 0700) != 0) {
+		g_printerr("ERROR: Could not create %s\n", path);
+		return FALSE;
+	}
+
+	for (iter = notes; iter; iter = iter->next) {
+		ConboyNote *note = CONBOY_NOTE(iter->data);
+		gchar *name = g_strconcat(note->guid, ".note", NULL);
+		gchar *file = g_build_filename(path, name, NULL);
+		xmlOutputBuffer *buffer = xmlOutputBufferCreateFilename(file, NULL, 0);
+		gboolean ok = buffer != NULL && conboy_xml_note_write(note, buffer);
+
+		if (!ok) {
+			g_printerr("ERROR: Could not write %s\n", file);
+		}
+		g_free(file);
+		g_free(name);
+
+		if (!ok) {
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static gboolean
+bench_plugin (const gchar *filename, GSList *notes, gsize bytes)
+{
+	ConboyPlugin *plugin;
+	ConboyStoragePlugin *storage;
+	GTimer *timer;
+	GSList *iter, *ids, *list;
+	gchar *name, *dir;
+	guint count, failed = 0;
+	gsize disk_bytes;
+	gdouble elapsed;
+
+	dir = g_build_filename(g_get_tmp_dir(), "conboy-bench-XXXXXX", NULL);
+	if (mkdtemp(dir) == NULL) {
+		g_printerr("ERROR: Could not create temporary directory\n");
+		g_free(dir);
+		return FALSE;
+	}
+	g_setenv("CONBOY_NOTES_DIR", dir, TRUE);
+	g_setenv("CONBOY_XML_COMPRESS", compress ? "1" : "0", TRUE);
+	g_setenv("CONBOY_XML_PARSER", parser, TRUE);
+
+	plugin = conboy_plugin_new_from_path((gchar*) filename);
+	if (plugin == NULL || !CONBOY_IS_STORAGE_PLUGIN(plugin)) {
+		g_printerr("ERROR: %s is not a storage plugin\n", filename);
+		if (plugin != NULL) {
+			g_object_unref(plugin);
+		}
+		remove_dir(dir);
+		g_free(dir);
+		return FALSE;
+	}
+	storage = CONBOY_STORAGE_PLUGIN(plugin);
+	name = g_path_get_basename(filename);
+	timer = g_timer_new();
+
+	/* save */
+	g_timer_start(timer);
+	for (iter = notes; iter; iter = iter->next) {
+		if (!conboy_storage_plugin_note_save(storage, CONBOY_NOTE(iter->data))) {
+			failed++;
+		}
+	}
+	conboy_storage_plugin_sync(storage);
+	elapsed = g_timer_elapsed(timer, NULL);
+	disk_bytes = get_disk_size(dir);
+	report(name, "save", g_slist_length(notes), bytes, disk_bytes, elapsed);
+
+	/* list_ids */
+	g_timer_start(timer);
+	ids = conboy_storage_plugin_note_list_ids(storage);
+	report(name, "list_ids", g_slist_length(ids), 0, disk_bytes, g_timer_elapsed(timer, NULL));
+
+	/* list */
+	g_timer_start(timer);
+	list = conboy_storage_plugin_note_list(storage);
+	report(name, "list", g_slist_length(list), 0, disk_bytes, g_timer_elapsed(timer, NULL));
+	free_notes(list);
+
+	/* load */
+	count = 0;
+	g_timer_start(timer);
+	for (iter = ids; iter; iter = iter->next) {
+		ConboyNote *note = conboy_storage_plugin_note_load(storage, iter->data);
+		if (note == NULL) {
+			failed++;
+			continue;
+		}
+		/* Plugins may load the content lazily, so force it */
+		conboy_note_get_content(note);
+		g_object_unref(note);
+		count++;
+	}
+	report(name, "load", count, bytes, disk_bytes, g_timer_elapsed(timer, NULL));
+	free_strings(ids);
+
+	/* delete */
+	g_timer_start(timer);
+	for (iter = notes; iter; iter = iter->next) {
+		if (!conboy_storage_plugin_note_delete(storage, CONBOY_NOTE(iter->data))) {
+			failed++;
+		}
+	}
+	conboy_storage_plugin_sync(storage);
+	report(name, "delete", g_slist_length(notes), 0, disk_bytes, g_timer_elapsed(timer, NULL));
+
+	if (failed > 0) {
+		g_printerr("WARN: %s: %u operations failed\n", name, failed);
+	}
+
+	g_timer_destroy(timer);
+	g_object_unref(plugin);
+	remove_dir(dir);
+	g_free(name);
+	g_free(dir);
+
+	return failed == 0;
+}
+
+/*
+ * ru_maxrss never goes down, so each plugin is measured in a forked child.
+ * The child starts out with the memory of the parent, i.e. the corpus, which
+ * is the same for all plugins.
+ */
+static gboolean
+bench_plugin_in_child (const gchar *filename, GSList *notes, gsize bytes)
+{
+	pid_t pid;
+	int status;
+
+	/* Don't let the child print what is still buffered a second time */
+	fflush(stdout);
+	fflush(stderr);
+
+	pid = fork();
+	if (pid < 0) {
+		g_printerr("ERROR: Could not fork to benchmark %s\n", filename);
+		return FALSE;
+	}
+
+	if (pid == 0) {
+		gboolean ok = bench_plugin(filename, notes, bytes);
+		fflush(stdout);
+		fflush(stderr);
+		_exit(ok ? 0 : 1);
+	}
+
+	if (waitpid(pid, &status, 0) != pid) {
+		g_printerr("ERROR: Could not wait for the benchmark of %s\n", filename);
+		return FALSE;
+	}
+
+	if (!WIFEXITED(status)) {
+		g_printerr("ERROR: Benchmark of %s crashed\n", filename);
+		return FALSE;
+	}
+
+	return WEXITSTATUS(status) == 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+	GOptionContext *context;
+	GError *error = NULL;
+	GSList *notes;
+	gsize bytes;
+	gboolean ok = TRUE;
+	gint i;
+
+	g_type_init();
+	if (!g_thread_supported()) {
+		g_thread_init(NULL);
+	}
+
+	context = g_option_context_new("PLUGIN.so... - benchmark Conboy storage plugins");
+	g_option_context_add_main_entries(context, entries, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		g_printerr("ERROR: %s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(context);
+		return 1;
+	}
+	g_option_context_free(context);
+
+	if (n_notes < 0 || note_size < 0 || list_depth < 0 || n_tags < 0) {
+		g_printerr("ERROR: Counts and sizes must not be negative\n");
+		return 1;
+	}
+
+	if (parser == NULL) {
+		parser = g_strdup("sax");
+	} else if (strcmp(parser, "sax") != 0 && strcmp(parser, "reader") != 0) {
+		g_printerr("ERROR: Unknown parser %s, use sax or reader\n", parser);
+		return 1;
+	}
+
+	if (corpus_dir == NULL && argc < 2) {
+		g_printerr("ERROR: No storage plugin given\n");
+		return 1;
+	}
+
+	notes = make_corpus(&bytes);
+
+	if (corpus_dir != NULL) {
+		ok = write_corpus(notes, corpus_dir);
+	} else {
+		for (i = 1; i < argc; i++) {
+			ok = bench_plugin_in_child(argv[i], notes, bytes) && ok;
+		}
+	}
+
+	free_notes(notes);
+
+	return ok ? 0 : 1;
+}
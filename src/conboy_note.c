@@ -19,10 +19,59 @@
 
 #include "localisation.h"
 #include <glib/gprintf.h>
+#include <string.h>
+#include <libxml/xmlreader.h>
 #include "conboy_note.h"
 
 static GObjectClass *parent_class = NULL;
 
+static void
+drop_content_loader (ConboyNote *note)
+{
+	GDestroyNotify destroy = note->content_loader_destroy;
+	gpointer data = note->content_loader_data;
+
+	note->content_loader = NULL;
+	note->content_loader_data = NULL;
+	note->content_loader_destroy = NULL;
+
+	if (destroy != NULL) {
+		destroy(data);
+	}
+}
+
+/*
+ * Forgets the plain text, it has to be computed again from the content.
+ */
+static void
+drop_text (ConboyNote *note)
+{
+	g_free(note->text);
+	note->text = NULL;
+}
+
+/*
+ * Loads the content from storage if the note was created without it.
+ */
+static void
+fault_content (ConboyNote *note)
+{
+	ConboyNoteContentLoader loader = note->content_loader;
+
+	if (loader == NULL || note->content != NULL) {
+		return;
+	}
+
+	/* Reset first, so that the loader can safely access the note */
+	note->content_loader = NULL;
+	note->content = loader(note, note->content_loader_data);
+	drop_content_loader(note);
+
+	if (note->content == NULL) {
+		g_printerr("ERROR: Couldn't load content of note: %s\n", note->guid);
+	}
+}
+
 /* GOBJECT ROUTINES */
 
 static GObject *
@@ -39,6 +88,7 @@ _conboy_note_constructor (GType type,
 	note->guid = NULL;
 	note->title = NULL;
 	note->content = NULL;
+	note->text = NULL;
 
 	note->note_version = 0.3;
 	note->content_version = 0.1;
@@ -61,6 +111,9 @@ _conboy_note_class_dispose(GObject *object)
 
 	g_free((gchar*)self->content);
 	self->content = NULL;
+	drop_text(self);
+
+	drop_content_loader(self);
 
 	conboy_note_clear_tags(self);
 
@@ -100,6 +153,7 @@ conboy_note_get_property (GObject *object, guint id, GValue *value, GParamSpec *
 			g_value_set_string(value, note->title);
 			break;
 		case PROP_CONTENT:
+			fault_content(note);
 			g_value_set_string(value, note->content);
 			break;
 		case PROP_CREATE_DATE:
@@ -160,8 +214,10 @@ conboy_note_set_property (GObject *object, guint id, const GValue *value, GParam
 			note->title = g_value_dup_string(value);
 			break;
 		case PROP_CONTENT:
+			drop_content_loader(note);
 			g_free ((gchar *)note->content);
 			note->content = g_value_dup_string(value);
+			drop_text(note);
 			break;
 		case PROP_CREATE_DATE:
 			note->create_date = g_value_get_uint(value);
@@ -351,6 +407,51 @@ conboy_note_new_with_title (const gchar* title)
 	return note;
 }
 
+static GQuark
+template_quark (void)
+{
+	static GQuark quark = 0;
+	if (quark == 0) {
+		quark = g_quark_from_static_string("system:template");
+	}
+	return quark;
+}
+
+/*
+ * Returns the position of quark in the sorted tag array of the note, or
+ * the position it would have to be inserted at.
+ */
+static guint
+find_tag (ConboyNote *note, GQuark quark, gboolean *found)
+{
+	guint low = 0;
+	guint high = note->n_tags;
+
+	while (low < high) {
+		guint mid = (low + high) / 2;
+		if (note->tags[mid] < quark) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	*found = (low < note->n_tags && note->tags[low] == quark);
+	return low;
+}
+
+static void
+update_tag_flags (ConboyNote *note)
+{
+	gboolean found;
+	find_tag(note, template_quark(), &found);
+	note->is_template = found;
+}
+
+/**
+ * Adds a tag to the note. Tags are interned, so all notes with the same
+ * tag share one string. Adding a tag twice has no effect.
+ */
 void
 conboy_note_add_tag(ConboyNote* note, const gchar* tag)
 {
@@ -359,50 +460,128 @@ conboy_note_add_tag(ConboyNote* note, const gchar* tag)
 
 	g_return_if_fail(CONBOY_IS_NOTE(note));
 
-	note->tags = g_list_append(note->tags, g_strdup(tag));
+	GQuark quark = g_quark_from_string(tag);
+	gboolean found;
+	guint pos = find_tag(note, quark, &found);
+
+	if (found) {
+		return;
+	}
+
+	note->tags = g_renew(GQuark, note->tags, note->n_tags + 1);
+	g_memmove(note->tags + pos + 1, note->tags + pos, (note->n_tags - pos) * sizeof(GQuark));
+	note->tags[pos] = quark;
+	note->n_tags++;
+
+	update_tag_flags(note);
 }
 
 void
-conboy_note_clear_tags(ConboyNote* note)
+conboy_note_remove_tag(ConboyNote* note, const gchar* tag)
 {
 	g_return_if_fail(note != NULL);
+	g_return_if_fail(tag != NULL);
 	g_return_if_fail(CONBOY_IS_NOTE(note));
-	g_return_if_fail(note->tags != NULL);
 
-	GList *tags = note->tags;
-	while (tags != NULL) {
-		g_free(tags->data);
-		tags = tags->next;
+	GQuark quark = g_quark_try_string(tag);
+	gboolean found;
+	guint pos;
+
+	if (quark == 0) {
+		return;
 	}
-	g_list_free(note->tags);
+
+	pos = find_tag(note, quark, &found);
+	if (!found) {
+		return;
+	}
+
+	note->n_tags--;
+	g_memmove(note->tags + pos, note->tags + pos + 1, (note->n_tags - pos) * sizeof(GQuark));
+	if (note->n_tags == 0) {
+		g_free(note->tags);
+		note->tags = NULL;
+	}
+
+	update_tag_flags(note);
+}
+
+void
+conboy_note_clear_tags(ConboyNote* note)
+{
+	g_return_if_fail(note != NULL);
+	g_return_if_fail(CONBOY_IS_NOTE(note));
+
+	g_free(note->tags);
 	note->tags = NULL;
+	note->n_tags = 0;
+	note->is_template = FALSE;
+}
+
+/*
+ * Replaces the tags of note with a copy of the tags of source.
+ */
+static void
+copy_tags (ConboyNote *note, ConboyNote *source)
+{
+	if (note == source) {
+		return;
+	}
+
+	conboy_note_clear_tags(note);
+	if (source->n_tags > 0) {
+		note->tags = g_memdup(source->tags, source->n_tags * sizeof(GQuark));
+		note->n_tags = source->n_tags;
+		note->is_template = source->is_template;
+	}
 }
 
+guint
+conboy_note_get_n_tags(ConboyNote* note)
+{
+	g_return_val_if_fail(note != NULL, 0);
+	g_return_val_if_fail(CONBOY_IS_NOTE(note), 0);
+
+	return note->n_tags;
+}
 
-GList*
-conboy_note_get_tags(ConboyNote* note)
+/**
+ * Returns the interned tag at position i. The string must not be freed.
+ */
+const gchar*
+conboy_note_get_tag(ConboyNote* note, guint i)
 {
 	g_return_val_if_fail(note != NULL, NULL);
 	g_return_val_if_fail(CONBOY_IS_NOTE(note), NULL);
+	g_return_val_if_fail(i < note->n_tags, NULL);
 
-	return note->tags;
+	return g_quark_to_string(note->tags[i]);
 }
 
 gboolean
-conboy_note_is_template(ConboyNote* note)
+conboy_note_has_tag(ConboyNote* note, const gchar* tag)
 {
 	g_return_val_if_fail(note != NULL, FALSE);
+	g_return_val_if_fail(tag != NULL, FALSE);
 	g_return_val_if_fail(CONBOY_IS_NOTE(note), FALSE);
 
-	GList *iter = note->tags;
-	while (iter != NULL) {
-		if (strcmp("system:template", (gchar*)iter->data) == 0) {
-			return TRUE;
-		}
-		iter = iter->next;
+	GQuark quark = g_quark_try_string(tag);
+	gboolean found = FALSE;
+
+	if (quark != 0) {
+		find_tag(note, quark, &found);
 	}
 
-	return FALSE;
+	return found;
+}
+
+gboolean
+conboy_note_is_template(ConboyNote* note)
+{
+	g_return_val_if_fail(note != NULL, FALSE);
+	g_return_val_if_fail(CONBOY_IS_NOTE(note), FALSE);
+
+	return note->is_template;
 }
 
 /**
@@ -418,7 +597,7 @@ conboy_note_copy (ConboyNote* note)
 
 	g_object_set(copy,
 			"title", note->title,
-			"content", note->content,
+			"content", conboy_note_get_content(note),
 			"create-date", note->create_date,
 			"change-date", note->last_change_date,
 			"metadata-change-date", note->last_metadata_change_date,
@@ -433,16 +612,147 @@ conboy_note_copy (ConboyNote* note)
 			"pinned", note->pinned,
 			NULL);
 
-	GList *tags = note->tags;
-	while (tags) {
-		gchar *tag = tags->data;
-		conboy_note_add_tag(copy, tag);
-		tags = tags->next;
-	}
+	copy_tags(copy, note);
 
 	return copy;
 }
 
+/**
+ * Returns the content of the note without copying it. If the note was
+ * loaded without content, the content is loaded from storage first.
+ */
+const gchar*
+conboy_note_get_content (ConboyNote *note)
+{
+	g_return_val_if_fail(note != NULL, NULL);
+	g_return_val_if_fail(CONBOY_IS_NOTE(note), NULL);
+
+	fault_content(note);
+	return note->content;
+}
+
+/*
+ * Returns the text of the xml content, without tags. Notes are also
+ * indexed from the sync thread, so this cannot use the shared reader of
+ * conboy_xml_get_reader_for_memory().
+ */
+static gchar*
+strip_tags (const gchar *xml_string)
+{
+	int ret;
+	GString *result = g_string_new("");
+	xmlTextReader *reader = xmlReaderForMemory(xml_string, strlen(xml_string), "", "UTF-8", 0);
+
+	if (reader == NULL) {
+		g_printerr("ERROR: Couldn't init xml parser.\n");
+		return g_string_free(result, FALSE);
+	}
+
+	ret = xmlTextReaderRead(reader);
+	while (ret == 1) {
+		int type = xmlTextReaderNodeType(reader);
+
+		if (type == XML_TEXT_NODE || type == XML_DTD_NODE) {
+			g_string_append(result, (const gchar*) xmlTextReaderConstValue(reader));
+		}
+
+		ret = xmlTextReaderRead(reader);
+	}
+
+	if (ret != 0) {
+		g_printerr("ERROR: Failed to strip tags from xml string.\n");
+	}
+
+	xmlFreeTextReader(reader);
+	return g_string_free(result, FALSE);
+}
+
+/**
+ * Returns the content of the note as casefolded plain text, including
+ * the title. It is only computed again after the content changed, so
+ * search and other users don't have to parse the xml each time.
+ *
+ * Casefolding can change the length of the text, e.g. "ß" becomes "ss",
+ * so positions in it don't map to positions in the note buffer. That is
+ * why there is no table of character offsets: snippets and the linker
+ * have to work on the buffer anyway.
+ */
+const gchar*
+conboy_note_get_text (ConboyNote *note)
+{
+	g_return_val_if_fail(note != NULL, NULL);
+	g_return_val_if_fail(CONBOY_IS_NOTE(note), NULL);
+
+	const gchar *content;
+	gchar *stripped;
+
+	if (note->text != NULL) {
+		return note->text;
+	}
+
+	content = conboy_note_get_content(note);
+	if (content == NULL) {
+		return NULL;
+	}
+
+	stripped = strip_tags(content);
+	note->text = g_utf8_casefold(stripped, -1);
+	g_free(stripped);
+
+	return note->text;
+}
+
+/**
+ * Sets a function that is used to load the content of the note the first
+ * time it is needed. Storage plugins use this to create notes that only
+ * contain metadata. Setting the content drops the loader.
+ */
+void
+conboy_note_set_content_loader (ConboyNote *note, ConboyNoteContentLoader loader, gpointer user_data, GDestroyNotify destroy)
+{
+	g_return_if_fail(note != NULL);
+	g_return_if_fail(CONBOY_IS_NOTE(note));
+
+	drop_content_loader(note);
+
+	note->content_loader = loader;
+	note->content_loader_data = user_data;
+	note->content_loader_destroy = destroy;
+}
+
+/**
+ * Overwrites title, content, metadata and tags of note with the ones
+ * of source. The guid is not changed. Used to update a note in place
+ * after it was changed by somebody else.
+ */
+void
+conboy_note_assign (ConboyNote *note, ConboyNote *source)
+{
+	g_return_if_fail(note != NULL);
+	g_return_if_fail(source != NULL);
+	g_return_if_fail(CONBOY_IS_NOTE(note));
+	g_return_if_fail(CONBOY_IS_NOTE(source));
+
+	g_object_set(note,
+			"title", source->title,
+			"content", conboy_note_get_content(source),
+			"create-date", source->create_date,
+			"change-date", source->last_change_date,
+			"metadata-change-date", source->last_metadata_change_date,
+			"content-version", source->content_version,
+			"cursor-position", source->cursor_position,
+			"note-version", source->note_version,
+			"x", source->x,
+			"y", source->y,
+			"width", source->width,
+			"height", source->height,
+			"open-on-startup", source->open_on_startup,
+			"pinned", source->pinned,
+			NULL);
+
+	copy_tags(note, source);
+}
+
 /**
  * Changes the title of a note. Affected are the title property,
  * as well as the first line in the content. Title is automatically
@@ -455,7 +765,7 @@ conboy_note_rename (ConboyNote *note, const gchar *new_title)
 	g_return_if_fail(CONBOY_IS_NOTE(note));
 
 	gchar *esc_title = g_markup_escape_text(new_title, -1);
-	gchar **parts = g_strsplit(note->content, "\n", 2);
+	gchar **parts = g_strsplit(conboy_note_get_content(note), "\n", 2);
 	gchar *new_content = g_strconcat("<note-content version=\"0.1\">", esc_title, "\n", parts[1], NULL);
 
 	g_object_set(note,
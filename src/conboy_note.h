@@ -34,6 +34,12 @@
 typedef struct _ConboyNote ConboyNote;
 typedef struct _ConboyNoteClass ConboyNoteClass;
 
+/**
+ * Returns the newly allocated content of a note that was loaded
+ * without its content. See conboy_note_set_content_loader().
+ */
+typedef gchar* (*ConboyNoteContentLoader) (ConboyNote *note, gpointer user_data);
+
 struct _ConboyNote {
 	GObject parent;
 
@@ -49,7 +55,11 @@ struct _ConboyNote {
 	time_t last_change_date;
 	time_t last_metadata_change_date;
 	time_t create_date;
-	GList  *tags;
+
+	/* interned tags, sorted by quark */
+	GQuark *tags;
+	guint   n_tags;
+	gboolean is_template;
 
 	/* ui */
 	gboolean open_on_startup;
@@ -63,6 +73,14 @@ struct _ConboyNote {
 	/* version */
 	gdouble note_version;
 	gdouble content_version;
+
+	/* lazy content */
+	ConboyNoteContentLoader content_loader;
+	gpointer content_loader_data;
+	GDestroyNotify content_loader_destroy;
+
+	/* casefolded text of content, computed when needed */
+	gchar *text;
 };
 
 struct _ConboyNoteClass {
@@ -83,11 +101,18 @@ ConboyNote*  conboy_note_new_with_title (const gchar* title);
 void         conboy_note_add_tag        (ConboyNote* note, const gchar*);
 void         conboy_note_remove_tag     (ConboyNote* note, const gchar*);
 void         conboy_note_clear_tags     (ConboyNote* note);
-GList*       conboy_note_get_tags       (ConboyNote* note);
+guint        conboy_note_get_n_tags     (ConboyNote* note);
+const gchar* conboy_note_get_tag        (ConboyNote* note, guint i);
+gboolean     conboy_note_has_tag        (ConboyNote* note, const gchar*);
 
 gboolean     conboy_note_is_template    (ConboyNote* note);
 
+const gchar* conboy_note_get_content    (ConboyNote *note);
+const gchar* conboy_note_get_text       (ConboyNote *note);
+void         conboy_note_set_content_loader (ConboyNote *note, ConboyNoteContentLoader loader, gpointer user_data, GDestroyNotify destroy);
+
 ConboyNote*  conboy_note_copy           (ConboyNote* note);
+void         conboy_note_assign         (ConboyNote *note, ConboyNote *source);
 void         conboy_note_rename         (ConboyNote *note, const gchar *new_title);
 void         conboy_note_renew_guid     (ConboyNote *note);
 
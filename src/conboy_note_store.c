@@ -36,51 +36,431 @@
 /*
  * Implementation of the interface
  */
-static void		conboy_note_store_tree_model_iface_init(GtkTreeModelIface *iface);
-static int		conboy_note_store_get_n_columns(GtkTreeModel *self);
-static GType	conboy_note_store_get_column_type(GtkTreeModel *self, int column);
-static void		conboy_note_store_get_value(GtkTreeModel *self, GtkTreeIter *iter, int column, GValue *value);
-
-
-/* ConboyNoteStore inherits from GtkListStore, and implements the GtkTreeStore
- * interface */
-G_DEFINE_TYPE_EXTENDED(ConboyNoteStore, conboy_note_store, GTK_TYPE_LIST_STORE, 0,
+static void			conboy_note_store_tree_model_iface_init(GtkTreeModelIface *iface);
+static GtkTreeModelFlags conboy_note_store_get_flags(GtkTreeModel *self);
+static int			conboy_note_store_get_n_columns(GtkTreeModel *self);
+static GType		conboy_note_store_get_column_type(GtkTreeModel *self, int column);
+static gboolean		conboy_note_store_get_iter_from_path(GtkTreeModel *self, GtkTreeIter *iter, GtkTreePath *path);
+static GtkTreePath*	conboy_note_store_get_path(GtkTreeModel *self, GtkTreeIter *iter);
+static void			conboy_note_store_get_value(GtkTreeModel *self, GtkTreeIter *iter, int column, GValue *value);
+static gboolean		conboy_note_store_iter_next(GtkTreeModel *self, GtkTreeIter *iter);
+static gboolean		conboy_note_store_iter_children(GtkTreeModel *self, GtkTreeIter *iter, GtkTreeIter *parent);
+static gboolean		conboy_note_store_iter_has_child(GtkTreeModel *self, GtkTreeIter *iter);
+static gint			conboy_note_store_iter_n_children(GtkTreeModel *self, GtkTreeIter *iter);
+static gboolean		conboy_note_store_iter_nth_child(GtkTreeModel *self, GtkTreeIter *iter, GtkTreeIter *parent, gint n);
+static gboolean		conboy_note_store_iter_parent(GtkTreeModel *self, GtkTreeIter *iter, GtkTreeIter *child);
+
+
+/* ConboyNoteStore is a plain GObject that implements the GtkTreeModel
+ * interface on top of a flat array of rows */
+G_DEFINE_TYPE_EXTENDED(ConboyNoteStore, conboy_note_store, G_TYPE_OBJECT, 0,
 		G_IMPLEMENT_INTERFACE(GTK_TYPE_TREE_MODEL,
 			conboy_note_store_tree_model_iface_init))
 
-/* our parent's model iface */
-static GtkTreeModelIface parent_iface = { {0,} };
+/*
+ * Every note in the store has one of these. self->array holds them in list
+ * order, and they are also kept in self->rows with the note as key, so that
+ * we can go from a note to its row without walking the whole list. A row
+ * lives as long as the note is in the store, so iters (which point to the
+ * row) stay valid until the row is removed.
+ */
+typedef struct {
+	ConboyNote  *note;      /* We hold a reference */
+	guint        index;     /* Position in self->array, that's the row number */
+	gchar        date[20];  /* Formatted change date for CHANGE_DATE_COLUMN */
+	gchar       *guid;      /* Own copy, the key in self->guids */
+	gchar       *title_key; /* Casefolded title, the key in self->titles */
+	glong        title_length;
+	guint        date_pos;  /* Position in the self->dates heap */
+	gulong       title_handler;
+	gulong       date_handler;
+	gulong       guid_handler;
+} NoteRow;
+
+static void
+note_row_free(NoteRow *row)
+{
+	g_signal_handler_disconnect(row->note, row->title_handler);
+	g_signal_handler_disconnect(row->note, row->date_handler);
+	g_signal_handler_disconnect(row->note, row->guid_handler);
+	g_object_unref(row->note);
+	g_free(row->guid);
+	g_free(row->title_key);
+	g_free(row);
+}
+
+static void
+note_array_free(GPtrArray *notes)
+{
+	g_ptr_array_free(notes, TRUE);
+}
+
+#define ARRAY_ROW(self, pos) ((NoteRow*)g_ptr_array_index((self)->array, (pos)))
+
+/*
+ * The title index maps casefolded titles to an array of notes. Normally
+ * titles are unique, but e.g. sync can bring in duplicates for a while.
+ */
+static void
+index_title(ConboyNoteStore *self, NoteRow *row)
+{
+	GPtrArray *notes;
+
+	if (row->note->title == NULL) {
+		row->title_key = NULL;
+		return;
+	}
+
+	row->title_key = g_utf8_casefold(row->note->title, -1);
+
+	notes = g_hash_table_lookup(self->titles, row->title_key);
+	if (notes == NULL) {
+		notes = g_ptr_array_sized_new(1);
+		g_hash_table_insert(self->titles, g_strdup(row->title_key), notes);
+	}
+	g_ptr_array_add(notes, row->note);
+}
+
+static void
+unindex_title(ConboyNoteStore *self, NoteRow *row)
+{
+	GPtrArray *notes;
+
+	if (row->title_key == NULL) {
+		return;
+	}
+
+	notes = g_hash_table_lookup(self->titles, row->title_key);
+	if (notes != NULL) {
+		g_ptr_array_remove(notes, row->note);
+		if (notes->len == 0) {
+			g_hash_table_remove(self->titles, row->title_key);
+		}
+	}
+
+	g_free(row->title_key);
+	row->title_key = NULL;
+}
+
+/*
+ * self->title_lengths is a histogram: element n holds the number of notes
+ * with a title of n characters. That way max_title_length is always exact
+ * and we never need to look at all notes again.
+ */
+static void
+add_title_length(ConboyNoteStore *self, NoteRow *row)
+{
+	row->title_length = (row->note->title != NULL) ? g_utf8_strlen(row->note->title, -1) : 0;
+
+	if ((guint)row->title_length >= self->title_lengths->len) {
+		g_array_set_size(self->title_lengths, row->title_length + 1);
+	}
+	g_array_index(self->title_lengths, guint, row->title_length)++;
+
+	self->max_title_length = max(row->title_length, self->max_title_length);
+}
+
+static void
+remove_title_length(ConboyNoteStore *self, NoteRow *row)
+{
+	g_array_index(self->title_lengths, guint, row->title_length)--;
+
+	/* If that was the last of the longest titles, walk down to the next used length */
+	while (self->max_title_length > 0 && g_array_index(self->title_lengths, guint, self->max_title_length) == 0) {
+		self->max_title_length--;
+	}
+}
+
+/*
+ * self->dates is a binary heap with the most recently changed note on top.
+ * Every row knows its position in the heap, so that it can be moved or
+ * removed when its change date changes or the note goes away.
+ */
+#define HEAP_ROW(self, pos) ((NoteRow*)g_ptr_array_index((self)->dates, (pos)))
+
+static void
+heap_swap(ConboyNoteStore *self, guint a, guint b)
+{
+	NoteRow *row_a = HEAP_ROW(self, a);
+	NoteRow *row_b = HEAP_ROW(self, b);
+
+	g_ptr_array_index(self->dates, a) = row_b;
+	g_ptr_array_index(self->dates, b) = row_a;
+	row_a->date_pos = b;
+	row_b->date_pos = a;
+}
+
+static gboolean
+heap_is_newer(ConboyNoteStore *self, guint a, guint b)
+{
+	return HEAP_ROW(self, a)->note->last_change_date > HEAP_ROW(self, b)->note->last_change_date;
+}
+
+static void
+heap_sift_up(ConboyNoteStore *self, guint pos)
+{
+	while (pos > 0) {
+		guint parent = (pos - 1) / 2;
+		if (!heap_is_newer(self, pos, parent)) break;
+		heap_swap(self, pos, parent);
+		pos = parent;
+	}
+}
+
+static void
+heap_sift_down(ConboyNoteStore *self, guint pos)
+{
+	guint len = self->dates->len;
+
+	while (TRUE) {
+		guint newest = pos;
+		guint left = 2 * pos + 1;
+		guint right = left + 1;
+
+		if (left < len && heap_is_newer(self, left, newest)) newest = left;
+		if (right < len && heap_is_newer(self, right, newest)) newest = right;
+		if (newest == pos) break;
+
+		heap_swap(self, pos, newest);
+		pos = newest;
+	}
+}
+
+static void
+heap_insert(ConboyNoteStore *self, NoteRow *row)
+{
+	row->date_pos = self->dates->len;
+	g_ptr_array_add(self->dates, row);
+	heap_sift_up(self, row->date_pos);
+}
+
+static void
+heap_remove(ConboyNoteStore *self, NoteRow *row)
+{
+	guint pos = row->date_pos;
+	guint last = self->dates->len - 1;
+
+	if (pos != last) {
+		heap_swap(self, pos, last);
+	}
+	g_ptr_array_remove_index(self->dates, last);
+
+	/* The row that took our place can be out of order in both directions */
+	if (pos < self->dates->len) {
+		NoteRow *moved = HEAP_ROW(self, pos);
+		heap_sift_up(self, moved->date_pos);
+		heap_sift_down(self, moved->date_pos);
+	}
+}
+
+static void
+heap_update(ConboyNoteStore *self, NoteRow *row)
+{
+	heap_sift_up(self, row->date_pos);
+	heap_sift_down(self, row->date_pos);
+}
+
+/*
+ * The date column is rendered very often, but only changes when the note is
+ * saved. So we format it once and keep the string in the row.
+ */
+static void
+format_date(NoteRow *row)
+{
+	GDate date;
+
+	g_date_clear(&date, 1);
+	g_date_set_time_t(&date, row->note->last_change_date);
+	if (g_date_strftime(row->date, sizeof(row->date), "%x", &date) == 0) {
+		row->date[0] = '\0';
+	}
+}
+
+static void
+on_note_date_changed(ConboyNote *note, GParamSpec *spec, ConboyNoteStore *self)
+{
+	NoteRow *row = g_hash_table_lookup(self->rows, note);
+	g_return_if_fail(row != NULL);
+
+	heap_update(self, row);
+	format_date(row);
+}
+
+static void
+on_note_title_changed(ConboyNote *note, GParamSpec *spec, ConboyNoteStore *self)
+{
+	NoteRow *row = g_hash_table_lookup(self->rows, note);
+	g_return_if_fail(row != NULL);
+
+	remove_title_length(self, row);
+	add_title_length(self, row);
+
+	/* Saving sets the title every time, mostly to the same value */
+	if (row->title_key != NULL && note->title != NULL) {
+		gchar *key = g_utf8_casefold(note->title, -1);
+		gboolean same = (strcmp(key, row->title_key) == 0);
+		g_free(key);
+		if (same) return;
+	}
+
+	unindex_title(self, row);
+	index_title(self, row);
+}
+
+/* E.g. the Midgard plugin assigns a new guid when a note is first saved */
+static void
+on_note_guid_changed(ConboyNote *note, GParamSpec *spec, ConboyNoteStore *self)
+{
+	NoteRow *row = g_hash_table_lookup(self->rows, note);
+	g_return_if_fail(row != NULL);
+
+	if (row->guid != NULL && note->guid != NULL && strcmp(row->guid, note->guid) == 0) {
+		return;
+	}
+
+	/* Only remove the guid entry if it still points to us */
+	if (row->guid != NULL && g_hash_table_lookup(self->guids, row->guid) == note) {
+		g_hash_table_remove(self->guids, row->guid);
+	}
+	g_free(row->guid);
+
+	row->guid = g_strdup(note->guid);
+	if (row->guid != NULL) {
+		g_hash_table_replace(self->guids, row->guid, note);
+	}
+}
+
+static void
+conboy_note_store_finalize(GObject *object)
+{
+	ConboyNoteStore *self = CONBOY_NOTE_STORE(object);
+
+	g_hash_table_destroy(self->guids);
+	g_hash_table_destroy(self->titles);
+	g_hash_table_destroy(self->rows);
+	g_array_free(self->title_lengths, TRUE);
+	g_ptr_array_free(self->dates, TRUE);
+	g_ptr_array_free(self->array, TRUE);
+
+	if (self->icon) {
+		g_object_unref(self->icon);
+		self->icon = NULL;
+	}
+
+	G_OBJECT_CLASS(conboy_note_store_parent_class)->finalize(object);
+}
+
+enum {
+	RESET,
+	LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL] = {0};
 
 /* this method is called once to set up the class */
 static void
 conboy_note_store_class_init (ConboyNoteStoreClass *klass)
 {
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
+	object_class->finalize = conboy_note_store_finalize;
+
+	klass->reset = NULL;
+
+	/* Emitted at the end of a batch instead of the per row signals.
+	 * Views need to drop their model and attach it again. */
+	signals[RESET] =
+		g_signal_new(
+				"reset",
+				CONBOY_TYPE_NOTE_STORE,
+				G_SIGNAL_RUN_LAST,
+				G_STRUCT_OFFSET(ConboyNoteStoreClass, reset),
+				NULL, NULL,
+				g_cclosure_marshal_VOID__VOID,
+				G_TYPE_NONE,
+				0);
 }
 
 /* this method is called once to set up the interface */
 static void
 conboy_note_store_tree_model_iface_init(GtkTreeModelIface *iface)
 {
-	/* this is where we override the interface methods */
-	/* first make a copy of our parent's interface to call later */
-	parent_iface = *iface;
-
-	/* now put in our own overriding methods */
-	iface->get_n_columns 	= conboy_note_store_get_n_columns;
-	iface->get_column_type 	= conboy_note_store_get_column_type;
-	iface->get_value 		= conboy_note_store_get_value;
+	iface->get_flags		= conboy_note_store_get_flags;
+	iface->get_n_columns	= conboy_note_store_get_n_columns;
+	iface->get_column_type	= conboy_note_store_get_column_type;
+	iface->get_iter			= conboy_note_store_get_iter_from_path;
+	iface->get_path			= conboy_note_store_get_path;
+	iface->get_value		= conboy_note_store_get_value;
+	iface->iter_next		= conboy_note_store_iter_next;
+	iface->iter_children	= conboy_note_store_iter_children;
+	iface->iter_has_child	= conboy_note_store_iter_has_child;
+	iface->iter_n_children	= conboy_note_store_iter_n_children;
+	iface->iter_nth_child	= conboy_note_store_iter_nth_child;
+	iface->iter_parent		= conboy_note_store_iter_parent;
 }
 
 /* this method is called every time an instance of the class is created */
 static void
 conboy_note_store_init (ConboyNoteStore *self)
 {
-	/* initialise the underlying storage for the GtkListStore */
-	GType types[] = { CONBOY_TYPE_NOTE };
-	gtk_list_store_set_column_types(GTK_LIST_STORE(self), 1, types);
-
 	self->storage = NULL;
 	self->max_title_length = 0;
+	self->icon = NULL;
+	self->stamp = g_random_int();
+	self->array = g_ptr_array_new();
+	self->batch = 0;
+	self->batch_changed = FALSE;
+
+	/* The guid index doesn't own its keys, they belong to the rows */
+	self->rows = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)note_row_free);
+	self->guids = g_hash_table_new(g_str_hash, g_str_equal);
+	self->titles = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)note_array_free);
+	self->title_lengths = g_array_new(FALSE, TRUE, sizeof(guint));
+	self->dates = g_ptr_array_new();
+}
+
+/* Fills in an iter pointing to the given row */
+static void
+set_iter(ConboyNoteStore *self, GtkTreeIter *iter, NoteRow *row)
+{
+	iter->stamp = self->stamp;
+	iter->user_data = row;
+	iter->user_data2 = NULL;
+	iter->user_data3 = NULL;
+}
+
+/* Returns the row an iter points to, or NULL if the iter is not ours */
+static NoteRow*
+get_row(ConboyNoteStore *self, GtkTreeIter *iter)
+{
+	g_return_val_if_fail(iter != NULL, NULL);
+	g_return_val_if_fail(iter->stamp == self->stamp, NULL);
+
+	return (NoteRow*)iter->user_data;
+}
+
+static void
+emit_row_signal(ConboyNoteStore *self, NoteRow *row, gboolean inserted)
+{
+	GtkTreeIter iter;
+	GtkTreePath *path;
+
+	/* Inside a batch the views are told once at the end */
+	if (self->batch > 0) {
+		self->batch_changed = TRUE;
+		return;
+	}
+
+	path = gtk_tree_path_new();
+	gtk_tree_path_append_index(path, row->index);
+	set_iter(self, &iter, row);
+
+	if (inserted) {
+		gtk_tree_model_row_inserted(GTK_TREE_MODEL(self), path, &iter);
+	} else {
+		gtk_tree_model_row_changed(GTK_TREE_MODEL(self), path, &iter);
+	}
+
+	gtk_tree_path_free(path);
 }
 
 /**
@@ -94,49 +474,53 @@ conboy_note_store_init (ConboyNoteStore *self)
 void
 conboy_note_store_add(ConboyNoteStore *self, ConboyNote *note, GtkTreeIter *iter)
 {
-	GtkTreeIter iter1;
+	NoteRow *row;
 
 	/* validate our parameters */
 	g_return_if_fail(CONBOY_IS_NOTE_STORE(self));
 	g_return_if_fail(CONBOY_IS_NOTE(note));
 
+	/* A note can only be in the store once */
+	row = g_hash_table_lookup(self->rows, note);
+	if (row != NULL) {
+		g_printerr("WARN: Note '%s' is already in the note store\n", note->title);
+		if (iter) set_iter(self, iter, row);
+		return;
+	}
+
 	/* put this object in our data storage */
-	gtk_list_store_append(GTK_LIST_STORE(self), &iter1);
-	gtk_list_store_set(GTK_LIST_STORE(self), &iter1, 0, note, -1);
+	row = g_new(NoteRow, 1);
+	row->note = g_object_ref(note);
+	row->index = self->array->len;
+	row->guid = g_strdup(note->guid);
+	format_date(row);
+	g_ptr_array_add(self->array, row);
+
+	/* Index the new row */
+	g_hash_table_insert(self->rows, note, row);
+	if (row->guid != NULL) {
+		g_hash_table_replace(self->guids, row->guid, note);
+	}
+	index_title(self, row);
+	add_title_length(self, row);
+	heap_insert(self, row);
 
-	/* TODO: If Note would be a gobject, then here we could
-	 * connect signals to recognize whenever the Note itself was
-	 * changed. If such a change would occure we could update the
-	 * coresponding row. */
+	/* Keep the indices up to date, whoever changes the note */
+	row->title_handler = g_signal_connect(note, "notify::title", G_CALLBACK(on_note_title_changed), self);
+	row->date_handler = g_signal_connect(note, "notify::change-date", G_CALLBACK(on_note_date_changed), self);
+	row->guid_handler = g_signal_connect(note, "notify::guid", G_CALLBACK(on_note_guid_changed), self);
 
-	/* Find out if title of the newly added note is longer then the currently longest */
-	self->max_title_length = max (g_utf8_strlen(note->title, -1), self->max_title_length);
+	emit_row_signal(self, row, TRUE);
 
 	/* return the iter if the user cares */
-	if (iter) *iter = iter1;
+	if (iter) set_iter(self, iter, row);
 }
 
-/* retreive an object from our parent's data storage,
- * unref the returned object when done */
-static ConboyNote*
-conboy_note_store_get_object(ConboyNoteStore *self, GtkTreeIter *iter)
+/* the rows are a flat list, iters persist as long as the row exists */
+static GtkTreeModelFlags
+conboy_note_store_get_flags(GtkTreeModel *self)
 {
-	GValue value = {0, };
-	ConboyNote *note;
-
-	/* validate our parameters */
-	g_return_val_if_fail(CONBOY_IS_NOTE_STORE(self), NULL);
-	g_return_val_if_fail(iter != NULL, NULL);
-
-	/* retreive the object using our parent's interface, take our own
-	 * reference to it */
-	parent_iface.get_value(GTK_TREE_MODEL(self), iter, 0, &value);
-
-	note = CONBOY_NOTE(g_value_dup_object(&value));
-
-	g_value_unset(&value);
-
-	return note;
+	return GTK_TREE_MODEL_LIST_ONLY | GTK_TREE_MODEL_ITERS_PERSIST;
 }
 
 /* this method returns the number of columns in our tree model */
@@ -165,34 +549,43 @@ conboy_note_store_get_column_type(GtkTreeModel *self, int column)
 	return types[column];
 }
 
-/* Returns newly allocated string. Needs to be freed later */
-static gchar*
-get_date_string(time_t t)
+static gboolean
+conboy_note_store_get_iter_from_path(GtkTreeModel *model, GtkTreeIter *iter, GtkTreePath *path)
 {
-	gchar date_str[20];
-	GDate *date = g_date_new();
+	ConboyNoteStore *self = CONBOY_NOTE_STORE(model);
+	gint index;
+
+	g_return_val_if_fail(gtk_tree_path_get_depth(path) > 0, FALSE);
 
-	g_date_set_time_t(date, t);
-	g_date_strftime(date_str, 20, "%x", date);
-	g_free(date);
+	index = gtk_tree_path_get_indices(path)[0];
+	if (index < 0 || index >= (gint)self->array->len) {
+		return FALSE;
+	}
 
-	return g_strdup(date_str);
+	set_iter(self, iter, ARRAY_ROW(self, index));
+	return TRUE;
 }
 
+static GtkTreePath*
+conboy_note_store_get_path(GtkTreeModel *model, GtkTreeIter *iter)
+{
+	NoteRow *row = get_row(CONBOY_NOTE_STORE(model), iter);
+	GtkTreePath *path;
+
+	g_return_val_if_fail(row != NULL, NULL);
 
-GdkPixbuf *_icon = NULL; /* TODO: Should not be global. Make it member of this Class. */
-/* this method retrieves the value for a particular column */
+	path = gtk_tree_path_new();
+	gtk_tree_path_append_index(path, row->index);
+	return path;
+}
+
+/* this method retrieves the value for a particular column. Strings are
+ * handed out as static strings, so rendering a cell doesn't copy anything */
 static void
-conboy_note_store_get_value(GtkTreeModel *self, GtkTreeIter *iter, int column, GValue *value)
+conboy_note_store_get_value(GtkTreeModel *model, GtkTreeIter *iter, int column, GValue *value)
 {
-	ConboyNote *note;
-	if (_icon == NULL) {
-#ifdef HILDON_HAS_APP_MENU
-		_icon = gdk_pixbuf_new_from_file("/usr/share/icons/hicolor/48x48/hildon/conboy.png", NULL);
-#else
-		_icon = gdk_pixbuf_new_from_file("/usr/share/icons/hicolor/26x26/hildon/conboy.png", NULL);
-#endif
-	}
+	ConboyNoteStore *self = CONBOY_NOTE_STORE(model);
+	NoteRow *row;
 
 	/* validate our parameters */
 	g_return_if_fail(CONBOY_IS_NOTE_STORE(self));
@@ -200,53 +593,101 @@ conboy_note_store_get_value(GtkTreeModel *self, GtkTreeIter *iter, int column, G
 	g_return_if_fail(column >= 0 && column < N_COLUMNS);
 	g_return_if_fail(value != NULL);
 
-	/* get the object from our parent's storage */
-	note = conboy_note_store_get_object(CONBOY_NOTE_STORE(self), iter);
+	row = get_row(self, iter);
+	g_return_if_fail(row != NULL);
 
 	/* initialise our GValue to the required type */
-	g_value_init(value, conboy_note_store_get_column_type(GTK_TREE_MODEL (self), column));
+	g_value_init(value, conboy_note_store_get_column_type(model, column));
 
 	switch (column)
 	{
 		case ICON_COLUMN:
-			/* the object itself was requested */
-			g_value_set_object(value, _icon);
+			if (self->icon == NULL) {
+#ifdef HILDON_HAS_APP_MENU
+				self->icon = gdk_pixbuf_new_from_file("/usr/share/icons/hicolor/48x48/hildon/conboy.png", NULL);
+#else
+				self->icon = gdk_pixbuf_new_from_file("/usr/share/icons/hicolor/26x26/hildon/conboy.png", NULL);
+#endif
+			}
+			g_value_set_object(value, self->icon);
 			break;
 
 		case TITLE_COLUMN:
 			/* the notes title was requested */
-			if (note != NULL) {
-				gchar *title;
-				g_object_get(note, "title", &title, NULL);
-				g_value_set_string(value, title);
-				g_free(title);
-			} else {
-				g_value_set_string(value, "");
-			}
+			g_value_set_static_string(value, row->note->title ? row->note->title : "");
 			break;
 
 		case CHANGE_DATE_COLUMN:
-			if (note != NULL) {
-				gint date;
-				g_object_get(note, "change-date", &date, NULL);
-				g_value_set_string(value, get_date_string(date));
-			} else {
-				g_value_set_string(value, "");
-			}
+			g_value_set_static_string(value, row->date);
 			break;
 
 		case NOTE_COLUMN:
-			g_value_set_object(value, note);
+			g_value_set_object(value, row->note);
 			break;
 
 		default:
 			g_assert_not_reached ();
 	}
+}
 
-	/* release the reference gained from my_list_store_get_object() */
-	if (note) {
-		g_object_unref(note);
+static gboolean
+conboy_note_store_iter_next(GtkTreeModel *model, GtkTreeIter *iter)
+{
+	ConboyNoteStore *self = CONBOY_NOTE_STORE(model);
+	NoteRow *row = get_row(self, iter);
+
+	g_return_val_if_fail(row != NULL, FALSE);
+
+	if (row->index + 1 >= self->array->len) {
+		iter->stamp = 0;
+		return FALSE;
 	}
+
+	set_iter(self, iter, ARRAY_ROW(self, row->index + 1));
+	return TRUE;
+}
+
+static gboolean
+conboy_note_store_iter_children(GtkTreeModel *model, GtkTreeIter *iter, GtkTreeIter *parent)
+{
+	return conboy_note_store_iter_nth_child(model, iter, parent, 0);
+}
+
+static gboolean
+conboy_note_store_iter_has_child(GtkTreeModel *model, GtkTreeIter *iter)
+{
+	return FALSE;
+}
+
+static gint
+conboy_note_store_iter_n_children(GtkTreeModel *model, GtkTreeIter *iter)
+{
+	/* Only the (invisible) root has children */
+	if (iter == NULL) {
+		return CONBOY_NOTE_STORE(model)->array->len;
+	}
+	return 0;
+}
+
+static gboolean
+conboy_note_store_iter_nth_child(GtkTreeModel *model, GtkTreeIter *iter, GtkTreeIter *parent, gint n)
+{
+	ConboyNoteStore *self = CONBOY_NOTE_STORE(model);
+
+	if (parent != NULL || n < 0 || n >= (gint)self->array->len) {
+		iter->stamp = 0;
+		return FALSE;
+	}
+
+	set_iter(self, iter, ARRAY_ROW(self, n));
+	return TRUE;
+}
+
+static gboolean
+conboy_note_store_iter_parent(GtkTreeModel *model, GtkTreeIter *iter, GtkTreeIter *child)
+{
+	iter->stamp = 0;
+	return FALSE;
 }
 
 /*
@@ -259,66 +700,162 @@ conboy_note_store_new(void)
 	return g_object_new(CONBOY_TYPE_NOTE_STORE, NULL);
 }
 
-static gint
-find_longest_title(ConboyNoteStore *self)
+/* Drops the note from the indices, but not from the array */
+static NoteRow*
+unindex_note(ConboyNoteStore *self, ConboyNote *note)
 {
-	gint max_len = 0;
-	GtkTreeIter iter;
-	GtkTreeModel *model = GTK_TREE_MODEL(self);
-	gboolean valid = gtk_tree_model_get_iter_first(model, &iter);
+	NoteRow *row = g_hash_table_lookup(self->rows, note);
+
+	if (row == NULL) {
+		return NULL;
+	}
 
-	while (valid) {
-		ConboyNote *note;
-		gtk_tree_model_get(model, &iter, NOTE_COLUMN, &note, -1);
-		max_len = max(g_utf8_strlen(note->title, -1), max_len);
-		valid = gtk_tree_model_iter_next(model, &iter);
+	/* Only remove the guid entry if it still points to us */
+	if (row->guid != NULL && g_hash_table_lookup(self->guids, row->guid) == note) {
+		g_hash_table_remove(self->guids, row->guid);
 	}
+	unindex_title(self, row);
+	remove_title_length(self, row);
+	heap_remove(self, row);
+	g_hash_table_steal(self->rows, note);
 
-	return max_len;
+	return row;
 }
 
 gboolean
 conboy_note_store_remove(ConboyNoteStore *self, ConboyNote *note)
 {
-	GtkTreeIter iter;
+	NoteRow *row;
+	GtkTreePath *path;
+	guint i;
 
-	if (conboy_note_store_get_iter(self, note, &iter)) {
-		gtk_list_store_remove(GTK_LIST_STORE(self), &iter);
+	g_return_val_if_fail(CONBOY_IS_NOTE_STORE(self), FALSE);
 
-		/* If the note with the longest title was removed, we need to find out what the longest title is now */
-		if (g_utf8_strlen(note->title, -1) == self->max_title_length) {
-			self->max_title_length = find_longest_title(self);
-		}
+	row = unindex_note(self, note);
+	if (row == NULL) {
+		return FALSE;
+	}
 
-		return TRUE;
+	/* Take the row out of the array and renumber the ones behind it */
+	g_ptr_array_remove_index(self->array, row->index);
+	for (i = row->index; i < self->array->len; i++) {
+		ARRAY_ROW(self, i)->index = i;
 	}
 
-	return FALSE;
+	/* Tell the views and only then free the row */
+	if (self->batch > 0) {
+		self->batch_changed = TRUE;
+	} else {
+		path = gtk_tree_path_new();
+		gtk_tree_path_append_index(path, row->index);
+		gtk_tree_model_row_deleted(GTK_TREE_MODEL(self), path);
+		gtk_tree_path_free(path);
+	}
+
+	note_row_free(row);
+
+	return TRUE;
+}
+
+/**
+ * Starts a batch of changes. Until the matching conboy_note_store_end_batch()
+ * no row signals are emitted. Batches can be nested.
+ */
+void
+conboy_note_store_begin_batch(ConboyNoteStore *self)
+{
+	g_return_if_fail(CONBOY_IS_NOTE_STORE(self));
+
+	self->batch++;
+}
+
+/**
+ * Ends a batch of changes. If the outermost batch changed anything, the
+ * "reset" signal is emitted once.
+ */
+void
+conboy_note_store_end_batch(ConboyNoteStore *self)
+{
+	g_return_if_fail(CONBOY_IS_NOTE_STORE(self));
+	g_return_if_fail(self->batch > 0);
+
+	self->batch--;
+
+	if (self->batch == 0 && self->batch_changed) {
+		self->batch_changed = FALSE;
+		/* Iters handed out before the reset are not valid anymore */
+		self->stamp++;
+		g_signal_emit(self, signals[RESET], 0);
+	}
+}
+
+/**
+ * Appends all notes of the list to the store. Views only get one
+ * "reset" signal instead of one row-inserted per note.
+ */
+void
+conboy_note_store_add_many(ConboyNoteStore *self, GSList *notes)
+{
+	g_return_if_fail(CONBOY_IS_NOTE_STORE(self));
+
+	conboy_note_store_begin_batch(self);
+	while (notes) {
+		conboy_note_store_add(self, notes->data, NULL);
+		notes = notes->next;
+	}
+	conboy_note_store_end_batch(self);
+}
+
+/**
+ * Removes all notes from the store.
+ */
+void
+conboy_note_store_clear(ConboyNoteStore *self)
+{
+	g_return_if_fail(CONBOY_IS_NOTE_STORE(self));
+
+	if (self->array->len == 0) {
+		return;
+	}
+
+	/* Views are rebuilt once instead of deleting row by row */
+	conboy_note_store_begin_batch(self);
+
+	g_hash_table_remove_all(self->guids);
+	g_hash_table_remove_all(self->titles);
+	g_ptr_array_set_size(self->dates, 0);
+	g_array_set_size(self->title_lengths, 0);
+	self->max_title_length = 0;
+
+	g_hash_table_remove_all(self->rows);
+	g_ptr_array_set_size(self->array, 0);
+
+	self->batch_changed = TRUE;
+	conboy_note_store_end_batch(self);
 }
 
 gboolean
 conboy_note_store_get_iter(ConboyNoteStore *self, ConboyNote *note_a, GtkTreeIter *iter)
 {
-	if (gtk_tree_model_get_iter_first(GTK_TREE_MODEL(self), iter)) do
-	{
-		ConboyNote *note_b;
-		gtk_tree_model_get(GTK_TREE_MODEL(self), iter, NOTE_COLUMN, &note_b, -1);
-		if (note_a == note_b) {
-			return TRUE;
-		}
-	} while (gtk_tree_model_iter_next(GTK_TREE_MODEL(self), iter));
+	NoteRow *row;
+
+	g_return_val_if_fail(CONBOY_IS_NOTE_STORE(self), FALSE);
+
+	row = g_hash_table_lookup(self->rows, note_a);
+	if (row != NULL) {
+		set_iter(self, iter, row);
+		return TRUE;
+	}
 
 	return FALSE;
 }
-
 ConboyNote*
 conboy_note_store_find(ConboyNoteStore *self, ConboyNote *note_a)
 {
-	ConboyNote *note_b;
-	GtkTreeIter iter;
-	if (conboy_note_store_get_iter(self, note_a, &iter)) {
-		gtk_tree_model_get(GTK_TREE_MODEL(self), &iter, NOTE_COLUMN, &note_b, -1);
-		return note_b;
+	g_return_val_if_fail(CONBOY_IS_NOTE_STORE(self), NULL);
+
+	if (g_hash_table_lookup(self->rows, note_a) != NULL) {
+		return note_a;
 	}
 	return NULL;
 }
@@ -329,58 +866,43 @@ conboy_note_store_find(ConboyNoteStore *self, ConboyNote *note_a)
 ConboyNote*
 conboy_note_store_find_by_title(ConboyNoteStore *self, const gchar *title)
 {
-	GtkTreeIter iter;
-	gchar *title_a = g_utf8_casefold(title, -1);
-
-	if (gtk_tree_model_get_iter_first(GTK_TREE_MODEL(self), &iter)) do {
-		ConboyNote *note;
-		gchar *title_b;
-		gtk_tree_model_get(GTK_TREE_MODEL(self), &iter, NOTE_COLUMN, &note, -1);
-		title_b = g_utf8_casefold(note->title, -1);
-		if (strcmp(title_a, title_b) == 0) {
-			g_free(title_a);
-			g_free(title_b);
-			return note;
-		}
-		g_free(title_b);
-	} while (gtk_tree_model_iter_next(GTK_TREE_MODEL(self), &iter));
+	GPtrArray *notes;
+	gchar *key;
+
+	g_return_val_if_fail(CONBOY_IS_NOTE_STORE(self), NULL);
+	g_return_val_if_fail(title != NULL, NULL);
+
+	key = g_utf8_casefold(title, -1);
+	notes = g_hash_table_lookup(self->titles, key);
+	g_free(key);
 
-	g_free(title_a);
+	if (notes != NULL) {
+		return g_ptr_array_index(notes, 0);
+	}
 	return NULL;
 }
 
 gint
 conboy_note_store_get_length(ConboyNoteStore *self)
 {
-	gint count = 0;
-	GtkTreeIter iter;
-
-	if (gtk_tree_model_get_iter_first(GTK_TREE_MODEL(self), &iter)) do {
-		count++;
-	} while (gtk_tree_model_iter_next(GTK_TREE_MODEL(self), &iter));
+	g_return_val_if_fail(CONBOY_IS_NOTE_STORE(self), 0);
 
-	return count;
+	return self->array->len;
 }
 
+/**
+ * Returns the note with the most recent change date, or NULL if the
+ * store is empty.
+ */
 ConboyNote*
 conboy_note_store_get_latest(ConboyNoteStore *self)
 {
-	GtkTreeIter iter;
-	ConboyNote *latest_note = NULL;
-
-	if (gtk_tree_model_get_iter_first(GTK_TREE_MODEL(self), &iter)) do {
-		ConboyNote *note;
-		gtk_tree_model_get(GTK_TREE_MODEL(self), &iter, NOTE_COLUMN, &note, -1);
-		if (latest_note != NULL) {
-			if (note->last_change_date > latest_note->last_change_date) {
-				latest_note = note;
-			}
-		} else {
-			latest_note = note;
-		}
-	} while (gtk_tree_model_iter_next(GTK_TREE_MODEL(self), &iter));
+	g_return_val_if_fail(CONBOY_IS_NOTE_STORE(self), NULL);
 
-	return latest_note;
+	if (self->dates->len == 0) {
+		return NULL;
+	}
+	return HEAP_ROW(self, 0)->note;
 }
 
 ConboyNote*
@@ -401,11 +923,17 @@ conboy_note_store_get_latest_or_new(ConboyNoteStore *self)
 void
 conboy_note_store_note_changed(ConboyNoteStore *self, ConboyNote *note)
 {
-	GtkTreeIter iter;
-	if (conboy_note_store_get_iter(self, note, &iter)) {
-		GtkTreePath *path = gtk_tree_model_get_path(GTK_TREE_MODEL(self), &iter);
-		gtk_tree_model_row_changed(GTK_TREE_MODEL(self), path, &iter);
-		gtk_tree_path_free(path);
+	NoteRow *row;
+
+	g_return_if_fail(CONBOY_IS_NOTE_STORE(self));
+
+	row = g_hash_table_lookup(self->rows, note);
+	if (row != NULL) {
+		/* The date might have been set directly on the struct */
+		heap_update(self, row);
+		format_date(row);
+
+		emit_row_signal(self, row, FALSE);
 	}
 }
 
@@ -415,25 +943,53 @@ on_storage_activated(ConboyStorage *storage, ConboyNoteStore *self)
 {
 	if (conboy_note_store_get_length(self) > 0) {
 		g_printerr("ERROR: Storage activated, but already notes in notes store\n");
-		gtk_list_store_clear(GTK_LIST_STORE(self));
+		conboy_note_store_clear(self);
 	}
 
 	/* Add all notes from Storage to NoteStore */
 	GSList *notes = conboy_storage_note_list(storage);
-	GSList *iter = notes;
-	while (iter) {
-		conboy_note_store_add(self, iter->data, NULL);
-		iter = iter->next;
-	}
+	conboy_note_store_add_many(self, notes);
 	g_slist_free(notes);
 }
 
 static void
 on_storage_deactivated(ConboyStorage *storage, ConboyNoteStore *self)
 {
-	gtk_list_store_clear(GTK_LIST_STORE(self));
+	conboy_note_store_clear(self);
+}
+
+/*
+ * A note was changed by another program. The note object is updated
+ * in place, so that open windows keep a valid note.
+ */
+static void
+on_storage_note_changed(ConboyStorage *storage, const gchar *guid, ConboyNoteStore *self)
+{
+	ConboyNote *note = conboy_note_store_find_by_guid(self, guid);
+	ConboyNote *loaded = conboy_storage_note_load(storage, guid);
+
+	if (loaded == NULL) {
+		return;
+	}
+
+	if (note != NULL) {
+		conboy_note_assign(note, loaded);
+		conboy_note_store_note_changed(self, note);
+		g_object_unref(loaded);
+	} else {
+		/* Like notes from conboy_storage_note_list(), the reference is
+		 * dropped by note_delete() or note_forget() */
+		conboy_note_store_add(self, loaded, NULL);
+	}
+}
+
+static void
+on_storage_note_added(ConboyStorage *storage, const gchar *guid, ConboyNoteStore *self)
+{
+	on_storage_note_changed(storage, guid, self);
 }
 
+
 void
 conboy_note_store_set_storage(ConboyNoteStore *self, ConboyStorage *storage) {
 
@@ -447,22 +1003,23 @@ conboy_note_store_set_storage(ConboyNoteStore *self, ConboyStorage *storage) {
 	g_object_ref(storage);
 
 	GTimer *timer = g_timer_new();
-	gulong micro;
+	gdouble seconds;
 
 	GSList *notes = conboy_storage_note_list(storage);
-	while (notes) {
-		conboy_note_store_add(self, notes->data, NULL);
-		notes = notes->next;
-	}
+	conboy_note_store_add_many(self, notes);
+	g_slist_free(notes);
 
-	g_timer_stop(timer);
-	g_timer_elapsed(timer, &micro);
+	/* The microseconds returned by g_timer_elapsed() are only the fractional part */
+	seconds = g_timer_elapsed(timer, NULL);
 	g_timer_destroy(timer);
 
-	g_printerr("INFO: Loading %i notes took %il micro seconds\n", conboy_note_store_get_length(self), micro);
+	g_printerr("INFO: Loading %i notes took %.1f ms\n", conboy_note_store_get_length(self), seconds * 1000);
 
 	g_signal_connect(storage, "activated",   G_CALLBACK(on_storage_activated),   self);
 	g_signal_connect(storage, "deactivated", G_CALLBACK(on_storage_deactivated), self);
+	g_signal_connect(storage, "note-added",   G_CALLBACK(on_storage_note_added),   self);
+	g_signal_connect(storage, "note-changed", G_CALLBACK(on_storage_note_changed), self);
+	/* "note-removed" is handled in interface.c, the note also has to go from the history */
 }
 
 ConboyNote*
@@ -472,24 +1029,7 @@ conboy_note_store_find_by_guid(ConboyNoteStore *self, const gchar *guid)
 	g_return_val_if_fail(guid != NULL, NULL);
 	g_return_val_if_fail(CONBOY_IS_NOTE_STORE(self), NULL);
 
-	GtkTreeIter iter;
-	ConboyNote *result = NULL;
-
-	if (gtk_tree_model_get_iter_first(GTK_TREE_MODEL(self), &iter)) do {
-		ConboyNote *note;
-		gtk_tree_model_get(GTK_TREE_MODEL(self), &iter, NOTE_COLUMN, &note, -1);
-		gchar *tmp_guid;
-		g_object_get(note, "guid", &tmp_guid, NULL);
-		if (strcmp(tmp_guid, guid) == 0) {
-			result = note;
-			g_free(tmp_guid);
-			break;
-		}
-		g_free(tmp_guid);
-
-	} while (gtk_tree_model_iter_next(GTK_TREE_MODEL(self), &iter));
-
-	return result;
+	return g_hash_table_lookup(self->guids, guid);
 }
 
 /**
@@ -501,14 +1041,14 @@ conboy_note_store_get_all (ConboyNoteStore *self)
 	g_return_val_if_fail(self != NULL, NULL);
 	g_return_val_if_fail(CONBOY_IS_NOTE_STORE(self), NULL);
 
-	GtkTreeIter iter;
 	GList *result = NULL;
-	if (gtk_tree_model_get_iter_first(GTK_TREE_MODEL(self), &iter)) do
-	{
-		ConboyNote *note;
-		gtk_tree_model_get(GTK_TREE_MODEL(self), &iter, NOTE_COLUMN, &note, -1);
-		result = g_list_append(result, note);
-	} while (gtk_tree_model_iter_next(GTK_TREE_MODEL(self), &iter));
+	guint i = self->array->len;
+
+	/* Prepend from the back, so the list is in store order */
+	while (i > 0) {
+		i--;
+		result = g_list_prepend(result, ARRAY_ROW(self, i)->note);
+	}
 
 	return result;
 }
@@ -45,14 +45,27 @@ G_BEGIN_DECLS
   (G_TYPE_INSTANCE_GET_CLASS ((obj), NOTE_TYPE_LISTSTORE, ConboyNoteStoreClass))
 
 typedef struct {
-  GtkListStore parent;
+  GObject parent;
   /* <privat> */
   ConboyStorage *storage;
   gint max_title_length;
+  gint stamp;
+  GdkPixbuf *icon;
+  GPtrArray *array; /* rows in list order */
+  gint batch; /* nesting depth of begin_batch() */
+  gboolean batch_changed;
+  GHashTable *rows;  /* ConboyNote* -> row, see conboy_note_store.c */
+  GHashTable *guids; /* guid -> ConboyNote* */
+  GHashTable *titles; /* casefolded title -> GPtrArray of ConboyNote* */
+  GArray *title_lengths; /* number of titles per length */
+  GPtrArray *dates; /* heap of rows, most recently changed first */
 } ConboyNoteStore;
 
 typedef struct {
-  GtkListStoreClass parent_class;
+  GObjectClass parent_class;
+
+  /* signals */
+  void (*reset) (ConboyNoteStore *self);
 } ConboyNoteStoreClass;
 
 typedef enum {
@@ -68,7 +81,11 @@ GType conboy_note_store_get_type(void);
 ConboyNoteStore*	conboy_note_store_new(void);
 
 void				conboy_note_store_add(ConboyNoteStore *self, ConboyNote *note, GtkTreeIter *iter);
+void				conboy_note_store_add_many(ConboyNoteStore *self, GSList *notes);
+void				conboy_note_store_begin_batch(ConboyNoteStore *self);
+void				conboy_note_store_end_batch(ConboyNoteStore *self);
 gboolean			conboy_note_store_remove(ConboyNoteStore *self, ConboyNote *note);
+void				conboy_note_store_clear(ConboyNoteStore *self);
 gboolean			conboy_note_store_get_iter(ConboyNoteStore *self, ConboyNote *note_a, GtkTreeIter *iter);
 ConboyNote*			conboy_note_store_find(ConboyNoteStore *self, ConboyNote *note);
 ConboyNote*			conboy_note_store_find_by_title(ConboyNoteStore *self, const gchar *title);
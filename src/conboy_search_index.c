@@ -0,0 +1,362 @@
+/*
+ * Copyright (C) 2009 Cornelius Hald <hald@icandy.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <string.h>
+
+#include "conboy_search_index.h"
+
+/* An indexed note */
+typedef struct {
+	gchar        *guid;
+	const gchar **words; /* Keys of ConboySearchIndex.postings */
+	guint         n_words;
+} Document;
+
+struct _ConboySearchIndex {
+	GHashTable *documents; /* guid -> Document* */
+	GHashTable *postings;  /* word -> GHashTable (Document* -> hits) */
+	GHashTable *matching;  /* query term -> GSList of the words containing it */
+};
+
+/* A single query word while searching */
+typedef struct {
+	const gchar *word;
+	GSList      *postings; /* Posting lists of the indexed words it matches */
+	guint        size;     /* Sum of their sizes */
+} Term;
+
+/* Looking for the indexed words that contain a term */
+typedef struct {
+	const gchar *term;
+	GSList      *words;
+} MatchData;
+
+/* Narrows the notes found so far down to the ones that also match term */
+typedef struct {
+	Term       *term;
+	GHashTable *result; /* Document* -> hits */
+} IntersectData;
+
+static void
+document_free (Document *doc)
+{
+	g_free(doc->guid);
+	g_free(doc->words);
+	g_free(doc);
+}
+
+/*
+ * Splits casefolded text into words of letters and digits. Every word is
+ * inserted into counts (newly allocated) with the number of occurrences.
+ */
+static void
+tokenize (const gchar *text, GHashTable *counts)
+{
+	const gchar *pos = text;
+	const gchar *start = NULL;
+
+	while (TRUE) {
+		gunichar c = g_utf8_get_char(pos);
+
+		if (c != 0 && g_unichar_isalnum(c)) {
+			if (start == NULL) {
+				start = pos;
+			}
+		} else if (start != NULL) {
+			gchar *word = g_strndup(start, pos - start);
+			gint count = GPOINTER_TO_INT(g_hash_table_lookup(counts, word));
+			g_hash_table_replace(counts, word, GINT_TO_POINTER(count + 1));
+			start = NULL;
+		}
+
+		if (c == 0) {
+			break;
+		}
+		pos = g_utf8_next_char(pos);
+	}
+}
+
+ConboySearchIndex*
+conboy_search_index_new ()
+{
+	ConboySearchIndex *index = g_new0(ConboySearchIndex, 1);
+
+	index->documents = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify) document_free);
+	index->postings = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_hash_table_destroy);
+	index->matching = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_slist_free);
+
+	return index;
+}
+
+void
+conboy_search_index_free (ConboySearchIndex *index)
+{
+	if (index == NULL) {
+		return;
+	}
+
+	g_hash_table_destroy(index->matching);
+	g_hash_table_destroy(index->postings);
+	g_hash_table_destroy(index->documents);
+	g_free(index);
+}
+
+void
+conboy_search_index_remove (ConboySearchIndex *index, const gchar *guid)
+{
+	g_return_if_fail(index != NULL);
+	g_return_if_fail(guid != NULL);
+
+	Document *doc = g_hash_table_lookup(index->documents, guid);
+	guint i;
+
+	if (doc == NULL) {
+		return;
+	}
+
+	for (i = 0; i < doc->n_words; i++) {
+		GHashTable *posting = g_hash_table_lookup(index->postings, doc->words[i]);
+		g_hash_table_remove(posting, doc);
+		if (g_hash_table_size(posting) == 0) {
+			/* The cached matches point to the words */
+			g_hash_table_remove_all(index->matching);
+			/* Frees doc->words[i] */
+			g_hash_table_remove(index->postings, doc->words[i]);
+		}
+	}
+
+	g_hash_table_remove(index->documents, guid);
+}
+
+typedef struct {
+	ConboySearchIndex *index;
+	Document          *doc;
+} AddData;
+
+static void
+add_posting (gpointer key, gpointer value, gpointer user_data)
+{
+	AddData *data = user_data;
+	gpointer word;
+	gpointer posting;
+
+	if (!g_hash_table_lookup_extended(data->index->postings, key, &word, &posting)) {
+		word = g_strdup(key);
+		posting = g_hash_table_new(g_direct_hash, g_direct_equal);
+		g_hash_table_insert(data->index->postings, word, posting);
+		/* A new word may contain terms searched before */
+		g_hash_table_remove_all(data->index->matching);
+	}
+
+	g_hash_table_insert(posting, data->doc, value);
+	data->doc->words[data->doc->n_words++] = word;
+}
+
+void
+conboy_search_index_add (ConboySearchIndex *index, const gchar *guid, const gchar *text)
+{
+	g_return_if_fail(index != NULL);
+	g_return_if_fail(guid != NULL);
+
+	GHashTable *counts;
+	AddData data;
+
+	conboy_search_index_remove(index, guid);
+
+	if (text == NULL) {
+		return;
+	}
+
+	counts = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	tokenize(text, counts);
+
+	data.index = index;
+	data.doc = g_new0(Document, 1);
+	data.doc->guid = g_strdup(guid);
+	data.doc->words = g_new(const gchar*, g_hash_table_size(counts));
+	g_hash_table_foreach(counts, add_posting, &data);
+	g_hash_table_insert(index->documents, data.doc->guid, data.doc);
+
+	g_hash_table_destroy(counts);
+}
+
+static void
+collect_matching_word (gpointer key, gpointer value, gpointer user_data)
+{
+	MatchData *data = user_data;
+
+	if (strstr(key, data->term) != NULL) {
+		data->words = g_slist_prepend(data->words, key);
+	}
+}
+
+/*
+ * Returns the indexed words that contain term, the exact word included.
+ * The result is cached until the vocabulary changes. While the user
+ * types, the words found for the term without its last character are
+ * a superset, so only those have to be scanned.
+ */
+static GSList*
+get_matching_words (ConboySearchIndex *index, const gchar *term)
+{
+	MatchData data;
+	GSList *candidates = NULL;
+	GSList *iter;
+	gpointer key;
+	gchar *shorter;
+	gboolean narrowed = FALSE;
+
+	if (g_hash_table_lookup_extended(index->matching, term, &key, (gpointer*) &data.words)) {
+		return data.words;
+	}
+
+	data.term = term;
+	data.words = NULL;
+
+	shorter = g_strndup(term, g_utf8_prev_char(term + strlen(term)) - term);
+	if (shorter[0] != '\0') {
+		narrowed = g_hash_table_lookup_extended(index->matching, shorter, &key, (gpointer*) &candidates);
+	}
+	g_free(shorter);
+
+	if (narrowed) {
+		for (iter = candidates; iter != NULL; iter = iter->next) {
+			collect_matching_word(iter->data, NULL, &data);
+		}
+	} else {
+		g_hash_table_foreach(index->postings, collect_matching_word, &data);
+	}
+
+	g_hash_table_insert(index->matching, g_strdup(term), data.words);
+	return data.words;
+}
+
+static void
+collect_query_term (gpointer key, gpointer value, gpointer user_data)
+{
+	*((GSList**) user_data) = g_slist_prepend(*((GSList**) user_data), key);
+}
+
+static gint
+compare_terms (gconstpointer a, gconstpointer b)
+{
+	guint size_a = ((const Term*) a)->size;
+	guint size_b = ((const Term*) b)->size;
+
+	return size_a < size_b ? -1 : (size_a > size_b ? 1 : 0);
+}
+
+static void
+add_hits (gpointer key, gpointer value, gpointer user_data)
+{
+	gint hits = GPOINTER_TO_INT(g_hash_table_lookup(user_data, key));
+	g_hash_table_insert(user_data, key, GINT_TO_POINTER(hits + GPOINTER_TO_INT(value)));
+}
+
+static void
+intersect_term (gpointer key, gpointer value, gpointer user_data)
+{
+	IntersectData *data = user_data;
+	gint hits = 0;
+	GSList *iter;
+
+	for (iter = data->term->postings; iter != NULL; iter = iter->next) {
+		hits += GPOINTER_TO_INT(g_hash_table_lookup(iter->data, key));
+	}
+
+	if (hits > 0) {
+		g_hash_table_insert(data->result, key, GINT_TO_POINTER(hits + GPOINTER_TO_INT(value)));
+	}
+}
+
+static void
+add_match (gpointer key, gpointer value, gpointer user_data)
+{
+	Document *doc = key;
+	g_hash_table_insert((GHashTable*) user_data, g_strdup(doc->guid), value);
+}
+
+void
+conboy_search_index_search (ConboySearchIndex *index, gchar **words, GHashTable *matches)
+{
+	g_return_if_fail(index != NULL);
+	g_return_if_fail(words != NULL);
+	g_return_if_fail(matches != NULL);
+
+	/* Query words are split like the notes, "e-mail" searches "e" and "mail" */
+	GHashTable *query = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	GHashTable *result = NULL;
+	GSList *query_words = NULL;
+	GSList *terms = NULL;
+	GSList *iter;
+	guint i;
+
+	for (i = 0; words[i] != NULL; i++) {
+		gchar *word = g_utf8_casefold(words[i], -1);
+		tokenize(word, query);
+		g_free(word);
+	}
+	g_hash_table_foreach(query, collect_query_term, &query_words);
+
+	/* A term matches every indexed word it is part of, like strstr() on the text */
+	for (iter = query_words; iter != NULL; iter = iter->next) {
+		Term *term = g_new0(Term, 1);
+		GSList *word;
+
+		term->word = iter->data;
+		for (word = get_matching_words(index, term->word); word != NULL; word = word->next) {
+			GHashTable *posting = g_hash_table_lookup(index->postings, word->data);
+			term->postings = g_slist_prepend(term->postings, posting);
+			term->size += g_hash_table_size(posting);
+		}
+		terms = g_slist_prepend(terms, term);
+	}
+
+	/* Start with the rarest term, so every step looks at as few notes as possible */
+	terms = g_slist_sort(terms, compare_terms);
+
+	if (terms != NULL && ((Term*) terms->data)->size > 0) {
+		result = g_hash_table_new(g_direct_hash, g_direct_equal);
+		for (iter = ((Term*) terms->data)->postings; iter != NULL; iter = iter->next) {
+			g_hash_table_foreach(iter->data, add_hits, result);
+		}
+
+		/* Each further term narrows the notes found so far down (AND) */
+		for (iter = terms->next; iter != NULL && g_hash_table_size(result) > 0; iter = iter->next) {
+			IntersectData data;
+
+			data.term = iter->data;
+			data.result = g_hash_table_new(g_direct_hash, g_direct_equal);
+			g_hash_table_foreach(result, intersect_term, &data);
+
+			g_hash_table_destroy(result);
+			result = data.result;
+		}
+
+		g_hash_table_foreach(result, add_match, matches);
+		g_hash_table_destroy(result);
+	}
+
+	for (iter = terms; iter != NULL; iter = iter->next) {
+		g_slist_free(((Term*) iter->data)->postings);
+		g_free(iter->data);
+	}
+	g_slist_free(terms);
+	g_slist_free(query_words);
+	g_hash_table_destroy(query);
+}
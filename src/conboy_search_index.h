@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2009 Cornelius Hald <hald@icandy.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef CONBOY_SEARCH_INDEX_H
+#define CONBOY_SEARCH_INDEX_H
+
+#include <glib.h>
+
+/*
+ * In-memory inverted index over the text of all notes. Every casefolded
+ * word maps to the notes that contain it and how often. Notes are added
+ * and removed one at a time, so the index can follow saves and syncs.
+ */
+typedef struct _ConboySearchIndex ConboySearchIndex;
+
+ConboySearchIndex* conboy_search_index_new    (void);
+void               conboy_search_index_free   (ConboySearchIndex *index);
+
+/* Indexes the text of a note, see conboy_note_get_text(). Replaces what was known about guid. */
+void               conboy_search_index_add    (ConboySearchIndex *index, const gchar *guid, const gchar *text);
+void               conboy_search_index_remove (ConboySearchIndex *index, const gchar *guid);
+
+/*
+ * Same contract as conboy_storage_plugin_search(): For every note that
+ * contains all words, the number of hits is inserted into matches with
+ * the newly allocated guid as key. A word matches every indexed word it
+ * is part of.
+ */
+void               conboy_search_index_search (ConboySearchIndex *index, gchar **words, GHashTable *matches);
+
+#endif /* CONBOY_SEARCH_INDEX_H */
@@ -26,6 +26,8 @@
 
 G_DEFINE_TYPE(ConboyStorage, conboy_storage, G_TYPE_OBJECT);
 
+static void conboy_storage_release_plugin(ConboyStorage *self);
+
 static void
 conboy_storage_dispose (GObject *gobject)
 {
@@ -34,8 +36,7 @@ conboy_storage_dispose (GObject *gobject)
 	if (self->plugin) {
 		/* TODO: g_signal_emit(self, "deactivate"; */
 		
-		g_object_unref(self->plugin);
-		self->plugin = NULL;
+		conboy_storage_release_plugin(self);
 	}
 	
 	/* Chain up to the parent class */
@@ -45,9 +46,9 @@ conboy_storage_dispose (GObject *gobject)
 static void
 conboy_storage_finalize (GObject *gobject)
 {
-	/*ConboyStorage *self = CONBOY_STORAGE(gobject);*/
+	ConboyStorage *self = CONBOY_STORAGE(gobject);
 	
-	/*g_free(self->xyz);*/ /* Stuff which is not gobject based*/
+	g_static_rec_mutex_free(&self->index_lock);
 	
 	/* Chain up to the parent class */
 	G_OBJECT_CLASS(conboy_storage_parent_class)->finalize(gobject);
@@ -57,6 +58,9 @@ conboy_storage_finalize (GObject *gobject)
 enum {
 	ACTIVATED,
 	DEACTIVATED,
+	NOTE_ADDED,
+	NOTE_CHANGED,
+	NOTE_REMOVED,
 	LAST_SIGNAL
 };
 
@@ -94,6 +98,39 @@ conboy_storage_class_init (ConboyStorageClass *klass)
 				g_cclosure_marshal_VOID__VOID,
 				G_TYPE_NONE,
 				0);
+
+	signals[NOTE_ADDED] =
+		g_signal_new(
+				"note-added",
+				CONBOY_TYPE_STORAGE,
+				G_SIGNAL_RUN_LAST,
+				G_STRUCT_OFFSET(ConboyStorageClass, note_added),
+				NULL, NULL,
+				g_cclosure_marshal_VOID__STRING,
+				G_TYPE_NONE,
+				1, G_TYPE_STRING);
+
+	signals[NOTE_CHANGED] =
+		g_signal_new(
+				"note-changed",
+				CONBOY_TYPE_STORAGE,
+				G_SIGNAL_RUN_LAST,
+				G_STRUCT_OFFSET(ConboyStorageClass, note_changed),
+				NULL, NULL,
+				g_cclosure_marshal_VOID__STRING,
+				G_TYPE_NONE,
+				1, G_TYPE_STRING);
+
+	signals[NOTE_REMOVED] =
+		g_signal_new(
+				"note-removed",
+				CONBOY_TYPE_STORAGE,
+				G_SIGNAL_RUN_LAST,
+				G_STRUCT_OFFSET(ConboyStorageClass, note_removed),
+				NULL, NULL,
+				g_cclosure_marshal_VOID__STRING,
+				G_TYPE_NONE,
+				1, G_TYPE_STRING);
 	
 }
 
@@ -104,9 +141,152 @@ conboy_storage_init (ConboyStorage *self)
 	/* Init all members */
 	self->plugin = NULL;
 	self->plugin_store = NULL;
+	self->search_index = NULL;
+	self->unindexed = NULL;
+	g_static_rec_mutex_init(&self->index_lock);
 }
 	
 
+/*
+ * Search index
+ */
+
+/*
+ * All of these take index_lock, web sync saves and deletes notes from its
+ * own thread.
+ */
+
+static void
+index_note (ConboyStorage *self, ConboyNote *note)
+{
+	g_static_rec_mutex_lock(&self->index_lock);
+	if (self->search_index != NULL) {
+		conboy_search_index_add(self->search_index, note->guid, conboy_note_get_text(note));
+		g_hash_table_remove(self->unindexed, note->guid);
+	}
+	g_static_rec_mutex_unlock(&self->index_lock);
+}
+
+static void
+unindex_note (ConboyStorage *self, const gchar *guid)
+{
+	g_static_rec_mutex_lock(&self->index_lock);
+	if (self->search_index != NULL) {
+		conboy_search_index_remove(self->search_index, guid);
+		g_hash_table_remove(self->unindexed, guid);
+	}
+	g_static_rec_mutex_unlock(&self->index_lock);
+}
+
+/*
+ * Notes changed by the plugin itself (e.g. by a sync) are only reindexed
+ * on the next search, so their content does not have to be loaded now.
+ */
+static void
+invalidate_note (ConboyStorage *self, const gchar *guid)
+{
+	g_static_rec_mutex_lock(&self->index_lock);
+	if (self->search_index != NULL) {
+		conboy_search_index_remove(self->search_index, guid);
+		g_hash_table_replace(self->unindexed, g_strdup(guid), GINT_TO_POINTER(TRUE));
+	}
+	g_static_rec_mutex_unlock(&self->index_lock);
+}
+
+static void
+drop_search_index (ConboyStorage *self)
+{
+	g_static_rec_mutex_lock(&self->index_lock);
+	if (self->search_index != NULL) {
+		conboy_search_index_free(self->search_index);
+		self->search_index = NULL;
+		g_hash_table_destroy(self->unindexed);
+		self->unindexed = NULL;
+	}
+	g_static_rec_mutex_unlock(&self->index_lock);
+}
+
+static void
+collect_unindexed (gpointer key, gpointer value, gpointer user_data)
+{
+	*((GSList**) user_data) = g_slist_prepend(*((GSList**) user_data), g_strdup(key));
+}
+
+/*
+ * Notes whose content would have to come from a server are not loaded
+ * for the index, they are tried again on the next search.
+ */
+static void
+index_cached_note (ConboyStorage *self, ConboyNote *note)
+{
+	if (note->content != NULL || conboy_storage_plugin_has_cached_content(self->plugin, note->guid)) {
+		index_note(self, note);
+	} else {
+		g_hash_table_replace(self->unindexed, g_strdup(note->guid), GINT_TO_POINTER(TRUE));
+	}
+}
+
+/*
+ * Builds the index from the given notes, or brings it up to date if it
+ * exists already. Using the notes the caller holds anyway means their
+ * content is only loaded once. Changed notes the caller does not have
+ * are loaded from the plugin. The caller holds index_lock.
+ */
+static void
+update_search_index (ConboyStorage *self, GList *notes)
+{
+	GHashTable *by_guid;
+	GSList *guids = NULL;
+	GSList *missing = NULL;
+	GSList *loaded;
+	GSList *iter;
+	GList *note_iter;
+
+	if (self->search_index == NULL) {
+		self->search_index = conboy_search_index_new();
+		self->unindexed = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+		for (note_iter = notes; note_iter != NULL; note_iter = note_iter->next) {
+			index_cached_note(self, CONBOY_NOTE(note_iter->data));
+		}
+		return;
+	}
+
+	if (g_hash_table_size(self->unindexed) == 0) {
+		return;
+	}
+
+	by_guid = g_hash_table_new(g_str_hash, g_str_equal);
+	for (note_iter = notes; note_iter != NULL; note_iter = note_iter->next) {
+		ConboyNote *note = CONBOY_NOTE(note_iter->data);
+		g_hash_table_insert(by_guid, note->guid, note);
+	}
+
+	g_hash_table_foreach(self->unindexed, collect_unindexed, &guids);
+	g_hash_table_remove_all(self->unindexed);
+
+	for (iter = guids; iter != NULL; iter = iter->next) {
+		ConboyNote *note = g_hash_table_lookup(by_guid, iter->data);
+		if (note != NULL) {
+			index_cached_note(self, note);
+			g_free(iter->data);
+		} else {
+			missing = g_slist_prepend(missing, iter->data);
+		}
+	}
+	g_slist_free(guids);
+	g_hash_table_destroy(by_guid);
+
+	loaded = conboy_storage_note_load_many(self, missing);
+	for (iter = loaded; iter != NULL; iter = iter->next) {
+		index_cached_note(self, CONBOY_NOTE(iter->data));
+		g_object_unref(iter->data);
+	}
+	g_slist_free(loaded);
+	g_slist_foreach(missing, (GFunc) g_free, NULL);
+	g_slist_free(missing);
+}
+
+
 /*
  * Public methods
  */
@@ -117,6 +297,50 @@ conboy_storage_new()
 	return g_object_new(CONBOY_TYPE_STORAGE, NULL);
 }
 
+static void
+on_plugin_note_added(ConboyStoragePlugin *plugin, const gchar *guid, ConboyStorage *self)
+{
+	invalidate_note(self, guid);
+	g_signal_emit(self, signals[NOTE_ADDED], 0, guid);
+}
+
+static void
+on_plugin_note_changed(ConboyStoragePlugin *plugin, const gchar *guid, ConboyStorage *self)
+{
+	invalidate_note(self, guid);
+	g_signal_emit(self, signals[NOTE_CHANGED], 0, guid);
+}
+
+static void
+on_plugin_note_removed(ConboyStoragePlugin *plugin, const gchar *guid, ConboyStorage *self)
+{
+	unindex_note(self, guid);
+	g_signal_emit(self, signals[NOTE_REMOVED], 0, guid);
+}
+
+/*
+ * Takes a reference on the plugin and forwards its signals.
+ */
+static void
+conboy_storage_use_plugin(ConboyStorage *self, ConboyStoragePlugin *plugin)
+{
+	self->plugin = plugin;
+	g_object_ref(self->plugin);
+
+	g_signal_connect(plugin, "note-added",   G_CALLBACK(on_plugin_note_added),   self);
+	g_signal_connect(plugin, "note-changed", G_CALLBACK(on_plugin_note_changed), self);
+	g_signal_connect(plugin, "note-removed", G_CALLBACK(on_plugin_note_removed), self);
+}
+
+static void
+conboy_storage_release_plugin(ConboyStorage *self)
+{
+	g_signal_handlers_disconnect_matched(self->plugin, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, self);
+	g_object_unref(self->plugin);
+	self->plugin = NULL;
+	drop_search_index(self);
+}
+
 static void
 conboy_storage_set_active_plugin(ConboyStorage *self, ConboyPluginStore *plugin_store)
 {
@@ -125,8 +349,7 @@ conboy_storage_set_active_plugin(ConboyStorage *self, ConboyPluginStore *plugin_
 		ConboyPluginInfo *info = CONBOY_PLUGIN_INFO(infos->data);
 		if (conboy_plugin_info_is_active(info)) {
 			if (CONBOY_IS_STORAGE_PLUGIN(info->plugin)) {
-				self->plugin = CONBOY_STORAGE_PLUGIN(info->plugin);
-				g_object_ref(self->plugin);
+				conboy_storage_use_plugin(self, CONBOY_STORAGE_PLUGIN(info->plugin));
 				break;
 			}
 		}
@@ -148,8 +371,7 @@ on_plugin_activated(ConboyPluginStore *store, ConboyPluginInfo *info, ConboyStor
 		return;
 	}
 	
-	self->plugin = CONBOY_STORAGE_PLUGIN(info->plugin);
-	g_object_ref(self->plugin);
+	conboy_storage_use_plugin(self, CONBOY_STORAGE_PLUGIN(info->plugin));
 	g_signal_emit_by_name(self, "activated");
 }
 
@@ -175,8 +397,8 @@ on_plugin_deactivate(ConboyPluginStore *store, ConboyPluginInfo *info, ConboySto
 	}
 	
 	g_signal_emit_by_name(self, "deactivated");
-	g_object_unref(self->plugin);
-	self->plugin = NULL;
+	conboy_storage_plugin_sync(self->plugin);
+	conboy_storage_release_plugin(self);
 }
 
 void
@@ -237,7 +459,12 @@ conboy_storage_note_save (ConboyStorage *self, ConboyNote *note)
 	g_return_val_if_fail(self->plugin != NULL, FALSE);
 	g_return_val_if_fail(CONBOY_IS_STORAGE_PLUGIN(self->plugin), FALSE);
 
-	return conboy_storage_plugin_note_save(self->plugin, note);
+	if (!conboy_storage_plugin_note_save(self->plugin, note)) {
+		return FALSE;
+	}
+
+	index_note(self, note);
+	return TRUE;
 }
 
 gboolean 
@@ -255,6 +482,7 @@ conboy_storage_note_delete (ConboyStorage *self, ConboyNote *note)
 
 	if (conboy_storage_plugin_note_delete(self->plugin, note)) {
 		/* TODO: Add filename to a files which tracks deleted files */
+		unindex_note(self, note->guid);
 		return TRUE;
 	} else {
 		return FALSE;
@@ -287,3 +515,149 @@ conboy_storage_note_list_ids (ConboyStorage *self)
 	return conboy_storage_plugin_note_list_ids(self->plugin);
 }
 
+void
+conboy_storage_sync (ConboyStorage *self)
+{
+	g_return_if_fail(self != NULL);
+	g_return_if_fail(CONBOY_IS_STORAGE(self));
+
+	if (self->plugin != NULL) {
+		conboy_storage_plugin_sync(self->plugin);
+	}
+}
+
+/**
+ * Lets the plugin search, see conboy_storage_plugin_search(). If it cannot
+ * search, our own index is used, which is built from notes, e.g. the ones
+ * of the note store. Returns FALSE if there is no plugin.
+ */
+gboolean
+conboy_storage_search (ConboyStorage *self, gchar **words, GList *notes, GHashTable *matches)
+{
+	g_return_val_if_fail(self != NULL, FALSE);
+	g_return_val_if_fail(CONBOY_IS_STORAGE(self), FALSE);
+	g_return_val_if_fail(matches != NULL, FALSE);
+
+	if (self->plugin == NULL) {
+		return FALSE;
+	}
+
+	if (conboy_storage_plugin_search(self->plugin, words, matches)) {
+		return TRUE;
+	}
+
+	g_static_rec_mutex_lock(&self->index_lock);
+	update_search_index(self, notes);
+	conboy_search_index_search(self->search_index, words, matches);
+	g_static_rec_mutex_unlock(&self->index_lock);
+	return TRUE;
+}
+
+
+/**
+ * Loads several notes at once, see conboy_storage_plugin_note_load_many().
+ * If the plugin cannot do that, the notes are loaded one by one.
+ */
+GSList*
+conboy_storage_note_load_many (ConboyStorage *self, GSList *guids)
+{
+	g_return_val_if_fail(self != NULL, NULL);
+	g_return_val_if_fail(CONBOY_IS_STORAGE(self), NULL);
+
+	g_return_val_if_fail(self->plugin != NULL, NULL);
+	g_return_val_if_fail(CONBOY_IS_STORAGE_PLUGIN(self->plugin), NULL);
+
+	GSList *result = NULL;
+	GSList *iter;
+
+	if (conboy_storage_plugin_has_load_many(self->plugin)) {
+		return conboy_storage_plugin_note_load_many(self->plugin, guids);
+	}
+
+	for (iter = guids; iter != NULL; iter = iter->next) {
+		ConboyNote *note = conboy_storage_plugin_note_load(self->plugin, iter->data);
+		if (note != NULL) {
+			result = g_slist_prepend(result, note);
+		}
+	}
+
+	return g_slist_reverse(result);
+}
+
+/**
+ * Saves several notes at once, see conboy_storage_plugin_note_save_many().
+ * If the plugin cannot do that, the notes are saved one by one. Then
+ * saving stops at the first failure, but notes saved before stay saved.
+ * Web sync calls this from its own thread, so the notes are only indexed
+ * on the next search.
+ */
+gboolean
+conboy_storage_note_save_many (ConboyStorage *self, GSList *notes)
+{
+	g_return_val_if_fail(self != NULL, FALSE);
+	g_return_val_if_fail(CONBOY_IS_STORAGE(self), FALSE);
+
+	g_return_val_if_fail(self->plugin != NULL, FALSE);
+	g_return_val_if_fail(CONBOY_IS_STORAGE_PLUGIN(self->plugin), FALSE);
+
+	GSList *iter;
+
+	if (notes == NULL) {
+		return TRUE;
+	}
+
+	if (conboy_storage_plugin_has_save_many(self->plugin)) {
+		if (!conboy_storage_plugin_note_save_many(self->plugin, notes)) {
+			return FALSE;
+		}
+		for (iter = notes; iter != NULL; iter = iter->next) {
+			invalidate_note(self, CONBOY_NOTE(iter->data)->guid);
+		}
+		return TRUE;
+	}
+
+	for (iter = notes; iter != NULL; iter = iter->next) {
+		if (!conboy_storage_plugin_note_save(self->plugin, CONBOY_NOTE(iter->data))) {
+			return FALSE;
+		}
+		invalidate_note(self, CONBOY_NOTE(iter->data)->guid);
+	}
+
+	return TRUE;
+}
+
+/**
+ * Returns the notes that changed after since, see
+ * conboy_storage_plugin_note_list_changed_since(). Falls back to
+ * filtering the list of all notes.
+ */
+GSList*
+conboy_storage_note_list_changed_since (ConboyStorage *self, time_t since)
+{
+	g_return_val_if_fail(self != NULL, NULL);
+	g_return_val_if_fail(CONBOY_IS_STORAGE(self), NULL);
+
+	g_return_val_if_fail(self->plugin != NULL, NULL);
+	g_return_val_if_fail(CONBOY_IS_STORAGE_PLUGIN(self->plugin), NULL);
+
+	GSList *notes;
+	GSList *result = NULL;
+	GSList *iter;
+
+	if (conboy_storage_plugin_has_list_changed_since(self->plugin)) {
+		return conboy_storage_plugin_note_list_changed_since(self->plugin, since);
+	}
+
+	notes = conboy_storage_plugin_note_list(self->plugin);
+	for (iter = notes; iter != NULL; iter = iter->next) {
+		ConboyNote *note = CONBOY_NOTE(iter->data);
+		if (note->last_change_date > since || note->last_metadata_change_date > since) {
+			result = g_slist_prepend(result, note);
+		} else {
+			g_object_unref(note);
+		}
+	}
+	g_slist_free(notes);
+
+	return g_slist_reverse(result);
+}
@@ -23,6 +23,7 @@
 #include <glib-object.h>
 #include "conboy_storage_plugin.h"
 #include "conboy_plugin_store.h"
+#include "conboy_search_index.h"
 
 /* convention macros */
 #define CONBOY_TYPE_STORAGE				(conboy_storage_get_type())
@@ -39,6 +40,11 @@ struct _ConboyStorage {
 	GObject parent;
 	ConboyStoragePlugin *plugin;
 	ConboyPluginStore *plugin_store;
+
+	/* Used if the plugin cannot search, built on the first search */
+	ConboySearchIndex *search_index;
+	GHashTable *unindexed; /* guids the plugin changed since */
+	GStaticRecMutex index_lock; /* Web sync saves notes from its own thread */
 };
 
 struct _ConboyStorageClass {
@@ -46,6 +52,11 @@ struct _ConboyStorageClass {
 	
 	void (*activated)	(ConboyStorage *storage);
 	void (*deactivated)	(ConboyStorage *storage);
+
+	/* Forwarded from the active plugin */
+	void (*note_added)		(ConboyStorage *storage, const gchar *guid);
+	void (*note_changed)	(ConboyStorage *storage, const gchar *guid);
+	void (*note_removed)	(ConboyStorage *storage, const gchar *guid);
 };
 
 GType			conboy_storage_get_type			(void);
@@ -56,6 +67,12 @@ gboolean		conboy_storage_note_save		(ConboyStorage *self, ConboyNote *note);
 gboolean		conboy_storage_note_delete		(ConboyStorage *self, ConboyNote *note);
 GSList*			conboy_storage_note_list		(ConboyStorage *self);
 GSList*			conboy_storage_note_list_ids	(ConboyStorage *self);
+void			conboy_storage_sync				(ConboyStorage *self);
+gboolean		conboy_storage_search			(ConboyStorage *self, gchar **words, GList *notes, GHashTable *matches);
+
+GSList*			conboy_storage_note_load_many	(ConboyStorage *self, GSList *guids);
+gboolean		conboy_storage_note_save_many	(ConboyStorage *self, GSList *notes);
+GSList*			conboy_storage_note_list_changed_since (ConboyStorage *self, time_t since);
 
 /*
 void					conboy_storage_set_plugin	(ConboyStorage *self, ConboyStoragePlugin *plugin);
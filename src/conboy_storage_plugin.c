@@ -21,6 +21,15 @@
 
 G_DEFINE_ABSTRACT_TYPE(ConboyStoragePlugin, conboy_storage_plugin, CONBOY_TYPE_PLUGIN)
 
+enum {
+	NOTE_ADDED,
+	NOTE_CHANGED,
+	NOTE_REMOVED,
+	LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL] = { 0 };
+
 
 /* GOBJECT ROUTINES */
 
@@ -38,6 +47,49 @@ conboy_storage_plugin_class_init (ConboyStoragePluginClass *klass)
 	klass->delete   = NULL;
 	klass->list     = NULL;
 	klass->list_ids = NULL;
+	klass->sync     = NULL;
+	klass->search   = NULL;
+	klass->has_cached_content = NULL;
+	klass->load_many    = NULL;
+	klass->save_many    = NULL;
+	klass->list_changed_since = NULL;
+
+	/*
+	 * Emitted by plugins that notice changes made by other programs.
+	 * The parameter is the guid of the note.
+	 */
+	signals[NOTE_ADDED] =
+		g_signal_new(
+				"note-added",
+				CONBOY_TYPE_STORAGE_PLUGIN,
+				G_SIGNAL_RUN_LAST,
+				G_STRUCT_OFFSET(ConboyStoragePluginClass, note_added),
+				NULL, NULL,
+				g_cclosure_marshal_VOID__STRING,
+				G_TYPE_NONE,
+				1, G_TYPE_STRING);
+
+	signals[NOTE_CHANGED] =
+		g_signal_new(
+				"note-changed",
+				CONBOY_TYPE_STORAGE_PLUGIN,
+				G_SIGNAL_RUN_LAST,
+				G_STRUCT_OFFSET(ConboyStoragePluginClass, note_changed),
+				NULL, NULL,
+				g_cclosure_marshal_VOID__STRING,
+				G_TYPE_NONE,
+				1, G_TYPE_STRING);
+
+	signals[NOTE_REMOVED] =
+		g_signal_new(
+				"note-removed",
+				CONBOY_TYPE_STORAGE_PLUGIN,
+				G_SIGNAL_RUN_LAST,
+				G_STRUCT_OFFSET(ConboyStoragePluginClass, note_removed),
+				NULL, NULL,
+				g_cclosure_marshal_VOID__STRING,
+				G_TYPE_NONE,
+				1, G_TYPE_STRING);
 }
 
 
@@ -76,3 +128,79 @@ conboy_storage_plugin_note_list_ids (ConboyStoragePlugin *self)
 	return CONBOY_STORAGE_PLUGIN_GET_CLASS(self)->list_ids(self);
 }
 
+void
+conboy_storage_plugin_sync (ConboyStoragePlugin *self)
+{
+	ConboyStoragePluginClass *klass = CONBOY_STORAGE_PLUGIN_GET_CLASS(self);
+	if (klass->sync != NULL) {
+		klass->sync(self);
+	}
+}
+
+gboolean
+conboy_storage_plugin_search (ConboyStoragePlugin *self, gchar **words, GHashTable *matches)
+{
+	ConboyStoragePluginClass *klass = CONBOY_STORAGE_PLUGIN_GET_CLASS(self);
+	if (klass->search == NULL) {
+		return FALSE;
+	}
+	return klass->search(self, words, matches);
+}
+
+gboolean
+conboy_storage_plugin_has_cached_content (ConboyStoragePlugin *self, const gchar *guid)
+{
+	ConboyStoragePluginClass *klass = CONBOY_STORAGE_PLUGIN_GET_CLASS(self);
+	if (klass->has_cached_content == NULL) {
+		return TRUE;
+	}
+	return klass->has_cached_content(self, guid);
+}
+
+gboolean
+conboy_storage_plugin_has_load_many (ConboyStoragePlugin *self)
+{
+	return CONBOY_STORAGE_PLUGIN_GET_CLASS(self)->load_many != NULL;
+}
+
+gboolean
+conboy_storage_plugin_has_save_many (ConboyStoragePlugin *self)
+{
+	return CONBOY_STORAGE_PLUGIN_GET_CLASS(self)->save_many != NULL;
+}
+
+gboolean
+conboy_storage_plugin_has_list_changed_since (ConboyStoragePlugin *self)
+{
+	return CONBOY_STORAGE_PLUGIN_GET_CLASS(self)->list_changed_since != NULL;
+}
+
+GSList*
+conboy_storage_plugin_note_load_many (ConboyStoragePlugin *self, GSList *guids)
+{
+	return CONBOY_STORAGE_PLUGIN_GET_CLASS(self)->load_many(self, guids);
+}
+
+gboolean
+conboy_storage_plugin_note_save_many (ConboyStoragePlugin *self, GSList *notes)
+{
+	return CONBOY_STORAGE_PLUGIN_GET_CLASS(self)->save_many(self, notes);
+}
+
+GSList*
+conboy_storage_plugin_note_list_changed_since (ConboyStoragePlugin *self, time_t since)
+{
+	return CONBOY_STORAGE_PLUGIN_GET_CLASS(self)->list_changed_since(self, since);
+}
+
+gchar*
+conboy_storage_plugin_get_notes_dir (void)
+{
+	const gchar *dir = g_getenv("CONBOY_NOTES_DIR");
+
+	if (dir != NULL && dir[0] != '\0') {
+		return g_strconcat(dir, G_DIR_SEPARATOR_S, NULL);
+	}
+
+	return g_strconcat(g_get_home_dir(), "/.conboy/", NULL);
+}
@@ -52,9 +52,17 @@ struct _ConboyStoragePluginClass {
 	gboolean		(*delete)	(ConboyStoragePlugin *self, ConboyNote *note);
 	GSList*			(*list)		(ConboyStoragePlugin *self);
 	GSList*			(*list_ids)	(ConboyStoragePlugin *self);
+	void			(*sync)		(ConboyStoragePlugin *self);
+	gboolean		(*search)	(ConboyStoragePlugin *self, gchar **words, GHashTable *matches);
+	gboolean		(*has_cached_content) (ConboyStoragePlugin *self, const gchar *guid);
+	GSList*			(*load_many)	(ConboyStoragePlugin *self, GSList *guids);
+	gboolean		(*save_many)	(ConboyStoragePlugin *self, GSList *notes);
+	GSList*			(*list_changed_since) (ConboyStoragePlugin *self, time_t since);
 	
 	/* signals */
-	
+	void			(*note_added)	(ConboyStoragePlugin *self, const gchar *guid);
+	void			(*note_changed)	(ConboyStoragePlugin *self, const gchar *guid);
+	void			(*note_removed)	(ConboyStoragePlugin *self, const gchar *guid);
 };
 
 GType			conboy_storage_plugin_get_type (void);
@@ -87,5 +95,62 @@ GSList*			conboy_storage_plugin_note_list (ConboyStoragePlugin *self);
  */
 GSList*			conboy_storage_plugin_note_list_ids (ConboyStoragePlugin *self);
 
+/**
+ * Blocks until all notes passed to conboy_storage_plugin_note_save() are
+ * written. Implementing this method is optional, plugins that save
+ * synchronously don't need it.
+ */
+void			conboy_storage_plugin_sync (ConboyStoragePlugin *self);
+
+/**
+ * Searches the content of all notes for the given words. For every note
+ * that contains all of them, the number of hits is inserted into matches,
+ * with the guid (newly allocated) as key. Returns FALSE if the plugin
+ * cannot search, then the caller has to search itself. Implementing this
+ * method is optional.
+ */
+gboolean		conboy_storage_plugin_search (ConboyStoragePlugin *self, gchar **words, GHashTable *matches);
+
+/**
+ * Returns TRUE if the content of the note can be loaded without waiting
+ * for a server. Implementing this method is optional, for plugins that
+ * keep all notes locally it is always TRUE.
+ */
+gboolean		conboy_storage_plugin_has_cached_content (ConboyStoragePlugin *self, const gchar *guid);
+
+/**
+ * Returns TRUE if the plugin implements conboy_storage_plugin_note_load_many(),
+ * conboy_storage_plugin_note_save_many() or
+ * conboy_storage_plugin_note_list_changed_since() itself. Otherwise the
+ * caller has to fall back to the single note methods, see ConboyStorage.
+ */
+gboolean		conboy_storage_plugin_has_load_many (ConboyStoragePlugin *self);
+gboolean		conboy_storage_plugin_has_save_many (ConboyStoragePlugin *self);
+gboolean		conboy_storage_plugin_has_list_changed_since (ConboyStoragePlugin *self);
+
+/**
+ * Loads all notes with the given GUIDs, in the same order. GUIDs that are
+ * not found are skipped. The list needs to be freed by the caller.
+ */
+GSList*			conboy_storage_plugin_note_load_many (ConboyStoragePlugin *self, GSList *guids);
+
+/**
+ * Saves all notes. Either all of them are saved or none is.
+ */
+gboolean		conboy_storage_plugin_note_save_many (ConboyStoragePlugin *self, GSList *notes);
+
+/**
+ * Like conboy_storage_plugin_note_list(), but only returns notes
+ * whose change or metadata change date is later than since.
+ */
+GSList*			conboy_storage_plugin_note_list_changed_since (ConboyStoragePlugin *self, time_t since);
+
+/**
+ * Returns the directory plugins keep their files in, with a trailing slash.
+ * That is ~/.conboy/ unless CONBOY_NOTES_DIR is set, e.g. by the benchmark.
+ * The string needs to be freed by the caller.
+ */
+gchar*			conboy_storage_plugin_get_notes_dir (void);
+
 
 #endif /* CONBOY_STORAGE_PLUGIN_H */
@@ -50,8 +50,30 @@ json_note_list_contains(JsonNoteList *list, const gchar *guid)
 	return FALSE;
 }
 
+/**
+ * Returns the guids of all notes the storage has changed since the last
+ * sync. The plugin only has to look at those notes, not at all of them.
+ */
+static GHashTable*
+web_sync_get_changed_guids(time_t last_sync_time)
+{
+	AppData *app_data = app_data_get();
+	GHashTable *result = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	GSList *notes = conboy_storage_note_list_changed_since(app_data->storage, last_sync_time);
+	GSList *iter;
+
+	for (iter = notes; iter != NULL; iter = iter->next) {
+		ConboyNote *note = CONBOY_NOTE(iter->data);
+		g_hash_table_insert(result, g_strdup(note->guid), GINT_TO_POINTER(TRUE));
+		g_object_unref(note);
+	}
+	g_slist_free(notes);
+
+	return result;
+}
+
 static gint
-web_sync_send_notes(GList *notes, gchar *url, JsonNoteList *all_server_notes, gint expected_rev, time_t last_sync_time, gint *uploaded_notes, GError **error)
+web_sync_send_notes(GList *notes, gchar *url, JsonNoteList *all_server_notes, gint expected_rev, GHashTable *changed_guids, gint *uploaded_notes, GError **error)
 {
 	/*
 	 * Create correct json structure to send the note
@@ -63,8 +85,7 @@ web_sync_send_notes(GList *notes, gchar *url, JsonNoteList *all_server_notes, gi
 		ConboyNote *note = CONBOY_NOTE(iter->data);
 		/* If the note has been changed since the last sync - send it */
 		/* If the note is not yet on the server sync it (even if it's change date is old, this can happen if you copy an old note into the conboy directory) */
-		if (note->last_metadata_change_date > last_sync_time
-				|| note->last_change_date > last_sync_time
+		if (g_hash_table_lookup(changed_guids, note->guid) != NULL
 				|| !json_note_list_contains(all_server_notes, note->guid)) {
 			g_printerr("Will send: %s\n", note->title);
 			JsonNode *note_node = json_get_node_from_note(note);
@@ -241,17 +262,21 @@ web_sync_incoming_changes(JsonUser *user, gint *last_sync_rev, time_t last_sync_
 	JsonNoteList *server_note_list = web_sync_get_notes(user, *last_sync_rev, TRUE, NULL);
 	*last_sync_rev = server_note_list->latest_sync_revision;
 
-	/* Save notes */
+	/* Update metadata change date and save all notes at once */
 	GSList *server_notes_iter = server_note_list->notes;
+	while (server_notes_iter != NULL) {
+		g_object_set(server_notes_iter->data, "metadata-change-date", time(NULL), NULL);
+		server_notes_iter = server_notes_iter->next;
+	}
+	if (!conboy_storage_note_save_many(app_data->storage, server_note_list->notes)) {
+		g_printerr("ERROR: Couldn't save the notes from the server\n");
+	}
+
+	server_notes_iter = server_note_list->notes;
 	while (server_notes_iter != NULL) {
 		ConboyNote *server_note = CONBOY_NOTE(server_notes_iter->data);
-		g_printerr("Saving: %s\n", server_note->title);
 		/* TODO: Check for title conflicts */
 
-		/* Update metadata change date and save */
-		g_object_set(server_note, "metadata-change-date", time(NULL), NULL);
-		conboy_storage_note_save(app_data->storage, server_note);
-
 		/* If not yet in the note store, add this note */
 		if (!conboy_note_store_find_by_guid(app_data->note_store, server_note->guid)) {
 			g_printerr("INFO: Adding note '%s' to note store\n", server_note->title);
@@ -677,9 +702,11 @@ web_sync_do_sync (gpointer *user_data)
 	 * Send them to the server
 	 */
 	gint uploaded_notes = 0;
+	GHashTable *changed_guids = web_sync_get_changed_guids(last_sync_time);
 
-	int sync_rev = web_sync_send_notes(local_changes, user->api_ref, all_server_notes, last_sync_rev + 1, last_sync_time, &uploaded_notes, &error);
+	int sync_rev = web_sync_send_notes(local_changes, user->api_ref, all_server_notes, last_sync_rev + 1, changed_guids, &uploaded_notes, &error);
 	web_sync_pulse_bar(bar);
+	g_hash_table_destroy(changed_guids);
 	g_list_free(local_changes);
 
 	gint deleted_on_server_count = 0;
@@ -0,0 +1,642 @@
+/*
+ * Copyright (C) 2009 Cornelius Hald <hald@icandy.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <glib/gstdio.h>
+#include <zlib.h>
+#include <libxml/parser.h>
+#include <libxml/parserInternals.h>
+#include <libxml/dict.h>
+#include <libxml/xmlwriter.h>
+
+#include "metadata.h"
+#include "conboy_xml_note.h"
+
+#define NOTE_CONTENT_START "<note-content"
+#define NOTE_CONTENT_END "</note-content>"
+
+typedef enum {
+	TAG_NOTE,
+	TAG_TITLE,
+	TAG_NOTE_CONTENT,
+	TAG_LAST_CHANGE_DATE,
+	TAG_LAST_METADATA_CHANGE_DATE,
+	TAG_CREATE_DATE,
+	TAG_CURSOR_POSITION,
+	TAG_WIDTH,
+	TAG_HEIGHT,
+	TAG_X,
+	TAG_Y,
+	TAG_OPEN_ON_STARTUP,
+	TAG_TAG,
+	N_TAGS,
+	TAG_UNKNOWN = N_TAGS
+} NoteTag;
+
+/* Indexed by NoteTag. <text> and <tags> are only containers, so we don't need them. */
+static const gchar *tag_names[N_TAGS] = {
+	"note",
+	"title",
+	"note-content",
+	"last-change-date",
+	"last-metadata-change-date",
+	"create-date",
+	"cursor-position",
+	"width",
+	"height",
+	"x",
+	"y",
+	"open-on-startup",
+	"tag"
+};
+
+typedef struct {
+	ConboyNote    *note;
+	/* tag_names interned in the dictionary of the parser. Names passed to
+	 * the SAX callbacks come from the same dictionary, so comparing
+	 * pointers is enough. */
+	const xmlChar *names[N_TAGS];
+	NoteTag        current;     /* leaf element whose text is collected */
+	GString       *text;
+	GString       *namespaces;  /* declarations of <note>, copied into the content */
+	gint           content_depth;
+} ParseState;
+
+
+static NoteTag
+lookup_tag (ParseState *state, const xmlChar *localname)
+{
+	guint i;
+	for (i = 0; i < N_TAGS; i++) {
+		if (state->names[i] == localname) {
+			return i;
+		}
+	}
+	return TAG_UNKNOWN;
+}
+
+static gdouble
+get_version_attribute (gint nb_attributes, const xmlChar **attributes)
+{
+	gint i;
+
+	/* Attributes come as (localname, prefix, URI, value, end) */
+	for (i = 0; i < nb_attributes; i++) {
+		const xmlChar **attr = attributes + i * 5;
+		if (attr[1] == NULL && strcmp((const gchar*) attr[0], "version") == 0) {
+			gchar *value = g_strndup((const gchar*) attr[3], attr[4] - attr[3]);
+			gdouble result = g_ascii_strtod(value, NULL);
+			g_free(value);
+			return result;
+		}
+	}
+
+	return -1;
+}
+
+static void
+on_start_element (void *ctx, const xmlChar *localname, const xmlChar *prefix,
+		const xmlChar *URI, int nb_namespaces, const xmlChar **namespaces,
+		int nb_attributes, int nb_defaulted, const xmlChar **attributes)
+{
+	ParseState *state = (ParseState*) ctx;
+	NoteTag tag;
+	gdouble version;
+	gint i;
+
+	/* Formatting inside of the content is not interesting here */
+	if (state->content_depth > 0) {
+		state->content_depth++;
+		return;
+	}
+
+	tag = lookup_tag(state, localname);
+
+	switch (tag) {
+
+	case TAG_NOTE:
+		version = get_version_attribute(nb_attributes, attributes);
+		if (version >= 0) {
+			g_object_set(state->note, "note-version", version, NULL);
+		} else {
+			g_printerr("ERROR: Couldn't parse note version.\n");
+		}
+
+		/* Namespaces come as (prefix, URI) */
+		for (i = 0; i < nb_namespaces; i++) {
+			const xmlChar *ns_prefix = namespaces[i * 2];
+			const xmlChar *ns_uri = namespaces[i * 2 + 1];
+			if (ns_prefix != NULL) {
+				g_string_append_printf(state->namespaces, " xmlns:%s=\"%s\"", ns_prefix, ns_uri);
+			} else {
+				g_string_append_printf(state->namespaces, " xmlns=\"%s\"", ns_uri);
+			}
+		}
+		break;
+
+	case TAG_NOTE_CONTENT:
+		version = get_version_attribute(nb_attributes, attributes);
+		if (version >= 0) {
+			g_object_set(state->note, "content-version", version, NULL);
+		} else {
+			g_printerr("ERROR: Couldn't parse content version.\n");
+		}
+		state->content_depth = 1;
+		break;
+
+	case TAG_UNKNOWN:
+		break;
+
+	default:
+		/* Leaf element, collect its text */
+		state->current = tag;
+		g_string_truncate(state->text, 0);
+		break;
+	}
+}
+
+static void
+on_end_element (void *ctx, const xmlChar *localname, const xmlChar *prefix, const xmlChar *URI)
+{
+	ParseState *state = (ParseState*) ctx;
+	ConboyNote *note = state->note;
+	const gchar *value = state->text->str;
+
+	if (state->content_depth > 0) {
+		state->content_depth--;
+		return;
+	}
+
+	if (state->current == TAG_UNKNOWN || lookup_tag(state, localname) != state->current) {
+		return;
+	}
+
+	switch (state->current) {
+
+	case TAG_TITLE:
+		g_object_set(note, "title", value, NULL);
+		break;
+
+	case TAG_LAST_CHANGE_DATE:
+		g_object_set(note, "change-date", get_iso8601_time_in_seconds(value), NULL);
+		break;
+
+	case TAG_LAST_METADATA_CHANGE_DATE:
+		g_object_set(note, "metadata-change-date", get_iso8601_time_in_seconds(value), NULL);
+		break;
+
+	case TAG_CREATE_DATE:
+		g_object_set(note, "create-date", get_iso8601_time_in_seconds(value), NULL);
+		break;
+
+	case TAG_CURSOR_POSITION:
+		g_object_set(note, "cursor-position", atoi(value), NULL);
+		break;
+
+	case TAG_WIDTH:
+		g_object_set(note, "width", atoi(value), NULL);
+		break;
+
+	case TAG_HEIGHT:
+		g_object_set(note, "height", atoi(value), NULL);
+		break;
+
+	case TAG_X:
+		g_object_set(note, "x", atoi(value), NULL);
+		break;
+
+	case TAG_Y:
+		g_object_set(note, "y", atoi(value), NULL);
+		break;
+
+	case TAG_OPEN_ON_STARTUP:
+		g_object_set(note, "open-on-startup", g_ascii_strcasecmp(value, "True") == 0, NULL);
+		break;
+
+	case TAG_TAG:
+		conboy_note_add_tag(note, value);
+		break;
+
+	default:
+		break;
+	}
+
+	state->current = TAG_UNKNOWN;
+}
+
+static void
+on_characters (void *ctx, const xmlChar *ch, int len)
+{
+	ParseState *state = (ParseState*) ctx;
+
+	if (state->current != TAG_UNKNOWN) {
+		g_string_append_len(state->text, (const gchar*) ch, len);
+	}
+}
+
+static void
+on_error (void *ctx, xmlErrorPtr error)
+{
+	/* Ignored, the caller reports files that could not be parsed */
+}
+
+/*
+ * Finds <note-content ...> and </note-content> in the raw file. Sets
+ * start to the beginning of the start tag, start_end behind it and end
+ * to the beginning of the end tag.
+ */
+static gboolean
+find_content (const gchar *data, gsize length, const gchar **start, const gchar **start_end, const gchar **end)
+{
+	*start = g_strstr_len(data, length, NOTE_CONTENT_START);
+	if (*start == NULL) {
+		return FALSE;
+	}
+
+	*start_end = memchr(*start, '>', data + length - *start);
+	if (*start_end == NULL) {
+		return FALSE;
+	}
+	(*start_end)++;
+
+	*end = g_strrstr_len(*start_end, data + length - *start_end, NOTE_CONTENT_END);
+	if (*end == NULL) {
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/*
+ * Builds the content from the raw bytes of the file. The namespace
+ * declarations of <note> are added to <note-content>, so that the
+ * result can be parsed on its own.
+ */
+static gchar*
+build_content (ParseState *state, const gchar *start, const gchar *end)
+{
+	gsize tag_length = strlen(NOTE_CONTENT_START);
+	gsize end_length = strlen(NOTE_CONTENT_END);
+	GString *content;
+
+	content = g_string_sized_new(end - start + end_length + state->namespaces->len + 1);
+	g_string_append_len(content, start, tag_length);
+	g_string_append_len(content, state->namespaces->str, state->namespaces->len);
+	g_string_append_len(content, start + tag_length, end - start - tag_length + end_length);
+
+	return g_string_free(content, FALSE);
+}
+
+ConboyNote*
+conboy_xml_note_parse_memory (const gchar *data, gsize length, const gchar *guid, gboolean with_content)
+{
+	g_return_val_if_fail(data != NULL, NULL);
+	g_return_val_if_fail(guid != NULL, NULL);
+
+	xmlSAXHandler sax;
+	xmlParserCtxt *ctxt;
+	ParseState state;
+	const gchar *start, *start_end, *end;
+	gboolean has_content;
+	gboolean well_formed;
+	guint i;
+
+	has_content = find_content(data, length, &start, &start_end, &end);
+
+	memset(&sax, 0, sizeof(xmlSAXHandler));
+	sax.initialized = XML_SAX2_MAGIC;
+	sax.startElementNs = on_start_element;
+	sax.endElementNs = on_end_element;
+	sax.characters = on_characters;
+	sax.serror = on_error;
+
+	ctxt = xmlCreatePushParserCtxt(&sax, &state, NULL, 0, guid);
+	if (ctxt == NULL) {
+		return NULL;
+	}
+	xmlCtxtUseOptions(ctxt, XML_PARSE_NONET);
+
+	state.note = conboy_note_new_with_guid(guid);
+	state.current = TAG_UNKNOWN;
+	state.text = g_string_sized_new(64);
+	state.namespaces = g_string_new(NULL);
+	state.content_depth = 0;
+	for (i = 0; i < N_TAGS; i++) {
+		state.names[i] = xmlDictLookup(ctxt->dict, BAD_CAST tag_names[i], -1);
+	}
+
+	if (has_content && !with_content) {
+		/* Leave out everything between <note-content> and </note-content> */
+		xmlParseChunk(ctxt, data, start_end - data, 0);
+		xmlParseChunk(ctxt, end, data + length - end, 1);
+	} else {
+		xmlParseChunk(ctxt, data, length, 1);
+	}
+
+	well_formed = ctxt->wellFormed;
+
+	if (well_formed && has_content && with_content) {
+		gchar *content = build_content(&state, start, end);
+		g_object_set(state.note, "content", content, NULL);
+		g_free(content);
+	}
+
+	xmlFreeParserCtxt(ctxt);
+	g_string_free(state.text, TRUE);
+	g_string_free(state.namespaces, TRUE);
+
+	if (!well_formed) {
+		g_object_unref(state.note);
+		return NULL;
+	}
+
+	return state.note;
+}
+
+/* Decompresses in chunks, the SAX parser needs the whole document anyway */
+static gboolean
+read_compressed_file (const gchar *filename, gchar **data, gsize *length)
+{
+	gchar buffer[16384];
+	GString *str;
+	gzFile file;
+	int read;
+
+	file = gzopen(filename, "rb");
+	if (file == NULL) {
+		return FALSE;
+	}
+
+	str = g_string_sized_new(sizeof(buffer));
+	while ((read = gzread(file, buffer, sizeof(buffer))) > 0) {
+		g_string_append_len(str, buffer, read);
+	}
+	gzclose(file);
+
+	if (read < 0) {
+		g_string_free(str, TRUE);
+		return FALSE;
+	}
+
+	*length = str->len;
+	*data = g_string_free(str, FALSE);
+	return TRUE;
+}
+
+gboolean
+conboy_xml_note_read_file (const gchar *filename, gchar **data, gsize *length)
+{
+	g_return_val_if_fail(filename != NULL, FALSE);
+
+	if (g_str_has_suffix(filename, CONBOY_XML_NOTE_COMPRESSED_SUFFIX)) {
+		return read_compressed_file(filename, data, length);
+	}
+	return g_file_get_contents(filename, data, length, NULL);
+}
+
+ConboyNote*
+conboy_xml_note_parse_file (const gchar *filename, const gchar *guid, gboolean with_content)
+{
+	g_return_val_if_fail(filename != NULL, NULL);
+	g_return_val_if_fail(guid != NULL, NULL);
+
+	ConboyNote *note;
+	gchar *data;
+	gsize length;
+
+	if (!conboy_xml_note_read_file(filename, &data, &length)) {
+		return NULL;
+	}
+
+	note = conboy_xml_note_parse_memory(data, length, guid, with_content);
+	g_free(data);
+
+	return note;
+}
+
+gchar*
+conboy_xml_note_find_file (const gchar *path, const gchar *guid, struct stat *file_stat)
+{
+	g_return_val_if_fail(path != NULL, NULL);
+	g_return_val_if_fail(guid != NULL, NULL);
+
+	gchar *plain = g_strconcat(path, guid, CONBOY_XML_NOTE_SUFFIX, NULL);
+	gchar *compressed = g_strconcat(path, guid, CONBOY_XML_NOTE_COMPRESSED_SUFFIX, NULL);
+	struct stat plain_stat, compressed_stat;
+	gboolean has_plain = g_stat(plain, &plain_stat) == 0;
+	gboolean has_compressed = g_stat(compressed, &compressed_stat) == 0;
+
+	if (has_compressed && (!has_plain || compressed_stat.st_mtime >= plain_stat.st_mtime)) {
+		*file_stat = compressed_stat;
+		g_free(plain);
+		return compressed;
+	}
+
+	g_free(compressed);
+	if (has_plain) {
+		*file_stat = plain_stat;
+		return plain;
+	}
+
+	g_free(plain);
+	return NULL;
+}
+
+gchar*
+conboy_xml_note_get_guid (const gchar *filename)
+{
+	g_return_val_if_fail(filename != NULL, NULL);
+
+	if (g_str_has_suffix(filename, CONBOY_XML_NOTE_SUFFIX)) {
+		return g_strndup(filename, strlen(filename) - strlen(CONBOY_XML_NOTE_SUFFIX));
+	}
+	if (g_str_has_suffix(filename, CONBOY_XML_NOTE_COMPRESSED_SUFFIX)) {
+		return g_strndup(filename, strlen(filename) - strlen(CONBOY_XML_NOTE_COMPRESSED_SUFFIX));
+	}
+	return NULL;
+}
+
+
+/*
+ * Writing
+ */
+
+static void
+write_header(xmlTextWriter *writer, ConboyNote *note)
+{
+	int rc;
+	gchar version[20];
+
+	/* Enable indentation */
+	rc = xmlTextWriterSetIndent(writer, TRUE);
+
+	/* Start document */
+	rc = xmlTextWriterStartDocument(writer, "1.0", "utf-8", NULL);
+
+	/* Start note element */
+	rc = xmlTextWriterStartElement(writer, BAD_CAST "note");
+
+	g_ascii_formatd(version, 20, "%.1f", note->note_version);
+	rc = xmlTextWriterWriteAttribute(writer, BAD_CAST "version", BAD_CAST &version);
+	rc = xmlTextWriterWriteAttributeNS(writer, BAD_CAST "xmlns", BAD_CAST "link", NULL, BAD_CAST "http://beatniksoftware.com/tomboy/link");
+	rc = xmlTextWriterWriteAttributeNS(writer, BAD_CAST "xmlns", BAD_CAST "size", NULL, BAD_CAST "http://beatniksoftware.com/tomboy/size");
+	rc = xmlTextWriterWriteAttributeNS(writer, NULL, BAD_CAST "xmlns", NULL, BAD_CAST "http://beatniksoftware.com/tomboy");
+
+	/* Title element */
+	rc = xmlTextWriterWriteElement(writer, BAD_CAST "title", BAD_CAST note->title);
+
+	/* Start text element */
+	rc = xmlTextWriterStartElement(writer, BAD_CAST "text");
+	rc = xmlTextWriterWriteAttributeNS(writer, BAD_CAST "xml", BAD_CAST "space", NULL, BAD_CAST "preserve");
+}
+
+static void
+write_footer(xmlTextWriter *writer, ConboyNote *note)
+{
+	int rc;
+	guint i;
+	gchar date[ISO8601_TIME_SIZE];
+
+	/* Enable indentation */
+	rc = xmlTextWriterSetIndent(writer, TRUE);
+
+	/* Meta data tags */
+	format_iso8601_time(note->last_change_date, date);
+	rc = xmlTextWriterWriteElement(writer, BAD_CAST "last-change-date", BAD_CAST date);
+	format_iso8601_time(note->last_metadata_change_date, date);
+	rc = xmlTextWriterWriteElement(writer, BAD_CAST "last-metadata-change-date", BAD_CAST date);
+	format_iso8601_time(note->create_date, date);
+	rc = xmlTextWriterWriteElement(writer, BAD_CAST "create-date", BAD_CAST date);
+	rc = xmlTextWriterWriteFormatElement(writer, BAD_CAST "cursor-position", "%i", note->cursor_position);
+	rc = xmlTextWriterWriteFormatElement(writer, BAD_CAST "width", "%i", note->width);
+	rc = xmlTextWriterWriteFormatElement(writer, BAD_CAST "height", "%i", note->height);
+	rc = xmlTextWriterWriteFormatElement(writer, BAD_CAST "x", "%i", note->x);
+	rc = xmlTextWriterWriteFormatElement(writer, BAD_CAST "y", "%i", note->y);
+
+	/* Write tags */
+	if (conboy_note_get_n_tags(note) > 0) {
+		rc = xmlTextWriterStartElement(writer, BAD_CAST "tags");
+		for (i = 0; i < conboy_note_get_n_tags(note); i++) {
+			const gchar *tag = conboy_note_get_tag(note, i);
+			rc = xmlTextWriterWriteElement(writer, BAD_CAST "tag", BAD_CAST tag);
+		}
+		rc = xmlTextWriterEndElement(writer);
+	}
+
+	if (note->open_on_startup == TRUE) {
+		rc = xmlTextWriterWriteFormatElement(writer, BAD_CAST "open-on-startup", "True");
+	} else {
+		rc = xmlTextWriterWriteFormatElement(writer, BAD_CAST "open-on-startup", "False");
+	}
+
+	/* End the document */
+	rc = xmlTextWriterEndDocument(writer);
+}
+
+/*
+ * Returns the end of a namespace declaration that starts at decl, or NULL
+ * if there is none. Same as the regex " xmlns(?:.*?)?=\".*?\"", but
+ * without compiling a regex for every save.
+ */
+static const gchar*
+find_namespace_end (const gchar *decl)
+{
+	const gchar *pos = decl + strlen(" xmlns");
+
+	/* Up to =" */
+	while (*pos != '\0' && *pos != '\n' && !(pos[0] == '=' && pos[1] == '"')) {
+		pos++;
+	}
+	if (*pos != '=') {
+		return NULL;
+	}
+
+	/* Up to the closing quote */
+	pos += 2;
+	while (*pos != '\0' && *pos != '\n' && *pos != '"') {
+		pos++;
+	}
+	if (*pos != '"') {
+		return NULL;
+	}
+
+	return pos + 1;
+}
+
+/*
+ * Writes the content and removes the redundant namespace declarations
+ * from it. Sadly libxml2 wont do that for us :(
+ * The content is passed through in chunks, it is never copied.
+ */
+static void
+write_content (xmlTextWriter *writer, const gchar *content)
+{
+	const gchar *chunk = content;
+	const gchar *decl = content;
+
+	if (content == NULL) {
+		return;
+	}
+
+	while ((decl = strstr(decl, " xmlns")) != NULL) {
+		const gchar *end = find_namespace_end(decl);
+		if (end == NULL) {
+			decl++;
+			continue;
+		}
+		if (decl > chunk) {
+			xmlTextWriterWriteRawLen(writer, BAD_CAST chunk, decl - chunk);
+		}
+		chunk = decl = end;
+	}
+
+	xmlTextWriterWriteRaw(writer, BAD_CAST chunk);
+}
+
+gboolean
+conboy_xml_note_write (ConboyNote *note, xmlOutputBuffer *buffer)
+{
+	g_return_val_if_fail(note != NULL, FALSE);
+	g_return_val_if_fail(buffer != NULL, FALSE);
+
+	xmlTextWriter *writer;
+
+	/* The writer takes ownership of the buffer */
+	writer = xmlNewTextWriter(buffer);
+	if (writer == NULL) {
+		g_printerr("ERROR: XmlWriter is NULL \n");
+		xmlOutputBufferClose(buffer);
+		return FALSE;
+	}
+
+	/* Write the complete header */
+	write_header(writer, note);
+
+	write_content(writer, conboy_note_get_content(note));
+
+	xmlTextWriterEndElement(writer); /*</text> */
+
+	/* Write the complete footer */
+	write_footer(writer, note);
+
+	/* Flushes the remaining output and closes the buffer */
+	xmlFreeTextWriter(writer);
+
+	return TRUE;
+}
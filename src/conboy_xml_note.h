@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2009 Cornelius Hald <hald@icandy.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef CONBOY_XML_NOTE_H
+#define CONBOY_XML_NOTE_H
+
+#include <glib.h>
+#include <sys/stat.h>
+#include <libxml/xmlIO.h>
+
+#include "conboy_note.h"
+
+/*
+ * Reading and writing of notes in the Tomboy .note format. Shared by
+ * the storage plugins.
+ */
+
+#define CONBOY_XML_NOTE_SUFFIX ".note"
+#define CONBOY_XML_NOTE_COMPRESSED_SUFFIX ".note.gz"
+
+/*
+ * Returns the file of the note in the directory path, which must end with
+ * a slash, either .note or .note.gz, and its stat. If both exist, e.g.
+ * after a crash while switching formats, the newer one is used. Returns
+ * NULL if there is no file.
+ */
+gchar*      conboy_xml_note_find_file    (const gchar *path, const gchar *guid, struct stat *file_stat);
+
+/*
+ * Returns the guid of a .note or .note.gz file name, or NULL for other files.
+ */
+gchar*      conboy_xml_note_get_guid     (const gchar *filename);
+
+/*
+ * Reads a .note file, .note.gz files are decompressed. Returns FALSE if
+ * the file could not be read.
+ */
+gboolean    conboy_xml_note_read_file    (const gchar *filename, gchar **data, gsize *length);
+
+/*
+ * SAX based parser for .note files, .note.gz files are decompressed
+ * first. Returns NULL if the file could not be read or is not well formed. If with_content is FALSE, the content
+ * of <note-content> is not parsed at all.
+ */
+ConboyNote* conboy_xml_note_parse_file   (const gchar *filename, const gchar *guid, gboolean with_content);
+ConboyNote* conboy_xml_note_parse_memory (const gchar *data, gsize length, const gchar *guid, gboolean with_content);
+
+/*
+ * Serializes the note into the buffer and closes the buffer. The
+ * content is streamed, it is never copied.
+ */
+gboolean    conboy_xml_note_write        (ConboyNote *note, xmlOutputBuffer *buffer);
+
+#endif /* CONBOY_XML_NOTE_H */
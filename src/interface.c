@@ -463,6 +463,66 @@ on_storage_deactivated (ConboyStorage *storage, UserInterface *ui)
 	gtk_widget_set_sensitive(GTK_WIDGET(ui->toolbar), FALSE);
 }
 
+/*
+ * The note store already has the new version of the note. Show it if it
+ * is the open note and the user did not start to edit it.
+ */
+static void
+on_storage_note_changed (ConboyStorage *storage, const gchar *guid, UserInterface *ui)
+{
+	if (ui->note == NULL || strcmp(ui->note->guid, guid) != 0) {
+		return;
+	}
+
+	if (gtk_text_buffer_get_modified(ui->buffer)) {
+		g_printerr("INFO: Note %s changed on disk, but has unsaved changes\n", guid);
+		return;
+	}
+
+	note_show(ui->note, FALSE, TRUE, FALSE);
+}
+
+static void
+on_storage_note_removed (ConboyStorage *storage, const gchar *guid, UserInterface *ui)
+{
+	AppData *app_data = app_data_get();
+	ConboyNote *note = conboy_note_store_find_by_guid(app_data->note_store, guid);
+	gboolean is_open;
+
+	if (note == NULL) {
+		return;
+	}
+
+	is_open = (ui->note == note);
+
+	/* Saving would bring the note back, so keep it */
+	if (is_open && gtk_text_buffer_get_modified(ui->buffer)) {
+		g_printerr("INFO: Note %s removed on disk, but has unsaved changes\n", guid);
+		return;
+	}
+
+	note_forget(note);
+
+	if (!is_open) {
+		return;
+	}
+
+	/* Show the previous note from the history or the latest one */
+	if (app_data->current_element != NULL) {
+		note = app_data->current_element->data;
+	} else {
+		note = conboy_note_store_get_latest(app_data->note_store);
+	}
+
+	ui->note = NULL;
+	if (note != NULL) {
+		note_show(note, FALSE, TRUE, FALSE);
+	} else {
+		gtk_text_buffer_set_text(ui->buffer, "", -1);
+		gtk_text_buffer_set_modified(ui->buffer, FALSE);
+	}
+}
+
 enum Icon {
 	ICON_DEC_INDENT,
 	ICON_INC_INDENT,
@@ -1304,6 +1364,13 @@ UserInterface* create_mainwin() {
 	g_signal_connect(storage, "deactivated",
 			G_CALLBACK(on_storage_deactivated), ui);
 
+	/* Listening to notes changed by other programs */
+	g_signal_connect(storage, "note-changed",
+			G_CALLBACK(on_storage_note_changed), ui);
+
+	g_signal_connect(storage, "note-removed",
+			G_CALLBACK(on_storage_note_removed), ui);
+
 
 	/* Listen to changes in the settings */
 	/* TODO: Use an array instead of the list */
@@ -1351,7 +1418,7 @@ UserInterface* create_mainwin() {
 void
 conboy_note_window_show_note(UserInterface *ui, ConboyNote *note)
 {
-	conboy_note_buffer_set_xml(CONBOY_NOTE_BUFFER(ui->buffer), note->content);
+	conboy_note_buffer_set_xml(CONBOY_NOTE_BUFFER(ui->buffer), conboy_note_get_content(note));
 	ui->note = note;
 }
 
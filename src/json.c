@@ -261,6 +261,7 @@ json_get_node_from_note(ConboyNote *note)
 	JsonNode *root;
 	JsonObject *obj;
 	JsonNode *node;
+	gchar date[ISO8601_TIME_SIZE];
 
 	root = json_node_new(JSON_NODE_OBJECT);
 	obj = json_object_new();
@@ -281,7 +282,7 @@ json_get_node_from_note(ConboyNote *note)
 	json_object_add_member(obj, JSON_TITLE, node);
 	g_free(esc_title);
 
-	gchar *content = convert_content(note->content);
+	gchar *content = convert_content(conboy_note_get_content(note));
 	node = json_node_new(JSON_NODE_VALUE);
 	json_node_set_string(node, content);
 	json_object_add_member(obj, JSON_NOTE_CONTENT, node);
@@ -294,15 +295,18 @@ json_get_node_from_note(ConboyNote *note)
 	json_object_add_member(obj, JSON_NOTE_CONTENT_VERSION, node);
 
 	node = json_node_new(JSON_NODE_VALUE);
-	json_node_set_string(node, get_time_in_seconds_as_iso8601(note->last_change_date));
+	format_iso8601_time(note->last_change_date, date);
+	json_node_set_string(node, date);
 	json_object_add_member(obj, JSON_LAST_CHANGE_DATE, node);
 
 	node = json_node_new(JSON_NODE_VALUE);
-	json_node_set_string(node, get_time_in_seconds_as_iso8601(note->last_metadata_change_date));
+	format_iso8601_time(note->last_metadata_change_date, date);
+	json_node_set_string(node, date);
 	json_object_add_member(obj, JSON_LAST_META_DATA_CHANGE_DATE, node);
 
 	node = json_node_new(JSON_NODE_VALUE);
-	json_node_set_string(node, get_time_in_seconds_as_iso8601(note->create_date));
+	format_iso8601_time(note->create_date, date);
+	json_node_set_string(node, date);
 	json_object_add_member(obj, JSON_CREATE_DATE, node);
 
 	node = json_node_new(JSON_NODE_VALUE);
@@ -314,15 +318,13 @@ json_get_node_from_note(ConboyNote *note)
 	json_object_add_member(obj, JSON_PINNED, node);
 
 
-	GList *tags = note->tags;
 	JsonArray *array = json_array_new();
+	guint i;
 
-	while (tags != NULL) {
-		gchar *tag = (gchar*)tags->data;
+	for (i = 0; i < conboy_note_get_n_tags(note); i++) {
 		node = json_node_new(JSON_NODE_VALUE);
-		json_node_set_string(node, tag);
+		json_node_set_string(node, conboy_note_get_tag(note, i));
 		json_array_add_element(array, node);
-		tags = tags->next;
 	}
 
 	node = json_node_new(JSON_NODE_ARRAY);
@@ -29,6 +29,7 @@
 #include "conboy_plugin_info.h"
 #include "conboy_plugin.h"
 #include "conboy_note_store.h"
+#include "conboy_storage.h"
 #include "orientation.h"
 
 
@@ -40,7 +41,11 @@
 static void cleanup()
 {
 	AppData *app_data = app_data_get();
-	gtk_list_store_clear(GTK_LIST_STORE(app_data->note_store));
+
+	/* Wait for pending writes */
+	conboy_storage_sync(app_data->storage);
+
+	conboy_note_store_clear(app_data->note_store);
 
 	/* Deinitialize OSSO */
 	osso_deinitialize(app_data->osso_ctx);
@@ -20,6 +20,7 @@
 #  include <config.h>
 #endif
 
+#include <string.h>
 #include <glib.h>
 #include <glib/gstdio.h>
 #include <sys/stat.h>
@@ -33,51 +34,53 @@
 
 
 /**
- * Returns the given time as iso8601 formatted string.
+ * Writes the given time as iso8601 formatted string into buffer, which
+ * must be at least ISO8601_TIME_SIZE bytes long.
  * Example: 2009-03-24T13:16:42.0000000+01:00
  *
  * This method is needed, because the glib function
  * g_time_val_to_iso8601() does only produce the short format without
  * milliseconds. E.g. 2009-04-17T13:14:52Z
  */
-const gchar* get_time_in_seconds_as_iso8601(time_t time_in_seconds) {
+void format_iso8601_time(time_t time_in_seconds, gchar *buffer) {
 
-	gchar      time_string[40];
-	gchar     *minutes;
-	gchar     *text_pointer;
-	struct tm *local_time;
-	gchar     *first_part;
-	gchar     *result;
+	struct tm local_time;
 
-	local_time = localtime(&time_in_seconds);
+	/* Reentrant, because notes are also written from a background thread */
+	localtime_r(&time_in_seconds, &local_time);
 
 	/* Milliseconds are always 0 and timezone is +0100 -> should be +01:00 */
-	strftime(time_string, 40, "%Y-%m-%dT%H:%M:%S.0000000%z", local_time);
-
-	/* Save minutes, add colon, add minutes */
-	text_pointer = (gchar*) &time_string;
-	text_pointer = text_pointer + 30;
+	strftime(buffer, ISO8601_TIME_SIZE, "%Y-%m-%dT%H:%M:%S.0000000%z", &local_time);
+
+	/* Move minutes one to the right and add the colon */
+	if (strlen(buffer) == 32) {
+		buffer[33] = '\0';
+		buffer[32] = buffer[31];
+		buffer[31] = buffer[30];
+		buffer[30] = ':';
+	}
+}
 
-	minutes = g_strndup(text_pointer, 2);
-	first_part = g_strndup(time_string, 30);
-	result = g_strconcat(first_part, ":", minutes, NULL);
+/**
+ * Returns the given time as iso8601 formatted string.
+ * Example: 2009-03-24T13:16:42.0000000+01:00
+ * The result must be freed with g_free().
+ */
+gchar* get_time_in_seconds_as_iso8601(time_t time_in_seconds) {
 
-	g_free(minutes);
-	g_free(first_part);
+	gchar time_string[ISO8601_TIME_SIZE];
 
-	return result;
+	format_iso8601_time(time_in_seconds, time_string);
+	return g_strdup(time_string);
 }
 
 
 /**
  * Returns the current time as string formattet as in iso8601.
  * Example: 2009-03-24T13:16:42.0000000+01:00
- *
- * This method is needed, because the glib function
- * g_time_val_to_iso8601() does only produce the short format without
- * milliseconds. E.g. 2009-04-17T13:14:52Z
+ * The result must be freed with g_free().
  */
-const gchar*
+gchar*
 get_current_time_in_iso8601() {
 	return get_time_in_seconds_as_iso8601(time(NULL));
 }
@@ -33,9 +33,14 @@ gboolean is_note_list_changed(void);
 
 GList* sort_note_list_by_change_date(GList* note_list);
 
-const gchar* get_current_time_in_iso8601(void);
+/* Size of a buffer for format_iso8601_time() */
+#define ISO8601_TIME_SIZE 40
 
-const gchar* get_time_in_seconds_as_iso8601(time_t time_in_seconds);
+void format_iso8601_time(time_t time_in_seconds, gchar *buffer);
+
+gchar* get_current_time_in_iso8601(void);
+
+gchar* get_time_in_seconds_as_iso8601(time_t time_in_seconds);
 
 time_t get_iso8601_time_in_seconds(const gchar *time_string);
 
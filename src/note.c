@@ -100,26 +100,31 @@ void note_set_window_title_from_buffer(GtkWindow *win, GtkTextBuffer *buffer)
 }
 
 
-static
-gboolean is_empty_str(const gchar* str)
+static gboolean
+is_not_space(gunichar ch, gpointer user_data)
 {
-	gchar *tmp;
+	return !g_unichar_isspace(ch);
+}
 
-	if (str == NULL) {
-		return TRUE;
-	}
+/*
+ * Returns TRUE if the buffer contains nothing but whitespace. Stops at
+ * the first other character instead of copying the whole text.
+ */
+static
+gboolean is_empty_buffer(GtkTextBuffer *buffer)
+{
+	GtkTextIter iter;
 
-	tmp = g_strdup(str);
-	g_strstrip(tmp);
+	gtk_text_buffer_get_start_iter(buffer, &iter);
 
-	if (strcmp(tmp, "") == 0) {
-		g_free(tmp);
+	if (gtk_text_iter_is_end(&iter)) {
 		return TRUE;
-	} else {
-		g_free(tmp);
+	}
+	if (!g_unichar_isspace(gtk_text_iter_get_char(&iter))) {
 		return FALSE;
 	}
 
+	return !gtk_text_iter_forward_find_char(&iter, is_not_space, NULL, NULL);
 }
 
 
@@ -128,25 +133,54 @@ void note_save(UserInterface *ui)
 	time_t time_in_s;
 	gchar* title;
 	gchar* content;
-	GtkTextIter iter, start, end;
+	const gchar *current;
+	GtkTextIter iter;
 	GtkTextMark *mark;
 	gint cursor_position;
 	AppData *app_data = app_data_get();
 	GtkTextBuffer *buffer = ui->buffer;
 	ConboyNote *note = ui->note;
 
+	/* If buffer is not dirty, don't save */
+	if (!gtk_text_buffer_get_modified(buffer)) {
+		return;
+	}
+
 	/* If note is empty, don't save */
-	gtk_text_buffer_get_bounds(buffer, &start, &end);
-	content = gtk_text_iter_get_text(&start, &end);
-	if (is_empty_str(content)) {
+	if (is_empty_buffer(buffer)) {
 		gtk_text_buffer_set_modified(buffer, FALSE);
+		return;
+	}
+
+	/* Serialize the buffer first, to find out whether anything changed */
+	content = conboy_note_buffer_get_xml(CONBOY_NOTE_BUFFER(buffer));
+
+	/** DEBUG **/
+	if (!g_str_has_suffix(content, "</note-content>\n")) {
+		g_printerr("WARN: Problem when saving:\n%s\n", content);
 		g_free(content);
+		content = NULL;
+
+		/* Get XML again. See wheter is's ok now */
+		content = conboy_note_buffer_get_xml(CONBOY_NOTE_BUFFER(buffer));
+		if (!g_str_has_suffix(content, "</note-content>\n")) {
+			g_printerr("ERROR: Second save NOT successful\n");
+		} else {
+			g_printerr("INFO: Second save successful\n");
+		}
+
+		gtk_text_buffer_set_modified(buffer, FALSE);
 		return;
 	}
-	g_free(content);
+	/****/
 
-	/* If buffer is not dirty, don't save */
-	if (!gtk_text_buffer_get_modified(buffer)) {
+	/* The edit was undone or only toggled formatting back and forth. Don't
+	 * touch the dates, otherwise web sync would upload the note again. */
+	current = conboy_note_get_content(note);
+	if (conboy_note_store_find(app_data->note_store, note)
+			&& current != NULL && strcmp(content, current) == 0) {
+		gtk_text_buffer_set_modified(buffer, FALSE);
+		g_free(content);
 		return;
 	}
 
@@ -200,28 +234,6 @@ void note_save(UserInterface *ui)
 		g_object_set(note, "y", 1, NULL);
 	}
 
-	/* Clear note content, then set it with fresh data from the text buffer */
-	content = conboy_note_buffer_get_xml(CONBOY_NOTE_BUFFER(buffer));
-
-	/** DEBUG **/
-	if (!g_str_has_suffix(content, "</note-content>\n")) {
-		g_printerr("WARN: Problem when saving:\n%s\n", content);
-		g_free(content);
-		content = NULL;
-
-		/* Get XML again. See wheter is's ok now */
-		content = conboy_note_buffer_get_xml(CONBOY_NOTE_BUFFER(buffer));
-		if (!g_str_has_suffix(content, "</note-content>\n")) {
-			g_printerr("ERROR: Second save NOT successful\n");
-		} else {
-			g_printerr("INFO: Second save successful\n");
-		}
-
-		gtk_text_buffer_set_modified(buffer, FALSE);
-		return;
-	}
-	/****/
-
 	g_object_set(note, "content", content, NULL);
 	g_free(content);
 
@@ -248,6 +260,17 @@ void note_delete(ConboyNote *note)
 		g_printerr("ERROR: The note with the guid %s could not be deleted \n", note->guid);
 	}
 
+	note_forget(note);
+}
+
+/**
+ * Removes the note from the note store and from the history and
+ * destroys it. Does not touch the storage.
+ */
+void note_forget(ConboyNote *note)
+{
+	AppData *app_data = app_data_get();
+
 	/* Remove from list store */
 	conboy_note_store_remove(CONBOY_NOTE_STORE(app_data->note_store), note);
 
@@ -34,6 +34,8 @@ void note_save(UserInterface *ui);
 
 void note_delete(ConboyNote *note);
 
+void note_forget(ConboyNote *note);
+
 gchar* note_extract_title_from_buffer(GtkTextBuffer *buffer);
 
 void note_show(ConboyNote *note, gboolean add_to_history, gboolean scroll, gboolean select_row);
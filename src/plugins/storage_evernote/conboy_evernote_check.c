@@ -0,0 +1,287 @@
+/*
+ * Copyright (C) 2009 Cornelius Hald <hald@icandy.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Checks the sync of the Evernote plugin against evernote-stub-server:
+ *
+ *   conboy-evernote-check ./evernote-stub-server src/plugins/storage_evernote/.libs/libstorageevernote.so
+ *
+ * The first sync has to page through all notes of the account and store
+ * the USN it reached. The server is then restarted with more notes and
+ * refuses to sync from older USNs, so the second sync only succeeds if
+ * it resumes from the stored USN. Works on a temporary directory, prints
+ * one PASS or FAIL line per check and exits with 1 if one failed.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "../../conboy_note.h"
+#include "../../conboy_plugin.h"
+#include "../../conboy_storage_plugin.h"
+
+/* Seconds to wait for a sync */
+#define SYNC_TIMEOUT 30
+
+static gint port    = 19800;
+static gint n_notes = 250; /* The plugin fetches 100 notes per chunk */
+
+static GOptionEntry entries[] = {
+	{ "port",  'p', 0, G_OPTION_ARG_INT, &port,    "Port for the stub server", "PORT" },
+	{ "notes", 'n', 0, G_OPTION_ARG_INT, &n_notes, "Number of notes on the server", "N" },
+	{ NULL }
+};
+
+static gboolean failed = FALSE;
+
+static void
+check (gboolean ok, const gchar *what)
+{
+	g_print("%s: %s\n", ok ? "PASS" : "FAIL", what);
+	if (!ok) {
+		failed = TRUE;
+	}
+}
+
+/* Starts the server and waits until it accepts connections. Returns 0 on failure. */
+static GPid
+start_server (const gchar *server, gint notes, gint min_usn)
+{
+	gchar *argv[8];
+	gchar *port_arg = g_strdup_printf("%i", port);
+	gchar *notes_arg = g_strdup_printf("%i", notes);
+	gchar *min_usn_arg = g_strdup_printf("%i", min_usn);
+	gchar line[64] = "";
+	GError *error = NULL;
+	GPid pid = 0;
+	gint out;
+	FILE *file;
+
+	argv[0] = (gchar*) server;
+	argv[1] = "--port";
+	argv[2] = port_arg;
+	argv[3] = "--notes";
+	argv[4] = notes_arg;
+	argv[5] = "--min-usn";
+	argv[6] = min_usn_arg;
+	argv[7] = NULL;
+
+	if (!g_spawn_async_with_pipes(NULL, argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD, NULL, NULL, &pid, NULL, &out, NULL, &error)) {
+		g_printerr("ERROR: Could not start %s: %s\n", server, error->message);
+		g_error_free(error);
+		pid = 0;
+	} else {
+		file = fdopen(out, "r");
+		if (fgets(line, sizeof(line), file) == NULL || strcmp(line, "READY\n") != 0) {
+			g_printerr("ERROR: %s did not start\n", server);
+			kill(pid, SIGTERM);
+			waitpid(pid, NULL, 0);
+			g_spawn_close_pid(pid);
+			pid = 0;
+		}
+		fclose(file);
+	}
+
+	g_free(min_usn_arg);
+	g_free(notes_arg);
+	g_free(port_arg);
+
+	return pid;
+}
+
+static void
+stop_server (GPid pid)
+{
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+	g_spawn_close_pid(pid);
+}
+
+static void
+free_strings (GSList *strings)
+{
+	g_slist_foreach(strings, (GFunc) g_free, NULL);
+	g_slist_free(strings);
+}
+
+/*
+ * Loads the plugin and waits until the sync brought it to expected notes.
+ * Unloading the plugin writes its state file. Returns the number of notes.
+ */
+static guint
+sync_plugin (const gchar *filename, guint expected, gboolean check_content)
+{
+	ConboyPlugin *plugin;
+	ConboyStoragePlugin *storage;
+	GTimer *timer;
+	GSList *ids;
+	guint count;
+
+	plugin = conboy_plugin_new_from_path((gchar*) filename);
+	if (plugin == NULL || !CONBOY_IS_STORAGE_PLUGIN(plugin)) {
+		g_printerr("ERROR: %s is not a storage plugin\n", filename);
+		if (plugin != NULL) {
+			g_object_unref(plugin);
+		}
+		return 0;
+	}
+	storage = CONBOY_STORAGE_PLUGIN(plugin);
+
+	/* Listing starts the sync on the sync thread */
+	ids = conboy_storage_plugin_note_list_ids(storage);
+	timer = g_timer_new();
+	while (g_slist_length(ids) < expected && g_timer_elapsed(timer, NULL) < SYNC_TIMEOUT) {
+		/* State changes and signals are handled in the main loop */
+		while (g_main_context_iteration(NULL, FALSE));
+		g_usleep(G_USEC_PER_SEC / 10);
+		free_strings(ids);
+		ids = conboy_storage_plugin_note_list_ids(storage);
+	}
+	g_timer_destroy(timer);
+	count = g_slist_length(ids);
+
+	if (check_content && ids != NULL) {
+		ConboyNote *note = conboy_storage_plugin_note_load(storage, ids->data);
+		const gchar *content = (note != NULL) ? conboy_note_get_content(note) : NULL;
+		check(content != NULL && strstr(content, "Stub note") != NULL, "Content is fetched with getNoteContent");
+		if (note != NULL) {
+			g_object_unref(note);
+		}
+	}
+
+	free_strings(ids);
+	g_object_unref(plugin);
+
+	return count;
+}
+
+/* The USN the plugin stored, or -1 */
+static gint
+read_usn (const gchar *dir)
+{
+	gchar *filename = g_build_filename(dir, "evernote", "state", NULL);
+	GKeyFile *file = g_key_file_new();
+	gint usn = -1;
+
+	if (g_key_file_load_from_file(file, filename, G_KEY_FILE_NONE, NULL)) {
+		usn = g_key_file_get_integer(file, "sync", "usn", NULL);
+	}
+
+	g_key_file_free(file);
+	g_free(filename);
+	return usn;
+}
+
+static void
+remove_dir (const gchar *path)
+{
+	GDir *dir = g_dir_open(path, 0, NULL);
+	const gchar *name;
+
+	if (dir != NULL) {
+		while ((name = g_dir_read_name(dir)) != NULL) {
+			gchar *file = g_build_filename(path, name, NULL);
+			if (g_file_test(file, G_FILE_TEST_IS_DIR)) {
+				remove_dir(file);
+			} else {
+				g_unlink(file);
+			}
+			g_free(file);
+		}
+		g_dir_close(dir);
+	}
+
+	g_rmdir(path);
+}
+
+int
+main (int argc, char *argv[])
+{
+	GOptionContext *context;
+	GError *error = NULL;
+	gchar *dir, *url;
+	GPid server;
+	guint count;
+
+	g_type_init();
+	if (!g_thread_supported()) {
+		g_thread_init(NULL);
+	}
+
+	context = g_option_context_new("SERVER PLUGIN.so - check the Evernote sync against a stub NoteStore");
+	g_option_context_add_main_entries(context, entries, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		g_printerr("ERROR: %s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(context);
+		return 1;
+	}
+	g_option_context_free(context);
+
+	if (argc != 3 || n_notes <= 0) {
+		g_printerr("ERROR: Give the stub server and the plugin, and at least one note\n");
+		return 1;
+	}
+
+	dir = g_build_filename(g_get_tmp_dir(), "conboy-evernote-XXXXXX", NULL);
+	if (mkdtemp(dir) == NULL) {
+		g_printerr("ERROR: Could not create temporary directory\n");
+		g_free(dir);
+		return 1;
+	}
+	url = g_strdup_printf("http://127.0.0.1:%i/", port);
+	g_setenv("CONBOY_NOTES_DIR", dir, TRUE);
+	g_setenv("CONBOY_EVERNOTE_URL", url, TRUE);
+	g_setenv("CONBOY_EVERNOTE_TOKEN", "stub", TRUE);
+
+	/* First sync, several chunks */
+	server = start_server(argv[1], n_notes, 0);
+	if (server != 0) {
+		count = sync_plugin(argv[2], n_notes, TRUE);
+		stop_server(server);
+		check(count == (guint) n_notes, "First sync pages through all notes");
+		check(read_usn(dir) == n_notes, "USN of the first sync is stored");
+	} else {
+		failed = TRUE;
+	}
+
+	/* Ten notes changed on the server, older USNs are refused */
+	server = start_server(argv[1], n_notes + 10, n_notes);
+	if (server != 0) {
+		count = sync_plugin(argv[2], n_notes + 10, FALSE);
+		stop_server(server);
+		check(count == (guint) n_notes + 10, "Second sync resumes from the stored USN");
+		check(read_usn(dir) == n_notes + 10, "USN of the second sync is stored");
+	} else {
+		failed = TRUE;
+	}
+
+	remove_dir(dir);
+	g_free(url);
+	g_free(dir);
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,377 @@
+/*
+ * Copyright (C) 2009 Piotr Pokora <piotrek.pokora@gmail.com>
+ * Copyright (C) 2009 Cornelius Hald <hald@icandy.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+
+#include <transport/THttpClient.h>
+#include <protocol/TBinaryProtocol.h>
+
+#include "evernote/NoteStore.h"
+#include "conboy_evernote_client.h"
+
+using boost::shared_ptr;
+using apache::thrift::TException;
+using apache::thrift::transport::TTransport;
+using apache::thrift::transport::THttpClient;
+using apache::thrift::protocol::TProtocol;
+using apache::thrift::protocol::TBinaryProtocol;
+using evernote::edam::NoteStoreClient;
+using evernote::edam::SyncChunk;
+
+struct _EvernoteClient {
+	shared_ptr<TTransport> transport;
+	NoteStoreClient *note_store;
+	std::string token;
+};
+
+/*
+ * Splits http://host[:port]/path. Only plain HTTP is supported by the
+ * bundled Thrift transports.
+ */
+static gboolean
+parse_url (const gchar *url, std::string &host, int &port, std::string &path)
+{
+	const gchar *start, *slash, *colon;
+
+	if (!g_str_has_prefix(url, "http://")) {
+		return FALSE;
+	}
+
+	start = url + strlen("http://");
+	slash = strchr(start, '/');
+	if (slash == NULL) {
+		slash = start + strlen(start);
+	}
+
+	colon = (const gchar*) memchr(start, ':', slash - start);
+	if (colon != NULL) {
+		host.assign(start, colon - start);
+		port = atoi(colon + 1);
+	} else {
+		host.assign(start, slash - start);
+		port = 80;
+	}
+	path = (*slash != '\0') ? slash : "/";
+
+	return !host.empty() && port > 0;
+}
+
+static time_t
+to_time_t (evernote::edam::Timestamp timestamp)
+{
+	/* Evernote timestamps are milliseconds */
+	return (time_t) (timestamp / 1000);
+}
+
+static void
+note_info_from_note (EvernoteNoteInfo *info, const evernote::edam::Note &note)
+{
+	info->guid    = g_strdup(note.guid.c_str());
+	info->title   = g_strdup(note.title.c_str());
+	info->created = to_time_t(note.created);
+	info->updated = to_time_t(note.updated);
+	info->usn     = note.updateSequenceNum;
+	info->active  = note.__isset.active ? note.active : TRUE;
+}
+
+static gboolean
+ensure_open (EvernoteClient *client)
+{
+	if (!client->transport->isOpen()) {
+		client->transport->open();
+	}
+	return TRUE;
+}
+
+/*
+ * Closes the connection after an error, so the next call starts over
+ * with a fresh one.
+ */
+static void
+handle_error (EvernoteClient *client, const gchar *what, const TException &e)
+{
+	g_printerr("ERROR: Evernote %s failed: %s\n", what, e.what());
+
+	try {
+		client->transport->close();
+	} catch (TException &) {
+		/* Nothing */
+	}
+}
+
+EvernoteClient*
+evernote_client_new (const gchar *url, const gchar *token)
+{
+	g_return_val_if_fail(url != NULL, NULL);
+	g_return_val_if_fail(token != NULL, NULL);
+
+	std::string host, path;
+	int port;
+
+	if (!parse_url(url, host, port, path)) {
+		g_printerr("ERROR: Unsupported Evernote NoteStore URL: %s\n", url);
+		return NULL;
+	}
+
+	EvernoteClient *client = new EvernoteClient;
+	client->transport = shared_ptr<TTransport>(new THttpClient(host, port, path));
+	shared_ptr<TProtocol> protocol(new TBinaryProtocol(client->transport));
+	client->note_store = new NoteStoreClient(protocol);
+	client->token = token;
+
+	return client;
+}
+
+void
+evernote_client_free (EvernoteClient *client)
+{
+	if (client == NULL) {
+		return;
+	}
+
+	try {
+		client->transport->close();
+	} catch (TException &) {
+		/* Nothing */
+	}
+
+	delete client->note_store;
+	delete client;
+}
+
+gboolean
+evernote_client_get_sync_chunk (EvernoteClient *client, gint32 after_usn, gint32 max_entries, EvernoteSyncChunk *chunk)
+{
+	g_return_val_if_fail(client != NULL, FALSE);
+	g_return_val_if_fail(chunk != NULL, FALSE);
+
+	SyncChunk result;
+	guint i;
+
+	memset(chunk, 0, sizeof(EvernoteSyncChunk));
+
+	try {
+		ensure_open(client);
+		client->note_store->getSyncChunk(result, client->token, after_usn, max_entries, false);
+	} catch (TException &e) {
+		handle_error(client, "getSyncChunk", e);
+		return FALSE;
+	}
+
+	/* Without chunkHighUSN there is nothing after after_usn */
+	chunk->high_usn = result.__isset.chunkHighUSN ? result.chunkHighUSN : result.updateCount;
+	chunk->update_count = result.updateCount;
+
+	for (i = 0; i < result.notes.size(); i++) {
+		EvernoteNoteInfo *info = g_new0(EvernoteNoteInfo, 1);
+		note_info_from_note(info, result.notes[i]);
+		chunk->notes = g_slist_prepend(chunk->notes, info);
+	}
+	chunk->notes = g_slist_reverse(chunk->notes);
+
+	for (i = 0; i < result.expungedNotes.size(); i++) {
+		chunk->expunged = g_slist_prepend(chunk->expunged, g_strdup(result.expungedNotes[i].c_str()));
+	}
+
+	return TRUE;
+}
+
+gchar*
+evernote_client_get_note_content (EvernoteClient *client, const gchar *guid)
+{
+	g_return_val_if_fail(client != NULL, NULL);
+	g_return_val_if_fail(guid != NULL, NULL);
+
+	std::string content;
+
+	try {
+		ensure_open(client);
+		client->note_store->getNoteContent(content, client->token, guid);
+	} catch (TException &e) {
+		handle_error(client, "getNoteContent", e);
+		return NULL;
+	}
+
+	return g_strndup(content.data(), content.size());
+}
+
+gboolean
+evernote_client_put_note (EvernoteClient *client, const gchar *guid, const gchar *title, const gchar *enml, EvernoteNoteInfo *result)
+{
+	g_return_val_if_fail(client != NULL, FALSE);
+	g_return_val_if_fail(title != NULL, FALSE);
+	g_return_val_if_fail(enml != NULL, FALSE);
+	g_return_val_if_fail(result != NULL, FALSE);
+
+	evernote::edam::Note note, stored;
+
+	note.title = title;
+	note.__isset.title = true;
+	note.content = enml;
+	note.__isset.content = true;
+
+	try {
+		ensure_open(client);
+		if (guid != NULL) {
+			note.guid = guid;
+			note.__isset.guid = true;
+			client->note_store->updateNote(stored, client->token, note);
+		} else {
+			client->note_store->createNote(stored, client->token, note);
+		}
+	} catch (TException &e) {
+		handle_error(client, guid != NULL ? "updateNote" : "createNote", e);
+		return FALSE;
+	}
+
+	note_info_from_note(result, stored);
+
+	return TRUE;
+}
+
+/* Returns the 16 byte binary form of a hex MD5 hash */
+static gboolean
+parse_hash (const gchar *hex, std::string &hash)
+{
+	guint i;
+
+	if (strlen(hex) != 32) {
+		return FALSE;
+	}
+
+	hash.clear();
+	for (i = 0; i < 32; i += 2) {
+		gint high = g_ascii_xdigit_value(hex[i]);
+		gint low = g_ascii_xdigit_value(hex[i + 1]);
+		if (high < 0 || low < 0) {
+			return FALSE;
+		}
+		hash.push_back((char) (high << 4 | low));
+	}
+
+	return TRUE;
+}
+
+gboolean
+evernote_client_save_resource (EvernoteClient *client, const gchar *note_guid, const gchar *hash, const gchar *filename)
+{
+	g_return_val_if_fail(client != NULL, FALSE);
+	g_return_val_if_fail(note_guid != NULL, FALSE);
+	g_return_val_if_fail(hash != NULL, FALSE);
+	g_return_val_if_fail(filename != NULL, FALSE);
+
+	evernote::edam::Resource resource;
+	std::string binary_hash;
+	GError *error = NULL;
+
+	if (!parse_hash(hash, binary_hash)) {
+		g_printerr("ERROR: Invalid resource hash: %s\n", hash);
+		return FALSE;
+	}
+
+	try {
+		ensure_open(client);
+		client->note_store->getResourceByHash(resource, client->token, note_guid, binary_hash, true, false, false);
+	} catch (TException &e) {
+		handle_error(client, "getResourceByHash", e);
+		return FALSE;
+	}
+
+	const std::string &body = resource.data.body;
+
+	if (resource.data.bodyHash != binary_hash || (gsize) resource.data.size != body.size()) {
+		g_printerr("ERROR: Resource %s arrived incomplete\n", hash);
+		return FALSE;
+	}
+
+	/* Written to a temporary file first, so the cache never has partial files */
+	if (!g_file_set_contents(filename, body.data(), body.size(), &error)) {
+		g_printerr("ERROR: Could not write %s: %s\n", filename, error->message);
+		g_error_free(error);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+gboolean
+evernote_client_delete_note (EvernoteClient *client, const gchar *guid, const gchar *title)
+{
+	g_return_val_if_fail(client != NULL, FALSE);
+	g_return_val_if_fail(guid != NULL, FALSE);
+
+	evernote::edam::Note note, stored;
+
+	/* This version of the API has no deleteNote(), inactive notes are in the trash */
+	note.guid = guid;
+	note.__isset.guid = true;
+	note.title = title != NULL ? title : "";
+	note.__isset.title = true;
+	note.active = false;
+	note.__isset.active = true;
+
+	try {
+		ensure_open(client);
+		client->note_store->updateNote(stored, client->token, note);
+	} catch (TException &e) {
+		handle_error(client, "updateNote", e);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+void
+evernote_note_info_clear (EvernoteNoteInfo *info)
+{
+	if (info == NULL) {
+		return;
+	}
+
+	g_free(info->guid);
+	g_free(info->title);
+	memset(info, 0, sizeof(EvernoteNoteInfo));
+}
+
+static void
+free_note_info (gpointer data, gpointer user_data)
+{
+	evernote_note_info_clear((EvernoteNoteInfo*) data);
+	g_free(data);
+}
+
+void
+evernote_sync_chunk_clear (EvernoteSyncChunk *chunk)
+{
+	if (chunk == NULL) {
+		return;
+	}
+
+	g_slist_foreach(chunk->notes, free_note_info, NULL);
+	g_slist_free(chunk->notes);
+
+	g_slist_foreach(chunk->expunged, (GFunc) g_free, NULL);
+	g_slist_free(chunk->expunged);
+
+	memset(chunk, 0, sizeof(EvernoteSyncChunk));
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2009 Piotr Pokora <piotrek.pokora@gmail.com>
+ * Copyright (C) 2009 Cornelius Hald <hald@icandy.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef CONBOY_EVERNOTE_CLIENT_H
+#define CONBOY_EVERNOTE_CLIENT_H
+
+#include <glib.h>
+#include <time.h>
+
+/*
+ * Thin C wrapper around the Thrift NoteStoreClient, so the plugin itself
+ * can stay C. The client talks plain HTTP to whatever NoteStore the url
+ * points to. That can be a local Thrift server implementing NoteStoreIf
+ * instead of the real service.
+ */
+
+G_BEGIN_DECLS
+
+typedef struct _EvernoteClient EvernoteClient;
+
+/* Metadata of a note. Sync chunks never contain the content. */
+typedef struct {
+	gchar   *guid;
+	gchar   *title;
+	time_t   created;
+	time_t   updated;
+	gint32   usn;
+	gboolean active;
+} EvernoteNoteInfo;
+
+typedef struct {
+	gint32  high_usn;     /* Highest USN in this chunk */
+	gint32  update_count; /* Highest USN of the whole account */
+	GSList *notes;        /* EvernoteNoteInfo* */
+	GSList *expunged;     /* gchar*, guids of expunged notes */
+} EvernoteSyncChunk;
+
+EvernoteClient*	evernote_client_new					(const gchar *url, const gchar *token);
+void			evernote_client_free				(EvernoteClient *client);
+
+/*
+ * Fetches the changes after after_usn. Returns FALSE if the server could
+ * not be reached, chunk is left empty then.
+ */
+gboolean		evernote_client_get_sync_chunk		(EvernoteClient *client, gint32 after_usn, gint32 max_entries, EvernoteSyncChunk *chunk);
+
+/* Returns the ENML content of the note or NULL. Free with g_free(). */
+gchar*			evernote_client_get_note_content	(EvernoteClient *client, const gchar *guid);
+
+/*
+ * Uploads a note. If guid is NULL, a new note is created. On success the
+ * metadata assigned by the server is stored in result.
+ */
+gboolean		evernote_client_put_note			(EvernoteClient *client, const gchar *guid, const gchar *title, const gchar *enml, EvernoteNoteInfo *result);
+
+/*
+ * Fetches the body of the resource with the given MD5 hash (hex) that
+ * belongs to the note and writes it to filename.
+ */
+gboolean		evernote_client_save_resource		(EvernoteClient *client, const gchar *note_guid, const gchar *hash, const gchar *filename);
+
+/* Moves the note to the trash of the account */
+gboolean		evernote_client_delete_note			(EvernoteClient *client, const gchar *guid, const gchar *title);
+
+void			evernote_note_info_clear			(EvernoteNoteInfo *info);
+void			evernote_sync_chunk_clear			(EvernoteSyncChunk *chunk);
+
+G_END_DECLS
+
+#endif /* CONBOY_EVERNOTE_CLIENT_H */
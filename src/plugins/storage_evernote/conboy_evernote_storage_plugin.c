@@ -17,391 +17,1460 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
+/*
+ * Storage backend that keeps a local copy of an Evernote account.
+ *
+ * The metadata of all notes lives in a GKeyFile together with the update
+ * sequence number (USN) the copy is in sync with. Changes are pulled
+ * incrementally with getSyncChunk(), so only notes that changed on the
+ * server since the last USN are touched. Note bodies are not part of
+ * sync chunks, they are fetched with getNoteContent() the first time a
+ * note is opened and then cached next to the state file.
+ *
+ * Saving and deleting only mark the note as changed. Uploads and the
+ * periodic pull run on a sync thread, and the signals about notes that
+ * changed on the server are emitted from the main loop.
+ *
+ * Attachments (resources) are cached by the MD5 hash of their body, which
+ * is also how ENML refers to them. A resource shared by several notes is
+ * stored once and only downloaded if its hash is not in the cache yet.
+ * Inside the note it becomes a file:// link to the cached file. Opening
+ * a note only waits for its body, the resources are downloaded on the
+ * sync thread afterwards.
+ *
+ * Set CONBOY_EVERNOTE_URL and CONBOY_EVERNOTE_TOKEN to point the plugin
+ * to a local Thrift NoteStore instead of the configured one, e.g. to
+ * evernote-stub-server, which "make check-evernote" uses.
+ */
+
+#include <string.h>
+#include <glib/gstdio.h>
+#include <gtk/gtk.h>
+
 #include "../../conboy_note.h"
 #include "../../conboy_storage_plugin.h"
+#include "../../localisation.h"
+#include "../../settings.h"
 #include "conboy_evernote_storage_plugin.h"
 
-#define CONBOY_EVERNOTE_NOTE_NAME "org_gnome_tomboy_note"
+#define STATE_FILE      "state"
+#define STATE_GROUP     "sync"
+#define RESOURCE_GROUP  "resources"
+#define RESOURCE_DIR    "resources"
+#define DEFAULT_MIME    "application/octet-stream"
+#define CONTENT_SUFFIX  ".content"
+#define SYNC_CHUNK_SIZE 100
+#define SYNC_INTERVAL   (15 * 60 * 1000)
+
+/* Work for the sync thread */
+#define JOB_PUSH GINT_TO_POINTER(1)
+#define JOB_PULL GINT_TO_POINTER(2)
+#define JOB_FETCH GINT_TO_POINTER(3)
 
-//static EvernoteConnection *mgd_global = NULL;
+#define ENML_HEADER \
+	"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n" \
+	"<!DOCTYPE en-note SYSTEM \"http://xml.evernote.com/pub/enml2.dtd\">\n" \
+	"<en-note>"
+#define ENML_FOOTER "</en-note>"
 
 G_DEFINE_TYPE(ConboyEvernoteStoragePlugin, conboy_evernote_storage_plugin, CONBOY_TYPE_STORAGE_PLUGIN);
 
-static ConboyNote *
-__conboy_note_from_evernote_object ()
-{
-//	g_return_val_if_fail (mgdobject != NULL, NULL);
-//
-//	gchar *guid = NULL;
-//	gchar *content = NULL;
-//	gchar *title = NULL;
-//
-//	g_object_get (mgdobject,
-//			"guid", &guid,
-//			"title", &title,
-//			"text", &content, NULL);
-//
-//	/* Create new conboy instance */
-//	ConboyNote *note = conboy_note_new();
-//
-//	/* and copy properties */
-//	g_object_set (note,
-//			"guid", guid,
-//			"title", title,
-//			"content", content, NULL);
-//
-//	g_free (guid);
-//	g_free (content);
-//	g_free (title);
-//
-//	return note;
+/* What we know about a note without loading it */
+typedef struct {
+	gchar    *guid;    /* Local guid */
+	gchar    *remote;  /* Evernote guid, NULL until the note was uploaded */
+	gchar    *title;
+	time_t    created;
+	time_t    updated;
+	gint32    usn;
+	gboolean  dirty;   /* Changed locally, but not uploaded yet */
+	gboolean  deleted; /* Deleted locally, but not on the server yet */
+	guint     revision; /* Counts local changes, not stored */
+} NoteEntry;
+
+/* A resource to download, see JOB_FETCH */
+typedef struct {
+	gchar *remote;  /* Evernote guid of the note */
+	gchar *hash;
+} ResourceFetch;
+
+static void
+resource_fetch_free (ResourceFetch *fetch)
+{
+	g_free(fetch->remote);
+	g_free(fetch->hash);
+	g_free(fetch);
+}
+
+static void
+note_entry_free (NoteEntry *entry)
+{
+	g_free(entry->guid);
+	g_free(entry->remote);
+	g_free(entry->title);
+	g_free(entry);
+}
+
+static gchar*
+get_content_file (ConboyEvernoteStoragePlugin *self, const gchar *guid)
+{
+	return g_strconcat(self->path, guid, CONTENT_SUFFIX, NULL);
+}
+
+/* The caller holds client_lock */
+static EvernoteClient*
+get_client (ConboyEvernoteStoragePlugin *self)
+{
+	if (self->client == NULL && self->url != NULL && self->url[0] != '\0'
+			&& self->token != NULL && self->token[0] != '\0') {
+		self->client = evernote_client_new(self->url, self->token);
+	}
+	return self->client;
+}
 
+
+static void schedule_save_state (ConboyEvernoteStoragePlugin *self);
+
+/*
+ * Conversion between ENML and Tomboy note content. Only line breaks and
+ * simple formatting survive, everything else is reduced to its text.
+ */
+
+static const gchar*
+tomboy_to_enml_tag (const gchar *name, gsize length)
+{
+	if (length == 4 && strncmp(name, "bold", 4) == 0) {
+		return "b";
+	} else if (length == 6 && strncmp(name, "italic", 6) == 0) {
+		return "i";
+	} else if (length == 13 && strncmp(name, "strikethrough", 13) == 0) {
+		return "s";
+	}
 	return NULL;
 }
 
-static ConboyNote*
-_conboy_evernote_storage_plugin_note_load (ConboyStoragePlugin *self, const gchar *uuid)
-{
-	g_printerr("In _conboy_evernote_storage_plugin_note_load\n");
-
-//	g_return_val_if_fail(self != NULL, FALSE);
-//	g_return_val_if_fail(uuid != NULL, FALSE);
-//
-//	g_return_val_if_fail(CONBOY_IS_MIDGARD_STORAGE_PLUGIN(self), FALSE);
-//
-//	/* Get Evernote object and its properties */
-//	GValue gval = {0, };
-//	g_value_init (&gval, G_TYPE_STRING);
-//
-//	if (uuid) g_value_set_string (&gval, uuid);
-//
-//	EvernoteObject *mgdobject = evernote_object_new (mgd_global, CONBOY_MIDGARD_NOTE_NAME, uuid ? &gval : NULL);
-//
-//	g_value_unset (&gval);
-//
-//	/* Create new conboy instance */
-//	ConboyNote *note = __conboy_note_from_evernote_object (mgdobject);
-//
-//	CONBOY_MIDGARD_STORAGE_PLUGIN (self)->object = mgdobject;
-
-	return (ConboyNote *)NULL;
+static const gchar*
+enml_to_tomboy_tag (const gchar *name, gsize length)
+{
+	if ((length == 1 && name[0] == 'b') || (length == 6 && g_ascii_strncasecmp(name, "strong", 6) == 0)) {
+		return "bold";
+	} else if ((length == 1 && name[0] == 'i') || (length == 2 && g_ascii_strncasecmp(name, "em", 2) == 0)) {
+		return "italic";
+	} else if ((length == 1 && name[0] == 's') || (length == 6 && g_ascii_strncasecmp(name, "strike", 6) == 0)
+			|| (length == 3 && g_ascii_strncasecmp(name, "del", 3) == 0)) {
+		return "strikethrough";
+	}
+	return NULL;
+}
+
+/* MD5 hashes in hex. Anything else must not end up in a file name. */
+static gboolean
+is_resource_hash (const gchar *hash)
+{
+	guint i;
+
+	for (i = 0; i < 32; i++) {
+		if (!g_ascii_isxdigit(hash[i])) {
+			return FALSE;
+		}
+	}
+	return hash[32] == '\0';
+}
+
+/* Returns the value of the attribute inside the tag that ends at close */
+static gchar*
+get_attribute (const gchar *tag, const gchar *close, const gchar *name)
+{
+	gsize length = strlen(name);
+	const gchar *pos = tag;
+
+	while ((pos = strstr(pos, name)) != NULL && pos < close) {
+		const gchar *value = pos + length;
+		gchar quote;
+
+		if (!g_ascii_isspace(pos[-1]) || *value != '=') {
+			pos = value;
+			continue;
+		}
+		quote = value[1];
+		if (quote == '"' || quote == '\'') {
+			const gchar *value_end = strchr(value + 2, quote);
+			if (value_end != NULL && value_end < close) {
+				return g_strndup(value + 2, value_end - value - 2);
+			}
+		}
+		return NULL;
+	}
+	return NULL;
+}
+
+/* The escaped file:// url of the cache file of a resource */
+static gchar*
+get_resource_url (ConboyEvernoteStoragePlugin *self, const gchar *hash)
+{
+	gchar *url = g_strconcat("file://", self->resource_path, hash, NULL);
+	gchar *escaped = g_markup_escape_text(url, -1);
+	g_free(url);
+	return escaped;
 }
 
+/* Block elements that end a line */
 static gboolean
-_conboy_evernote_storage_plugin_note_save (ConboyStoragePlugin *self, ConboyNote *note)
-{
-	g_printerr("In _conboy_evernote_storage_plugin_note_save\n");
-
-//	g_return_val_if_fail(self != NULL, FALSE);
-//	g_return_val_if_fail(note != NULL, FALSE);
-//
-//	g_return_val_if_fail(CONBOY_IS_MIDGARD_STORAGE_PLUGIN(self), FALSE);
-//	g_return_val_if_fail(CONBOY_IS_NOTE(note), FALSE);
-//
-//	EvernoteObject *mgdobject = CONBOY_MIDGARD_STORAGE_PLUGIN (self)->object;
-//
-//	gchar *guid = NULL;
-//	gchar *title = NULL;
-//	gchar *content = NULL;
-//
-//	/* Get note properties */
-//	g_object_get (note,
-//			"title", &title,
-//			"content", &content, NULL);
-//
-//	/* Set Evernote object properties */
-//	g_object_set (mgdobject,
-//			"title", title,
-//			"text", content, NULL);
-//
-//	g_free (title);
-//	g_free (content);
-//
-//	/* Get guid to check if to create or update */
-//	g_object_get (mgdobject, "guid", &guid, NULL);
-//
-//	gboolean created = FALSE;
-//	/* Create case */
-//	if (!guid || (guid && *guid == '\0')) {
-//
-//		created = evernote_object_create (mgdobject);
-//
-//		g_free (guid);
-//
-//		if (created) {
-//
-//			g_object_get (mgdobject, "guid", &guid, NULL);
-//			g_object_set (note, "guid", guid, NULL);
-//			g_free (guid);
-//
-//			return TRUE;
-//		}
-//
-//		return FALSE;
-//	}
-//
-//	return evernote_object_update (mgdobject);
+is_block_tag (const gchar *name, gsize length)
+{
+	static const gchar *blocks[] = { "div", "p", "li", "tr", "h1", "h2", "h3", "h4", "h5", "h6", "blockquote", NULL };
+	guint i;
+
+	for (i = 0; blocks[i] != NULL; i++) {
+		if (strlen(blocks[i]) == length && g_ascii_strncasecmp(name, blocks[i], length) == 0) {
+			return TRUE;
+		}
+	}
 	return FALSE;
 }
 
+/*
+ * Converts Tomboy note content to ENML. The first line is the title,
+ * which Evernote stores separately. The caller holds lock.
+ */
+static gchar*
+content_to_enml (ConboyEvernoteStoragePlugin *self, const gchar *content)
+{
+	GString *enml = g_string_new(ENML_HEADER);
+	gchar *prefix = get_resource_url(self, "");
+	gsize prefix_length = strlen(prefix);
+	const gchar *pos = content;
+	const gchar *end;
+
+	/* Skip <note-content ...> and the title */
+	if (g_str_has_prefix(pos, "<note-content")) {
+		pos = strchr(pos, '>');
+		pos = (pos != NULL) ? pos + 1 : content;
+	}
+	end = strstr(pos, "</note-content>");
+	if (end == NULL) {
+		end = pos + strlen(pos);
+	}
+	while (pos < end && *pos != '\n') {
+		pos++;
+	}
+	if (pos < end) {
+		pos++;
+	}
+
+	while (pos < end) {
+		if (*pos == '<') {
+			const gchar *close = strchr(pos, '>');
+			const gchar *name = pos + 1;
+			gboolean closing = (*name == '/');
+			const gchar *tag;
+			gsize length;
+
+			if (close == NULL || close > end) {
+				break;
+			}
+			if (closing) {
+				name++;
+			}
+			length = strcspn(name, " />");
+
+			/* Links to cached resources become <en-media/> again */
+			if (!closing && length == 8 && strncmp(name, "link:url", 8) == 0
+					&& strncmp(close + 1, prefix, prefix_length) == 0) {
+				const gchar *hash_start = close + 1 + prefix_length;
+				if (strspn(hash_start, "0123456789abcdefABCDEF") == 32
+						&& g_str_has_prefix(hash_start + 32, "</link:url>")) {
+					gchar *hash = g_strndup(hash_start, 32);
+					const gchar *type = g_hash_table_lookup(self->resource_types, hash);
+					g_string_append_printf(enml, "<en-media hash=\"%s\" type=\"%s\"/>",
+							hash, type != NULL ? type : DEFAULT_MIME);
+					g_free(hash);
+					pos = hash_start + 32 + strlen("</link:url>");
+					continue;
+				}
+			}
+
+			tag = tomboy_to_enml_tag(name, length);
+			if (tag != NULL && close[-1] != '/') {
+				g_string_append_printf(enml, closing ? "</%s>" : "<%s>", tag);
+			}
+			pos = close + 1;
+		} else if (*pos == '\n') {
+			g_string_append(enml, "<br/>");
+			pos++;
+		} else {
+			g_string_append_c(enml, *pos);
+			pos++;
+		}
+	}
+
+	g_string_append(enml, ENML_FOOTER);
+	g_free(prefix);
+	return g_string_free(enml, FALSE);
+}
+
+/*
+ * Converts ENML to Tomboy note content with the title as first line. The
+ * hashes of all resources the note refers to are added to resources.
+ * The caller holds lock.
+ */
+static gchar*
+enml_to_content (ConboyEvernoteStoragePlugin *self, const gchar *title, const gchar *enml, GSList **resources)
+{
+	GString *content = g_string_new("<note-content version=\"0.1\">");
+	gchar *escaped = g_markup_escape_text(title != NULL ? title : "", -1);
+	const gchar *pos, *end;
+
+	g_string_append(content, escaped);
+	g_string_append_c(content, '\n');
+	g_free(escaped);
+
+	pos = strstr(enml, "<en-note");
+	if (pos != NULL) {
+		pos = strchr(pos, '>');
+	}
+	pos = (pos != NULL) ? pos + 1 : enml;
+	end = strstr(pos, ENML_FOOTER);
+	if (end == NULL) {
+		end = pos + strlen(pos);
+	}
+
+	while (pos < end) {
+		if (g_str_has_prefix(pos, "<!--")) {
+			const gchar *close = strstr(pos, "-->");
+			pos = (close != NULL) ? close + 3 : end;
+		} else if (*pos == '<') {
+			const gchar *close = strchr(pos, '>');
+			const gchar *name = pos + 1;
+			gboolean closing = (*name == '/');
+			gboolean empty;
+			const gchar *tag;
+			gsize length;
+
+			if (close == NULL || close > end) {
+				break;
+			}
+			if (closing) {
+				name++;
+			}
+			empty = (close[-1] == '/');
+			length = strcspn(name, " \t\n/>");
+
+			if (!closing && length == 8 && g_ascii_strncasecmp(name, "en-media", 8) == 0) {
+				gchar *hash = get_attribute(name, close, "hash");
+				gchar *type = get_attribute(name, close, "type");
+
+				if (hash != NULL && is_resource_hash(hash)) {
+					gchar *lower = g_ascii_strdown(hash, -1);
+					gchar *url, *known;
+
+					g_free(hash);
+					hash = lower;
+					url = get_resource_url(self, hash);
+					g_string_append_printf(content, "<link:url>%s</link:url>", url);
+					g_free(url);
+
+					known = g_hash_table_lookup(self->resource_types, hash);
+					if (type != NULL && (known == NULL || strcmp(known, type) != 0)) {
+						g_hash_table_insert(self->resource_types, g_strdup(hash), g_strdup(type));
+						schedule_save_state(self);
+					}
+					*resources = g_slist_prepend(*resources, hash);
+					hash = NULL;
+				}
+				g_free(hash);
+				g_free(type);
+			} else if (length == 2 && g_ascii_strncasecmp(name, "br", 2) == 0) {
+				g_string_append_c(content, '\n');
+			} else if (closing && is_block_tag(name, length)) {
+				g_string_append_c(content, '\n');
+			} else if (!empty && (tag = enml_to_tomboy_tag(name, length)) != NULL) {
+				g_string_append_printf(content, closing ? "</%s>" : "<%s>", tag);
+			}
+			pos = close + 1;
+		} else if (*pos == '&') {
+			const gchar *semicolon = strchr(pos, ';');
+			gsize length = (semicolon != NULL) ? (gsize) (semicolon - pos + 1) : 0;
+
+			if (length == 0 || length > 10) {
+				g_string_append(content, "&amp;");
+				pos++;
+				continue;
+			}
+
+			/* Only the XML entities are allowed in Tomboy notes */
+			if (strncmp(pos, "&nbsp;", length) == 0) {
+				g_string_append_c(content, ' ');
+			} else if (pos[1] == '#' || strncmp(pos, "&amp;", length) == 0 || strncmp(pos, "&lt;", length) == 0
+					|| strncmp(pos, "&gt;", length) == 0 || strncmp(pos, "&quot;", length) == 0
+					|| strncmp(pos, "&apos;", length) == 0) {
+				g_string_append_len(content, pos, length);
+			}
+			pos += length;
+		} else {
+			g_string_append_c(content, *pos);
+			pos++;
+		}
+	}
+
+	g_string_append(content, "</note-content>");
+	return g_string_free(content, FALSE);
+}
+
+
+/*
+ * State file
+ */
+
+static void
+load_state (ConboyEvernoteStoragePlugin *self)
+{
+	gchar *filename = g_strconcat(self->path, STATE_FILE, NULL);
+	GKeyFile *file = g_key_file_new();
+	gchar **groups;
+	guint i;
+
+	if (!g_key_file_load_from_file(file, filename, G_KEY_FILE_NONE, NULL)) {
+		g_key_file_free(file);
+		g_free(filename);
+		return;
+	}
+
+	self->usn = g_key_file_get_integer(file, STATE_GROUP, "usn", NULL);
+
+	groups = g_key_file_get_keys(file, RESOURCE_GROUP, NULL, NULL);
+	for (i = 0; groups != NULL && groups[i] != NULL; i++) {
+		gchar *type = g_key_file_get_string(file, RESOURCE_GROUP, groups[i], NULL);
+		if (type != NULL) {
+			g_hash_table_insert(self->resource_types, g_strdup(groups[i]), type);
+		}
+	}
+	g_strfreev(groups);
+
+	groups = g_key_file_get_groups(file, NULL);
+	for (i = 0; groups[i] != NULL; i++) {
+		NoteEntry *entry;
+
+		if (strcmp(groups[i], STATE_GROUP) == 0 || strcmp(groups[i], RESOURCE_GROUP) == 0) {
+			continue;
+		}
+
+		entry = g_new0(NoteEntry, 1);
+		entry->guid    = g_strdup(groups[i]);
+		entry->remote  = g_key_file_get_string(file, groups[i], "remote", NULL);
+		entry->title   = g_key_file_get_string(file, groups[i], "title", NULL);
+		entry->created = g_key_file_get_integer(file, groups[i], "created", NULL);
+		entry->updated = g_key_file_get_integer(file, groups[i], "updated", NULL);
+		entry->usn     = g_key_file_get_integer(file, groups[i], "usn", NULL);
+		entry->dirty   = g_key_file_get_boolean(file, groups[i], "dirty", NULL);
+		entry->deleted = g_key_file_get_boolean(file, groups[i], "deleted", NULL);
+
+		g_hash_table_insert(self->entries, entry->guid, entry);
+		if (entry->remote != NULL) {
+			g_hash_table_insert(self->remote_guids, entry->remote, entry);
+		}
+	}
+
+	g_strfreev(groups);
+	g_key_file_free(file);
+	g_free(filename);
+}
+
+static void
+add_entry_to_key_file (gpointer key, gpointer value, gpointer user_data)
+{
+	NoteEntry *entry = value;
+	GKeyFile *file = user_data;
+
+	if (entry->remote != NULL) {
+		g_key_file_set_string(file, entry->guid, "remote", entry->remote);
+	}
+	g_key_file_set_string(file, entry->guid, "title", entry->title != NULL ? entry->title : "");
+	g_key_file_set_integer(file, entry->guid, "created", entry->created);
+	g_key_file_set_integer(file, entry->guid, "updated", entry->updated);
+	g_key_file_set_integer(file, entry->guid, "usn", entry->usn);
+	if (entry->dirty) {
+		g_key_file_set_boolean(file, entry->guid, "dirty", TRUE);
+	}
+	if (entry->deleted) {
+		g_key_file_set_boolean(file, entry->guid, "deleted", TRUE);
+	}
+}
+
+static void
+add_resource_to_key_file (gpointer key, gpointer value, gpointer user_data)
+{
+	g_key_file_set_string((GKeyFile*) user_data, RESOURCE_GROUP, key, value);
+}
+
+/* The caller holds lock */
+static void
+write_state (ConboyEvernoteStoragePlugin *self)
+{
+	gchar *filename = g_strconcat(self->path, STATE_FILE, NULL);
+	GKeyFile *file = g_key_file_new();
+	GError *error = NULL;
+	gchar *data;
+	gsize length;
+
+	g_key_file_set_integer(file, STATE_GROUP, "usn", self->usn);
+	g_hash_table_foreach(self->resource_types, add_resource_to_key_file, file);
+	g_hash_table_foreach(self->entries, add_entry_to_key_file, file);
+
+	data = g_key_file_to_data(file, &length, NULL);
+	if (!g_file_set_contents(filename, data, length, &error)) {
+		g_printerr("ERROR: Could not write %s: %s\n", filename, error->message);
+		g_error_free(error);
+	}
+
+	g_free(data);
+	g_key_file_free(file);
+	g_free(filename);
+}
+
 static gboolean
-_conboy_evernote_storage_plugin_note_delete (ConboyStoragePlugin *self, ConboyNote *note)
-{
-	g_printerr("In _conboy_evernote_storage_plugin_note_delete\n");
-
-	//	g_return_val_if_fail(self != NULL, FALSE);
-//	g_return_val_if_fail(note != NULL, FALSE);
-//
-//	g_return_val_if_fail(CONBOY_IS_MIDGARD_STORAGE_PLUGIN(self), FALSE);
-//	g_return_val_if_fail(CONBOY_IS_NOTE(note), FALSE);
-//
-//	EvernoteObject *mgdobject = CONBOY_MIDGARD_STORAGE_PLUGIN (self)->object;
-//
-//	/* Use this one if you want to have possibility to undelete */
-//	/* return evernote_object_delete (mgdobject); */
-//
-//	return evernote_object_purge (mgdobject);
+save_state_idle (gpointer user_data)
+{
+	ConboyEvernoteStoragePlugin *self = CONBOY_EVERNOTE_STORAGE_PLUGIN(user_data);
+
+	g_mutex_lock(self->lock);
+	self->save_state_source = 0;
+	write_state(self);
+	g_mutex_unlock(self->lock);
 
 	return FALSE;
 }
 
-static GSList*
-_conboy_evernote_storage_plugin_note_list (ConboyStoragePlugin *self)
-{
-	g_printerr("In _conboy_evernote_storage_plugin_note_list\n");
-
-//	g_return_val_if_fail(self != NULL, FALSE);
-//	g_return_val_if_fail(CONBOY_IS_MIDGARD_STORAGE_PLUGIN(self), FALSE);
-//
-//	EvernoteQueryBuilder *builder = evernote_query_builder_new (mgd_global, CONBOY_MIDGARD_NOTE_NAME);
-//	guint n_objects;
-//	GObject **objects = evernote_query_builder_execute (builder, &n_objects);
-//
-//	g_object_unref (builder);
-//
-//	if (!objects)
-//		return NULL;
-//
-//	GSList *slist = NULL;
-//	guint i = 0;
-//
-//	for (i = 0; i < n_objects; i++) {
-//
-//		ConboyNote *note = __conboy_note_from_evernote_object (objects[i]);
-//		slist = g_slist_prepend (slist, (gpointer) note);
-//		g_object_unref (objects[i]);
-//	}
-//
-//	g_free (objects);
-//
-//	return g_slist_reverse (slist);
+/*
+ * The state file is rewritten once the main loop becomes idle, so a sync
+ * that changes many notes writes it only once. The caller holds lock.
+ */
+static void
+schedule_save_state (ConboyEvernoteStoragePlugin *self)
+{
+	if (self->save_state_source == 0) {
+		self->save_state_source = g_idle_add(save_state_idle, self);
+	}
+}
+
+static void
+flush_state (ConboyEvernoteStoragePlugin *self)
+{
+	g_mutex_lock(self->lock);
+	if (self->save_state_source != 0) {
+		g_source_remove(self->save_state_source);
+		self->save_state_source = 0;
+		write_state(self);
+	}
+	g_mutex_unlock(self->lock);
+}
+
+/* The caller holds lock */
+static void
+remove_entry (ConboyEvernoteStoragePlugin *self, NoteEntry *entry)
+{
+	gchar *filename = get_content_file(self, entry->guid);
+	g_unlink(filename);
+	g_free(filename);
+
+	if (entry->remote != NULL) {
+		g_hash_table_remove(self->remote_guids, entry->remote);
+	}
+	/* Frees the entry */
+	g_hash_table_remove(self->entries, entry->guid);
+}
+
+
+/*
+ * Talking to the server
+ */
+
+static gboolean
+write_content (ConboyEvernoteStoragePlugin *self, const gchar *guid, const gchar *content)
+{
+	gchar *filename = get_content_file(self, guid);
+	GError *error = NULL;
+	gboolean result;
+
+	result = g_file_set_contents(filename, content, -1, &error);
+	if (!result) {
+		g_printerr("ERROR: Could not write %s: %s\n", filename, error->message);
+		g_error_free(error);
+	}
+
+	g_free(filename);
+	return result;
+}
+
+static gchar*
+read_content (ConboyEvernoteStoragePlugin *self, const gchar *guid)
+{
+	gchar *filename = get_content_file(self, guid);
+	gchar *content = NULL;
+
+	g_file_get_contents(filename, &content, NULL, NULL);
+
+	g_free(filename);
+	return content;
+}
+
+/*
+ * Uploads the local change of a note, content is read from the cache.
+ * Runs on the sync thread. lock is not held while the server is
+ * contacted, so the main thread can go on loading and saving notes.
+ */
+static gboolean
+push_entry (ConboyEvernoteStoragePlugin *self, const gchar *guid)
+{
+	EvernoteClient *client;
+	EvernoteNoteInfo info;
+	NoteEntry *entry;
+	gchar *remote, *title, *content, *enml = NULL;
+	gboolean deleted;
+	guint revision;
+	gboolean result = FALSE;
+
+	g_mutex_lock(self->lock);
+	entry = g_hash_table_lookup(self->entries, guid);
+	if (entry == NULL || !(entry->dirty || entry->deleted)) {
+		g_mutex_unlock(self->lock);
+		return TRUE;
+	}
+	remote = g_strdup(entry->remote);
+	title = g_strdup(entry->title != NULL ? entry->title : "");
+	deleted = entry->deleted;
+	revision = entry->revision;
+	g_mutex_unlock(self->lock);
+
+	if (!deleted) {
+		content = read_content(self, guid);
+		if (content == NULL) {
+			g_free(remote);
+			g_free(title);
+			return FALSE;
+		}
+		g_mutex_lock(self->lock);
+		enml = content_to_enml(self, content);
+		g_mutex_unlock(self->lock);
+		g_free(content);
+	}
+
+	memset(&info, 0, sizeof(EvernoteNoteInfo));
+
+	g_mutex_lock(self->client_lock);
+	client = get_client(self);
+	if (client != NULL) {
+		if (deleted) {
+			result = (remote == NULL || evernote_client_delete_note(client, remote, title));
+		} else {
+			result = evernote_client_put_note(client, remote, title, enml, &info);
+		}
+	}
+	g_mutex_unlock(self->client_lock);
+
+	if (result) {
+		g_mutex_lock(self->lock);
+		entry = g_hash_table_lookup(self->entries, guid);
+		if (entry != NULL && deleted) {
+			if (entry->deleted) {
+				remove_entry(self, entry);
+			} else if (entry->remote != NULL) {
+				/* Saved again in the meantime, so it is uploaded as a new note */
+				g_hash_table_remove(self->remote_guids, entry->remote);
+				g_free(entry->remote);
+				entry->remote = NULL;
+			}
+		} else if (entry != NULL) {
+			if (entry->remote == NULL) {
+				entry->remote = g_strdup(info.guid);
+				g_hash_table_insert(self->remote_guids, entry->remote, entry);
+			}
+			entry->usn = info.usn;
+			/* Stays dirty if it was saved again during the upload */
+			if (entry->revision == revision) {
+				entry->dirty = FALSE;
+			}
+		}
+		schedule_save_state(self);
+		g_mutex_unlock(self->lock);
+	}
+
+	evernote_note_info_clear(&info);
+	g_free(enml);
+	g_free(title);
+	g_free(remote);
+
+	return result;
+}
+
+static void
+collect_dirty_entry (gpointer key, gpointer value, gpointer user_data)
+{
+	NoteEntry *entry = value;
+	GSList **dirty = user_data;
+
+	if (entry->dirty || entry->deleted) {
+		*dirty = g_slist_prepend(*dirty, g_strdup(entry->guid));
+	}
+}
+
+/* Uploads all local changes, stops at the first failure */
+static void
+push_dirty (ConboyEvernoteStoragePlugin *self)
+{
+	GSList *dirty = NULL;
+	GSList *iter;
+
+	g_mutex_lock(self->lock);
+	g_hash_table_foreach(self->entries, collect_dirty_entry, &dirty);
+	g_mutex_unlock(self->lock);
+
+	for (iter = dirty; iter != NULL; iter = iter->next) {
+		if (!push_entry(self, iter->data)) {
+			break;
+		}
+	}
+
+	g_slist_foreach(dirty, (GFunc) g_free, NULL);
+	g_slist_free(dirty);
+}
+
+typedef struct {
+	ConboyEvernoteStoragePlugin *self;
+	const gchar *signal;
+	gchar *guid;
+} Emission;
+
+static gboolean
+emit_idle (gpointer user_data)
+{
+	Emission *emission = user_data;
+
+	/* Handlers update the UI, but callbacks from the main loop
+	 * don't hold the gdk lock */
+	gdk_threads_enter();
+	g_signal_emit_by_name(emission->self, emission->signal, emission->guid);
+	gdk_threads_leave();
+
+	g_object_unref(emission->self);
+	g_free(emission->guid);
+	g_free(emission);
+
+	return FALSE;
+}
+
+/* Signals are emitted on the main loop, not on the sync thread */
+static void
+emit (ConboyEvernoteStoragePlugin *self, const gchar *signal, const gchar *guid)
+{
+	Emission *emission = g_new(Emission, 1);
+
+	emission->self = g_object_ref(self);
+	emission->signal = signal;
+	emission->guid = g_strdup(guid);
+	g_idle_add(emit_idle, emission);
+}
+
+/*
+ * Applies one sync chunk to the local copy. Only notes whose USN changed
+ * are touched, and their cached content is dropped, to be fetched again
+ * when it is needed. The caller holds lock.
+ */
+static void
+apply_chunk (ConboyEvernoteStoragePlugin *self, EvernoteSyncChunk *chunk)
+{
+	GSList *iter;
+
+	for (iter = chunk->notes; iter != NULL; iter = iter->next) {
+		EvernoteNoteInfo *info = iter->data;
+		NoteEntry *entry = g_hash_table_lookup(self->remote_guids, info->guid);
+		gboolean added = (entry == NULL);
+		gchar *filename;
+
+		if (entry != NULL && entry->usn == info->usn) {
+			/* Our own upload */
+			continue;
+		}
+
+		if (entry != NULL && (entry->dirty || entry->deleted)) {
+			/* Local changes win, they are uploaded next */
+			continue;
+		}
+
+		if (!info->active) {
+			if (entry != NULL) {
+				emit(self, "note-removed", entry->guid);
+				remove_entry(self, entry);
+			}
+			continue;
+		}
+
+		if (added) {
+			entry = g_new0(NoteEntry, 1);
+			entry->guid = g_strdup(info->guid);
+			entry->remote = g_strdup(info->guid);
+			g_hash_table_insert(self->entries, entry->guid, entry);
+			g_hash_table_insert(self->remote_guids, entry->remote, entry);
+		} else {
+			filename = get_content_file(self, entry->guid);
+			g_unlink(filename);
+			g_free(filename);
+		}
+
+		g_free(entry->title);
+		entry->title = g_strdup(info->title);
+		entry->created = info->created;
+		entry->updated = info->updated;
+		entry->usn = info->usn;
+
+		emit(self, added ? "note-added" : "note-changed", entry->guid);
+	}
+
+	for (iter = chunk->expunged; iter != NULL; iter = iter->next) {
+		NoteEntry *entry = g_hash_table_lookup(self->remote_guids, iter->data);
+		if (entry != NULL) {
+			emit(self, "note-removed", entry->guid);
+			remove_entry(self, entry);
+		}
+	}
+}
+
+/*
+ * Pulls everything that changed on the server after the last USN we
+ * have seen, one chunk at a time. The USN is stored after every chunk,
+ * so an interrupted sync continues where it stopped. Local changes are
+ * uploaded first.
+ */
+static void
+pull_changes (ConboyEvernoteStoragePlugin *self)
+{
+	EvernoteClient *client;
+	EvernoteSyncChunk chunk;
+	GTimer *timer;
+	guint n_notes = 0;
+	gint32 start_usn, usn;
+
+	g_mutex_lock(self->client_lock);
+	client = get_client(self);
+	g_mutex_unlock(self->client_lock);
+	if (client == NULL) {
+		return;
+	}
+
+	push_dirty(self);
+
+	g_mutex_lock(self->lock);
+	start_usn = usn = self->usn;
+	g_mutex_unlock(self->lock);
+
+	timer = g_timer_new();
+
+	while (TRUE) {
+		gboolean received, done;
+
+		/* Taken for each chunk, so opening a note does not wait for the whole sync */
+		g_mutex_lock(self->client_lock);
+		client = get_client(self);
+		received = (client != NULL && evernote_client_get_sync_chunk(client, usn, SYNC_CHUNK_SIZE, &chunk));
+		g_mutex_unlock(self->client_lock);
+
+		if (!received) {
+			break;
+		}
+
+		g_mutex_lock(self->lock);
+		apply_chunk(self, &chunk);
+		done = (chunk.high_usn <= self->usn || chunk.high_usn >= chunk.update_count);
+		if (chunk.high_usn > self->usn) {
+			self->usn = chunk.high_usn;
+			schedule_save_state(self);
+		}
+		usn = self->usn;
+		g_mutex_unlock(self->lock);
+
+		n_notes += g_slist_length(chunk.notes);
+		evernote_sync_chunk_clear(&chunk);
+		if (done) {
+			break;
+		}
+	}
+
+	g_printerr("INFO: Evernote sync from USN %i to %i, %u changed notes, took %.1f ms\n",
+			start_usn, usn, n_notes, g_timer_elapsed(timer, NULL) * 1000);
+	g_timer_destroy(timer);
+}
+
+/*
+ * Downloads a resource unless a note that uses it was opened before.
+ * Resources are fetched one at a time and written out right away, so at
+ * most one of them is held in memory. The caller holds client_lock.
+ */
+static void
+fetch_resource (ConboyEvernoteStoragePlugin *self, EvernoteClient *client, const gchar *remote, const gchar *hash)
+{
+	gchar *filename = g_strconcat(self->resource_path, hash, NULL);
+
+	if (!g_file_test(filename, G_FILE_TEST_EXISTS)) {
+		evernote_client_save_resource(client, remote, hash, filename);
+	}
+
+	g_free(filename);
+}
+
+/* Downloads the resources queued by load_content() */
+static void
+fetch_resources (ConboyEvernoteStoragePlugin *self)
+{
+	EvernoteClient *client;
+	GSList *fetches, *iter;
+
+	g_mutex_lock(self->lock);
+	fetches = g_slist_reverse(self->fetches);
+	self->fetches = NULL;
+	g_mutex_unlock(self->lock);
+
+	g_mutex_lock(self->client_lock);
+	client = get_client(self);
+	for (iter = fetches; iter != NULL; iter = iter->next) {
+		ResourceFetch *fetch = iter->data;
+		if (client != NULL) {
+			fetch_resource(self, client, fetch->remote, fetch->hash);
+		}
+		resource_fetch_free(fetch);
+	}
+	g_mutex_unlock(self->client_lock);
+
+	g_slist_free(fetches);
+}
+
+static void
+run_job (ConboyEvernoteStoragePlugin *self, gpointer job)
+{
+	if (job == JOB_PULL) {
+		pull_changes(self);
+	} else if (job == JOB_FETCH) {
+		fetch_resources(self);
+	} else {
+		push_dirty(self);
+	}
+}
+
+/*
+ * Background thread talking to the server. Exits when the plugin itself
+ * is pushed to the queue.
+ */
+static gpointer
+sync_thread_func (gpointer data)
+{
+	ConboyEvernoteStoragePlugin *self = CONBOY_EVERNOTE_STORAGE_PLUGIN(data);
+
+	while (TRUE) {
+		gpointer job = g_async_queue_pop(self->queue);
+
+		if (job == self) {
+			break;
+		}
+		run_job(self, job);
+	}
 
 	return NULL;
 }
 
+/* Lets the sync thread do the job, or does it right away without threads */
+static void
+queue_job (ConboyEvernoteStoragePlugin *self, gpointer job)
+{
+	GError *error = NULL;
+
+	if (self->worker == NULL && g_thread_supported()) {
+		self->worker = g_thread_create(sync_thread_func, self, TRUE, &error);
+		if (self->worker == NULL) {
+			g_printerr("ERROR: Couldn't start Evernote sync thread: %s\n", error->message);
+			g_error_free(error);
+		}
+	}
+
+	if (self->worker != NULL) {
+		g_async_queue_push(self->queue, job);
+	} else {
+		run_job(self, job);
+	}
+}
+
+static void
+ensure_pulled (ConboyEvernoteStoragePlugin *self)
+{
+	if (!self->pulled) {
+		self->pulled = TRUE;
+		queue_job(self, JOB_PULL);
+	}
+}
+
+static gboolean
+sync_timeout (gpointer user_data)
+{
+	queue_job(CONBOY_EVERNOTE_STORAGE_PLUGIN(user_data), JOB_PULL);
+	return TRUE;
+}
+
+/*
+ * Storage plugin methods
+ */
+
+/*
+ * The content is needed right now, so unlike uploads this waits for the
+ * server. Only the body is fetched here, its resources are left to the
+ * sync thread.
+ */
+static gchar*
+load_content (ConboyNote *note, gpointer user_data)
+{
+	ConboyEvernoteStoragePlugin *self = CONBOY_EVERNOTE_STORAGE_PLUGIN(user_data);
+	NoteEntry *entry;
+	EvernoteClient *client;
+	GSList *resources = NULL, *iter;
+	gchar *content, *enml = NULL;
+	gboolean fetch = FALSE;
+	gchar *remote = NULL, *title = NULL;
+
+	content = read_content(self, note->guid);
+	if (content != NULL) {
+		return content;
+	}
+
+	g_mutex_lock(self->lock);
+	entry = g_hash_table_lookup(self->entries, note->guid);
+	if (entry != NULL) {
+		remote = g_strdup(entry->remote);
+		title = g_strdup(entry->title);
+	}
+	g_mutex_unlock(self->lock);
+
+	if (remote == NULL) {
+		g_free(title);
+		return NULL;
+	}
+
+	g_mutex_lock(self->client_lock);
+	client = get_client(self);
+	if (client != NULL) {
+		enml = evernote_client_get_note_content(client, remote);
+	}
+	if (enml != NULL) {
+		g_mutex_lock(self->lock);
+		content = enml_to_content(self, title, enml, &resources);
+		/* Don't overwrite what was saved locally in the meantime */
+		entry = g_hash_table_lookup(self->entries, note->guid);
+		if (entry != NULL && !entry->dirty) {
+			write_content(self, note->guid, content);
+		}
+
+		for (iter = resources; iter != NULL; iter = iter->next) {
+			ResourceFetch *resource = g_new(ResourceFetch, 1);
+			resource->remote = g_strdup(remote);
+			resource->hash = iter->data;
+			self->fetches = g_slist_prepend(self->fetches, resource);
+			fetch = TRUE;
+		}
+		g_mutex_unlock(self->lock);
+	}
+	g_mutex_unlock(self->client_lock);
+
+	/* Without a sync thread this runs right away, so client_lock must be free */
+	if (fetch) {
+		queue_job(self, JOB_FETCH);
+	}
+
+	g_slist_free(resources);
+	g_free(enml);
+	g_free(title);
+	g_free(remote);
+
+	return content;
+}
+
+/* The caller holds lock */
+static ConboyNote*
+note_from_entry (ConboyEvernoteStoragePlugin *self, NoteEntry *entry)
+{
+	ConboyNote *note = conboy_note_new_with_guid(entry->guid);
+
+	g_object_set(note,
+			"title", entry->title,
+			"create-date", entry->created,
+			"change-date", entry->updated,
+			"metadata-change-date", entry->updated,
+			NULL);
+
+	/* Content is fetched when it's needed */
+	conboy_note_set_content_loader(note, load_content, g_object_ref(self), g_object_unref);
+
+	return note;
+}
+
+static ConboyNote*
+note_load (ConboyStoragePlugin *self, const gchar *guid)
+{
+	g_return_val_if_fail(self != NULL, NULL);
+	g_return_val_if_fail(guid != NULL, NULL);
+	g_return_val_if_fail(CONBOY_IS_EVERNOTE_STORAGE_PLUGIN(self), NULL);
+
+	ConboyEvernoteStoragePlugin *plugin = CONBOY_EVERNOTE_STORAGE_PLUGIN(self);
+	ConboyNote *note = NULL;
+	NoteEntry *entry;
+
+	g_mutex_lock(plugin->lock);
+	entry = g_hash_table_lookup(plugin->entries, guid);
+	if (entry != NULL && !entry->deleted) {
+		note = note_from_entry(plugin, entry);
+	}
+	g_mutex_unlock(plugin->lock);
+
+	return note;
+}
+
+static gboolean
+note_save (ConboyStoragePlugin *self, ConboyNote *note)
+{
+	g_return_val_if_fail(self != NULL, FALSE);
+	g_return_val_if_fail(note != NULL, FALSE);
+	g_return_val_if_fail(CONBOY_IS_EVERNOTE_STORAGE_PLUGIN(self), FALSE);
+	g_return_val_if_fail(CONBOY_IS_NOTE(note), FALSE);
+
+	ConboyEvernoteStoragePlugin *plugin = CONBOY_EVERNOTE_STORAGE_PLUGIN(self);
+	NoteEntry *entry;
+
+	/* Under lock, so a sync cannot drop the content before the entry is dirty */
+	g_mutex_lock(plugin->lock);
+
+	if (!write_content(plugin, note->guid, conboy_note_get_content(note))) {
+		g_mutex_unlock(plugin->lock);
+		return FALSE;
+	}
+
+	entry = g_hash_table_lookup(plugin->entries, note->guid);
+	if (entry == NULL) {
+		entry = g_new0(NoteEntry, 1);
+		entry->guid = g_strdup(note->guid);
+		g_hash_table_insert(plugin->entries, entry->guid, entry);
+	}
+
+	g_free(entry->title);
+	entry->title = g_strdup(note->title);
+	entry->created = note->create_date;
+	entry->updated = note->last_change_date;
+	entry->dirty = TRUE;
+	entry->deleted = FALSE;
+	entry->revision++;
+	schedule_save_state(plugin);
+
+	g_mutex_unlock(plugin->lock);
+
+	/* If the upload fails, the note is uploaded with the next sync */
+	queue_job(plugin, JOB_PUSH);
+
+	return TRUE;
+}
+
+static gboolean
+note_delete (ConboyStoragePlugin *self, ConboyNote *note)
+{
+	g_return_val_if_fail(self != NULL, FALSE);
+	g_return_val_if_fail(note != NULL, FALSE);
+	g_return_val_if_fail(CONBOY_IS_EVERNOTE_STORAGE_PLUGIN(self), FALSE);
+	g_return_val_if_fail(CONBOY_IS_NOTE(note), FALSE);
+
+	ConboyEvernoteStoragePlugin *plugin = CONBOY_EVERNOTE_STORAGE_PLUGIN(self);
+	NoteEntry *entry;
+
+	g_mutex_lock(plugin->lock);
+	entry = g_hash_table_lookup(plugin->entries, note->guid);
+	if (entry == NULL) {
+		g_mutex_unlock(plugin->lock);
+		return FALSE;
+	}
+	entry->deleted = TRUE;
+	entry->revision++;
+	schedule_save_state(plugin);
+	g_mutex_unlock(plugin->lock);
+
+	queue_job(plugin, JOB_PUSH);
+
+	return TRUE;
+}
+
+static void
+collect_note (gpointer key, gpointer value, gpointer user_data)
+{
+	NoteEntry *entry = value;
+	gpointer *data = user_data;
+
+	if (!entry->deleted) {
+		GSList **result = data[1];
+		*result = g_slist_prepend(*result, note_from_entry(data[0], entry));
+	}
+}
+
+/*
+ * Returns the local copy. Changes on the server show up later as
+ * note-added, note-changed and note-removed.
+ */
 static GSList*
-_conboy_evernote_storage_plugin_note_list_ids (ConboyStoragePlugin *self)
-{
-	g_printerr("In _conboy_evernote_storage_plugin_note_list_ids\n");
-
-//	g_return_val_if_fail(self != NULL, FALSE);
-//	g_return_val_if_fail(CONBOY_IS_MIDGARD_STORAGE_PLUGIN(self), FALSE);
-//
-//	EvernoteQueryBuilder *builder = evernote_query_builder_new (mgd_global, CONBOY_MIDGARD_NOTE_NAME);
-//	guint n_objects;
-//	GObject **objects = evernote_query_builder_execute (builder, &n_objects);
-//
-//	g_object_unref (builder);
-//
-//	if (!objects)
-//		return NULL;
-//
-//	GSList *slist = NULL;
-//	guint i = 0;
-//	gchar *guid;
-//
-//	for (i = 0; i < n_objects; i++) {
-//
-//		g_object_get (objects[i], "guid", &guid, NULL);
-//		slist = g_slist_prepend (slist, (gpointer) guid);
-//	}
-//
-//	g_free (objects);
-//
-//	return g_slist_reverse (slist);
+note_list (ConboyStoragePlugin *self)
+{
+	g_return_val_if_fail(self != NULL, NULL);
+	g_return_val_if_fail(CONBOY_IS_EVERNOTE_STORAGE_PLUGIN(self), NULL);
 
-	return NULL;
+	ConboyEvernoteStoragePlugin *plugin = CONBOY_EVERNOTE_STORAGE_PLUGIN(self);
+	GSList *result = NULL;
+	gpointer data[2] = { plugin, &result };
+
+	ensure_pulled(plugin);
+
+	g_mutex_lock(plugin->lock);
+	g_hash_table_foreach(plugin->entries, collect_note, data);
+	g_mutex_unlock(plugin->lock);
+
+	return result;
 }
 
-static GtkWidget*
-_conboy_evernote_storage_plugin_get_widget (ConboyPlugin *self)
-{
-	g_printerr("In _conboy_evernote_storage_plugin_get_widget\n");
-
-
-//	g_return_val_if_fail(self != NULL, NULL);
-//	g_return_val_if_fail(CONBOY_IS_PLUGIN(self), NULL);
-//
-//	/* First row */
-//	GtkWidget *hbox1 = gtk_hbox_new(FALSE, 0);
-//	GtkWidget *label1 = gtk_label_new("Host:");
-//	GtkWidget *entry1 = gtk_entry_new();
-//	gtk_container_add(GTK_CONTAINER(hbox1), label1);
-//	gtk_container_add(GTK_CONTAINER(hbox1), entry1);
-//	gtk_widget_show(label1);
-//	gtk_widget_show(entry1);
-//	gtk_widget_show(hbox1);
-//
-//	/* First row */
-//	GtkWidget *hbox2 = gtk_hbox_new(FALSE, 0);
-//	GtkWidget *label2 = gtk_label_new("Username:");
-//	GtkWidget *entry2 = gtk_entry_new();
-//	gtk_container_add(GTK_CONTAINER(hbox2), label2);
-//	gtk_container_add(GTK_CONTAINER(hbox2), entry2);
-//	gtk_widget_show(label2);
-//	gtk_widget_show(entry2);
-//	gtk_widget_show(hbox2);
-//
-//	/* First row */
-//	GtkWidget *hbox3 = gtk_hbox_new(FALSE, 0);
-//	GtkWidget *label3 = gtk_label_new("Password:");
-//	GtkWidget *entry3 = gtk_entry_new();
-//	gtk_container_add(GTK_CONTAINER(hbox3), label3);
-//	gtk_container_add(GTK_CONTAINER(hbox3), entry3);
-//	gtk_widget_show(label3);
-//	gtk_widget_show(entry3);
-//	gtk_widget_show(hbox3);
-//
-//	/* Result widget */
-//	GtkWidget *vbox = gtk_vbox_new(FALSE, 0);
-//	gtk_container_add(GTK_CONTAINER(vbox), hbox1);
-//	gtk_container_add(GTK_CONTAINER(vbox), hbox2);
-//	gtk_container_add(GTK_CONTAINER(vbox), hbox3);
-//
-//	return vbox;
+static void
+collect_guid (gpointer key, gpointer value, gpointer user_data)
+{
+	NoteEntry *entry = value;
+	GSList **result = user_data;
 
-	return NULL;
+	if (!entry->deleted) {
+		*result = g_slist_prepend(*result, g_strdup(entry->guid));
+	}
 }
 
-/* GOBJECT ROUTINES */
+static GSList*
+note_list_ids (ConboyStoragePlugin *self)
+{
+	g_return_val_if_fail(self != NULL, NULL);
+	g_return_val_if_fail(CONBOY_IS_EVERNOTE_STORAGE_PLUGIN(self), NULL);
+
+	ConboyEvernoteStoragePlugin *plugin = CONBOY_EVERNOTE_STORAGE_PLUGIN(self);
+	GSList *result = NULL;
+
+	ensure_pulled(plugin);
+
+	g_mutex_lock(plugin->lock);
+	g_hash_table_foreach(plugin->entries, collect_guid, &result);
+	g_mutex_unlock(plugin->lock);
+
+	return result;
+}
+
+static void
+note_sync (ConboyStoragePlugin *self)
+{
+	flush_state(CONBOY_EVERNOTE_STORAGE_PLUGIN(self));
+}
 
-static GObject *
-_conboy_evernote_storage_plugin_constructor (GType type,
-		guint n_construct_properties,
-		GObjectConstructParam *construct_properties)
+/* Content is cached once it has been downloaded or saved locally */
+static gboolean
+note_has_cached_content (ConboyStoragePlugin *self, const gchar *guid)
 {
-	g_printerr("In _conboy_evernote_storage_plugin_constructor\n");
+	gchar *filename = get_content_file(CONBOY_EVERNOTE_STORAGE_PLUGIN(self), guid);
+	gboolean result = g_file_test(filename, G_FILE_TEST_EXISTS);
+	g_free(filename);
+	return result;
+}
 
-	GObject *object = (GObject *)
-		G_OBJECT_CLASS (conboy_evernote_storage_plugin_parent_class)->constructor (type,
-				n_construct_properties,
-				construct_properties);
 
-	CONBOY_EVERNOTE_STORAGE_PLUGIN(object)->user = NULL;
-	CONBOY_EVERNOTE_STORAGE_PLUGIN(object)->pass = NULL;
+/*
+ * Settings
+ */
 
-	return G_OBJECT(object);
+/* The caller holds client_lock, or the sync thread is not running */
+static void
+reset_client (ConboyEvernoteStoragePlugin *self)
+{
+	evernote_client_free(self->client);
+	self->client = NULL;
 }
 
 static void
-_conboy_evernote_storage_plugin_dispose(GObject *object)
+on_url_changed (GtkEntry *entry, ConboyEvernoteStoragePlugin *self)
 {
-	g_printerr("In _conboy_evernote_storage_plugin_dispose\n");
-///	g_printerr("INFO: Dispose() called on Evernote plugin\n");
-//	ConboyEvernoteStoragePlugin *self = CONBOY_MIDGARD_STORAGE_PLUGIN(object);
-//
-//	g_free((gchar *)self->user);
-//	self->user = NULL;
-//
-//	g_free((gchar *)self->pass);
-//	self->pass = NULL;
-//
-//	G_OBJECT_CLASS(conboy_evernote_storage_plugin_parent_class)->dispose(object);
+	g_mutex_lock(self->client_lock);
+	g_free(self->url);
+	self->url = g_strdup(gtk_entry_get_text(entry));
+	reset_client(self);
+	g_mutex_unlock(self->client_lock);
+
+	settings_save_evernote_url(self->url);
+}
+
+static void
+on_token_changed (GtkEntry *entry, ConboyEvernoteStoragePlugin *self)
+{
+	g_mutex_lock(self->client_lock);
+	g_free(self->token);
+	self->token = g_strdup(gtk_entry_get_text(entry));
+	reset_client(self);
+	g_mutex_unlock(self->client_lock);
+
+	settings_save_evernote_token(self->token);
+}
+
+static GtkWidget*
+get_widget (ConboyPlugin *plugin)
+{
+	ConboyEvernoteStoragePlugin *self = CONBOY_EVERNOTE_STORAGE_PLUGIN(plugin);
+	GtkWidget *vbox = gtk_vbox_new(FALSE, 10);
+	GtkWidget *label;
+	GtkWidget *entry;
+
+	/* Translators: Option of the Evernote storage backend. */
+	label = gtk_label_new(_("NoteStore URL:"));
+	gtk_misc_set_alignment(GTK_MISC(label), 0, 0.5);
+	gtk_box_pack_start(GTK_BOX(vbox), label, FALSE, FALSE, 0);
+
+	entry = gtk_entry_new();
+	gtk_entry_set_text(GTK_ENTRY(entry), self->url != NULL ? self->url : "");
+	g_signal_connect(entry, "changed", G_CALLBACK(on_url_changed), self);
+	gtk_box_pack_start(GTK_BOX(vbox), entry, FALSE, FALSE, 0);
+
+	/* Translators: Explains the "NoteStore URL" option. */
+	label = gtk_label_new(_("Only plain HTTP URLs (http://host:port/path) are supported, HTTPS is not."));
+	gtk_label_set_line_wrap(GTK_LABEL(label), TRUE);
+	gtk_misc_set_alignment(GTK_MISC(label), 0, 0.5);
+	gtk_box_pack_start(GTK_BOX(vbox), label, FALSE, FALSE, 0);
+
+	/* Translators: Option of the Evernote storage backend. */
+	label = gtk_label_new(_("Authentication token:"));
+	gtk_misc_set_alignment(GTK_MISC(label), 0, 0.5);
+	gtk_box_pack_start(GTK_BOX(vbox), label, FALSE, FALSE, 0);
+
+	entry = gtk_entry_new();
+	gtk_entry_set_visibility(GTK_ENTRY(entry), FALSE);
+	gtk_entry_set_text(GTK_ENTRY(entry), self->token != NULL ? self->token : "");
+	g_signal_connect(entry, "changed", G_CALLBACK(on_token_changed), self);
+	gtk_box_pack_start(GTK_BOX(vbox), entry, FALSE, FALSE, 0);
 
-//	return NULL;
+	gtk_widget_show_all(vbox);
+
+	return vbox;
 }
 
-#define __DB_EXISTS_FILE "~/.evernote-2.0/.conboy_db_exists"
+
+/* GOBJECT ROUTINES */
 
 static void
-conboy_evernote_storage_plugin_class_init (ConboyEvernoteStoragePluginClass *klass)
+dispose (GObject *object)
 {
-	g_printerr("In _conboy_evernote_storage_plugin_class_init\n");
+	ConboyEvernoteStoragePlugin *self = CONBOY_EVERNOTE_STORAGE_PLUGIN(object);
+
+	if (self->sync_source != 0) {
+		g_source_remove(self->sync_source);
+		self->sync_source = 0;
+	}
+
+	/* Lets the sync thread finish what it is doing */
+	if (self->worker != NULL) {
+		g_async_queue_push(self->queue, self);
+		g_thread_join(self->worker);
+		self->worker = NULL;
+	}
 
-	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	g_slist_foreach(self->fetches, (GFunc) resource_fetch_free, NULL);
+	g_slist_free(self->fetches);
+	self->fetches = NULL;
+
+	if (self->entries != NULL) {
+		flush_state(self);
+		g_hash_table_destroy(self->remote_guids);
+		self->remote_guids = NULL;
+		g_hash_table_destroy(self->entries);
+		self->entries = NULL;
+		g_hash_table_destroy(self->resource_types);
+		self->resource_types = NULL;
+	}
+
+	reset_client(self);
+
+	g_free(self->url);
+	self->url = NULL;
+	g_free(self->token);
+	self->token = NULL;
+	g_free(self->path);
+	self->path = NULL;
+	g_free(self->resource_path);
+	self->resource_path = NULL;
+
+	if (self->queue != NULL) {
+		g_async_queue_unref(self->queue);
+		self->queue = NULL;
+	}
+	if (self->lock != NULL) {
+		g_mutex_free(self->lock);
+		self->lock = NULL;
+		g_mutex_free(self->client_lock);
+		self->client_lock = NULL;
+	}
+
+	G_OBJECT_CLASS(conboy_evernote_storage_plugin_parent_class)->dispose(object);
+}
+
+static void
+conboy_evernote_storage_plugin_class_init (ConboyEvernoteStoragePluginClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
 	ConboyPluginClass *plugin_class = CONBOY_PLUGIN_CLASS(klass);
 	ConboyStoragePluginClass *storage_plugin_class = CONBOY_STORAGE_PLUGIN_CLASS(klass);
 
-	object_class->constructor = _conboy_evernote_storage_plugin_constructor;
-	object_class->dispose     = _conboy_evernote_storage_plugin_dispose;
+	object_class->dispose = dispose;
 
-	storage_plugin_class->load     = _conboy_evernote_storage_plugin_note_load;
-	storage_plugin_class->save     = _conboy_evernote_storage_plugin_note_save;
-	storage_plugin_class->delete   = _conboy_evernote_storage_plugin_note_delete;
-	storage_plugin_class->list     = _conboy_evernote_storage_plugin_note_list;
-	storage_plugin_class->list_ids = _conboy_evernote_storage_plugin_note_list_ids;
+	storage_plugin_class->load     = note_load;
+	storage_plugin_class->save     = note_save;
+	storage_plugin_class->delete   = note_delete;
+	storage_plugin_class->list     = note_list;
+	storage_plugin_class->list_ids = note_list_ids;
+	storage_plugin_class->sync     = note_sync;
+	storage_plugin_class->has_cached_content = note_has_cached_content;
 
-	plugin_class->get_widget 		= _conboy_evernote_storage_plugin_get_widget;
+	plugin_class->get_widget = get_widget;
 }
 
 static void
 conboy_evernote_storage_plugin_init (ConboyEvernoteStoragePlugin *self)
 {
-	g_printerr("In _conboy_evernote_storage_plugin_init\n");
-
-//	/* Initialize evernote */
-//	evernote_init();
-//
-//	/* Initialize config for SQLite */
-//	EvernoteConfig *config = evernote_config_new();
-//	g_object_set (config,
-//			"dbtype", "SQLite",
-//			"database", "ConboyNotes",
-//			"dbuser", "evernote",
-//			"dbpass", "evernote",
-//			"sharedir", "/usr/share/evernote-2.0", NULL);
-//
-//	evernote_config_save_file (config, "ConboyNotesStorage", TRUE, NULL);
-//
-//	/* Initialize connection for given config */
-//	mgd_global = evernote_connection_new();
-//	if (!evernote_connection_open_config (mgd_global, config))
-//		g_error ("Can not connect to Conboy notes database. %s", evernote_connection_get_error_string (mgd_global));
-//
-//	evernote_connection_set_loglevel (mgd_global, "debug", NULL);
-//
-//	gchar *db_file_exists = g_build_path (G_DIR_SEPARATOR_S, g_get_home_dir(), ".evernote-2.0/.conboy_db_exists", NULL);
-//
-//	/* Check if database already exists */
-//	if (g_file_test (db_file_exists, G_FILE_TEST_EXISTS)) { /* HACK */
-//
-//		EvernoteObject *mgdobject = evernote_object_new (mgd_global, CONBOY_MIDGARD_NOTE_NAME, NULL);
-//		CONBOY_MIDGARD_STORAGE_PLUGIN (self)->object = mgdobject;
-//
-//		CONBOY_PLUGIN(self)->has_settings = TRUE;
-//
-//		g_free (db_file_exists);
-//
-//		return;
-//	}
-//
-//	/* Create base storage and one required for note */
-//	evernote_config_create_evernote_tables (config, mgd_global);
-//	EvernoteObjectClass *klass = MIDGARD_OBJECT_GET_CLASS_BY_NAME (CONBOY_MIDGARD_NOTE_NAME);
-//	evernote_config_create_class_table (config, klass, mgd_global);
-//
-//	/* HACK */
-//	g_file_set_contents (db_file_exists, "", 1, NULL);
-//	g_free (db_file_exists);
-//
-//	EvernoteObject *mgdobject = evernote_object_new (mgd_global, CONBOY_EVERNOTE_NOTE_NAME, NULL);
-//	CONBOY_EVERNOTE_STORAGE_PLUGIN (self)->object = mgdobject;
-//
-//	CONBOY_PLUGIN(self)->has_settings = TRUE;
+	gchar *dir = conboy_storage_plugin_get_notes_dir();
+	const gchar *url = g_getenv("CONBOY_EVERNOTE_URL");
+	const gchar *token = g_getenv("CONBOY_EVERNOTE_TOKEN");
+
+	CONBOY_PLUGIN(self)->has_settings = TRUE;
+
+	self->path = g_strconcat(dir, "evernote", G_DIR_SEPARATOR_S, NULL);
+	self->resource_path = g_strconcat(self->path, RESOURCE_DIR, G_DIR_SEPARATOR_S, NULL);
+	g_free(dir);
+	if (g_mkdir_with_parents(self->resource_path, 0700) != 0) {
+		g_printerr("ERROR: Could not create %s\n", self->resource_path);
+	}
+
+	self->url = (url != NULL) ? g_strdup(url) : settings_load_evernote_url();
+	self->token = (token != NULL) ? g_strdup(token) : settings_load_evernote_token();
+
+	/* Entries are owned by the first table */
+	self->entries = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify) note_entry_free);
+	self->remote_guids = g_hash_table_new(g_str_hash, g_str_equal);
+	self->resource_types = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	load_state(self);
+
+	self->worker = NULL;
+	self->queue = g_async_queue_new();
+	self->fetches = NULL;
+	self->lock = g_mutex_new();
+	self->client_lock = g_mutex_new();
+
+	self->sync_source = g_timeout_add(SYNC_INTERVAL, sync_timeout, self);
 }
 
 ConboyEvernoteStoragePlugin*
-conboy_plugin_new() {
-	g_printerr("In conboy_plugin_new\n");
+conboy_plugin_new()
+{
 	return g_object_new(CONBOY_TYPE_EVERNOTE_STORAGE_PLUGIN, NULL);
 }
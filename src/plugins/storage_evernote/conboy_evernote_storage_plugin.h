@@ -17,10 +17,11 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
-#ifndef CONBOY_MIDGARD_STORAGE_PLUGIN_H
-#define CONBOY_MIDGARD_STORAGE_PLUGIN_H
+#ifndef CONBOY_EVERNOTE_STORAGE_PLUGIN_H
+#define CONBOY_EVERNOTE_STORAGE_PLUGIN_H
 
 #include <glib-object.h>
+#include "conboy_evernote_client.h"
 
 /* convention macros */
 #define CONBOY_TYPE_EVERNOTE_STORAGE_PLUGIN				(conboy_evernote_storage_plugin_get_type())
@@ -36,9 +37,31 @@ typedef struct _ConboyEvernoteStoragePluginClass ConboyEvernoteStoragePluginClas
 struct _ConboyEvernoteStoragePlugin {
 	ConboyStoragePlugin parent;
 
-	gchar *user;
-	gchar *pass;
-	//EvernoteObject *object;
+	/* Local cache of the account */
+	gchar *path;
+	GHashTable *entries;      /* local guid -> NoteEntry */
+	GHashTable *remote_guids; /* Evernote guid -> NoteEntry */
+	gint32 usn;               /* Update sequence number we are in sync with */
+	gboolean pulled;
+
+	/* Attachments, stored once per MD5 body hash */
+	gchar *resource_path;
+	GHashTable *resource_types; /* hash -> mime type */
+
+	/* NoteStore connection */
+	gchar *url;
+	gchar *token;
+	EvernoteClient *client;
+
+	/* Uploads and downloads run on the sync thread */
+	GThread *worker;
+	GAsyncQueue *queue;   /* JOB_PUSH, JOB_PULL or JOB_FETCH, the plugin itself to stop */
+	GSList *fetches;      /* Resources for JOB_FETCH */
+	GMutex *lock;         /* protects the local cache, fetches and save_state_source */
+	GMutex *client_lock;  /* held while the server is contacted, protects url, token and client */
+
+	guint save_state_source;
+	guint sync_source;
 };
 
 struct _ConboyEvernoteStoragePluginClass {
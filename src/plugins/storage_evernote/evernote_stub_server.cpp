@@ -0,0 +1,433 @@
+/*
+ * Copyright (C) 2009 Cornelius Hald <hald@icandy.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Minimal stand-in for the Evernote NoteStore, so the sync of the plugin
+ * can be checked without an account:
+ *
+ *   evernote-stub-server --port 19800 --notes 250 [--min-usn 250]
+ *
+ * It speaks Thrift over plain HTTP, like THttpClient, and keeps everything
+ * in memory. Note i of the generated notes has USN i, so a server that is
+ * restarted with more notes looks like an account that changed in the
+ * meantime. With --min-usn, getSyncChunk() fails for older USNs, which
+ * shows whether a client resumed from the USN it stored.
+ *
+ * Prints READY to stdout once it accepts connections.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+
+#include <transport/TBufferTransports.h>
+#include <protocol/TBinaryProtocol.h>
+
+#include "evernote/NoteStore.h"
+
+using boost::shared_ptr;
+using apache::thrift::TException;
+using apache::thrift::transport::TMemoryBuffer;
+using apache::thrift::protocol::TProtocol;
+using apache::thrift::protocol::TBinaryProtocol;
+using evernote::edam::NoteStoreNull;
+using evernote::edam::NoteStoreProcessor;
+using evernote::edam::SyncChunk;
+using evernote::edam::Note;
+
+#define MAX_CONNECTIONS 16
+
+static bool
+compare_usn (const Note *a, const Note *b)
+{
+	return a->updateSequenceNum < b->updateSequenceNum;
+}
+
+class StubNoteStore : public NoteStoreNull {
+public:
+	StubNoteStore (int n_notes, int min_usn) : update_count(0), min_usn(min_usn)
+	{
+		int i;
+
+		for (i = 1; i <= n_notes; i++) {
+			char guid[64], title[64], content[256];
+			Note note;
+
+			snprintf(guid, sizeof(guid), "00000000-0000-4000-8000-%012x", i);
+			snprintf(title, sizeof(title), "Stub note %05i", i);
+			snprintf(content, sizeof(content),
+					"<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+					"<!DOCTYPE en-note SYSTEM \"http://xml.evernote.com/pub/enml2.dtd\">"
+					"<en-note>Stub note %05i</en-note>", i);
+
+			note.guid = guid;
+			note.__isset.guid = true;
+			note.title = title;
+			note.__isset.title = true;
+			note.content = content;
+			note.__isset.content = true;
+			store(note);
+		}
+	}
+
+	void
+	getSyncChunk (SyncChunk &result, const std::string &token, const int32_t after_usn, const int32_t max_entries, const bool full_sync_only)
+	{
+		std::vector<const Note*> changed;
+		std::map<std::string, Note>::const_iterator iter;
+		size_t i;
+
+		if (after_usn < min_usn) {
+			evernote::edam::EDAMUserException e;
+			e.errorCode = evernote::edam::DATA_CONFLICT;
+			e.parameter = "afterUSN";
+			e.__isset.parameter = true;
+			fprintf(stderr, "WARN: getSyncChunk after USN %i, but --min-usn is %i\n", after_usn, min_usn);
+			throw e;
+		}
+
+		for (iter = notes.begin(); iter != notes.end(); iter++) {
+			if (iter->second.updateSequenceNum > after_usn) {
+				changed.push_back(&iter->second);
+			}
+		}
+		std::sort(changed.begin(), changed.end(), compare_usn);
+
+		result.currentTime = (int64_t) time(NULL) * 1000;
+		result.updateCount = update_count;
+		for (i = 0; i < changed.size() && (int32_t) i < max_entries; i++) {
+			Note note = *changed[i];
+			/* Sync chunks never contain the content */
+			note.content = "";
+			note.__isset.content = false;
+			result.notes.push_back(note);
+			result.chunkHighUSN = note.updateSequenceNum;
+			result.__isset.chunkHighUSN = true;
+		}
+		result.__isset.notes = true;
+
+		fprintf(stderr, "INFO: getSyncChunk after USN %i, sent %u of %u notes\n",
+				after_usn, (unsigned) result.notes.size(), (unsigned) changed.size());
+	}
+
+	void
+	getNoteContent (std::string &result, const std::string &token, const evernote::edam::Guid &guid)
+	{
+		result = find(guid).content;
+	}
+
+	void
+	createNote (Note &result, const std::string &token, const Note &note)
+	{
+		char guid[64];
+
+		result = note;
+		snprintf(guid, sizeof(guid), "00000000-0000-4000-9000-%012x", update_count + 1);
+		result.guid = guid;
+		result.__isset.guid = true;
+		store(result);
+		strip_content(result);
+	}
+
+	void
+	updateNote (Note &result, const std::string &token, const Note &note)
+	{
+		result = find(note.guid);
+		if (note.__isset.title) {
+			result.title = note.title;
+		}
+		if (note.__isset.content) {
+			result.content = note.content;
+		}
+		if (note.__isset.active) {
+			result.active = note.active;
+			result.__isset.active = true;
+		}
+		store(result);
+		strip_content(result);
+	}
+
+	void
+	getResourceByHash (evernote::edam::Resource &result, const std::string &token, const evernote::edam::Guid &note_guid,
+			const std::string &hash, const bool with_data, const bool with_recognition, const bool with_alternate_data)
+	{
+		/* Stub notes have no resources */
+		evernote::edam::EDAMNotFoundException e;
+		e.identifier = "Resource.hash";
+		e.__isset.identifier = true;
+		throw e;
+	}
+
+private:
+	std::map<std::string, Note> notes;
+	int32_t update_count;
+	int32_t min_usn;
+
+	/* Every change gets the next USN of the account */
+	void
+	store (Note &note)
+	{
+		note.updateSequenceNum = ++update_count;
+		note.__isset.updateSequenceNum = true;
+		note.updated = (int64_t) time(NULL) * 1000;
+		note.__isset.updated = true;
+		if (!note.__isset.created) {
+			note.created = note.updated;
+			note.__isset.created = true;
+		}
+		notes[note.guid] = note;
+	}
+
+	const Note&
+	find (const std::string &guid)
+	{
+		std::map<std::string, Note>::const_iterator iter = notes.find(guid);
+
+		if (iter == notes.end()) {
+			evernote::edam::EDAMNotFoundException e;
+			e.identifier = "Note.guid";
+			e.__isset.identifier = true;
+			e.key = guid;
+			e.__isset.key = true;
+			throw e;
+		}
+		return iter->second;
+	}
+
+	static void
+	strip_content (Note &note)
+	{
+		note.content = "";
+		note.__isset.content = false;
+	}
+};
+
+/* An HTTP connection, requests arrive in pieces */
+struct Connection {
+	int fd;
+	std::string input;
+};
+
+static bool
+write_all (int fd, const char *data, size_t length)
+{
+	while (length > 0) {
+		ssize_t written = write(fd, data, length);
+		if (written < 0 && errno == EINTR) {
+			continue;
+		}
+		if (written <= 0) {
+			return false;
+		}
+		data += written;
+		length -= written;
+	}
+	return true;
+}
+
+/* Returns the Content-Length of the header block, or -1 */
+static long
+get_content_length (const std::string &headers)
+{
+	size_t pos = 0;
+
+	while ((pos = headers.find("\r\n", pos)) != std::string::npos) {
+		pos += 2;
+		if (strncasecmp(headers.c_str() + pos, "Content-Length:", strlen("Content-Length:")) == 0) {
+			return atol(headers.c_str() + pos + strlen("Content-Length:"));
+		}
+	}
+	return -1;
+}
+
+/*
+ * Answers every complete request in the input of the connection. Returns
+ * false if the connection should be closed.
+ */
+static bool
+handle_requests (Connection &connection, NoteStoreProcessor &processor)
+{
+	while (true) {
+		size_t header_end = connection.input.find("\r\n\r\n");
+		long length;
+
+		if (header_end == std::string::npos) {
+			return true;
+		}
+
+		length = get_content_length(connection.input.substr(0, header_end + 2));
+		if (length < 0) {
+			fprintf(stderr, "ERROR: Request without Content-Length\n");
+			return false;
+		}
+		if (connection.input.size() < header_end + 4 + length) {
+			return true;
+		}
+
+		shared_ptr<TMemoryBuffer> in(new TMemoryBuffer());
+		shared_ptr<TMemoryBuffer> out(new TMemoryBuffer());
+		shared_ptr<TProtocol> in_protocol(new TBinaryProtocol(in));
+		shared_ptr<TProtocol> out_protocol(new TBinaryProtocol(out));
+
+		in->write((const uint8_t*) connection.input.data() + header_end + 4, length);
+		connection.input.erase(0, header_end + 4 + length);
+
+		try {
+			processor.process(in_protocol, out_protocol);
+		} catch (TException &e) {
+			fprintf(stderr, "ERROR: Could not process request: %s\n", e.what());
+			return false;
+		}
+
+		std::string body = out->getBufferAsString();
+		char header[256];
+		snprintf(header, sizeof(header),
+				"HTTP/1.1 200 OK\r\n"
+				"Content-Type: application/x-thrift\r\n"
+				"Content-Length: %lu\r\n"
+				"\r\n", (unsigned long) body.size());
+
+		if (!write_all(connection.fd, header, strlen(header)) || !write_all(connection.fd, body.data(), body.size())) {
+			return false;
+		}
+	}
+}
+
+static int
+listen_on (int port)
+{
+	struct sockaddr_in address;
+	int fd, on = 1;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(fd, (struct sockaddr*) &address, sizeof(address)) != 0 || listen(fd, MAX_CONNECTIONS) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void
+usage (const char *name)
+{
+	fprintf(stderr, "Usage: %s [--port PORT] [--notes N] [--min-usn USN]\n", name);
+}
+
+int
+main (int argc, char *argv[])
+{
+	std::vector<Connection> connections;
+	int port = 19800, n_notes = 0, min_usn = 0;
+	int listen_fd, i;
+
+	for (i = 1; i < argc; i++) {
+		if (i + 1 < argc && strcmp(argv[i], "--port") == 0) {
+			port = atoi(argv[++i]);
+		} else if (i + 1 < argc && strcmp(argv[i], "--notes") == 0) {
+			n_notes = atoi(argv[++i]);
+		} else if (i + 1 < argc && strcmp(argv[i], "--min-usn") == 0) {
+			min_usn = atoi(argv[++i]);
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	shared_ptr<StubNoteStore> note_store(new StubNoteStore(n_notes, min_usn));
+	NoteStoreProcessor processor(note_store);
+
+	listen_fd = listen_on(port);
+	if (listen_fd < 0) {
+		fprintf(stderr, "ERROR: Could not listen on port %i: %s\n", port, strerror(errno));
+		return 1;
+	}
+	printf("READY\n");
+	fflush(stdout);
+
+	while (true) {
+		std::vector<struct pollfd> fds(connections.size() + 1);
+		size_t n;
+
+		fds[0].fd = listen_fd;
+		fds[0].events = POLLIN;
+		for (n = 0; n < connections.size(); n++) {
+			fds[n + 1].fd = connections[n].fd;
+			fds[n + 1].events = POLLIN;
+		}
+
+		if (poll(&fds[0], fds.size(), -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			fprintf(stderr, "ERROR: poll failed: %s\n", strerror(errno));
+			return 1;
+		}
+
+		/* Backwards, so closed connections can be removed right away */
+		for (n = connections.size(); n > 0; n--) {
+			Connection &connection = connections[n - 1];
+			char buffer[16384];
+			ssize_t length;
+
+			if (fds[n].revents == 0) {
+				continue;
+			}
+
+			length = read(connection.fd, buffer, sizeof(buffer));
+			if (length > 0) {
+				connection.input.append(buffer, length);
+			}
+			if (length <= 0 || !handle_requests(connection, processor)) {
+				close(connection.fd);
+				connections.erase(connections.begin() + (n - 1));
+			}
+		}
+
+		if (fds[0].revents & POLLIN) {
+			Connection connection;
+			connection.fd = accept(listen_fd, NULL, NULL);
+			if (connection.fd >= 0) {
+				connections.push_back(connection);
+			}
+		}
+	}
+
+	return 0;
+}
@@ -27,6 +27,8 @@
 #define __USE_XOPEN
 #endif
 #include <time.h>
+#include <stdio.h>
+#include <string.h>
 
 #define CONBOY_MIDGARD_NOTE_NAME "org_gnome_tomboy_note"
 
@@ -37,8 +39,41 @@ G_DEFINE_TYPE(ConboyMidgardStoragePlugin, conboy_midgard_storage_plugin, CONBOY_
 static time_t _time_t_from_iso8601 (const gchar *time_string)
 {
 	struct tm _time;
-  	strptime(time_string, "%Y-%m-%d %H:%M:%S", &_time);
-	return mktime(&_time);
+
+	memset (&_time, 0, sizeof (struct tm));
+	_time.tm_isdst = -1;
+
+	if (time_string == NULL || sscanf (time_string, "%d-%d-%d %d:%d:%d",
+				&_time.tm_year, &_time.tm_mon, &_time.tm_mday,
+				&_time.tm_hour, &_time.tm_min, &_time.tm_sec) != 6)
+		return 0;
+
+	_time.tm_year -= 1900;
+	_time.tm_mon -= 1;
+
+	return mktime (&_time);
+}
+
+/* Reads a MIDGARD_TYPE_TIMESTAMP property of the metadata as time_t */
+static time_t
+__metadata_get_time (MidgardMetadata *metadata, const gchar *property)
+{
+	GValue val = {0, };
+	GValue str = {0, };
+	time_t result;
+
+	g_value_init (&val, MIDGARD_TYPE_TIMESTAMP);
+	g_value_init (&str, G_TYPE_STRING);
+
+	g_object_get_property (G_OBJECT (metadata), property, &val);
+	g_value_transform ((const GValue *) &val, &str);
+
+	result = _time_t_from_iso8601 (g_value_get_string (&str));
+
+	g_value_unset (&val);
+	g_value_unset (&str);
+
+	return result;
 }
 
 static ConboyNote *
@@ -50,21 +85,15 @@ __conboy_note_from_midgard_object (MidgardObject *mgdobject)
 	gchar *content = NULL;
 	gchar *title = NULL;
 
-	time_t last_change_date;
-        time_t last_metadata_change_date;
-        time_t create_date;
-        GList  *tags;
-
 	gboolean open_on_startup;
-	gboolean pinned;
 	gint cursor_position;
 	gint width;
 	gint height;
 	gint x;
 	gint y;
 
-	gdouble note_version;
-	gdouble content_version;
+	time_t created = 0;
+	time_t revised = 0;
 
 	g_object_get (mgdobject,
 			"guid", &guid,
@@ -79,23 +108,14 @@ __conboy_note_from_midgard_object (MidgardObject *mgdobject)
 			NULL);
 
 	/* Get metadata datetimes */
-	MidgardMetadata *metadata;
+	MidgardMetadata *metadata = NULL;
 	g_object_get (mgdobject, "metadata", &metadata, NULL);
 
-	GValue created_val = {0, };
-	g_value_init (&created_val, MIDGARD_TYPE_TIMESTAMP);
-	GValue updated_val = {0, };
-	g_value_init (&updated_val, MIDGARD_TYPE_TIMESTAMP);
-	GValue created_str = {0, };
-	g_value_init (&created_str, G_TYPE_STRING);
-	GValue updated_str = {0, };
-	g_value_init (&updated_str, G_TYPE_STRING);
-
-	g_object_get_property (G_OBJECT (metadata), "created", &created_val);
-	g_object_get_property (G_OBJECT (metadata), "revised", &updated_val);
-
-	g_value_transform ((const GValue *) &created_val, &created_str);
-	g_value_transform ((const GValue *) &updated_val, &updated_str);
+	if (metadata != NULL) {
+		created = __metadata_get_time (metadata, "created");
+		revised = __metadata_get_time (metadata, "revised");
+		g_object_unref (metadata);
+	}
 
 	/* Create new conboy instance */
 	ConboyNote *note = conboy_note_new();
@@ -111,101 +131,265 @@ __conboy_note_from_midgard_object (MidgardObject *mgdobject)
 			"height", height,
 			"x", x,
 			"y", y,
-			"change-date", _time_t_from_iso8601 (g_value_get_string (&updated_str)),
-        	"metadata-change-date", _time_t_from_iso8601 (g_value_get_string (&updated_str)),
-        	"create-date", _time_t_from_iso8601 (g_value_get_string (&created_str)),
+			"change-date", revised,
+			"metadata-change-date", revised,
+			"create-date", created,
 			NULL);
 
 	g_free (guid);
 	g_free (content);
 	g_free (title);
 
-	g_value_unset (&updated_val);
-	g_value_unset (&created_val);
-	g_value_unset (&updated_str);
-	g_value_unset (&created_str);
-
 	return note;
 }
 
-static ConboyNote*
-_conboy_midgard_storage_plugin_note_load (ConboyStoragePlugin *self, const gchar *uuid)
+/*
+ * Takes over the reference of mgdobject and keeps it in the cache, so
+ * later loads and saves of the same note don't need to query it again.
+ */
+static void
+__cache_object (ConboyMidgardStoragePlugin *self, MidgardObject *mgdobject)
 {
-	g_return_val_if_fail(self != NULL, FALSE);
-	g_return_val_if_fail(uuid != NULL, FALSE);
+	gchar *guid = NULL;
 
-	g_return_val_if_fail(CONBOY_IS_MIDGARD_STORAGE_PLUGIN(self), FALSE);
+	g_object_get (mgdobject, "guid", &guid, NULL);
+
+	if (guid == NULL || *guid == '\0') {
+		g_free (guid);
+		g_object_unref (mgdobject);
+		return;
+	}
+
+	/* The table owns the guid */
+	g_hash_table_insert (self->objects, guid, mgdobject);
+}
+
+/*
+ * Returns the cached object of the note with the given guid and queries
+ * it if it is not cached yet. Returns NULL if there is no such object.
+ */
+static MidgardObject*
+__get_object (ConboyMidgardStoragePlugin *self, const gchar *guid)
+{
+	MidgardObject *mgdobject;
+
+	if (guid == NULL || *guid == '\0')
+		return NULL;
+
+	mgdobject = g_hash_table_lookup (self->objects, guid);
+	if (mgdobject != NULL)
+		return mgdobject;
 
-	/* Get Midgard object and its properties */
 	GValue gval = {0, };
 	g_value_init (&gval, G_TYPE_STRING);
+	g_value_set_string (&gval, guid);
 
-	if (uuid) g_value_set_string (&gval, uuid);
-
-	MidgardObject *mgdobject = midgard_object_new (mgd_global, CONBOY_MIDGARD_NOTE_NAME, uuid ? &gval : NULL);
+	mgdobject = midgard_object_new (mgd_global, CONBOY_MIDGARD_NOTE_NAME, &gval);
 
 	g_value_unset (&gval);
 
-	/* Create new conboy instance */
-	ConboyNote *note = __conboy_note_from_midgard_object (mgdobject);
+	if (mgdobject == NULL)
+		return NULL;
 
-	CONBOY_MIDGARD_STORAGE_PLUGIN (self)->object = mgdobject;
+	g_hash_table_insert (self->objects, g_strdup (guid), mgdobject);
 
-	return note;
+	return mgdobject;
 }
 
-static gboolean
-_conboy_midgard_storage_plugin_note_save (ConboyStoragePlugin *self, ConboyNote *note)
+/*
+ * Runs the query builder for all notes. If guids is not NULL, only the
+ * notes with those guids are queried. All returned objects are cached.
+ */
+static GObject**
+__query_objects (ConboyMidgardStoragePlugin *self, GSList *guids, guint *n_objects)
+{
+	MidgardQueryBuilder *builder = midgard_query_builder_new (mgd_global, CONBOY_MIDGARD_NOTE_NAME);
+	GObject **objects;
+	guint i;
+
+	*n_objects = 0;
+
+	if (guids != NULL) {
+		GValueArray *array = g_value_array_new (g_slist_length (guids));
+		GValue gval = {0, };
+		GValue aval = {0, };
+
+		g_value_init (&gval, G_TYPE_STRING);
+		for (; guids != NULL; guids = guids->next) {
+			g_value_set_string (&gval, guids->data);
+			g_value_array_append (array, &gval);
+		}
+		g_value_unset (&gval);
+
+		g_value_init (&aval, G_TYPE_VALUE_ARRAY);
+		g_value_take_boxed (&aval, array);
+		midgard_query_builder_add_constraint (builder, "guid", "IN", &aval);
+		g_value_unset (&aval);
+	}
+
+	objects = midgard_query_builder_execute (builder, n_objects);
+
+	g_object_unref (builder);
+
+	if (!objects)
+		return NULL;
+
+	for (i = 0; i < *n_objects; i++) {
+		__cache_object (self, MIDGARD_OBJECT (g_object_ref (objects[i])));
+	}
+
+	return objects;
+}
+
+static void
+__free_objects (GObject **objects, guint n_objects)
+{
+	guint i;
+
+	for (i = 0; i < n_objects; i++) {
+		g_object_unref (objects[i]);
+	}
+
+	g_free (objects);
+}
+
+static ConboyNote*
+_conboy_midgard_storage_plugin_note_load (ConboyStoragePlugin *self, const gchar *uuid)
 {
 	g_return_val_if_fail(self != NULL, FALSE);
-	g_return_val_if_fail(note != NULL, FALSE);
+	g_return_val_if_fail(uuid != NULL, FALSE);
 
 	g_return_val_if_fail(CONBOY_IS_MIDGARD_STORAGE_PLUGIN(self), FALSE);
-	g_return_val_if_fail(CONBOY_IS_NOTE(note), FALSE);
 
-	MidgardObject *mgdobject = CONBOY_MIDGARD_STORAGE_PLUGIN (self)->object;
+	MidgardObject *mgdobject = __get_object (CONBOY_MIDGARD_STORAGE_PLUGIN (self), uuid);
+
+	if (mgdobject == NULL)
+		return NULL;
+
+	return __conboy_note_from_midgard_object (mgdobject);
+}
+
+static GSList*
+_conboy_midgard_storage_plugin_note_load_many (ConboyStoragePlugin *self, GSList *guids)
+{
+	g_return_val_if_fail(self != NULL, NULL);
+	g_return_val_if_fail(CONBOY_IS_MIDGARD_STORAGE_PLUGIN(self), NULL);
+
+	ConboyMidgardStoragePlugin *plugin = CONBOY_MIDGARD_STORAGE_PLUGIN (self);
+	GSList *missing = NULL;
+	GSList *result = NULL;
+	GSList *iter;
+
+	for (iter = guids; iter != NULL; iter = iter->next) {
+		if (g_hash_table_lookup (plugin->objects, iter->data) == NULL)
+			missing = g_slist_prepend (missing, iter->data);
+	}
+
+	/* Fetch everything that is not cached in one query */
+	if (missing != NULL) {
+		guint n_objects;
+		GObject **objects = __query_objects (plugin, missing, &n_objects);
+		if (objects)
+			__free_objects (objects, n_objects);
+		g_slist_free (missing);
+	}
+
+	for (iter = guids; iter != NULL; iter = iter->next) {
+		MidgardObject *mgdobject = g_hash_table_lookup (plugin->objects, iter->data);
+		if (mgdobject != NULL)
+			result = g_slist_prepend (result, __conboy_note_from_midgard_object (mgdobject));
+	}
+
+	return g_slist_reverse (result);
+}
 
+static gboolean
+__save_note (ConboyMidgardStoragePlugin *self, ConboyNote *note)
+{
+	MidgardObject *mgdobject = __get_object (self, note->guid);
+	gboolean create = (mgdobject == NULL);
 	gchar *guid = NULL;
-	gchar *title = NULL;
-	gchar *content = NULL;
 
-	/* Get note properties */
-	g_object_get (note,
-			"title", &title,
-			"content", &content, NULL);
+	if (create)
+		mgdobject = midgard_object_new (mgd_global, CONBOY_MIDGARD_NOTE_NAME, NULL);
 
 	/* Set Midgard object properties */
 	g_object_set (mgdobject,
-			"title", title,
-			"text", content, NULL);
+			"title", note->title,
+			"text", conboy_note_get_content (note),
+			"openonstartup", note->open_on_startup,
+			"cursorposition", note->cursor_position,
+			"width", note->width,
+			"height", note->height,
+			"x", note->x,
+			"y", note->y,
+			NULL);
 
-	g_free (title);
-	g_free (content);
+	if (!create)
+		return midgard_object_update (mgdobject);
+
+	if (!midgard_object_create (mgdobject)) {
+		g_object_unref (mgdobject);
+		return FALSE;
+	}
 
-	/* Get guid to check if to create or update */
 	g_object_get (mgdobject, "guid", &guid, NULL);
+	g_object_set (note, "guid", guid, NULL);
+	g_free (guid);
 
-	gboolean created = FALSE;
-	/* Create case */
-	if (!guid || (guid && *guid == '\0')) {
+	__cache_object (self, mgdobject);
 
-		created = midgard_object_create (mgdobject);
+	return TRUE;
+}
 
-		g_free (guid);
+static gboolean
+_conboy_midgard_storage_plugin_note_save (ConboyStoragePlugin *self, ConboyNote *note)
+{
+	g_return_val_if_fail(self != NULL, FALSE);
+	g_return_val_if_fail(note != NULL, FALSE);
 
-		if (created) {
+	g_return_val_if_fail(CONBOY_IS_MIDGARD_STORAGE_PLUGIN(self), FALSE);
+	g_return_val_if_fail(CONBOY_IS_NOTE(note), FALSE);
 
-			g_object_get (mgdobject, "guid", &guid, NULL);
-			g_object_set (note, "guid", guid, NULL);
-			g_free (guid);
+	return __save_note (CONBOY_MIDGARD_STORAGE_PLUGIN (self), note);
+}
 
-			return TRUE;
-		}
+static gboolean
+_conboy_midgard_storage_plugin_note_save_many (ConboyStoragePlugin *self, GSList *notes)
+{
+	g_return_val_if_fail(self != NULL, FALSE);
+	g_return_val_if_fail(CONBOY_IS_MIDGARD_STORAGE_PLUGIN(self), FALSE);
+
+	MidgardTransaction *trns = midgard_transaction_new (mgd_global);
+	gboolean result = TRUE;
 
+	if (!midgard_transaction_begin (trns)) {
+		g_printerr("ERROR: Could not begin transaction: %s\n", midgard_connection_get_error_string (mgd_global));
+		g_object_unref (trns);
 		return FALSE;
 	}
 
-	return midgard_object_update (mgdobject);
+	for (; notes != NULL; notes = notes->next) {
+		if (!__save_note (CONBOY_MIDGARD_STORAGE_PLUGIN (self), CONBOY_NOTE (notes->data))) {
+			result = FALSE;
+			break;
+		}
+	}
+
+	if (result) {
+		result = midgard_transaction_commit (trns);
+	} else {
+		midgard_transaction_rollback (trns);
+	}
+
+	if (!result) {
+		/* The cached objects may hold changes that never made it to the database */
+		g_hash_table_remove_all (CONBOY_MIDGARD_STORAGE_PLUGIN (self)->objects);
+	}
+
+	g_object_unref (trns);
+
+	return result;
 }
 
 static gboolean
@@ -217,12 +401,21 @@ _conboy_midgard_storage_plugin_note_delete (ConboyStoragePlugin *self, ConboyNot
 	g_return_val_if_fail(CONBOY_IS_MIDGARD_STORAGE_PLUGIN(self), FALSE);
 	g_return_val_if_fail(CONBOY_IS_NOTE(note), FALSE);
 
-	MidgardObject *mgdobject = CONBOY_MIDGARD_STORAGE_PLUGIN (self)->object;
+	ConboyMidgardStoragePlugin *plugin = CONBOY_MIDGARD_STORAGE_PLUGIN (self);
+	MidgardObject *mgdobject = __get_object (plugin, note->guid);
+
+	if (mgdobject == NULL)
+		return FALSE;
 
 	/* Use this one if you want to have possibility to undelete */
 	/* return midgard_object_delete (mgdobject); */
 
-	return midgard_object_purge (mgdobject, FALSE);
+	if (!midgard_object_purge (mgdobject, FALSE))
+		return FALSE;
+
+	g_hash_table_remove (plugin->objects, note->guid);
+
+	return TRUE;
 }
 
 static GSList*
@@ -231,11 +424,8 @@ _conboy_midgard_storage_plugin_note_list (ConboyStoragePlugin *self)
 	g_return_val_if_fail(self != NULL, FALSE);
 	g_return_val_if_fail(CONBOY_IS_MIDGARD_STORAGE_PLUGIN(self), FALSE);
 
-	MidgardQueryBuilder *builder = midgard_query_builder_new (mgd_global, CONBOY_MIDGARD_NOTE_NAME);
 	guint n_objects;
-	GObject **objects = midgard_query_builder_execute (builder, &n_objects);
-
-	g_object_unref (builder);
+	GObject **objects = __query_objects (CONBOY_MIDGARD_STORAGE_PLUGIN (self), NULL, &n_objects);
 
 	if (!objects)
 		return NULL;
@@ -247,10 +437,9 @@ _conboy_midgard_storage_plugin_note_list (ConboyStoragePlugin *self)
 
 		ConboyNote *note = __conboy_note_from_midgard_object (MIDGARD_OBJECT(objects[i]));
 		slist = g_slist_prepend (slist, (gpointer) note);
-		g_object_unref (objects[i]);
 	}
 
-	g_free (objects);
+	__free_objects (objects, n_objects);
 
 	return g_slist_reverse (slist);
 }
@@ -261,11 +450,8 @@ _conboy_midgard_storage_plugin_note_list_ids (ConboyStoragePlugin *self)
 	g_return_val_if_fail(self != NULL, FALSE);
 	g_return_val_if_fail(CONBOY_IS_MIDGARD_STORAGE_PLUGIN(self), FALSE);
 
-	MidgardQueryBuilder *builder = midgard_query_builder_new (mgd_global, CONBOY_MIDGARD_NOTE_NAME);
 	guint n_objects;
-	GObject **objects = midgard_query_builder_execute (builder, &n_objects);
-
-	g_object_unref (builder);
+	GObject **objects = __query_objects (CONBOY_MIDGARD_STORAGE_PLUGIN (self), NULL, &n_objects);
 
 	if (!objects)
 		return NULL;
@@ -280,7 +466,7 @@ _conboy_midgard_storage_plugin_note_list_ids (ConboyStoragePlugin *self)
 		slist = g_slist_prepend (slist, (gpointer) guid);
 	}
 
-	g_free (objects);
+	__free_objects (objects, n_objects);
 
 	return g_slist_reverse (slist);
 }
@@ -307,6 +493,11 @@ _conboy_midgard_storage_plugin_dispose(GObject *object)
 	g_printerr("INFO: Dispose() called on Midgard plugin\n");
 	ConboyMidgardStoragePlugin *self = CONBOY_MIDGARD_STORAGE_PLUGIN(object);
 
+	if (self->objects != NULL) {
+		g_hash_table_destroy (self->objects);
+		self->objects = NULL;
+	}
+
 	G_OBJECT_CLASS(conboy_midgard_storage_plugin_parent_class)->dispose(object);
 }
 
@@ -327,6 +518,9 @@ conboy_midgard_storage_plugin_class_init (ConboyMidgardStoragePluginClass *klass
 	storage_plugin_class->delete   = _conboy_midgard_storage_plugin_note_delete;
 	storage_plugin_class->list     = _conboy_midgard_storage_plugin_note_list;
 	storage_plugin_class->list_ids = _conboy_midgard_storage_plugin_note_list_ids;
+
+	storage_plugin_class->load_many = _conboy_midgard_storage_plugin_note_load_many;
+	storage_plugin_class->save_many = _conboy_midgard_storage_plugin_note_save_many;
 }
 
 static void
@@ -335,6 +529,9 @@ conboy_midgard_storage_plugin_init (ConboyMidgardStoragePlugin *self)
 	g_printerr("Hello from Midgard plugin\n");
 	CONBOY_PLUGIN(self)->has_settings = FALSE;
 
+	/* guid -> MidgardObject */
+	self->objects = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+
 	/* Initialize midgard */
 	midgard_init();
 
@@ -361,9 +558,6 @@ conboy_midgard_storage_plugin_init (ConboyMidgardStoragePlugin *self)
 	/* Check if database already exists */
 	if (g_file_test (db_file_exists, G_FILE_TEST_EXISTS)) { /* HACK */
 
-		MidgardObject *mgdobject = midgard_object_new (mgd_global, CONBOY_MIDGARD_NOTE_NAME, NULL);
-		CONBOY_MIDGARD_STORAGE_PLUGIN (self)->object = mgdobject;
-
 		g_free (db_file_exists);
 
 		return;
@@ -387,9 +581,6 @@ conboy_midgard_storage_plugin_init (ConboyMidgardStoragePlugin *self)
 	g_file_set_contents (db_file_exists, "", 1, NULL);
 	g_free (db_file_exists);
 
-	MidgardObject *mgdobject = midgard_object_new (mgd_global, CONBOY_MIDGARD_NOTE_NAME, NULL);
-	CONBOY_MIDGARD_STORAGE_PLUGIN (self)->object = mgdobject;
-
 	/* Hide the banner again */
 	gtk_widget_destroy(banner);
 }
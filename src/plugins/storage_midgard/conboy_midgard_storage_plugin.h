@@ -36,7 +36,7 @@ typedef struct _ConboyMidgardStoragePluginClass ConboyMidgardStoragePluginClass;
 
 struct _ConboyMidgardStoragePlugin {
 	ConboyStoragePlugin parent;
-	MidgardObject *object;
+	GHashTable *objects;
 };
 
 struct _ConboyMidgardStoragePluginClass {
@@ -0,0 +1,1370 @@
+/*
+ * Copyright (C) 2009 Cornelius Hald <hald@icandy.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+#include <gtk/gtk.h>
+
+#include "../../localisation.h"
+#include "../../conboy_note.h"
+#include "../../conboy_storage_plugin.h"
+#include "../../conboy_xml_note.h"
+#include "conboy_pack_storage_plugin.h"
+
+/*
+ * All notes live in a single file. A save appends the complete note as a
+ * new record, a delete appends a tombstone. The index in memory maps each
+ * guid to the offset of its latest record.
+ *
+ * File layout (native byte order, the file never leaves the device):
+ *
+ *   "CBYPACK1"
+ *   records:
+ *     RecordHeader
+ *     guid (not terminated)
+ *     data
+ *
+ * The data of a note record is the note in the Tomboy .note format, so
+ * importing and exporting .note files is a plain copy.
+ *
+ * sync() appends a checkpoint with the offsets of all live records and a
+ * trailer pointing to it. If the file ends with a trailer, the index is
+ * read from the checkpoint. Otherwise, e.g. after a crash, all records
+ * are scanned and a torn record at the end is cut off.
+ *
+ * Once superseded records make up more than half of the file, the live
+ * records are copied to a new file in the background.
+ */
+
+#define PACK_FILE "notes.pack"
+#define PACK_MAGIC "CBYPACK1"
+#define PACK_MAGIC_LENGTH 8
+#define RECORD_MAGIC 0x4b504243
+
+/* Compact when more than half of the file, but at least this much, is dead */
+#define COMPACT_MIN_DEAD (256 * 1024)
+
+#define CHECKSUM_INIT 2166136261U
+
+typedef enum {
+	RECORD_NOTE = 1,
+	RECORD_DELETE,
+	RECORD_CHECKPOINT,
+	RECORD_TRAILER
+} RecordType;
+
+typedef struct {
+	guint32 magic;
+	guint32 type;
+	guint32 guid_length;
+	guint32 data_length;
+	guint32 checksum;    /* of guid and data */
+	guint32 reserved;
+} RecordHeader;
+
+typedef struct {
+	gint64  dead;
+	guint32 n_entries;
+	guint32 reserved;
+	/* followed by n_entries offsets of note records */
+} CheckpointHeader;
+
+typedef struct {
+	gint64  offset;
+	guint32 length;      /* of the complete record */
+} PackEntry;
+
+struct _PackFile {
+	int         fd;
+	GHashTable *entries;            /* guid -> PackEntry */
+	gint64      end;
+	gint64      dead;               /* bytes of superseded records */
+	gint64      checkpoint_end;     /* end of the last trailer, 0 if none */
+	gint64      checkpoint_length;  /* of the last checkpoint and trailer */
+};
+
+#define RECORD_LENGTH(header) (sizeof(RecordHeader) + (header)->guid_length + (header)->data_length)
+#define RECORD_DATA(record, header) ((record) + sizeof(RecordHeader) + (header)->guid_length)
+#define TRAILER_LENGTH ((gint64) (sizeof(RecordHeader) + sizeof(gint64)))
+
+G_DEFINE_TYPE(ConboyPackStoragePlugin, conboy_pack_storage_plugin, CONBOY_TYPE_STORAGE_PLUGIN);
+
+
+/*
+ * Records
+ */
+
+/* 32 bit FNV-1a over guid and data, which follow the header */
+static guint32
+record_checksum (const gchar *record, const RecordHeader *header)
+{
+	const guchar *pos = (const guchar*) record + sizeof(RecordHeader);
+	const guchar *end = pos + header->guid_length + header->data_length;
+	guint32 hash = CHECKSUM_INIT;
+
+	while (pos < end) {
+		hash ^= *pos++;
+		hash *= 16777619;
+	}
+
+	return hash;
+}
+
+/*
+ * Reads the header of the record at offset. Returns FALSE if there is no
+ * complete record. The checksum is only verified if check is TRUE.
+ */
+static gboolean
+read_header (const gchar *data, gint64 length, gint64 offset, RecordHeader *header, gboolean check)
+{
+	if (offset < 0 || length - offset < (gint64) sizeof(RecordHeader)) {
+		return FALSE;
+	}
+
+	memcpy(header, data + offset, sizeof(RecordHeader));
+
+	if (header->magic != RECORD_MAGIC) {
+		return FALSE;
+	}
+	if ((gint64) header->guid_length + header->data_length > length - offset - (gint64) sizeof(RecordHeader)) {
+		return FALSE;
+	}
+	if (check && record_checksum(data + offset, header) != header->checksum) {
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/*
+ * Starts a new record. The data is appended to the returned string,
+ * then record_finish() fills in the header.
+ */
+static GString*
+record_new (RecordType type, const gchar *guid)
+{
+	RecordHeader header;
+	GString *record = g_string_sized_new(4096);
+
+	memset(&header, 0, sizeof(RecordHeader));
+	header.magic = RECORD_MAGIC;
+	header.type = type;
+	header.guid_length = strlen(guid);
+
+	g_string_append_len(record, (const gchar*) &header, sizeof(RecordHeader));
+	g_string_append_len(record, guid, header.guid_length);
+
+	return record;
+}
+
+static void
+record_finish (GString *record)
+{
+	RecordHeader header;
+
+	memcpy(&header, record->str, sizeof(RecordHeader));
+	header.data_length = record->len - sizeof(RecordHeader) - header.guid_length;
+	header.checksum = record_checksum(record->str, &header);
+	memcpy(record->str, &header, sizeof(RecordHeader));
+}
+
+static int
+record_output_write (void *context, const char *buffer, int length)
+{
+	g_string_append_len((GString*) context, buffer, length);
+	return length;
+}
+
+static int
+record_output_close (void *context)
+{
+	return 0;
+}
+
+/*
+ * Serializes the note straight into a new record.
+ */
+static GString*
+note_record_new (ConboyNote *note)
+{
+	GString *record = record_new(RECORD_NOTE, note->guid);
+	xmlOutputBuffer *buffer;
+
+	buffer = xmlOutputBufferCreateIO(record_output_write, record_output_close, record, NULL);
+	if (buffer == NULL || !conboy_xml_note_write(note, buffer)) {
+		g_printerr("ERROR: Couldn't serialize note %s\n", note->guid);
+		g_string_free(record, TRUE);
+		return NULL;
+	}
+
+	record_finish(record);
+	return record;
+}
+
+
+/*
+ * Pack files
+ */
+
+static gboolean
+write_all (int fd, const gchar *data, gsize length, gint64 offset)
+{
+	while (length > 0) {
+		ssize_t written = pwrite(fd, data, length, offset);
+		if (written < 0) {
+			if (errno == EINTR) continue;
+			return FALSE;
+		}
+		data += written;
+		length -= written;
+		offset += written;
+	}
+	return TRUE;
+}
+
+static gboolean
+read_all (int fd, gchar *data, gsize length, gint64 offset)
+{
+	while (length > 0) {
+		ssize_t n = pread(fd, data, length, offset);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return FALSE;
+		}
+		if (n == 0) {
+			return FALSE;
+		}
+		data += n;
+		length -= n;
+		offset += n;
+	}
+	return TRUE;
+}
+
+static PackFile*
+pack_file_new (int fd)
+{
+	PackFile *pack = g_new0(PackFile, 1);
+	pack->fd = fd;
+	pack->entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	pack->end = PACK_MAGIC_LENGTH;
+	return pack;
+}
+
+static void
+pack_file_free (PackFile *pack)
+{
+	if (pack->fd >= 0) {
+		close(pack->fd);
+	}
+	g_hash_table_destroy(pack->entries);
+	g_free(pack);
+}
+
+/*
+ * Updates the index for the record at offset. The guid of the record
+ * does not need to be terminated. Checkpoints and trailers are not
+ * accounted here.
+ */
+static void
+pack_file_apply (PackFile *pack, const gchar *guid, gint64 offset, const RecordHeader *header)
+{
+	PackEntry *old;
+	PackEntry *entry;
+	gchar *key;
+
+	if (header->type != RECORD_NOTE && header->type != RECORD_DELETE) {
+		return;
+	}
+
+	key = g_strndup(guid, header->guid_length);
+
+	old = g_hash_table_lookup(pack->entries, key);
+	if (old != NULL) {
+		pack->dead += old->length;
+	}
+
+	if (header->type == RECORD_NOTE) {
+		entry = g_new(PackEntry, 1);
+		entry->offset = offset;
+		entry->length = RECORD_LENGTH(header);
+		g_hash_table_replace(pack->entries, key, entry);
+	} else {
+		/* The tombstone is only needed until the next compaction */
+		g_hash_table_remove(pack->entries, key);
+		pack->dead += RECORD_LENGTH(header);
+		g_free(key);
+	}
+}
+
+/*
+ * Appends one or more complete records and updates the index. The
+ * records are not synced, call pack_file_sync() for that.
+ */
+static gboolean
+pack_file_append (PackFile *pack, const gchar *record, gsize length)
+{
+	RecordHeader header;
+	gsize pos;
+
+	if (!write_all(pack->fd, record, length, pack->end)) {
+		g_printerr("ERROR: Couldn't append to pack: %s\n", g_strerror(errno));
+		/* Don't leave half a record behind */
+		if (ftruncate(pack->fd, pack->end) != 0) {
+			g_printerr("ERROR: Couldn't truncate pack: %s\n", g_strerror(errno));
+		}
+		return FALSE;
+	}
+
+	for (pos = 0; pos < length; pos += RECORD_LENGTH(&header)) {
+		memcpy(&header, record + pos, sizeof(RecordHeader));
+		pack_file_apply(pack, record + pos + sizeof(RecordHeader), pack->end + pos, &header);
+	}
+	pack->end += length;
+
+	return TRUE;
+}
+
+static gboolean
+pack_file_sync (PackFile *pack)
+{
+	if (fdatasync(pack->fd) != 0) {
+		g_printerr("ERROR: Couldn't sync pack: %s\n", g_strerror(errno));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static void
+append_offset (gpointer key, gpointer value, gpointer user_data)
+{
+	PackEntry *entry = (PackEntry*) value;
+	g_string_append_len((GString*) user_data, (const gchar*) &entry->offset, sizeof(gint64));
+}
+
+/*
+ * Appends a checkpoint of the index and a trailer pointing to it, then
+ * syncs the file. Does nothing if nothing was appended since the last
+ * checkpoint.
+ */
+static gboolean
+pack_file_write_checkpoint (PackFile *pack)
+{
+	CheckpointHeader checkpoint;
+	GString *record;
+	GString *trailer;
+	gint64 offset = pack->end;
+	gboolean result;
+
+	if (pack->checkpoint_end == pack->end) {
+		return TRUE;
+	}
+
+	/* The previous checkpoint is superseded by this one */
+	memset(&checkpoint, 0, sizeof(CheckpointHeader));
+	checkpoint.dead = pack->dead + pack->checkpoint_length;
+	checkpoint.n_entries = g_hash_table_size(pack->entries);
+
+	record = record_new(RECORD_CHECKPOINT, "");
+	g_string_append_len(record, (const gchar*) &checkpoint, sizeof(CheckpointHeader));
+	g_hash_table_foreach(pack->entries, append_offset, record);
+	record_finish(record);
+
+	trailer = record_new(RECORD_TRAILER, "");
+	g_string_append_len(trailer, (const gchar*) &offset, sizeof(gint64));
+	record_finish(trailer);
+
+	result = pack_file_append(pack, record->str, record->len)
+			&& pack_file_append(pack, trailer->str, trailer->len)
+			&& pack_file_sync(pack);
+
+	if (result) {
+		pack->dead = checkpoint.dead;
+		pack->checkpoint_end = pack->end;
+		pack->checkpoint_length = record->len + trailer->len;
+	}
+
+	g_string_free(record, TRUE);
+	g_string_free(trailer, TRUE);
+
+	return result;
+}
+
+/*
+ * Builds the index from the checkpoint the trailer at the end of the
+ * file points to. Returns FALSE if there is no valid trailer.
+ */
+static gboolean
+pack_file_read_checkpoint (PackFile *pack, const gchar *data, gint64 length)
+{
+	RecordHeader header;
+	CheckpointHeader checkpoint;
+	const gchar *offsets;
+	gint64 trailer = length - TRAILER_LENGTH;
+	gint64 offset;
+	guint i;
+
+	if (trailer < PACK_MAGIC_LENGTH || !read_header(data, length, trailer, &header, TRUE)) {
+		return FALSE;
+	}
+	if (header.type != RECORD_TRAILER || header.data_length != sizeof(gint64)) {
+		return FALSE;
+	}
+	memcpy(&offset, RECORD_DATA(data + trailer, &header), sizeof(gint64));
+
+	if (offset < PACK_MAGIC_LENGTH || !read_header(data, trailer, offset, &header, TRUE)) {
+		return FALSE;
+	}
+	if (header.type != RECORD_CHECKPOINT || header.data_length < sizeof(CheckpointHeader)) {
+		return FALSE;
+	}
+	memcpy(&checkpoint, RECORD_DATA(data + offset, &header), sizeof(CheckpointHeader));
+	if (header.data_length - sizeof(CheckpointHeader) != (gsize) checkpoint.n_entries * sizeof(gint64)) {
+		return FALSE;
+	}
+
+	offsets = RECORD_DATA(data + offset, &header) + sizeof(CheckpointHeader);
+
+	for (i = 0; i < checkpoint.n_entries; i++) {
+		RecordHeader note_header;
+		gint64 note_offset;
+
+		memcpy(&note_offset, offsets + i * sizeof(gint64), sizeof(gint64));
+
+		/* Checksums are not verified, that would mean reading the whole file */
+		if (note_offset < PACK_MAGIC_LENGTH || !read_header(data, offset, note_offset, &note_header, FALSE)
+				|| note_header.type != RECORD_NOTE) {
+			g_hash_table_remove_all(pack->entries);
+			return FALSE;
+		}
+		pack_file_apply(pack, data + note_offset + sizeof(RecordHeader), note_offset, &note_header);
+	}
+
+	pack->end = length;
+	pack->dead = checkpoint.dead;
+	pack->checkpoint_end = length;
+	pack->checkpoint_length = RECORD_LENGTH(&header) + TRAILER_LENGTH;
+
+	return TRUE;
+}
+
+/*
+ * Builds the index by reading all records. Stops at the first record that
+ * is incomplete or damaged.
+ */
+static void
+pack_file_scan (PackFile *pack, const gchar *data, gint64 length)
+{
+	RecordHeader header;
+	gint64 offset = PACK_MAGIC_LENGTH;
+
+	pack->dead = 0;
+	while (read_header(data, length, offset, &header, TRUE)) {
+		if (header.type == RECORD_NOTE || header.type == RECORD_DELETE) {
+			pack_file_apply(pack, data + offset + sizeof(RecordHeader), offset, &header);
+		} else {
+			/* Checkpoints are not used without the trailer at the end */
+			pack->dead += RECORD_LENGTH(&header);
+		}
+		offset += RECORD_LENGTH(&header);
+	}
+
+	pack->end = offset;
+}
+
+/*
+ * Opens or creates the pack and builds its index. Returns NULL if the
+ * file cannot be used.
+ */
+static PackFile*
+pack_file_open (const gchar *filename)
+{
+	PackFile *pack;
+	GMappedFile *file;
+	GError *error = NULL;
+	struct stat file_stat;
+	const gchar *data;
+	gint64 length;
+	int fd;
+
+	fd = g_open(filename, O_RDWR | O_CREAT, 0644);
+	if (fd < 0 || fstat(fd, &file_stat) != 0) {
+		g_printerr("ERROR: Couldn't open %s: %s\n", filename, g_strerror(errno));
+		if (fd >= 0) {
+			close(fd);
+		}
+		return NULL;
+	}
+
+	pack = pack_file_new(fd);
+
+	if (file_stat.st_size == 0) {
+		if (!write_all(fd, PACK_MAGIC, PACK_MAGIC_LENGTH, 0)) {
+			g_printerr("ERROR: Couldn't write %s: %s\n", filename, g_strerror(errno));
+			pack_file_free(pack);
+			return NULL;
+		}
+		return pack;
+	}
+
+	file = g_mapped_file_new(filename, FALSE, &error);
+	if (file == NULL) {
+		g_printerr("ERROR: Couldn't map %s: %s\n", filename, error->message);
+		g_error_free(error);
+		pack_file_free(pack);
+		return NULL;
+	}
+
+	data = g_mapped_file_get_contents(file);
+	length = g_mapped_file_get_length(file);
+
+	if (length < PACK_MAGIC_LENGTH || memcmp(data, PACK_MAGIC, PACK_MAGIC_LENGTH) != 0) {
+		/* Never touch a file we don't know */
+		g_printerr("ERROR: %s is not a note pack\n", filename);
+		g_mapped_file_free(file);
+		pack_file_free(pack);
+		return NULL;
+	}
+
+	if (!pack_file_read_checkpoint(pack, data, length)) {
+		g_printerr("WARN: %s has no valid checkpoint, scanning all records\n", filename);
+		pack_file_scan(pack, data, length);
+		if (pack->end < length) {
+			g_printerr("WARN: Cutting off %li damaged bytes at the end of %s\n", (glong) (length - pack->end), filename);
+			if (ftruncate(fd, pack->end) != 0) {
+				g_printerr("ERROR: Couldn't truncate %s: %s\n", filename, g_strerror(errno));
+			}
+		}
+	}
+
+	g_mapped_file_free(file);
+
+	return pack;
+}
+
+/*
+ * Reads and verifies the latest record of the note. Returns NULL if the
+ * note is not in the pack.
+ */
+static gchar*
+pack_file_read_record (PackFile *pack, const gchar *guid, RecordHeader *header)
+{
+	PackEntry *entry = g_hash_table_lookup(pack->entries, guid);
+	gchar *record;
+
+	if (entry == NULL) {
+		return NULL;
+	}
+
+	record = g_malloc(entry->length);
+	if (!read_all(pack->fd, record, entry->length, entry->offset)
+			|| !read_header(record, entry->length, 0, header, TRUE)) {
+		g_printerr("ERROR: Record of %s is damaged\n", guid);
+		g_free(record);
+		return NULL;
+	}
+
+	return record;
+}
+
+static void
+collect_entry (gpointer key, gpointer value, gpointer user_data)
+{
+	g_array_append_val((GArray*) user_data, *(PackEntry*) value);
+}
+
+static gint
+compare_offsets (gconstpointer a, gconstpointer b)
+{
+	gint64 offset_a = ((const PackEntry*) a)->offset;
+	gint64 offset_b = ((const PackEntry*) b)->offset;
+	return offset_a < offset_b ? -1 : offset_a > offset_b;
+}
+
+/*
+ * Returns the live records of the pack in file order.
+ */
+static GArray*
+pack_file_get_entries (PackFile *pack)
+{
+	GArray *entries = g_array_sized_new(FALSE, FALSE, sizeof(PackEntry), g_hash_table_size(pack->entries));
+	g_hash_table_foreach(pack->entries, collect_entry, entries);
+	g_array_sort(entries, compare_offsets);
+	return entries;
+}
+
+
+/*
+ * Public methods
+ */
+
+ConboyPackStoragePlugin*
+conboy_plugin_new ()
+{
+	return g_object_new(CONBOY_TYPE_PACK_STORAGE_PLUGIN, NULL);
+}
+
+
+/*
+ * Appends all .note and .note.gz files in path that are not in the pack
+ * yet or that changed after the version in the pack. The guids of imported notes are
+ * prepended to imported, if it is not NULL.
+ */
+static guint
+import_notes (PackFile *pack, const gchar *path, GSList **imported)
+{
+	GDir *dir = g_dir_open(path, 0, NULL);
+	const gchar *filename;
+	guint count = 0;
+
+	if (dir == NULL) {
+		return 0;
+	}
+
+	while ((filename = g_dir_read_name(dir)) != NULL) {
+		RecordHeader header;
+		ConboyNote *note;
+		ConboyNote *current = NULL;
+		GString *record;
+		gchar *guid;
+		gchar *full_name;
+		gchar *data;
+		gchar *current_record;
+		gsize length;
+		struct stat file_stat;
+
+		guid = conboy_xml_note_get_guid(filename);
+		if (guid == NULL) {
+			continue;
+		}
+
+		/* If there is both a .note and a .note.gz, only the newer one counts */
+		full_name = conboy_xml_note_find_file(path, guid, &file_stat);
+		if (full_name == NULL || !g_str_has_suffix(full_name, filename)) {
+			g_free(full_name);
+			g_free(guid);
+			continue;
+		}
+
+		if (!conboy_xml_note_read_file(full_name, &data, &length)) {
+			g_printerr("WARN: Couldn't read %s\n", full_name);
+			g_free(full_name);
+			g_free(guid);
+			continue;
+		}
+
+		note = conboy_xml_note_parse_memory(data, length, guid, FALSE);
+
+		current_record = pack_file_read_record(pack, guid, &header);
+		if (current_record != NULL) {
+			current = conboy_xml_note_parse_memory(RECORD_DATA(current_record, &header), header.data_length, guid, FALSE);
+			g_free(current_record);
+		}
+
+		if (note == NULL) {
+			g_printerr("WARN: Not importing %s, it's not a valid note\n", full_name);
+		} else if (current == NULL || note->last_change_date > current->last_change_date) {
+			/* The file is copied as it is */
+			record = record_new(RECORD_NOTE, guid);
+			g_string_append_len(record, data, length);
+			record_finish(record);
+
+			if (pack_file_append(pack, record->str, record->len)) {
+				count++;
+				if (imported != NULL) {
+					*imported = g_slist_prepend(*imported, g_strdup(guid));
+				}
+			}
+			g_string_free(record, TRUE);
+		}
+
+		if (note != NULL) {
+			g_object_unref(note);
+		}
+		if (current != NULL) {
+			g_object_unref(current);
+		}
+		g_free(guid);
+		g_free(data);
+		g_free(full_name);
+	}
+
+	g_dir_close(dir);
+
+	return count;
+}
+
+/* Must be called with self->lock held */
+static PackFile*
+get_pack (ConboyPackStoragePlugin *self)
+{
+	gboolean exists;
+	guint count;
+
+	if (self->pack != NULL) {
+		return self->pack;
+	}
+
+	exists = g_file_test(self->filename, G_FILE_TEST_EXISTS);
+
+	self->pack = pack_file_open(self->filename);
+	if (self->pack == NULL) {
+		return NULL;
+	}
+
+	if (!exists) {
+		/* First start, take over the notes of the XML backend */
+		count = import_notes(self->pack, self->path, NULL);
+		pack_file_write_checkpoint(self->pack);
+		g_printerr("INFO: Imported %u notes into %s\n", count, self->filename);
+	}
+
+	return self->pack;
+}
+
+/*
+ * Copies the records between start and end of the pack to the target.
+ * Checkpoints are left out. Must be called with self->lock held.
+ */
+static gboolean
+copy_tail (PackFile *pack, gint64 start, PackFile *target)
+{
+	RecordHeader header;
+	gint64 length = pack->end - start;
+	gint64 offset = 0;
+	gchar *data;
+	gboolean result = TRUE;
+
+	if (length == 0) {
+		return TRUE;
+	}
+
+	data = g_malloc(length);
+	if (!read_all(pack->fd, data, length, start)) {
+		g_free(data);
+		return FALSE;
+	}
+
+	while (result && read_header(data, length, offset, &header, FALSE)) {
+		if (header.type == RECORD_NOTE || header.type == RECORD_DELETE) {
+			result = pack_file_append(target, data + offset, RECORD_LENGTH(&header));
+		}
+		offset += RECORD_LENGTH(&header);
+	}
+
+	g_free(data);
+
+	return result && offset == length;
+}
+
+/*
+ * Copies the live records to a new file, while saving continues. Records
+ * appended in the meantime are copied at the end, with the lock held.
+ * Then the new file replaces the pack.
+ */
+static gpointer
+compact_thread_func (gpointer data)
+{
+	ConboyPackStoragePlugin *self = CONBOY_PACK_STORAGE_PLUGIN(data);
+	PackFile *target = NULL;
+	GArray *entries;
+	GTimer *timer;
+	gchar *tmp_filename;
+	gchar *buffer = NULL;
+	gsize buffer_size = 0;
+	gint64 start;
+	gint64 old_length;
+	gboolean result;
+	int source_fd;
+	int fd;
+	guint i;
+
+	timer = g_timer_new();
+	tmp_filename = g_strconcat(self->filename, ".tmp", NULL);
+
+	/* Only this thread replaces self->pack, so it can be used without
+	 * the lock. Records are never changed once they are written. */
+	g_mutex_lock(self->lock);
+	entries = pack_file_get_entries(self->pack);
+	start = self->pack->end;
+	source_fd = self->pack->fd;
+	g_mutex_unlock(self->lock);
+
+	fd = g_open(tmp_filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd >= 0) {
+		target = pack_file_new(fd);
+	}
+	result = target != NULL && write_all(fd, PACK_MAGIC, PACK_MAGIC_LENGTH, 0);
+
+	for (i = 0; result && i < entries->len; i++) {
+		PackEntry *entry = &g_array_index(entries, PackEntry, i);
+
+		if (g_atomic_int_get(&self->closing)) {
+			result = FALSE;
+			break;
+		}
+
+		if (entry->length > buffer_size) {
+			buffer_size = entry->length;
+			buffer = g_realloc(buffer, buffer_size);
+		}
+		result = read_all(source_fd, buffer, entry->length, entry->offset)
+				&& pack_file_append(target, buffer, entry->length);
+	}
+
+	g_free(buffer);
+	g_array_free(entries, TRUE);
+
+	if (result) {
+		g_mutex_lock(self->lock);
+		old_length = self->pack->end;
+		result = copy_tail(self->pack, start, target)
+				&& pack_file_write_checkpoint(target)
+				&& g_rename(tmp_filename, self->filename) == 0;
+		if (result) {
+			g_printerr("INFO: Compacted pack from %li to %li bytes in %.1f ms\n",
+					(glong) old_length, (glong) target->end, g_timer_elapsed(timer, NULL) * 1000);
+			pack_file_free(self->pack);
+			self->pack = target;
+			target = NULL;
+		}
+		g_mutex_unlock(self->lock);
+	}
+
+	if (target != NULL) {
+		if (!g_atomic_int_get(&self->closing)) {
+			g_printerr("ERROR: Couldn't compact pack: %s\n", g_strerror(errno));
+		}
+		pack_file_free(target);
+		g_unlink(tmp_filename);
+	} else if (fd < 0) {
+		g_printerr("ERROR: Couldn't open %s: %s\n", tmp_filename, g_strerror(errno));
+	}
+
+	g_free(tmp_filename);
+	g_timer_destroy(timer);
+
+	/* Must be the last thing, after that the thread may be joined */
+	g_atomic_int_set(&self->compacting, FALSE);
+
+	return NULL;
+}
+
+/*
+ * Starts a compaction if there is enough dead space.
+ * Must be called with self->lock held.
+ */
+static void
+maybe_compact (ConboyPackStoragePlugin *self)
+{
+	PackFile *pack = self->pack;
+	GError *error = NULL;
+
+	if (pack->dead < COMPACT_MIN_DEAD || pack->dead < pack->end / 2) {
+		return;
+	}
+
+	if (g_atomic_int_get(&self->compacting) || !g_thread_supported()) {
+		return;
+	}
+
+	/* The previous run is done, collect it */
+	if (self->compactor != NULL) {
+		g_thread_join(self->compactor);
+		self->compactor = NULL;
+	}
+
+	g_atomic_int_set(&self->compacting, TRUE);
+	self->compactor = g_thread_create(compact_thread_func, self, TRUE, &error);
+	if (self->compactor == NULL) {
+		g_printerr("ERROR: Couldn't start compaction: %s\n", error->message);
+		g_error_free(error);
+		g_atomic_int_set(&self->compacting, FALSE);
+	}
+}
+
+/*
+ * Reads the note from the pack. The record is read with the lock held,
+ * parsing happens without it.
+ */
+static ConboyNote*
+read_note (ConboyPackStoragePlugin *self, const gchar *guid, gboolean with_content)
+{
+	RecordHeader header;
+	ConboyNote *note = NULL;
+	gchar *record = NULL;
+
+	g_mutex_lock(self->lock);
+	if (get_pack(self) != NULL) {
+		record = pack_file_read_record(self->pack, guid, &header);
+	}
+	g_mutex_unlock(self->lock);
+
+	if (record != NULL) {
+		note = conboy_xml_note_parse_memory(RECORD_DATA(record, &header), header.data_length, guid, with_content);
+		g_free(record);
+	}
+
+	return note;
+}
+
+static ConboyNote*
+load (ConboyStoragePlugin *self, const gchar *guid)
+{
+	g_return_val_if_fail(self != NULL, NULL);
+	g_return_val_if_fail(guid != NULL, NULL);
+	g_return_val_if_fail(CONBOY_IS_PACK_STORAGE_PLUGIN(self), NULL);
+
+	return read_note(CONBOY_PACK_STORAGE_PLUGIN(self), guid, TRUE);
+}
+
+/*
+ * Content loader of the notes returned by list()
+ */
+static gchar*
+load_content (ConboyNote *note, gpointer user_data)
+{
+	ConboyPackStoragePlugin *self = CONBOY_PACK_STORAGE_PLUGIN(user_data);
+	ConboyNote *full_note;
+	gchar *content = NULL;
+
+	full_note = read_note(self, note->guid, TRUE);
+	if (full_note != NULL) {
+		g_object_get(full_note, "content", &content, NULL);
+		g_object_unref(full_note);
+	}
+
+	return content;
+}
+
+static gboolean
+save (ConboyStoragePlugin *self, ConboyNote *note)
+{
+	g_return_val_if_fail(self != NULL, FALSE);
+	g_return_val_if_fail(note != NULL, FALSE);
+
+	g_return_val_if_fail(CONBOY_IS_PACK_STORAGE_PLUGIN(self), FALSE);
+	g_return_val_if_fail(CONBOY_IS_NOTE(note), FALSE);
+
+	g_assert(note->guid != NULL);
+
+	ConboyPackStoragePlugin *plugin = CONBOY_PACK_STORAGE_PLUGIN(self);
+	gboolean result = FALSE;
+	GString *record;
+
+	/* Serialize before taking the lock */
+	record = note_record_new(note);
+	if (record == NULL) {
+		return FALSE;
+	}
+
+	g_mutex_lock(plugin->lock);
+	if (get_pack(plugin) != NULL) {
+		result = pack_file_append(plugin->pack, record->str, record->len)
+				&& pack_file_sync(plugin->pack);
+		maybe_compact(plugin);
+	}
+	g_mutex_unlock(plugin->lock);
+
+	g_string_free(record, TRUE);
+
+	return result;
+}
+
+/*
+ * Serializes all notes first and appends them with one write and one
+ * sync. If a note cannot be serialized, nothing is written.
+ */
+static gboolean
+save_many (ConboyStoragePlugin *self, GSList *notes)
+{
+	g_return_val_if_fail(self != NULL, FALSE);
+	g_return_val_if_fail(CONBOY_IS_PACK_STORAGE_PLUGIN(self), FALSE);
+
+	ConboyPackStoragePlugin *plugin = CONBOY_PACK_STORAGE_PLUGIN(self);
+	gboolean result = FALSE;
+	GString *records = g_string_new(NULL);
+	GSList *iter;
+
+	for (iter = notes; iter != NULL; iter = iter->next) {
+		GString *record = note_record_new(CONBOY_NOTE(iter->data));
+		if (record == NULL) {
+			g_string_free(records, TRUE);
+			return FALSE;
+		}
+		g_string_append_len(records, record->str, record->len);
+		g_string_free(record, TRUE);
+	}
+
+	g_mutex_lock(plugin->lock);
+	if (get_pack(plugin) != NULL) {
+		result = pack_file_append(plugin->pack, records->str, records->len)
+				&& pack_file_sync(plugin->pack);
+		maybe_compact(plugin);
+	}
+	g_mutex_unlock(plugin->lock);
+
+	g_string_free(records, TRUE);
+
+	return result;
+}
+
+static gboolean
+delete (ConboyStoragePlugin *self, ConboyNote *note)
+{
+	g_return_val_if_fail(self != NULL, FALSE);
+	g_return_val_if_fail(note != NULL, FALSE);
+
+	g_return_val_if_fail(CONBOY_IS_PACK_STORAGE_PLUGIN(self), FALSE);
+	g_return_val_if_fail(CONBOY_IS_NOTE(note), FALSE);
+
+	ConboyPackStoragePlugin *plugin = CONBOY_PACK_STORAGE_PLUGIN(self);
+	gboolean result = FALSE;
+	GString *record;
+
+	g_mutex_lock(plugin->lock);
+	if (get_pack(plugin) != NULL && g_hash_table_lookup(plugin->pack->entries, note->guid) != NULL) {
+		record = record_new(RECORD_DELETE, note->guid);
+		record_finish(record);
+		result = pack_file_append(plugin->pack, record->str, record->len)
+				&& pack_file_sync(plugin->pack);
+		g_string_free(record, TRUE);
+		maybe_compact(plugin);
+	}
+	g_mutex_unlock(plugin->lock);
+
+	return result;
+}
+
+static void
+prepend_guid (gpointer key, gpointer value, gpointer user_data)
+{
+	GSList **result = (GSList**) user_data;
+	*result = g_slist_prepend(*result, g_strdup(key));
+}
+
+static GSList*
+list_ids (ConboyStoragePlugin *self)
+{
+	g_return_val_if_fail(self != NULL, NULL);
+	g_return_val_if_fail(CONBOY_IS_PACK_STORAGE_PLUGIN(self), NULL);
+
+	ConboyPackStoragePlugin *plugin = CONBOY_PACK_STORAGE_PLUGIN(self);
+	GSList *result = NULL;
+
+	g_mutex_lock(plugin->lock);
+	if (get_pack(plugin) != NULL) {
+		g_hash_table_foreach(plugin->pack->entries, prepend_guid, &result);
+	}
+	g_mutex_unlock(plugin->lock);
+
+	return result;
+}
+
+static GSList*
+list (ConboyStoragePlugin *self)
+{
+	g_return_val_if_fail(self != NULL, NULL);
+	g_return_val_if_fail(CONBOY_IS_PACK_STORAGE_PLUGIN(self), NULL);
+
+	ConboyPackStoragePlugin *plugin = CONBOY_PACK_STORAGE_PLUGIN(self);
+	GMappedFile *file = NULL;
+	GArray *entries = NULL;
+	GError *error = NULL;
+	GSList *result = NULL;
+	const gchar *data;
+	gint64 length;
+	guint i;
+
+	/* The mapping stays valid even if a compaction replaces the file */
+	g_mutex_lock(plugin->lock);
+	if (get_pack(plugin) != NULL) {
+		file = g_mapped_file_new(plugin->filename, FALSE, &error);
+		entries = pack_file_get_entries(plugin->pack);
+	}
+	g_mutex_unlock(plugin->lock);
+
+	if (file == NULL) {
+		if (error != NULL) {
+			g_printerr("ERROR: Couldn't map %s: %s\n", plugin->filename, error->message);
+			g_error_free(error);
+		}
+		if (entries != NULL) {
+			g_array_free(entries, TRUE);
+		}
+		return NULL;
+	}
+
+	data = g_mapped_file_get_contents(file);
+	length = g_mapped_file_get_length(file);
+
+	/* Reverse file order, prepending turns it around again */
+	for (i = entries->len; i > 0; i--) {
+		PackEntry *entry = &g_array_index(entries, PackEntry, i - 1);
+		RecordHeader header;
+		ConboyNote *note;
+		gchar *guid;
+
+		if (!read_header(data, length, entry->offset, &header, FALSE)) {
+			continue;
+		}
+
+		guid = g_strndup(data + entry->offset + sizeof(RecordHeader), header.guid_length);
+		note = conboy_xml_note_parse_memory(RECORD_DATA(data + entry->offset, &header), header.data_length, guid, FALSE);
+		if (note != NULL) {
+			/* Content is loaded when it's needed */
+			conboy_note_set_content_loader(note, load_content, g_object_ref(plugin), g_object_unref);
+			result = g_slist_prepend(result, note);
+		} else {
+			g_printerr("ERROR: Couldn't parse note %s\n", guid);
+		}
+		g_free(guid);
+	}
+
+	g_array_free(entries, TRUE);
+	g_mapped_file_free(file);
+
+	return result;
+}
+
+/*
+ * Waits for a running compaction and writes a checkpoint, so that the
+ * next start does not need to scan the whole pack.
+ */
+static void
+sync_pack (ConboyStoragePlugin *self)
+{
+	g_return_if_fail(self != NULL);
+	g_return_if_fail(CONBOY_IS_PACK_STORAGE_PLUGIN(self));
+
+	ConboyPackStoragePlugin *plugin = CONBOY_PACK_STORAGE_PLUGIN(self);
+	GThread *compactor;
+
+	/* Taken out under the lock, so that maybe_compact() does not join it
+	 * as well. Joined without the lock, the compaction needs it to finish. */
+	g_mutex_lock(plugin->lock);
+	compactor = plugin->compactor;
+	plugin->compactor = NULL;
+	g_mutex_unlock(plugin->lock);
+
+	if (compactor != NULL) {
+		g_thread_join(compactor);
+	}
+
+	g_mutex_lock(plugin->lock);
+	if (plugin->pack != NULL) {
+		pack_file_write_checkpoint(plugin->pack);
+	}
+	g_mutex_unlock(plugin->lock);
+}
+
+/*
+ * Writes every note to <guid>.note, so that the XML backend finds them.
+ * Other .note files are left alone.
+ */
+static guint
+export_notes (ConboyPackStoragePlugin *self)
+{
+	GSList *ids = list_ids(CONBOY_STORAGE_PLUGIN(self));
+	GSList *iter;
+	guint count = 0;
+
+	for (iter = ids; iter != NULL; iter = iter->next) {
+		const gchar *guid = iter->data;
+		RecordHeader header;
+		GError *error = NULL;
+		gchar *record = NULL;
+		gchar *filename;
+
+		g_mutex_lock(self->lock);
+		record = pack_file_read_record(self->pack, guid, &header);
+		g_mutex_unlock(self->lock);
+
+		if (record == NULL) {
+			continue;
+		}
+
+		filename = g_strconcat(self->path, guid, ".note", NULL);
+		if (g_file_set_contents(filename, RECORD_DATA(record, &header), header.data_length, &error)) {
+			count++;
+		} else {
+			g_printerr("ERROR: Couldn't export %s: %s\n", guid, error->message);
+			g_error_free(error);
+		}
+
+		g_free(filename);
+		g_free(record);
+	}
+
+	g_slist_foreach(ids, (GFunc) g_free, NULL);
+	g_slist_free(ids);
+
+	return count;
+}
+
+static void
+on_import_clicked (GtkButton *button, GtkLabel *label)
+{
+	ConboyPackStoragePlugin *self = g_object_get_data(G_OBJECT(button), "plugin");
+	GSList *imported = NULL;
+	GSList *iter;
+	guint count = 0;
+	gchar *text;
+
+	g_mutex_lock(self->lock);
+	if (get_pack(self) != NULL) {
+		count = import_notes(self->pack, self->path, &imported);
+		pack_file_write_checkpoint(self->pack);
+	}
+	g_mutex_unlock(self->lock);
+
+	/* Let the note store pick up the imported notes */
+	for (iter = imported; iter != NULL; iter = iter->next) {
+		g_signal_emit_by_name(self, "note-changed", iter->data);
+		g_free(iter->data);
+	}
+	g_slist_free(imported);
+
+	/* Translators: Shown after importing .note files. */
+	text = g_strdup_printf(_("Imported %u notes."), count);
+	gtk_label_set_text(label, text);
+	g_free(text);
+}
+
+static void
+on_export_clicked (GtkButton *button, GtkLabel *label)
+{
+	ConboyPackStoragePlugin *self = g_object_get_data(G_OBJECT(button), "plugin");
+	gchar *text;
+
+	/* Translators: Shown after exporting .note files. */
+	text = g_strdup_printf(_("Exported %u notes."), export_notes(self));
+	gtk_label_set_text(label, text);
+	g_free(text);
+}
+
+static GtkWidget*
+get_widget (ConboyPlugin *plugin)
+{
+	GtkWidget *vbox = gtk_vbox_new(FALSE, 10);
+	GtkWidget *label;
+	GtkWidget *button;
+
+	/* Translators: Explains the import and export buttons of the packed storage backend. */
+	label = gtk_label_new(_("Notes can be imported from and exported to .note files, which are used by the XML storage backend."));
+	gtk_label_set_line_wrap(GTK_LABEL(label), TRUE);
+	gtk_box_pack_start(GTK_BOX(vbox), label, FALSE, FALSE, 0);
+
+	button = gtk_button_new_with_label(_("Import .note files"));
+	g_object_set_data(G_OBJECT(button), "plugin", plugin);
+	g_signal_connect(button, "clicked", G_CALLBACK(on_import_clicked), label);
+	gtk_box_pack_start(GTK_BOX(vbox), button, FALSE, FALSE, 0);
+
+	button = gtk_button_new_with_label(_("Export .note files"));
+	g_object_set_data(G_OBJECT(button), "plugin", plugin);
+	g_signal_connect(button, "clicked", G_CALLBACK(on_export_clicked), label);
+	gtk_box_pack_start(GTK_BOX(vbox), button, FALSE, FALSE, 0);
+
+	gtk_widget_show_all(vbox);
+
+	return vbox;
+}
+
+/*
+ * GOBJECT stuff
+ */
+
+static void
+finalize(GObject *object)
+{
+	ConboyPackStoragePlugin *self = CONBOY_PACK_STORAGE_PLUGIN(object);
+
+	g_mutex_free(self->lock);
+
+	G_OBJECT_CLASS(conboy_pack_storage_plugin_parent_class)->finalize(object);
+}
+
+static void
+dispose(GObject *object)
+{
+	ConboyPackStoragePlugin *self = CONBOY_PACK_STORAGE_PLUGIN(object);
+
+	/* Stop a running compaction, the pack stays as it is */
+	g_atomic_int_set(&self->closing, TRUE);
+	if (self->compactor != NULL) {
+		g_thread_join(self->compactor);
+		self->compactor = NULL;
+	}
+
+	if (self->pack != NULL) {
+		pack_file_write_checkpoint(self->pack);
+		pack_file_free(self->pack);
+		self->pack = NULL;
+	}
+
+	g_free(self->path);
+	self->path = NULL;
+	g_free(self->filename);
+	self->filename = NULL;
+
+	G_OBJECT_CLASS(conboy_pack_storage_plugin_parent_class)->dispose(object);
+}
+
+static void
+conboy_pack_storage_plugin_class_init (ConboyPackStoragePluginClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	ConboyPluginClass *plugin_class = CONBOY_PLUGIN_CLASS(klass);
+	ConboyStoragePluginClass *storage_class = CONBOY_STORAGE_PLUGIN_CLASS(klass);
+
+	object_class->dispose =	dispose;
+	object_class->finalize = finalize;
+
+	plugin_class->get_widget = get_widget;
+
+	storage_class->load = load;
+	storage_class->save = save;
+	storage_class->delete = delete;
+	storage_class->list = list;
+	storage_class->list_ids = list_ids;
+	storage_class->sync = sync_pack;
+	storage_class->save_many = save_many;
+}
+
+static void
+conboy_pack_storage_plugin_init (ConboyPackStoragePlugin *self)
+{
+	CONBOY_PLUGIN(self)->has_settings = TRUE;
+	self->path = conboy_storage_plugin_get_notes_dir();
+	self->filename = g_strconcat(self->path, PACK_FILE, NULL);
+
+	self->lock = g_mutex_new();
+	self->pack = NULL;
+	self->compactor = NULL;
+	self->compacting = FALSE;
+	self->closing = FALSE;
+}
@@ -0,0 +1,968 @@
+/*
+ * Copyright (C) 2009 Cornelius Hald <hald@icandy.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "../../conboy_note.h"
+#include "../../conboy_storage_plugin.h"
+#include "../../conboy_xml_note.h"
+#include "conboy_sqlite_storage_plugin.h"
+
+#define DATABASE_FILE "notes.db"
+
+/*
+ * Notes and their tags live in normal tables. The text of each note,
+ * without markup, is mirrored into an FTS3 table, whose docid is the id
+ * of the note.
+ */
+static const gchar *schema =
+	"CREATE TABLE IF NOT EXISTS notes ("
+	"  id INTEGER PRIMARY KEY,"
+	"  guid TEXT UNIQUE NOT NULL,"
+	"  title TEXT,"
+	"  content TEXT,"
+	"  create_date INTEGER,"
+	"  change_date INTEGER,"
+	"  metadata_change_date INTEGER,"
+	"  note_version REAL,"
+	"  content_version REAL,"
+	"  cursor_position INTEGER,"
+	"  width INTEGER,"
+	"  height INTEGER,"
+	"  x INTEGER,"
+	"  y INTEGER,"
+	"  open_on_startup INTEGER);"
+	"CREATE TABLE IF NOT EXISTS tags ("
+	"  note INTEGER NOT NULL,"
+	"  tag TEXT NOT NULL,"
+	"  PRIMARY KEY (note, tag));";
+
+static const gchar *fts_schema =
+	"CREATE VIRTUAL TABLE IF NOT EXISTS notes_fts USING fts3(text);";
+
+/* Columns of the note, in the order note_from_row() expects them */
+#define NOTE_COLUMNS "id, guid, title, create_date, change_date, metadata_change_date, note_version, " \
+	"content_version, cursor_position, width, height, x, y, open_on_startup"
+
+typedef enum {
+	STMT_FIND_ID,
+	STMT_INSERT,
+	STMT_UPDATE,
+	STMT_DELETE,
+	STMT_LOAD,
+	STMT_LOAD_CONTENT,
+	STMT_LIST,
+	STMT_LIST_IDS,
+	STMT_LOAD_TAGS,
+	STMT_LIST_TAGS,
+	STMT_DELETE_TAGS,
+	STMT_INSERT_TAG,
+	STMT_DELETE_TEXT,
+	STMT_INSERT_TEXT,
+	STMT_SEARCH,
+	STMT_LIST_CHANGED,
+	STMT_LIST_CHANGED_TAGS,
+	N_STATEMENTS
+} Statement;
+
+/* Indexed by Statement. Insert and update take the same parameters. */
+static const gchar *statement_sql[N_STATEMENTS] = {
+	"SELECT id FROM notes WHERE guid = ?1",
+	"INSERT INTO notes (guid, title, content, create_date, change_date, metadata_change_date, note_version, "
+	"content_version, cursor_position, width, height, x, y, open_on_startup) "
+	"VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11, ?12, ?13, ?14)",
+	"UPDATE notes SET title = ?2, content = ?3, create_date = ?4, change_date = ?5, metadata_change_date = ?6, "
+	"note_version = ?7, content_version = ?8, cursor_position = ?9, width = ?10, height = ?11, x = ?12, y = ?13, "
+	"open_on_startup = ?14 WHERE guid = ?1",
+	"DELETE FROM notes WHERE id = ?1",
+	"SELECT " NOTE_COLUMNS ", content FROM notes WHERE guid = ?1",
+	"SELECT content FROM notes WHERE guid = ?1",
+	"SELECT " NOTE_COLUMNS " FROM notes",
+	"SELECT guid FROM notes",
+	"SELECT tag FROM tags WHERE note = ?1",
+	"SELECT notes.guid, tags.tag FROM tags JOIN notes ON notes.id = tags.note",
+	"DELETE FROM tags WHERE note = ?1",
+	"INSERT OR IGNORE INTO tags (note, tag) VALUES (?1, ?2)",
+	"DELETE FROM notes_fts WHERE docid = ?1",
+	"INSERT INTO notes_fts (docid, text) VALUES (?1, ?2)",
+	"SELECT notes.guid, offsets(notes_fts) FROM notes_fts JOIN notes ON notes.id = notes_fts.docid "
+	"WHERE notes_fts MATCH ?1",
+	"SELECT " NOTE_COLUMNS " FROM notes WHERE change_date > ?1 OR metadata_change_date > ?1",
+	"SELECT notes.guid, tags.tag FROM tags JOIN notes ON notes.id = tags.note "
+	"WHERE notes.change_date > ?1 OR notes.metadata_change_date > ?1"
+};
+
+G_DEFINE_TYPE(ConboySqliteStoragePlugin, conboy_sqlite_storage_plugin, CONBOY_TYPE_STORAGE_PLUGIN);
+
+
+/*
+ * Database helpers
+ */
+
+static gboolean
+exec (ConboySqliteStoragePlugin *self, const gchar *sql)
+{
+	gchar *message = NULL;
+
+	if (sqlite3_exec(self->db, sql, NULL, NULL, &message) != SQLITE_OK) {
+		g_printerr("ERROR: '%s' failed: %s\n", sql, message);
+		sqlite3_free(message);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Returns the prepared statement. It has to be given back with
+ * statement_done() after use.
+ */
+static sqlite3_stmt*
+get_statement (ConboySqliteStoragePlugin *self, Statement statement)
+{
+	if (self->statements[statement] == NULL) {
+		if (sqlite3_prepare_v2(self->db, statement_sql[statement], -1, &self->statements[statement], NULL) != SQLITE_OK) {
+			g_printerr("ERROR: Couldn't prepare '%s': %s\n", statement_sql[statement], sqlite3_errmsg(self->db));
+			self->statements[statement] = NULL;
+		}
+	}
+	return self->statements[statement];
+}
+
+static void
+statement_done (sqlite3_stmt *stmt)
+{
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+}
+
+/*
+ * Executes a statement that returns no rows and gives it back.
+ */
+static gboolean
+step_done (ConboySqliteStoragePlugin *self, sqlite3_stmt *stmt)
+{
+	gboolean result = sqlite3_step(stmt) == SQLITE_DONE;
+
+	if (!result) {
+		g_printerr("ERROR: Statement failed: %s\n", sqlite3_errmsg(self->db));
+	}
+	statement_done(stmt);
+
+	return result;
+}
+
+static void
+end_transaction (ConboySqliteStoragePlugin *self)
+{
+	if (self->in_transaction) {
+		self->in_transaction = FALSE;
+		exec(self, "COMMIT");
+	}
+}
+
+static gboolean
+commit_idle (gpointer data)
+{
+	ConboySqliteStoragePlugin *self = CONBOY_SQLITE_STORAGE_PLUGIN(data);
+
+	g_static_rec_mutex_lock(&self->lock);
+	/* commit() might have removed us while we waited for the lock */
+	if (self->commit_source == g_source_get_id(g_main_current_source())) {
+		self->commit_source = 0;
+		end_transaction(self);
+	}
+	g_static_rec_mutex_unlock(&self->lock);
+
+	return FALSE;
+}
+
+/*
+ * Opens a transaction, unless one is open already. All saves until the
+ * main loop becomes idle end up in it, so bulk writes like a sync are
+ * committed at once.
+ */
+static void
+begin (ConboySqliteStoragePlugin *self)
+{
+	if (self->in_transaction) {
+		return;
+	}
+
+	if (exec(self, "BEGIN")) {
+		self->in_transaction = TRUE;
+		self->commit_source = g_idle_add(commit_idle, self);
+	}
+}
+
+static void
+commit (ConboySqliteStoragePlugin *self)
+{
+	if (self->commit_source != 0) {
+		g_source_remove(self->commit_source);
+		self->commit_source = 0;
+	}
+	end_transaction(self);
+}
+
+/*
+ * Returns the id of the note or -1 if it is not in the database.
+ */
+static sqlite3_int64
+find_id (ConboySqliteStoragePlugin *self, const gchar *guid)
+{
+	sqlite3_stmt *stmt = get_statement(self, STMT_FIND_ID);
+	sqlite3_int64 id = -1;
+
+	if (stmt == NULL) {
+		return -1;
+	}
+
+	sqlite3_bind_text(stmt, 1, guid, -1, SQLITE_STATIC);
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		id = sqlite3_column_int64(stmt, 0);
+	}
+	statement_done(stmt);
+
+	return id;
+}
+
+/*
+ * Creates a note from a row starting with NOTE_COLUMNS. The content
+ * and the tags are not set.
+ */
+static ConboyNote*
+note_from_row (sqlite3_stmt *stmt)
+{
+	ConboyNote *note = conboy_note_new_with_guid((const gchar*) sqlite3_column_text(stmt, 1));
+
+	g_object_set(note,
+			"title", (const gchar*) sqlite3_column_text(stmt, 2),
+			"create-date", (guint) sqlite3_column_int64(stmt, 3),
+			"change-date", (guint) sqlite3_column_int64(stmt, 4),
+			"metadata-change-date", (guint) sqlite3_column_int64(stmt, 5),
+			"note-version", sqlite3_column_double(stmt, 6),
+			"content-version", sqlite3_column_double(stmt, 7),
+			"cursor-position", sqlite3_column_int(stmt, 8),
+			"width", sqlite3_column_int(stmt, 9),
+			"height", sqlite3_column_int(stmt, 10),
+			"x", sqlite3_column_int(stmt, 11),
+			"y", sqlite3_column_int(stmt, 12),
+			"open-on-startup", sqlite3_column_int(stmt, 13) != 0,
+			NULL);
+
+	return note;
+}
+
+/*
+ * Writes the note, its tags and its text. Must be called inside of a
+ * transaction.
+ */
+static gboolean
+save_note (ConboySqliteStoragePlugin *self, ConboyNote *note)
+{
+	const gchar *content = conboy_note_get_content(note);
+	sqlite3_int64 id = find_id(self, note->guid);
+	sqlite3_stmt *stmt;
+	guint i;
+
+	stmt = get_statement(self, id >= 0 ? STMT_UPDATE : STMT_INSERT);
+	if (stmt == NULL) {
+		return FALSE;
+	}
+
+	sqlite3_bind_text(stmt, 1, note->guid, -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 2, note->title, -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 3, content, -1, SQLITE_STATIC);
+	sqlite3_bind_int64(stmt, 4, note->create_date);
+	sqlite3_bind_int64(stmt, 5, note->last_change_date);
+	sqlite3_bind_int64(stmt, 6, note->last_metadata_change_date);
+	sqlite3_bind_double(stmt, 7, note->note_version);
+	sqlite3_bind_double(stmt, 8, note->content_version);
+	sqlite3_bind_int(stmt, 9, note->cursor_position);
+	sqlite3_bind_int(stmt, 10, note->width);
+	sqlite3_bind_int(stmt, 11, note->height);
+	sqlite3_bind_int(stmt, 12, note->x);
+	sqlite3_bind_int(stmt, 13, note->y);
+	sqlite3_bind_int(stmt, 14, note->open_on_startup ? 1 : 0);
+
+	if (!step_done(self, stmt)) {
+		return FALSE;
+	}
+
+	if (id < 0) {
+		id = sqlite3_last_insert_rowid(self->db);
+	}
+
+	/* Tags */
+	stmt = get_statement(self, STMT_DELETE_TAGS);
+	if (stmt == NULL) {
+		return FALSE;
+	}
+	sqlite3_bind_int64(stmt, 1, id);
+	if (!step_done(self, stmt)) {
+		return FALSE;
+	}
+
+	for (i = 0; i < note->n_tags; i++) {
+		stmt = get_statement(self, STMT_INSERT_TAG);
+		if (stmt == NULL) {
+			return FALSE;
+		}
+		sqlite3_bind_int64(stmt, 1, id);
+		sqlite3_bind_text(stmt, 2, conboy_note_get_tag(note, i), -1, SQLITE_STATIC);
+		if (!step_done(self, stmt)) {
+			return FALSE;
+		}
+	}
+
+	/* Full text index. The text is casefolded, so that searching does not
+	 * depend on the tokenizer, which only folds ASCII. */
+	if (self->has_fts) {
+
+		stmt = get_statement(self, STMT_DELETE_TEXT);
+		if (stmt == NULL) {
+			return FALSE;
+		}
+		sqlite3_bind_int64(stmt, 1, id);
+		if (!step_done(self, stmt)) {
+			return FALSE;
+		}
+
+		stmt = get_statement(self, STMT_INSERT_TEXT);
+		if (stmt == NULL) {
+			return FALSE;
+		}
+		sqlite3_bind_int64(stmt, 1, id);
+		sqlite3_bind_text(stmt, 2, conboy_note_get_text(note), -1, SQLITE_STATIC);
+		return step_done(self, stmt);
+	}
+
+	return TRUE;
+}
+
+/*
+ * Saves the note, either completely or not at all. Savepoints can be
+ * nested into the open transaction.
+ */
+static gboolean
+save_note_atomic (ConboySqliteStoragePlugin *self, ConboyNote *note)
+{
+	if (!exec(self, "SAVEPOINT note")) {
+		return FALSE;
+	}
+
+	if (!save_note(self, note)) {
+		exec(self, "ROLLBACK TO note");
+		exec(self, "RELEASE note");
+		return FALSE;
+	}
+
+	return exec(self, "RELEASE note");
+}
+
+/*
+ * Copies the .note and .note.gz files of the XML backend into the database.
+ */
+static guint
+import_notes (ConboySqliteStoragePlugin *self)
+{
+	GDir *dir = g_dir_open(self->path, 0, NULL);
+	const gchar *filename;
+	guint count = 0;
+
+	if (dir == NULL) {
+		return 0;
+	}
+
+	begin(self);
+
+	while ((filename = g_dir_read_name(dir)) != NULL) {
+		ConboyNote *note;
+		gchar *full_name;
+		gchar *guid;
+		struct stat file_stat;
+
+		guid = conboy_xml_note_get_guid(filename);
+		if (guid == NULL) {
+			continue;
+		}
+
+		/* If there is both a .note and a .note.gz, only the newer one counts */
+		full_name = conboy_xml_note_find_file(self->path, guid, &file_stat);
+		if (full_name == NULL || !g_str_has_suffix(full_name, filename)) {
+			g_free(full_name);
+			g_free(guid);
+			continue;
+		}
+
+		note = conboy_xml_note_parse_file(full_name, guid, TRUE);
+		if (note == NULL) {
+			g_printerr("WARN: Not importing %s, it's not a valid note\n", full_name);
+		} else {
+			if (save_note_atomic(self, note)) {
+				count++;
+			}
+			g_object_unref(note);
+		}
+
+		g_free(guid);
+		g_free(full_name);
+	}
+
+	g_dir_close(dir);
+
+	commit(self);
+
+	return count;
+}
+
+/*
+ * Opens the database and creates the tables if needed. Returns FALSE if
+ * the database cannot be used.
+ */
+static gboolean
+open_db (ConboySqliteStoragePlugin *self)
+{
+	gboolean exists;
+	guint count;
+
+	if (self->db != NULL) {
+		return TRUE;
+	}
+
+	exists = g_file_test(self->filename, G_FILE_TEST_EXISTS);
+
+	if (sqlite3_open(self->filename, &self->db) != SQLITE_OK) {
+		g_printerr("ERROR: Couldn't open %s: %s\n", self->filename, sqlite3_errmsg(self->db));
+		sqlite3_close(self->db);
+		self->db = NULL;
+		return FALSE;
+	}
+
+	/* Readers don't block the writer and commits only append to the log.
+	 * Older versions of SQLite just ignore this. */
+	exec(self, "PRAGMA journal_mode = WAL");
+	exec(self, "PRAGMA synchronous = NORMAL");
+
+	if (!exec(self, schema)) {
+		sqlite3_close(self->db);
+		self->db = NULL;
+		return FALSE;
+	}
+
+	self->has_fts = exec(self, fts_schema);
+	if (!self->has_fts) {
+		g_printerr("WARN: SQLite has no FTS3, searching without index\n");
+	}
+
+	if (!exists) {
+		/* First start, take over the notes of the XML backend */
+		count = import_notes(self);
+		g_printerr("INFO: Imported %u notes into %s\n", count, self->filename);
+	}
+
+	return TRUE;
+}
+
+
+/*
+ * Public methods
+ */
+
+ConboySqliteStoragePlugin*
+conboy_plugin_new ()
+{
+	return g_object_new(CONBOY_TYPE_SQLITE_STORAGE_PLUGIN, NULL);
+}
+
+static ConboyNote*
+load (ConboyStoragePlugin *self, const gchar *guid)
+{
+	g_return_val_if_fail(self != NULL, NULL);
+	g_return_val_if_fail(guid != NULL, NULL);
+	g_return_val_if_fail(CONBOY_IS_SQLITE_STORAGE_PLUGIN(self), NULL);
+
+	ConboySqliteStoragePlugin *plugin = CONBOY_SQLITE_STORAGE_PLUGIN(self);
+	ConboyNote *note = NULL;
+	sqlite3_stmt *stmt;
+	sqlite3_int64 id = 0;
+
+	g_static_rec_mutex_lock(&plugin->lock);
+
+	if (!open_db(plugin) || (stmt = get_statement(plugin, STMT_LOAD)) == NULL) {
+		g_static_rec_mutex_unlock(&plugin->lock);
+		return NULL;
+	}
+
+	sqlite3_bind_text(stmt, 1, guid, -1, SQLITE_STATIC);
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		id = sqlite3_column_int64(stmt, 0);
+		note = note_from_row(stmt);
+		g_object_set(note, "content", (const gchar*) sqlite3_column_text(stmt, 14), NULL);
+	}
+	statement_done(stmt);
+
+	if (note != NULL && (stmt = get_statement(plugin, STMT_LOAD_TAGS)) != NULL) {
+		sqlite3_bind_int64(stmt, 1, id);
+		while (sqlite3_step(stmt) == SQLITE_ROW) {
+			conboy_note_add_tag(note, (const gchar*) sqlite3_column_text(stmt, 0));
+		}
+		statement_done(stmt);
+	}
+
+	g_static_rec_mutex_unlock(&plugin->lock);
+
+	return note;
+}
+
+/*
+ * Content loader of the notes returned by list()
+ */
+static gchar*
+load_content (ConboyNote *note, gpointer user_data)
+{
+	ConboySqliteStoragePlugin *self = CONBOY_SQLITE_STORAGE_PLUGIN(user_data);
+	sqlite3_stmt *stmt;
+	gchar *content = NULL;
+
+	g_static_rec_mutex_lock(&self->lock);
+	if (open_db(self) && (stmt = get_statement(self, STMT_LOAD_CONTENT)) != NULL) {
+		sqlite3_bind_text(stmt, 1, note->guid, -1, SQLITE_STATIC);
+		if (sqlite3_step(stmt) == SQLITE_ROW) {
+			content = g_strdup((const gchar*) sqlite3_column_text(stmt, 0));
+		}
+		statement_done(stmt);
+	}
+	g_static_rec_mutex_unlock(&self->lock);
+
+	return content;
+}
+
+static gboolean
+save (ConboyStoragePlugin *self, ConboyNote *note)
+{
+	g_return_val_if_fail(self != NULL, FALSE);
+	g_return_val_if_fail(note != NULL, FALSE);
+
+	g_return_val_if_fail(CONBOY_IS_SQLITE_STORAGE_PLUGIN(self), FALSE);
+	g_return_val_if_fail(CONBOY_IS_NOTE(note), FALSE);
+
+	g_assert(note->guid != NULL);
+
+	ConboySqliteStoragePlugin *plugin = CONBOY_SQLITE_STORAGE_PLUGIN(self);
+	gboolean result = FALSE;
+
+	g_static_rec_mutex_lock(&plugin->lock);
+	if (open_db(plugin)) {
+		begin(plugin);
+		result = save_note_atomic(plugin, note);
+	}
+	g_static_rec_mutex_unlock(&plugin->lock);
+
+	return result;
+}
+
+static gboolean
+delete (ConboyStoragePlugin *self, ConboyNote *note)
+{
+	g_return_val_if_fail(self != NULL, FALSE);
+	g_return_val_if_fail(note != NULL, FALSE);
+
+	g_return_val_if_fail(CONBOY_IS_SQLITE_STORAGE_PLUGIN(self), FALSE);
+	g_return_val_if_fail(CONBOY_IS_NOTE(note), FALSE);
+
+	ConboySqliteStoragePlugin *plugin = CONBOY_SQLITE_STORAGE_PLUGIN(self);
+	Statement statements[] = { STMT_DELETE_TAGS, STMT_DELETE_TEXT, STMT_DELETE };
+	gboolean result = TRUE;
+	sqlite3_int64 id;
+	guint i;
+
+	g_static_rec_mutex_lock(&plugin->lock);
+
+	if (!open_db(plugin) || (id = find_id(plugin, note->guid)) < 0) {
+		g_static_rec_mutex_unlock(&plugin->lock);
+		return FALSE;
+	}
+
+	begin(plugin);
+
+	for (i = 0; result && i < G_N_ELEMENTS(statements); i++) {
+		sqlite3_stmt *stmt;
+
+		if (statements[i] == STMT_DELETE_TEXT && !plugin->has_fts) {
+			continue;
+		}
+
+		stmt = get_statement(plugin, statements[i]);
+		if (stmt == NULL) {
+			result = FALSE;
+			break;
+		}
+		sqlite3_bind_int64(stmt, 1, id);
+		result = step_done(plugin, stmt);
+	}
+
+	/* Deleting is rare, don't leave it lying around */
+	commit(plugin);
+	g_static_rec_mutex_unlock(&plugin->lock);
+
+	return result;
+}
+
+static GSList*
+list_ids (ConboyStoragePlugin *self)
+{
+	g_return_val_if_fail(self != NULL, NULL);
+	g_return_val_if_fail(CONBOY_IS_SQLITE_STORAGE_PLUGIN(self), NULL);
+
+	ConboySqliteStoragePlugin *plugin = CONBOY_SQLITE_STORAGE_PLUGIN(self);
+	GSList *result = NULL;
+	sqlite3_stmt *stmt;
+
+	g_static_rec_mutex_lock(&plugin->lock);
+	if (open_db(plugin) && (stmt = get_statement(plugin, STMT_LIST_IDS)) != NULL) {
+		while (sqlite3_step(stmt) == SQLITE_ROW) {
+			result = g_slist_prepend(result, g_strdup((const gchar*) sqlite3_column_text(stmt, 0)));
+		}
+		statement_done(stmt);
+	}
+	g_static_rec_mutex_unlock(&plugin->lock);
+
+	return result;
+}
+
+/*
+ * Returns the notes selected by one of the list statements, without
+ * content. The tags statement has to select the tags of the same notes.
+ * since is bound to both statements if they take a parameter.
+ */
+static GSList*
+list_notes (ConboySqliteStoragePlugin *self, Statement notes_statement, Statement tags_statement, time_t since)
+{
+	GHashTable *notes;
+	GSList *result = NULL;
+	sqlite3_stmt *stmt;
+
+	g_static_rec_mutex_lock(&self->lock);
+
+	if (!open_db(self) || (stmt = get_statement(self, notes_statement)) == NULL) {
+		g_static_rec_mutex_unlock(&self->lock);
+		return NULL;
+	}
+
+	/* guid -> note, to attach the tags */
+	notes = g_hash_table_new(g_str_hash, g_str_equal);
+
+	if (sqlite3_bind_parameter_count(stmt) > 0) {
+		sqlite3_bind_int64(stmt, 1, since);
+	}
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		ConboyNote *note = note_from_row(stmt);
+		g_hash_table_insert(notes, (gpointer) note->guid, note);
+
+		/* Content is loaded when it's needed */
+		conboy_note_set_content_loader(note, load_content, g_object_ref(self), g_object_unref);
+		result = g_slist_prepend(result, note);
+	}
+	statement_done(stmt);
+
+	stmt = get_statement(self, tags_statement);
+	if (stmt != NULL) {
+		if (sqlite3_bind_parameter_count(stmt) > 0) {
+			sqlite3_bind_int64(stmt, 1, since);
+		}
+		while (sqlite3_step(stmt) == SQLITE_ROW) {
+			ConboyNote *note = g_hash_table_lookup(notes, sqlite3_column_text(stmt, 0));
+			if (note != NULL) {
+				conboy_note_add_tag(note, (const gchar*) sqlite3_column_text(stmt, 1));
+			}
+		}
+		statement_done(stmt);
+	}
+
+	g_static_rec_mutex_unlock(&self->lock);
+	g_hash_table_destroy(notes);
+
+	return result;
+}
+
+static GSList*
+list (ConboyStoragePlugin *self)
+{
+	g_return_val_if_fail(self != NULL, NULL);
+	g_return_val_if_fail(CONBOY_IS_SQLITE_STORAGE_PLUGIN(self), NULL);
+
+	return list_notes(CONBOY_SQLITE_STORAGE_PLUGIN(self), STMT_LIST, STMT_LIST_TAGS, 0);
+}
+
+static GSList*
+list_changed_since (ConboyStoragePlugin *self, time_t since)
+{
+	g_return_val_if_fail(self != NULL, NULL);
+	g_return_val_if_fail(CONBOY_IS_SQLITE_STORAGE_PLUGIN(self), NULL);
+
+	return list_notes(CONBOY_SQLITE_STORAGE_PLUGIN(self), STMT_LIST_CHANGED, STMT_LIST_CHANGED_TAGS, since);
+}
+
+/*
+ * Saves all notes in a transaction of their own, so either all of them
+ * end up in the database or none. Called by web sync from its thread,
+ * so it must not leave the commit to the idle handler.
+ */
+static gboolean
+save_many (ConboyStoragePlugin *self, GSList *notes)
+{
+	g_return_val_if_fail(self != NULL, FALSE);
+	g_return_val_if_fail(CONBOY_IS_SQLITE_STORAGE_PLUGIN(self), FALSE);
+
+	ConboySqliteStoragePlugin *plugin = CONBOY_SQLITE_STORAGE_PLUGIN(self);
+	gboolean result = FALSE;
+	GSList *iter;
+
+	g_static_rec_mutex_lock(&plugin->lock);
+
+	/* Earlier saves go in first, they don't depend on ours */
+	if (open_db(plugin)) {
+		commit(plugin);
+		result = exec(plugin, "BEGIN");
+	}
+
+	for (iter = notes; result && iter != NULL; iter = iter->next) {
+		result = save_note(plugin, CONBOY_NOTE(iter->data));
+	}
+
+	if (result) {
+		result = exec(plugin, "COMMIT");
+	}
+	if (!result && plugin->db != NULL && !sqlite3_get_autocommit(plugin->db)) {
+		exec(plugin, "ROLLBACK");
+	}
+
+	g_static_rec_mutex_unlock(&plugin->lock);
+
+	return result;
+}
+
+static void
+sync_db (ConboyStoragePlugin *self)
+{
+	g_return_if_fail(self != NULL);
+	g_return_if_fail(CONBOY_IS_SQLITE_STORAGE_PLUGIN(self));
+
+	ConboySqliteStoragePlugin *plugin = CONBOY_SQLITE_STORAGE_PLUGIN(self);
+
+	g_static_rec_mutex_lock(&plugin->lock);
+	commit(plugin);
+	g_static_rec_mutex_unlock(&plugin->lock);
+}
+
+/*
+ * Turns the words into an FTS3 query. Every word is casefolded like the
+ * indexed text and matched as a prefix, all of them have to be found.
+ * Characters with a meaning in the query syntax separate words. Returns
+ * NULL if nothing is left.
+ */
+static gchar*
+build_query (gchar **words)
+{
+	GString *query = g_string_new(NULL);
+	gboolean in_word = FALSE;
+	guint i;
+
+	for (i = 0; words[i] != NULL; i++) {
+		gchar *word = g_utf8_casefold(words[i], -1);
+		const gchar *pos;
+
+		for (pos = word; *pos != '\0'; pos++) {
+			/* Non ASCII characters are part of words */
+			if (g_ascii_isalnum(*pos) || (guchar) *pos >= 0x80) {
+				if (!in_word && query->len > 0) {
+					g_string_append_c(query, ' ');
+				}
+				g_string_append_c(query, *pos);
+				in_word = TRUE;
+			} else if (in_word) {
+				g_string_append_c(query, '*');
+				in_word = FALSE;
+			}
+		}
+
+		if (in_word) {
+			g_string_append_c(query, '*');
+			in_word = FALSE;
+		}
+		g_free(word);
+	}
+
+	if (query->len == 0) {
+		g_string_free(query, TRUE);
+		return NULL;
+	}
+
+	return g_string_free(query, FALSE);
+}
+
+/*
+ * Each hit is a tuple of four numbers in the result of offsets().
+ */
+static gint
+count_hits (const gchar *offsets)
+{
+	gint numbers = 0;
+	gchar **parts;
+	guint i;
+
+	if (offsets == NULL) {
+		return 0;
+	}
+
+	parts = g_strsplit(offsets, " ", -1);
+	for (i = 0; parts[i] != NULL; i++) {
+		if (parts[i][0] != '\0') {
+			numbers++;
+		}
+	}
+	g_strfreev(parts);
+
+	return numbers / 4;
+}
+
+static gboolean
+search (ConboyStoragePlugin *self, gchar **words, GHashTable *matches)
+{
+	g_return_val_if_fail(self != NULL, FALSE);
+	g_return_val_if_fail(CONBOY_IS_SQLITE_STORAGE_PLUGIN(self), FALSE);
+
+	ConboySqliteStoragePlugin *plugin = CONBOY_SQLITE_STORAGE_PLUGIN(self);
+	sqlite3_stmt *stmt;
+	gchar *query;
+	gint rc;
+
+	g_static_rec_mutex_lock(&plugin->lock);
+
+	if (!open_db(plugin) || !plugin->has_fts) {
+		g_static_rec_mutex_unlock(&plugin->lock);
+		return FALSE;
+	}
+
+	query = build_query(words);
+	if (query == NULL || (stmt = get_statement(plugin, STMT_SEARCH)) == NULL) {
+		g_static_rec_mutex_unlock(&plugin->lock);
+		g_free(query);
+		return FALSE;
+	}
+
+	sqlite3_bind_text(stmt, 1, query, -1, SQLITE_STATIC);
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		gint hits = count_hits((const gchar*) sqlite3_column_text(stmt, 1));
+		g_hash_table_insert(matches, g_strdup((const gchar*) sqlite3_column_text(stmt, 0)), GINT_TO_POINTER(MAX(hits, 1)));
+	}
+	statement_done(stmt);
+	g_free(query);
+
+	if (rc != SQLITE_DONE) {
+		g_printerr("ERROR: Search failed: %s\n", sqlite3_errmsg(plugin->db));
+		g_hash_table_remove_all(matches);
+	}
+	g_static_rec_mutex_unlock(&plugin->lock);
+
+	return rc == SQLITE_DONE;
+}
+
+/*
+ * GOBJECT stuff
+ */
+
+static void
+finalize(GObject *object)
+{
+	ConboySqliteStoragePlugin *self = CONBOY_SQLITE_STORAGE_PLUGIN(object);
+
+	g_free(self->statements);
+	g_static_rec_mutex_free(&self->lock);
+
+	G_OBJECT_CLASS(conboy_sqlite_storage_plugin_parent_class)->finalize(object);
+}
+
+static void
+dispose(GObject *object)
+{
+	ConboySqliteStoragePlugin *self = CONBOY_SQLITE_STORAGE_PLUGIN(object);
+	guint i;
+
+	if (self->db != NULL) {
+		commit(self);
+
+		for (i = 0; i < N_STATEMENTS; i++) {
+			if (self->statements[i] != NULL) {
+				sqlite3_finalize(self->statements[i]);
+				self->statements[i] = NULL;
+			}
+		}
+
+		sqlite3_close(self->db);
+		self->db = NULL;
+	}
+
+	g_free(self->path);
+	self->path = NULL;
+	g_free(self->filename);
+	self->filename = NULL;
+
+	G_OBJECT_CLASS(conboy_sqlite_storage_plugin_parent_class)->dispose(object);
+}
+
+static void
+conboy_sqlite_storage_plugin_class_init (ConboySqliteStoragePluginClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	ConboyStoragePluginClass *storage_class = CONBOY_STORAGE_PLUGIN_CLASS(klass);
+
+	object_class->dispose =	dispose;
+	object_class->finalize = finalize;
+
+	storage_class->load = load;
+	storage_class->save = save;
+	storage_class->delete = delete;
+	storage_class->list = list;
+	storage_class->list_ids = list_ids;
+	storage_class->sync = sync_db;
+	storage_class->search = search;
+	storage_class->save_many = save_many;
+	storage_class->list_changed_since = list_changed_since;
+}
+
+static void
+conboy_sqlite_storage_plugin_init (ConboySqliteStoragePlugin *self)
+{
+	CONBOY_PLUGIN(self)->has_settings = FALSE;
+	self->path = conboy_storage_plugin_get_notes_dir();
+	self->filename = g_strconcat(self->path, DATABASE_FILE, NULL);
+
+	g_static_rec_mutex_init(&self->lock);
+	self->db = NULL;
+	self->statements = g_new0(sqlite3_stmt*, N_STATEMENTS);
+	self->has_fts = FALSE;
+	self->in_transaction = FALSE;
+	self->commit_source = 0;
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2009 Cornelius Hald <hald@icandy.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef CONBOY_SQLITE_STORAGE_PLUGIN_H
+#define CONBOY_SQLITE_STORAGE_PLUGIN_H
+
+#include <glib-object.h>
+#include <sqlite3.h>
+
+/* convention macros */
+#define CONBOY_TYPE_SQLITE_STORAGE_PLUGIN				(conboy_sqlite_storage_plugin_get_type())
+#define CONBOY_SQLITE_STORAGE_PLUGIN(object)			(G_TYPE_CHECK_INSTANCE_CAST ((object),CONBOY_TYPE_SQLITE_STORAGE_PLUGIN, ConboySqliteStoragePlugin))
+#define CONBOY_SQLITE_STORAGE_PLUGIN_CLASS(klass)		(G_TYPE_CHECK_CLASS_CAST ((klass), CONBOY_TYPE_SQLITE_STORAGE_PLUGIN, ConboySqliteStoragePluginClass))
+#define CONBOY_IS_SQLITE_STORAGE_PLUGIN(object)			(G_TYPE_CHECK_INSTANCE_TYPE ((object), CONBOY_TYPE_SQLITE_STORAGE_PLUGIN))
+#define CONBOY_IS_SQLITE_STORAGE_PLUGIN_CLASS(klass)	(G_TYPE_CHECK_CLASS_TYPE ((klass), CONBOY_TYPE_SQLITE_STORAGE_PLUGIN))
+#define CONBOY_SQLITE_STORAGE_PLUGIN_GET_CLASS(obj)		(G_TYPE_INSTANCE_GET_CLASS ((obj), CONBOY_TYPE_SQLITE_STORAGE_PLUGIN, ConboySqliteStoragePluginClass))
+
+typedef struct _ConboySqliteStoragePlugin 		ConboySqliteStoragePlugin;
+typedef struct _ConboySqliteStoragePluginClass	ConboySqliteStoragePluginClass;
+
+struct _ConboySqliteStoragePlugin {
+	ConboyStoragePlugin parent;
+	/*<private>*/
+	gchar *path;                 /* directory of the database and of the .note files */
+	gchar *filename;             /* the database itself */
+
+	/* Web sync saves from its own thread. Recursive, because saving
+	 * a note can load its content through load_content(). */
+	GStaticRecMutex lock;        /* protects everything below */
+
+	sqlite3 *db;                 /* NULL until the first access */
+	sqlite3_stmt **statements;   /* prepared when first used */
+	gboolean has_fts;            /* FALSE if SQLite was built without FTS3 */
+
+	/* Saves are collected in one transaction, which is committed
+	 * when the main loop becomes idle or on sync(). save_many()
+	 * commits its own transaction. */
+	gboolean in_transaction;
+	guint commit_source;
+};
+
+struct _ConboySqliteStoragePluginClass {
+	ConboyStoragePluginClass parent;
+};
+
+GType						conboy_sqlite_storage_plugin_get_type	(void);
+ConboySqliteStoragePlugin*	conboy_plugin_new						(void);
+
+#endif /* CONBOY_SQLITE_STORAGE_PLUGIN_H */
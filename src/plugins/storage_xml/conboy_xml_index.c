@@ -0,0 +1,339 @@
+/*
+ * Copyright (C) 2009 Cornelius Hald <hald@icandy.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "conboy_xml_index.h"
+
+/*
+ * File layout (native byte order, the file never leaves the device):
+ *
+ *   IndexHeader
+ *   n_entries times:
+ *     IndexEntry
+ *     guid\0 title\0 tag\0 ... tag\0
+ *     padding up to a multiple of 8 bytes
+ *
+ * IndexEntry.length is the size of the complete record including the
+ * strings and the padding.
+ */
+
+#define INDEX_MAGIC "CBYIDX01"
+#define INDEX_ALIGN(n) (((n) + 7) & ~7)
+
+#define FLAG_OPEN_ON_STARTUP (1 << 0)
+
+typedef struct {
+	gchar   magic[8];
+	guint32 n_entries;
+	guint32 reserved;
+	gint64  written;     /* time the index was written */
+} IndexHeader;
+
+typedef struct {
+	guint32 length;
+	guint16 n_tags;
+	guint16 flags;
+	gint64  mtime;       /* of the .note file */
+	gint64  size;        /* of the .note file */
+	gint64  create_date;
+	gint64  change_date;
+	gint64  metadata_change_date;
+	gdouble note_version;
+	gdouble content_version;
+	gint32  cursor_position;
+	gint32  width;
+	gint32  height;
+	gint32  x;
+	gint32  y;
+	gint32  reserved;
+} IndexEntry;
+
+struct _ConboyXmlIndex {
+	GMappedFile *file;
+	gint64       written;
+	GHashTable  *entries; /* guid -> start of record in the mapped file */
+};
+
+
+/*
+ * Checks that the record contains n_strings zero terminated strings.
+ */
+static gboolean
+check_strings (const gchar *strings, gsize length, guint n_strings)
+{
+	const gchar *end = strings + length;
+
+	while (n_strings > 0) {
+		const gchar *nul = memchr(strings, '\0', end - strings);
+		if (nul == NULL) {
+			return FALSE;
+		}
+		strings = nul + 1;
+		n_strings--;
+	}
+
+	return TRUE;
+}
+
+static gboolean
+read_entries (ConboyXmlIndex *index, const gchar *data, gsize length)
+{
+	IndexHeader header;
+	gsize pos;
+	guint i;
+
+	if (length < sizeof(IndexHeader)) {
+		return FALSE;
+	}
+
+	memcpy(&header, data, sizeof(IndexHeader));
+	if (memcmp(header.magic, INDEX_MAGIC, sizeof(header.magic)) != 0) {
+		return FALSE;
+	}
+
+	index->written = header.written;
+	pos = sizeof(IndexHeader);
+
+	for (i = 0; i < header.n_entries; i++) {
+		IndexEntry entry;
+		const gchar *guid;
+
+		if (length - pos < sizeof(IndexEntry)) {
+			return FALSE;
+		}
+		memcpy(&entry, data + pos, sizeof(IndexEntry));
+
+		if (entry.length < sizeof(IndexEntry) || entry.length > length - pos) {
+			return FALSE;
+		}
+
+		/* guid, title and the tags */
+		guid = data + pos + sizeof(IndexEntry);
+		if (!check_strings(guid, entry.length - sizeof(IndexEntry), 2 + entry.n_tags)) {
+			return FALSE;
+		}
+
+		g_hash_table_replace(index->entries, (gpointer) guid, (gpointer) (data + pos));
+		pos += entry.length;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Maps the index into memory. If the file does not exist or is not valid,
+ * an empty index is returned.
+ */
+ConboyXmlIndex*
+conboy_xml_index_open (const gchar *filename)
+{
+	g_return_val_if_fail(filename != NULL, NULL);
+
+	ConboyXmlIndex *index = g_new0(ConboyXmlIndex, 1);
+	index->entries = g_hash_table_new(g_str_hash, g_str_equal);
+
+	index->file = g_mapped_file_new(filename, FALSE, NULL);
+	if (index->file == NULL) {
+		return index;
+	}
+
+	if (!read_entries(index, g_mapped_file_get_contents(index->file), g_mapped_file_get_length(index->file))) {
+		g_printerr("WARN: Ignoring invalid index: %s\n", filename);
+		g_hash_table_remove_all(index->entries);
+		g_mapped_file_free(index->file);
+		index->file = NULL;
+	}
+
+	return index;
+}
+
+void
+conboy_xml_index_free (ConboyXmlIndex *index)
+{
+	g_return_if_fail(index != NULL);
+
+	g_hash_table_destroy(index->entries);
+	if (index->file != NULL) {
+		g_mapped_file_free(index->file);
+	}
+	g_free(index);
+}
+
+guint
+conboy_xml_index_size (ConboyXmlIndex *index)
+{
+	g_return_val_if_fail(index != NULL, 0);
+
+	return g_hash_table_size(index->entries);
+}
+
+/**
+ * Creates a note from the cached metadata. The note has no content.
+ * Returns NULL if the note is not in the index or if the .note file
+ * changed since the index was written.
+ */
+ConboyNote*
+conboy_xml_index_get_note (ConboyXmlIndex *index, const gchar *guid, const struct stat *file_stat)
+{
+	g_return_val_if_fail(index != NULL, NULL);
+	g_return_val_if_fail(guid != NULL, NULL);
+	g_return_val_if_fail(file_stat != NULL, NULL);
+
+	const gchar *record;
+	const gchar *title;
+	const gchar *tag;
+	IndexEntry entry;
+	ConboyNote *note;
+	guint i;
+
+	record = g_hash_table_lookup(index->entries, guid);
+	if (record == NULL) {
+		return NULL;
+	}
+
+	memcpy(&entry, record, sizeof(IndexEntry));
+
+	if (entry.mtime != file_stat->st_mtime || entry.size != file_stat->st_size) {
+		return NULL;
+	}
+
+	/* The file could have been changed again in the same second the
+	 * index was written. In that case the mtime is not reliable. */
+	if (entry.mtime >= index->written) {
+		return NULL;
+	}
+
+	title = record + sizeof(IndexEntry) + strlen(guid) + 1;
+
+	note = conboy_note_new_with_guid(guid);
+	g_object_set(note,
+			"title", title,
+			"create-date", (guint) entry.create_date,
+			"change-date", (guint) entry.change_date,
+			"metadata-change-date", (guint) entry.metadata_change_date,
+			"note-version", entry.note_version,
+			"content-version", entry.content_version,
+			"cursor-position", entry.cursor_position,
+			"width", entry.width,
+			"height", entry.height,
+			"x", entry.x,
+			"y", entry.y,
+			"open-on-startup", (entry.flags & FLAG_OPEN_ON_STARTUP) != 0,
+			NULL);
+
+	tag = title + strlen(title) + 1;
+	for (i = 0; i < entry.n_tags; i++) {
+		conboy_note_add_tag(note, tag);
+		tag += strlen(tag) + 1;
+	}
+
+	return note;
+}
+
+static void
+append_string (GByteArray *data, const gchar *string)
+{
+	if (string == NULL) {
+		string = "";
+	}
+	g_byte_array_append(data, (const guint8*) string, strlen(string) + 1);
+}
+
+/**
+ * Writes the metadata of the given notes to the index. Entries in notes
+ * may be NULL, those are skipped. file_stats contains the stat of the
+ * .note file of each note.
+ */
+gboolean
+conboy_xml_index_write (const gchar *filename, ConboyNote **notes, const struct stat *file_stats, guint n_notes)
+{
+	g_return_val_if_fail(filename != NULL, FALSE);
+
+	static const guint8 padding[8] = { 0 };
+	IndexHeader header;
+	GByteArray *data;
+	GError *error = NULL;
+	gboolean result;
+	guint i;
+
+	data = g_byte_array_sized_new(sizeof(IndexHeader) + n_notes * (sizeof(IndexEntry) + 128));
+
+	memset(&header, 0, sizeof(IndexHeader));
+	memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+	header.written = time(NULL);
+	g_byte_array_append(data, (const guint8*) &header, sizeof(IndexHeader));
+
+	for (i = 0; i < n_notes; i++) {
+		ConboyNote *note = notes[i];
+		IndexEntry entry;
+		guint start, length;
+		guint j;
+
+		if (note == NULL) {
+			continue;
+		}
+
+		memset(&entry, 0, sizeof(IndexEntry));
+		entry.n_tags = conboy_note_get_n_tags(note);
+		entry.flags = note->open_on_startup ? FLAG_OPEN_ON_STARTUP : 0;
+		entry.mtime = file_stats[i].st_mtime;
+		entry.size = file_stats[i].st_size;
+		entry.create_date = note->create_date;
+		entry.change_date = note->last_change_date;
+		entry.metadata_change_date = note->last_metadata_change_date;
+		entry.note_version = note->note_version;
+		entry.content_version = note->content_version;
+		entry.cursor_position = note->cursor_position;
+		entry.width = note->width;
+		entry.height = note->height;
+		entry.x = note->x;
+		entry.y = note->y;
+
+		start = data->len;
+		g_byte_array_append(data, (const guint8*) &entry, sizeof(IndexEntry));
+		append_string(data, note->guid);
+		append_string(data, note->title);
+		for (j = 0; j < entry.n_tags; j++) {
+			append_string(data, conboy_note_get_tag(note, j));
+		}
+
+		length = data->len - start;
+		g_byte_array_append(data, padding, INDEX_ALIGN(length) - length);
+
+		/* Now that the length is known, update the record */
+		entry.length = INDEX_ALIGN(length);
+		memcpy(data->data + start, &entry, sizeof(IndexEntry));
+
+		header.n_entries++;
+	}
+
+	memcpy(data->data, &header, sizeof(IndexHeader));
+
+	/* Writes to a temporary file first and renames it afterwards */
+	result = g_file_set_contents(filename, (const gchar*) data->data, data->len, &error);
+	if (!result) {
+		g_printerr("ERROR: Couldn't write index: %s\n", error->message);
+		g_error_free(error);
+	}
+
+	g_byte_array_free(data, TRUE);
+
+	return result;
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2009 Cornelius Hald <hald@icandy.de>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef CONBOY_XML_INDEX_H
+#define CONBOY_XML_INDEX_H
+
+#include <glib.h>
+#include <sys/stat.h>
+
+#include "../../conboy_note.h"
+
+/*
+ * Binary cache of the metadata of all .note files. The file is mapped
+ * into memory and an entry is only used if the size and modification
+ * time of its .note file did not change.
+ */
+typedef struct _ConboyXmlIndex ConboyXmlIndex;
+
+ConboyXmlIndex* conboy_xml_index_open     (const gchar *filename);
+void            conboy_xml_index_free     (ConboyXmlIndex *index);
+guint           conboy_xml_index_size     (ConboyXmlIndex *index);
+ConboyNote*     conboy_xml_index_get_note (ConboyXmlIndex *index, const gchar *guid, const struct stat *file_stat);
+
+gboolean        conboy_xml_index_write    (const gchar *filename, ConboyNote **notes, const struct stat *file_stats, guint n_notes);
+
+#endif /* CONBOY_XML_INDEX_H */
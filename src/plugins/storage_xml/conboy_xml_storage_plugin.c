@@ -17,18 +17,34 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
 #include <libxml/xmlreader.h>
-#include <libxml/xmlwriter.h>
 #include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <glib/gprintf.h>
 #include <glib/gstdio.h>
-
+#include <gtk/gtk.h>
+#include <zlib.h>
+#ifdef WITH_GIO
+#include <gio/gio.h>
+#include <gdk/gdk.h>
+#endif
+
+#include "../../localisation.h"
 #include "../../metadata.h"
 #include "../../conboy_note.h"
 #include "../../conboy_storage_plugin.h"
 #include "../../conboy_xml.h"
-#include "../../gregex.h"
+#include "../../conboy_xml_note.h"
+#include "../../settings.h"
 #include "conboy_xml_storage_plugin.h"
+#include "conboy_xml_index.h"
 
 #define NOTE_TAG "note"
 #define TITLE_TAG "title"
@@ -46,6 +62,12 @@
 #define TAGS_TAG "tags"
 #define TAG_TAG "tag"
 
+/* Upper bound for the number of threads used by list() */
+#define MAX_LOADER_THREADS 8
+
+/* Metadata cache, see conboy_xml_index.h */
+#define INDEX_FILE "index.cache"
+
 G_DEFINE_TYPE(ConboyXmlStoragePlugin, conboy_xml_storage_plugin, CONBOY_TYPE_STORAGE_PLUGIN);
 
 typedef enum {
@@ -89,15 +111,32 @@ string_to_enum(const gchar *string)
 	return UNKNOWN;
 }
 
-static void
-handle_start_element(xmlTextReader *reader, ConboyNote *note)
+/*
+ * Returns TRUE if the subtree of the current element should be skipped.
+ * If with_content is FALSE, <note-content> is not read at all.
+ */
+static gboolean
+handle_start_element(xmlTextReader *reader, ConboyNote *note, gboolean with_content)
 {
 	/* TODO: Whats the official way to convert xmlChar to gchar? */
 	const gchar *name = (const gchar *)xmlTextReaderConstName(reader);
-	gchar *value = (gchar *) xmlTextReaderReadString(reader);
+	gchar *value = NULL;
 	xmlChar *attr_value = NULL;
 	XmlTag tag = string_to_enum(name);
 
+	/* Only read the text of leaf elements. For <note> this would be the whole document */
+	switch (tag) {
+	case NOTE:
+	case TEXT:
+	case NOTE_CONTENT:
+	case TAGS:
+	case UNKNOWN:
+		break;
+	default:
+		value = (gchar *) xmlTextReaderReadString(reader);
+		break;
+	}
+
 	switch (tag) {
 
 	case NOTE:
@@ -109,6 +148,7 @@ handle_start_element(xmlTextReader *reader, ConboyNote *note)
 		} else {
 			g_printerr("ERROR: Couldn't parse note version.\n");
 		}
+		break;
 
 	case TITLE:
 		g_object_set(note, "title", value, NULL);
@@ -124,10 +164,13 @@ handle_start_element(xmlTextReader *reader, ConboyNote *note)
 			g_printerr("ERROR: Couldn't parse content version.\n");
 		}
 
-		xmlChar *content = xmlTextReaderReadOuterXml(reader);
-		g_object_set(note, "content", (gchar*)content, NULL);
-		xmlFree(content);
-		break;
+		if (with_content) {
+			xmlChar *content = xmlTextReaderReadOuterXml(reader);
+			g_object_set(note, "content", (gchar*)content, NULL);
+			xmlFree(content);
+		}
+		/* Don't descend into the content */
+		return TRUE;
 
 	case LAST_CHANGE_DATE:
 		g_object_set(note, "change-date", get_iso8601_time_in_seconds(value), NULL);
@@ -162,7 +205,7 @@ handle_start_element(xmlTextReader *reader, ConboyNote *note)
 		break;
 
 	case OPEN_ON_STARTUP:
-		g_object_set(note, "open-on-startup", atoi(value), NULL);
+		g_object_set(note, "open-on-startup", g_ascii_strcasecmp(value, "True") == 0, NULL);
 		break;
 
 	case TAG:
@@ -175,118 +218,121 @@ handle_start_element(xmlTextReader *reader, ConboyNote *note)
 
 	g_free(value);
 	g_free(attr_value);
+
+	return FALSE;
 }
 
-static
-void process_note(xmlTextReader *reader, ConboyNote *note)
+static gboolean
+process_note(xmlTextReader *reader, ConboyNote *note, gboolean with_content)
 {
 	if (xmlTextReaderNodeType(reader) == XML_ELEMENT_NODE) {
-		handle_start_element(reader, note);
+		return handle_start_element(reader, note, with_content);
 	}
+	return FALSE;
 }
 
-static void
-write_header(xmlTextWriter *writer, ConboyNote *note)
-{
-	int rc;
-	gchar version[20];
-	gdouble note_version;
-	gchar *title;
-
-	g_object_get(note, "title", &title, "note-version", &note_version, NULL);
+/*
+ * Public methods
+ */
 
-	/* Enable indentation */
-	rc = xmlTextWriterSetIndent(writer, TRUE);
+ConboyXmlStoragePlugin*
+conboy_plugin_new ()
+{
+	return g_object_new(CONBOY_TYPE_XML_STORAGE_PLUGIN, NULL);
+}
 
-	/* Start document */
-	rc = xmlTextWriterStartDocument(writer, "1.0", "utf-8", NULL);
 
-	/* Start note element */
-	rc = xmlTextWriterStartElement(writer, BAD_CAST "note");
+/*
+ * Stat of a .note file as we last saw it. Used to tell our own writes
+ * and no-op events apart from real changes.
+ */
+typedef struct {
+	gint64 mtime;
+	gint64 size;
+} KnownFile;
 
-	g_ascii_formatd(version, 20, "%.1f", note_version);
-	rc = xmlTextWriterWriteAttribute(writer, BAD_CAST "version", BAD_CAST &version);
-	rc = xmlTextWriterWriteAttributeNS(writer, BAD_CAST "xmlns", BAD_CAST "link", NULL, BAD_CAST "http://beatniksoftware.com/tomboy/link");
-	rc = xmlTextWriterWriteAttributeNS(writer, BAD_CAST "xmlns", BAD_CAST "size", NULL, BAD_CAST "http://beatniksoftware.com/tomboy/size");
-	rc = xmlTextWriterWriteAttributeNS(writer, NULL, BAD_CAST "xmlns", NULL, BAD_CAST "http://beatniksoftware.com/tomboy");
+/* Must be called with self->lock held */
+static void
+remember_file (ConboyXmlStoragePlugin *self, const gchar *guid, const struct stat *file_stat)
+{
+	KnownFile *known = g_new(KnownFile, 1);
+	known->mtime = file_stat->st_mtime;
+	known->size = file_stat->st_size;
+	g_hash_table_replace(self->known, g_strdup(guid), known);
+}
 
-	/* Title element */
-	rc = xmlTextWriterWriteElement(writer, BAD_CAST "title", BAD_CAST title);
-	g_free(title);
+/*
+ * Parses one .note file with an xmlTextReader. Slower than the SAX
+ * parser, but it also copes with files the SAX parser rejects.
+ */
+static ConboyNote*
+load_file_with_reader (const gchar *filename, const gchar *guid, gboolean with_content)
+{
+	int ret = -1;
+	ConboyNote *note;
+	xmlTextReader *reader;
 
-	/* Start text element */
-	rc = xmlTextWriterStartElement(writer, BAD_CAST "text");
-	rc = xmlTextWriterWriteAttributeNS(writer, BAD_CAST "xml", BAD_CAST "space", NULL, BAD_CAST "preserve");
-}
+	reader = xmlReaderForFile(filename, "UTF-8", 0);
+	note = conboy_note_new_with_guid(guid);
 
-static void
-write_footer(xmlTextWriter *writer, ConboyNote *note)
-{
-	int rc;
-	GList *tags;
-	guint change_date, metadata_change_date, create_date;
-	gint  cursor_position, width, height, x, y;
-	gboolean open_on_startup;
-
-	g_object_get(note,
-			"change-date", &change_date,
-			"metadata-change-date", &metadata_change_date,
-			"create-date", &create_date,
-			"cursor-position", &cursor_position,
-			"open-on-startup", &open_on_startup,
-			"width", &width,
-			"height", &height,
-			"x", &x,
-			"y", &y,
-			NULL);
-
-	/* Enable indentation */
-	rc = xmlTextWriterSetIndent(writer, TRUE);
-
-	/* Meta data tags */
-	rc = xmlTextWriterWriteFormatElement(writer, BAD_CAST "last-change-date", "%s", get_time_in_seconds_as_iso8601(change_date));
-	rc = xmlTextWriterWriteFormatElement(writer, BAD_CAST "last-metadata-change-date", "%s", get_time_in_seconds_as_iso8601(metadata_change_date));
-	rc = xmlTextWriterWriteFormatElement(writer, BAD_CAST "create-date", "%s", get_time_in_seconds_as_iso8601(create_date));
-	rc = xmlTextWriterWriteFormatElement(writer, BAD_CAST "cursor-position", "%i", cursor_position);
-	rc = xmlTextWriterWriteFormatElement(writer, BAD_CAST "width", "%i", width);
-	rc = xmlTextWriterWriteFormatElement(writer, BAD_CAST "height", "%i", height);
-	rc = xmlTextWriterWriteFormatElement(writer, BAD_CAST "x", "%i", x);
-	rc = xmlTextWriterWriteFormatElement(writer, BAD_CAST "y", "%i", y);
-
-	/* Write tags */
-	tags = conboy_note_get_tags(note);
-	if (tags != NULL) {
-		rc = xmlTextWriterStartElement(writer, BAD_CAST "tags");
-		while (tags != NULL) {
-			gchar *tag = tags->data;
-			rc = xmlTextWriterWriteFormatElement(writer, BAD_CAST "tag", "%s", tag);
-			tags = tags->next;
+	if (reader != NULL) {
+		ret = xmlTextReaderRead(reader);
+		while (ret == 1) {
+			if (process_note(reader, note, with_content)) {
+				ret = xmlTextReaderNext(reader);
+			} else {
+				ret = xmlTextReaderRead(reader);
+			}
 		}
-		rc = xmlTextWriterEndElement(writer);
+		xmlFreeTextReader(reader);
 	}
 
-	if (open_on_startup == TRUE) {
-		rc = xmlTextWriterWriteFormatElement(writer, BAD_CAST "open-on-startup", "True");
-	} else {
-		rc = xmlTextWriterWriteFormatElement(writer, BAD_CAST "open-on-startup", "False");
+	if (ret != 0) {
+		g_object_unref(note);
+		note = NULL;
 	}
 
-	/* End the document */
-	rc = xmlTextWriterEndDocument(writer);
+	return note;
 }
 
-
-
 /*
- * Public methods
+ * Parses one .note or .note.gz file. Can be called from several threads
+ * at the same time. If with_content is FALSE, only the metadata is parsed.
+ *
+ * Set CONBOY_XML_PARSER=reader to always use the xmlTextReader, e.g.
+ * to compare both parsers.
  */
-
-ConboyXmlStoragePlugin*
-conboy_plugin_new ()
+static ConboyNote*
+load_file (const gchar *path, const gchar *guid, gboolean with_content)
 {
-	return g_object_new(CONBOY_TYPE_XML_STORAGE_PLUGIN, NULL);
-}
+	const gchar *parser = g_getenv("CONBOY_XML_PARSER");
+	gboolean use_reader = (parser != NULL && strcmp(parser, "reader") == 0);
+	ConboyNote *note = NULL;
+	struct stat file_stat;
+	gchar *filename;
+
+	filename = conboy_xml_note_find_file(path, guid, &file_stat);
+	if (filename == NULL) {
+		g_printerr("ERROR: No file for note %s\n", guid);
+		return NULL;
+	}
+
+	if (!use_reader) {
+		note = conboy_xml_note_parse_file(filename, guid, with_content);
+	}
+	/* The reader also decompresses by itself */
+	if (note == NULL) {
+		note = load_file_with_reader(filename, guid, with_content);
+	}
+
+	if (note == NULL) {
+		g_printerr("ERROR: Failed to parse file: %s\n", filename);
+	}
+
+	g_free(filename);
 
+	return note;
+}
 
 static ConboyNote*
 load (ConboyStoragePlugin *self, const gchar *guid)
@@ -295,35 +341,263 @@ load (ConboyStoragePlugin *self, const gchar *guid)
 	g_return_val_if_fail(guid != NULL, FALSE);
 	g_return_val_if_fail(CONBOY_IS_XML_STORAGE_PLUGIN(self), FALSE);
 
-	int ret;
+	ConboyXmlStoragePlugin *plugin = CONBOY_XML_STORAGE_PLUGIN(self);
 	ConboyNote *note;
+
+	/* The file might not contain the latest version yet */
+	g_mutex_lock(plugin->lock);
+	note = g_hash_table_lookup(plugin->pending, guid);
+	if (note != NULL) {
+		note = conboy_note_copy(note);
+	}
+	g_mutex_unlock(plugin->lock);
+
+	if (note == NULL) {
+		g_mutex_lock(plugin->io_lock);
+		note = load_file(plugin->path, guid, TRUE);
+		g_mutex_unlock(plugin->io_lock);
+	}
+
+	return note;
+}
+
+/*
+ * Content loader for notes created by list()
+ */
+static gchar*
+load_content (ConboyNote *note, gpointer user_data)
+{
+	ConboyNote *full_note;
+	gchar *content = NULL;
+
+	/* Same as load(), a queued version is newer than the file */
+	full_note = load(CONBOY_STORAGE_PLUGIN(user_data), note->guid);
+	if (full_note != NULL) {
+		g_object_get(full_note, "content", &content, NULL);
+		g_object_unref(full_note);
+	}
+
+	return content;
+}
+
+
+/*
+ * Output of the xml writer, goes straight to the file.
+ */
+typedef struct {
+	int fd;
+	gzFile gz;         /* NULL if the file is not compressed */
+	gsize written;
+	gboolean failed;
+} NoteOutput;
+
+static int
+note_output_write (void *context, const char *buffer, int length)
+{
+	NoteOutput *output = (NoteOutput*) context;
+	int left = length;
+
+	if (output->gz != NULL) {
+		if (gzwrite(output->gz, buffer, length) != length) {
+			output->failed = TRUE;
+			return -1;
+		}
+		output->written += length;
+		return length;
+	}
+
+	while (left > 0) {
+		ssize_t written = write(output->fd, buffer, left);
+		if (written < 0) {
+			if (errno == EINTR) continue;
+			output->failed = TRUE;
+			return -1;
+		}
+		buffer += written;
+		left -= written;
+	}
+
+	output->written += length;
+	return length;
+}
+
+static int
+note_output_close (void *context)
+{
+	/* The file is synced and closed by write_note() */
+	return 0;
+}
+
+/*
+ * Serializes the note straight into the output. Returns FALSE if
+ * writing failed.
+ */
+static gboolean
+stream_note (NoteOutput *output, ConboyNote *note)
+{
+	xmlOutputBuffer *buffer;
+
+	buffer = xmlOutputBufferCreateIO(note_output_write, note_output_close, output, NULL);
+	if (buffer == NULL) {
+		g_printerr("ERROR: Couldn't create output buffer\n");
+		return FALSE;
+	}
+
+	if (!conboy_xml_note_write(note, buffer)) {
+		return FALSE;
+	}
+
+	return !output->failed;
+}
+
+/*
+ * Streams the note into a temporary file, syncs it to disk and renames
+ * it to the final name. So the .note file contains either the old or the
+ * new version, even if we crash in the middle. The file in the other
+ * format is removed afterwards.
+ */
+static gboolean
+write_note (ConboyXmlStoragePlugin *self, ConboyNote *note)
+{
+	NoteOutput output;
 	gchar *filename;
-	xmlTextReader *reader;
+	gchar *other_filename;
+	gchar *tmp_filename;
+	gboolean compress = self->compress;
+	gboolean result = FALSE;
+	GTimer *timer;
+
+	filename = g_strconcat(self->path, note->guid, compress ? CONBOY_XML_NOTE_COMPRESSED_SUFFIX : CONBOY_XML_NOTE_SUFFIX, NULL);
+	other_filename = g_strconcat(self->path, note->guid, compress ? CONBOY_XML_NOTE_SUFFIX : CONBOY_XML_NOTE_COMPRESSED_SUFFIX, NULL);
+	tmp_filename = g_strconcat(filename, ".tmp", NULL);
+
+	output.written = 0;
+	output.failed = FALSE;
+	output.gz = NULL;
+	output.fd = g_open(tmp_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (output.fd < 0) {
+		g_printerr("ERROR: Couldn't open %s: %s\n", tmp_filename, g_strerror(errno));
+		g_free(tmp_filename);
+		g_free(other_filename);
+		g_free(filename);
+		return FALSE;
+	}
 
-	filename = g_strconcat(CONBOY_XML_STORAGE_PLUGIN(self)->path, guid, ".note", NULL);
-	reader = conboy_xml_get_reader_for_file(filename);
-	note = conboy_note_new_with_guid(guid);
+	if (compress) {
+		/* gzclose() closes the descriptor, but we still need it for the sync */
+		output.gz = gzdopen(dup(output.fd), "wb");
+		output.failed = (output.gz == NULL);
+	}
 
-	ret = xmlTextReaderRead(reader);
-	while (ret == 1) {
-		process_note(reader, note);
-		ret = xmlTextReaderRead(reader);
+	timer = g_timer_new();
+
+	if (stream_note(&output, note)
+			&& (output.gz == NULL || gzclose(output.gz) == Z_OK)
+			&& fsync(output.fd) == 0) {
+		struct stat file_stat;
+		result = TRUE;
+
+		/* The rename keeps size and mtime. Remember them before the
+		 * file appears, so the directory monitor ignores our own write. */
+		if (fstat(output.fd, &file_stat) == 0) {
+			g_mutex_lock(self->lock);
+			remember_file(self, note->guid, &file_stat);
+			g_mutex_unlock(self->lock);
+		}
+	}
+	if (close(output.fd) != 0) {
+		result = FALSE;
+	}
+	if (result && g_rename(tmp_filename, filename) != 0) {
+		result = FALSE;
 	}
 
-	if (ret != 0) {
-		g_printerr("ERROR: Failed to parse file: %s\n", filename);
+	if (result) {
+		g_unlink(other_filename);
+		g_printerr("INFO: Saved %s (%lu bytes) in %.1f ms\n", note->guid,
+				(gulong) output.written, g_timer_elapsed(timer, NULL) * 1000);
+	} else {
+		g_printerr("ERROR: Couldn't write %s: %s\n", filename, g_strerror(errno));
+		g_unlink(tmp_filename);
 	}
 
+	g_timer_destroy(timer);
+	g_free(tmp_filename);
+	g_free(other_filename);
 	g_free(filename);
 
-	if (ret != 0) {
-		return NULL;
-	} else {
-		return note;
+	return result;
+}
+
+/*
+ * Background thread writing the notes queued by save(). Exits when
+ * the plugin itself is pushed to the queue.
+ */
+static gpointer
+writer_thread_func (gpointer data)
+{
+	ConboyXmlStoragePlugin *self = CONBOY_XML_STORAGE_PLUGIN(data);
+
+	while (TRUE) {
+		gpointer item = g_async_queue_pop(self->queue);
+		ConboyNote *note = NULL;
+		gchar *guid;
+
+		if (item == self) {
+			break;
+		}
+		guid = item;
+
+		/* Take the most recent snapshot. There is none if the note
+		 * has been deleted in the meantime. */
+		g_mutex_lock(self->lock);
+		note = g_hash_table_lookup(self->pending, guid);
+		if (note != NULL) {
+			g_object_ref(note);
+			g_hash_table_remove(self->pending, guid);
+			self->writing = guid;
+		}
+		g_mutex_unlock(self->lock);
+
+		if (note != NULL) {
+			g_mutex_lock(self->io_lock);
+			write_note(self, note);
+			g_mutex_unlock(self->io_lock);
+			g_object_unref(note);
+		}
+
+		g_mutex_lock(self->lock);
+		self->writing = NULL;
+		g_cond_broadcast(self->idle);
+		g_mutex_unlock(self->lock);
+		g_free(guid);
 	}
 
+	return NULL;
 }
 
+static gboolean
+start_writer (ConboyXmlStoragePlugin *self)
+{
+	GError *error = NULL;
+
+	if (self->writer != NULL) {
+		return TRUE;
+	}
+
+	if (!g_thread_supported()) {
+		return FALSE;
+	}
+
+	self->writer = g_thread_create(writer_thread_func, self, TRUE, &error);
+	if (self->writer == NULL) {
+		g_printerr("ERROR: Couldn't start writer thread: %s\n", error->message);
+		g_error_free(error);
+		return FALSE;
+	}
+
+	return TRUE;
+}
 
 static gboolean
 save (ConboyStoragePlugin *self, ConboyNote *note)
@@ -336,46 +610,52 @@ save (ConboyStoragePlugin *self, ConboyNote *note)
 
 	g_assert(note->guid != NULL);
 
-	xmlTextWriter *writer;
-	gchar *filename;
-	gchar *content;
-
-	/* Get content and version */
-	g_object_get(note, "content", &content, NULL);
+	ConboyXmlStoragePlugin *plugin = CONBOY_XML_STORAGE_PLUGIN(self);
+	ConboyNote *snapshot;
+	gboolean queued;
 
-	/* Create filename */
-	filename = g_strconcat(CONBOY_XML_STORAGE_PLUGIN(self)->path, note->guid, ".note", NULL);
+	if (!start_writer(plugin)) {
+		gboolean result;
 
-	/* Create xml writer */
-	writer = xmlNewTextWriterFilename(filename, 0);
-	if (writer == NULL) {
-		g_printerr("ERROR: XmlWriter is NULL \n");
-		return FALSE;
+		/* Write synchronously */
+		g_mutex_lock(plugin->io_lock);
+		result = write_note(plugin, note);
+		g_mutex_unlock(plugin->io_lock);
+		return result;
 	}
 
-	/* Write the complete header */
-	write_header(writer, note);
+	/* The writer only ever sees its own copy of the note */
+	snapshot = conboy_note_copy(note);
 
-	/* Write the complete content, but before writing it we need to
-	 * remove the redundant namespace declaration from it. Sadly libxml2
-	 * wont do that for us :( */
-	GRegex *regex = g_regex_new(" xmlns(?:.*?)?=\".*?\"", 0, 0, NULL);
-	gchar *content_clean = g_regex_replace(regex, content, -1, 0, "", 0, NULL);
-	g_regex_unref(regex);
+	/* If an older version is still waiting, just replace it */
+	g_mutex_lock(plugin->lock);
+	queued = g_hash_table_lookup(plugin->pending, note->guid) != NULL;
+	g_hash_table_replace(plugin->pending, g_strdup(note->guid), snapshot);
+	if (!queued) {
+		g_async_queue_push(plugin->queue, g_strdup(note->guid));
+	}
+	g_mutex_unlock(plugin->lock);
 
-	xmlTextWriterWriteRaw(writer, (const xmlChar *)content_clean);
-	g_free(content);
-	xmlFree(content_clean);
+	return TRUE;
+}
 
-	xmlTextWriterEndElement(writer); /*</text> */
+static void
+sync_pending (ConboyStoragePlugin *self)
+{
+	g_return_if_fail(self != NULL);
+	g_return_if_fail(CONBOY_IS_XML_STORAGE_PLUGIN(self));
 
-	/* Write the complete footer */
-	write_footer(writer, note);
+	ConboyXmlStoragePlugin *plugin = CONBOY_XML_STORAGE_PLUGIN(self);
 
-	xmlFreeTextWriter(writer);
-	g_free(filename);
+	if (plugin->writer == NULL) {
+		return;
+	}
 
-	return TRUE;
+	g_mutex_lock(plugin->lock);
+	while (g_hash_table_size(plugin->pending) > 0 || plugin->writing != NULL) {
+		g_cond_wait(plugin->idle, plugin->lock);
+	}
+	g_mutex_unlock(plugin->lock);
 }
 
 static gboolean
@@ -387,19 +667,35 @@ delete (ConboyStoragePlugin *self, ConboyNote *note)
 	g_return_val_if_fail(CONBOY_IS_XML_STORAGE_PLUGIN(self), FALSE);
 	g_return_val_if_fail(CONBOY_IS_NOTE(note), FALSE);
 
+	ConboyXmlStoragePlugin *plugin = CONBOY_XML_STORAGE_PLUGIN(self);
 	gboolean result = FALSE;
 
 	gchar *guid;
 	g_object_get(note, "guid", &guid, NULL);
-	gchar *filename = g_strconcat(guid, ".note", NULL);
-	gchar *full_name = g_build_filename(CONBOY_XML_STORAGE_PLUGIN(self)->path, filename, NULL);
+	gchar *full_name = g_strconcat(plugin->path, guid, CONBOY_XML_NOTE_SUFFIX, NULL);
+	gchar *compressed_name = g_strconcat(plugin->path, guid, CONBOY_XML_NOTE_COMPRESSED_SUFFIX, NULL);
+
+	/* Drop a queued write, it would bring the file back. A write that
+	 * already started has to finish first, it also remembers the file. */
+	g_mutex_lock(plugin->lock);
+	g_hash_table_remove(plugin->pending, guid);
+	while (plugin->writing != NULL && strcmp(plugin->writing, guid) == 0) {
+		g_cond_wait(plugin->idle, plugin->lock);
+	}
+	g_hash_table_remove(plugin->known, guid);
+	g_mutex_unlock(plugin->lock);
 
+	g_mutex_lock(plugin->io_lock);
 	if (g_unlink(full_name) == 0) {
 		result = TRUE;
 	}
+	if (g_unlink(compressed_name) == 0) {
+		result = TRUE;
+	}
+	g_mutex_unlock(plugin->io_lock);
 
+	g_free(compressed_name);
 	g_free(full_name);
-	g_free(filename);
 	g_free(guid);
 
 	return result;
@@ -413,50 +709,537 @@ list_ids (ConboyStoragePlugin *self)
 
 	const gchar *filename;
 	GDir *dir = g_dir_open(CONBOY_XML_STORAGE_PLUGIN(self)->path, 0, NULL);
+	GHashTable *seen = g_hash_table_new(g_str_hash, g_str_equal);
 	GSList *result = NULL;
 
 	while ((filename = g_dir_read_name(dir)) != NULL) {
-		if (g_str_has_suffix(filename, ".note")) {
-			gchar *guid = g_strndup(filename, g_utf8_strlen(filename, -1) - 5);
-			result = g_slist_prepend(result, guid);
+		gchar *guid = conboy_xml_note_get_guid(filename);
+		if (guid == NULL) {
+			continue;
 		}
+		/* A note can have both files for a moment */
+		if (g_hash_table_lookup(seen, guid) != NULL) {
+			g_free(guid);
+			continue;
+		}
+		g_hash_table_insert(seen, guid, guid);
+		result = g_slist_prepend(result, guid);
 	}
 
+	g_hash_table_destroy(seen);
 	g_dir_close(dir);
 
 	return result;
 }
 
+/*
+ * State shared by the loader threads of list() and load_many(). Every
+ * job writes only to its own slot in notes, so no locking is needed.
+ */
+typedef struct {
+	const gchar  *path;
+	gchar       **guids;
+	ConboyNote  **notes;
+	gboolean      with_content;
+} LoadJob;
+
+static void
+load_job_func (gpointer data, gpointer user_data)
+{
+	LoadJob *job = (LoadJob*) user_data;
+	/* Index is shifted by one, because NULL cannot be pushed to a pool */
+	guint i = GPOINTER_TO_UINT(data) - 1;
+
+	job->notes[i] = load_file(job->path, job->guids[i], job->with_content);
+}
+
+static gint
+get_loader_thread_count (guint n_files)
+{
+	glong n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (n_cpus < 1) {
+		n_cpus = 1;
+	}
+	if (n_cpus > MAX_LOADER_THREADS) {
+		n_cpus = MAX_LOADER_THREADS;
+	}
+	if (n_cpus > n_files) {
+		n_cpus = n_files;
+	}
+
+	return n_cpus;
+}
+
+/*
+ * Parses all files of the job whose slot in notes is still empty, with
+ * several threads if there are enough of them.
+ */
+static void
+run_load_jobs (LoadJob *job, guint n_files, guint n_missing)
+{
+	GThreadPool *pool = NULL;
+	gint n_threads;
+	guint i;
+
+	/* libxml2 has to be initialized from one thread before it is used by several */
+	xmlInitParser();
+	/* Make sure the note class is initialized before the threads create instances */
+	g_type_class_unref(g_type_class_ref(CONBOY_TYPE_NOTE));
+
+	n_threads = get_loader_thread_count(n_missing);
+	if (n_threads > 1 && g_thread_supported()) {
+		pool = g_thread_pool_new(load_job_func, job, n_threads, TRUE, NULL);
+	}
+
+	for (i = 0; i < n_files; i++) {
+		if (job->notes[i] != NULL) {
+			continue;
+		}
+		if (pool != NULL) {
+			g_thread_pool_push(pool, GUINT_TO_POINTER(i + 1), NULL);
+		} else {
+			load_job_func(GUINT_TO_POINTER(i + 1), job);
+		}
+	}
+
+	if (pool != NULL) {
+		/* Wait until all jobs are done */
+		g_thread_pool_free(pool, FALSE, TRUE);
+	}
+}
+
+/*
+ * Loads the notes in parallel. Notes still waiting for the writer are
+ * copied from the queue instead.
+ */
+static GSList*
+load_many (ConboyStoragePlugin *self, GSList *guids)
+{
+	g_return_val_if_fail(self != NULL, NULL);
+	g_return_val_if_fail(CONBOY_IS_XML_STORAGE_PLUGIN(self), NULL);
+
+	ConboyXmlStoragePlugin *plugin = CONBOY_XML_STORAGE_PLUGIN(self);
+	GSList *result = NULL;
+	GSList *iter;
+	LoadJob job;
+	guint n_files, n_missing, i;
+
+	n_files = g_slist_length(guids);
+	if (n_files == 0) {
+		return NULL;
+	}
+
+	job.path = plugin->path;
+	job.guids = g_new(gchar*, n_files);
+	job.notes = g_new0(ConboyNote*, n_files);
+	job.with_content = TRUE;
+	n_missing = 0;
+
+	g_mutex_lock(plugin->lock);
+	for (i = 0, iter = guids; iter != NULL; i++, iter = iter->next) {
+		ConboyNote *pending = g_hash_table_lookup(plugin->pending, iter->data);
+		job.guids[i] = iter->data;
+		if (pending != NULL) {
+			job.notes[i] = conboy_note_copy(pending);
+		} else {
+			n_missing++;
+		}
+	}
+	g_mutex_unlock(plugin->lock);
+
+	if (n_missing > 0) {
+		g_mutex_lock(plugin->io_lock);
+		run_load_jobs(&job, n_files, n_missing);
+		g_mutex_unlock(plugin->io_lock);
+	}
+
+	for (i = n_files; i > 0; i--) {
+		if (job.notes[i - 1] != NULL) {
+			result = g_slist_prepend(result, job.notes[i - 1]);
+		}
+	}
+
+	g_free(job.guids);
+	g_free(job.notes);
+
+	return result;
+}
+
+/*
+ * Only parses the .note files that were modified after since. A note
+ * cannot have changed later than its file was written.
+ */
+static GSList*
+list_changed_since (ConboyStoragePlugin *self, time_t since)
+{
+	g_return_val_if_fail(self != NULL, NULL);
+	g_return_val_if_fail(CONBOY_IS_XML_STORAGE_PLUGIN(self), NULL);
+
+	ConboyXmlStoragePlugin *plugin = CONBOY_XML_STORAGE_PLUGIN(self);
+	GSList *result = NULL;
+	GSList *ids;
+	GSList *iter;
+	LoadJob job;
+	guint n_files, i;
+
+	/* Queued notes have to be in their files */
+	sync_pending(self);
+
+	ids = list_ids(self);
+	job.path = plugin->path;
+	job.guids = g_new(gchar*, g_slist_length(ids) + 1);
+	job.with_content = FALSE;
+	n_files = 0;
+
+	for (iter = ids; iter != NULL; iter = iter->next) {
+		struct stat file_stat;
+		gchar *filename = conboy_xml_note_find_file(plugin->path, iter->data, &file_stat);
+
+		if (filename != NULL && file_stat.st_mtime >= since) {
+			job.guids[n_files++] = iter->data;
+		} else {
+			g_free(iter->data);
+		}
+		g_free(filename);
+	}
+	g_slist_free(ids);
+
+	job.notes = g_new0(ConboyNote*, n_files + 1);
+	if (n_files > 0) {
+		g_mutex_lock(plugin->io_lock);
+		run_load_jobs(&job, n_files, n_files);
+		g_mutex_unlock(plugin->io_lock);
+	}
+
+	for (i = n_files; i > 0; i--) {
+		ConboyNote *note = job.notes[i - 1];
+		if (note == NULL) {
+			/* Nothing */
+		} else if (note->last_change_date > since || note->last_metadata_change_date > since) {
+			conboy_note_set_content_loader(note, load_content, g_object_ref(plugin), g_object_unref);
+			result = g_slist_prepend(result, note);
+		} else {
+			g_object_unref(note);
+		}
+		g_free(job.guids[i - 1]);
+	}
+
+	g_free(job.guids);
+	g_free(job.notes);
+
+	return result;
+}
+
+static gint
+compare_guids (gconstpointer a, gconstpointer b)
+{
+	return strcmp(*(const gchar**)a, *(const gchar**)b);
+}
+
+#ifdef WITH_GIO
+/*
+ * Something in the notes directory changed. Emits note-added,
+ * note-changed or note-removed, unless the file is still as we
+ * know it, e.g. because we wrote it ourselves.
+ */
+static void
+on_directory_changed (GFileMonitor *monitor, GFile *file, GFile *other_file,
+		GFileMonitorEvent event, ConboyXmlStoragePlugin *self)
+{
+	gchar *basename;
+	gchar *guid;
+	gchar *filename;
+	struct stat file_stat;
+	KnownFile *known;
+	const gchar *signal = NULL;
+
+	basename = g_file_get_basename(file);
+	guid = conboy_xml_note_get_guid(basename);
+	g_free(basename);
+	if (guid == NULL) {
+		return;
+	}
+
+	switch (event) {
+
+	case G_FILE_MONITOR_EVENT_DELETED:
+		/* Switching between plain and compressed removes the old file */
+		filename = conboy_xml_note_find_file(self->path, guid, &file_stat);
+		if (filename != NULL) {
+			g_free(filename);
+			break;
+		}
+		g_mutex_lock(self->lock);
+		if (g_hash_table_remove(self->known, guid)) {
+			signal = "note-removed";
+		}
+		g_mutex_unlock(self->lock);
+		break;
+
+	case G_FILE_MONITOR_EVENT_CREATED:
+	case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+		filename = g_file_get_path(file);
+		if (g_stat(filename, &file_stat) == 0) {
+			g_mutex_lock(self->lock);
+			known = g_hash_table_lookup(self->known, guid);
+			if (known == NULL) {
+				signal = "note-added";
+			} else if (known->mtime != file_stat.st_mtime || known->size != file_stat.st_size) {
+				signal = "note-changed";
+			}
+			if (signal != NULL) {
+				remember_file(self, guid, &file_stat);
+			}
+			g_mutex_unlock(self->lock);
+		}
+		g_free(filename);
+		break;
+
+	default:
+		break;
+	}
+
+	if (signal != NULL) {
+		g_printerr("INFO: %s: %s\n", signal, guid);
+		/* Handlers update the UI, but callbacks from the main loop
+		 * don't hold the gdk lock */
+		gdk_threads_enter();
+		g_signal_emit_by_name(self, signal, guid);
+		gdk_threads_leave();
+	}
+
+	g_free(guid);
+}
+
+static void
+start_monitor (ConboyXmlStoragePlugin *self)
+{
+	GFile *dir;
+	GError *error = NULL;
+
+	if (self->monitor != NULL) {
+		return;
+	}
+
+	dir = g_file_new_for_path(self->path);
+	self->monitor = G_OBJECT(g_file_monitor_directory(dir, G_FILE_MONITOR_NONE, NULL, &error));
+	g_object_unref(dir);
+
+	if (self->monitor == NULL) {
+		g_printerr("WARN: Cannot watch %s: %s\n", self->path, error->message);
+		g_error_free(error);
+		return;
+	}
+
+	g_signal_connect(self->monitor, "changed", G_CALLBACK(on_directory_changed), self);
+}
+#endif
+
 static GSList*
 list (ConboyStoragePlugin *self)
 {
 	g_return_val_if_fail(self != NULL, FALSE);
 	g_return_val_if_fail(CONBOY_IS_XML_STORAGE_PLUGIN(self), FALSE);
 
+	ConboyXmlStoragePlugin *plugin = CONBOY_XML_STORAGE_PLUGIN(self);
 	GSList *result = NULL;
-	GSList *ids = list_ids(self);
-	GSList *iter = ids;
-	while (iter != NULL) {
-		ConboyNote *note = load(self, iter->data);
+	GSList *ids;
+
+#ifdef WITH_GIO
+	start_monitor(plugin);
+#endif
+
+	ids = list_ids(self);
+	GSList *iter;
+	ConboyXmlIndex *index;
+	struct stat *stats;
+	gchar *index_file;
+	LoadJob job;
+	guint n_files, n_missing, n_cached, n_compressed, i;
+	guint64 disk_size;
+	GTimer *timer;
+
+	n_files = g_slist_length(ids);
+	if (n_files == 0) {
+		return NULL;
+	}
+
+	timer = g_timer_new();
+
+	job.path = plugin->path;
+	job.guids = g_new(gchar*, n_files);
+	job.notes = g_new0(ConboyNote*, n_files);
+	stats = g_new0(struct stat, n_files);
+
+	for (i = 0, iter = ids; iter != NULL; i++, iter = iter->next) {
+		job.guids[i] = iter->data;
+	}
+	g_slist_free(ids);
+
+	/* Sort, so that the result does not depend on the directory order */
+	qsort(job.guids, n_files, sizeof(gchar*), compare_guids);
+
+	/* Take notes from the index if their files did not change. The stat
+	 * has to happen before parsing, otherwise a change during parsing
+	 * could end up in the index with the old metadata. */
+	index_file = g_strconcat(plugin->path, INDEX_FILE, NULL);
+	index = conboy_xml_index_open(index_file);
+	n_cached = conboy_xml_index_size(index);
+	n_missing = 0;
+
+	n_compressed = 0;
+	disk_size = 0;
+
+	for (i = 0; i < n_files; i++) {
+		gchar *filename = conboy_xml_note_find_file(plugin->path, job.guids[i], &stats[i]);
+		if (filename != NULL) {
+			job.notes[i] = conboy_xml_index_get_note(index, job.guids[i], &stats[i]);
+			if (g_str_has_suffix(filename, CONBOY_XML_NOTE_COMPRESSED_SUFFIX)) {
+				n_compressed++;
+			}
+			disk_size += stats[i].st_size;
+		}
+		if (job.notes[i] == NULL) {
+			n_missing++;
+		}
+		g_free(filename);
+	}
+
+	conboy_xml_index_free(index);
+
+	/* Parse all the others */
+	if (n_missing > 0) {
+		/* Only read the metadata, content is loaded when it's needed */
+		job.with_content = FALSE;
+		g_mutex_lock(plugin->io_lock);
+		run_load_jobs(&job, n_files, n_missing);
+		g_mutex_unlock(plugin->io_lock);
+	}
+
+	/* Update the index if files were added, changed or removed */
+	if (n_missing > 0 || n_cached != n_files) {
+		conboy_xml_index_write(index_file, job.notes, stats, n_files);
+	}
+	g_free(index_file);
+
+	g_mutex_lock(plugin->lock);
+	for (i = 0; i < n_files; i++) {
+		if (job.notes[i] != NULL) {
+			remember_file(plugin, job.guids[i], &stats[i]);
+		}
+	}
+	g_mutex_unlock(plugin->lock);
+
+	/* Prepend in reverse, so the list is in guid order */
+	for (i = n_files; i > 0; i--) {
+		ConboyNote *note = job.notes[i - 1];
 		if (note != NULL) {
+			/* Content is loaded when it's needed */
+			conboy_note_set_content_loader(note, load_content, g_object_ref(plugin), g_object_unref);
 			result = g_slist_prepend(result, note);
 		}
-		g_free(iter->data);
-		iter = iter->next;
+		g_free(job.guids[i - 1]);
 	}
-	g_slist_free(ids);
+
+	g_free(job.guids);
+	g_free(job.notes);
+	g_free(stats);
+
+	/* To compare the startup time and size of plain and compressed notes */
+	g_printerr("INFO: Read %u notes (%u compressed, %" G_GUINT64_FORMAT " bytes on disk, %u parsed) in %.1f ms\n",
+			n_files, n_compressed, disk_size, n_missing, g_timer_elapsed(timer, NULL) * 1000);
+	g_timer_destroy(timer);
+
 	return result;
 }
 
+/*
+ * Set CONBOY_XML_COMPRESS=1 or 0 to override the setting, e.g. when
+ * benchmarking both formats.
+ */
+static gboolean
+use_compression (void)
+{
+	const gchar *compress = g_getenv("CONBOY_XML_COMPRESS");
+
+	if (compress != NULL) {
+		return strcmp(compress, "0") != 0;
+	}
+
+	return settings_load_compress_notes();
+}
+
+static void
+on_compress_toggled (GtkToggleButton *button, ConboyXmlStoragePlugin *self)
+{
+	self->compress = gtk_toggle_button_get_active(button);
+	settings_save_compress_notes(self->compress);
+}
+
+static GtkWidget*
+get_widget (ConboyPlugin *plugin)
+{
+	ConboyXmlStoragePlugin *self = CONBOY_XML_STORAGE_PLUGIN(plugin);
+	GtkWidget *vbox = gtk_vbox_new(FALSE, 10);
+	GtkWidget *label;
+	GtkWidget *button;
+
+	/* Translators: Option of the XML storage backend. */
+	button = gtk_check_button_new_with_label(_("Compress notes"));
+	gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(button), self->compress);
+	g_signal_connect(button, "toggled", G_CALLBACK(on_compress_toggled), self);
+	gtk_box_pack_start(GTK_BOX(vbox), button, FALSE, FALSE, 0);
+
+	/* Translators: Explains the "Compress notes" option. */
+	label = gtk_label_new(_("Saves notes as .note.gz files. They use less space, but cannot be read by Tomboy. Notes are converted when they are saved the next time."));
+	gtk_label_set_line_wrap(GTK_LABEL(label), TRUE);
+	gtk_box_pack_start(GTK_BOX(vbox), label, FALSE, FALSE, 0);
+
+	gtk_widget_show_all(vbox);
+
+	return vbox;
+}
+
 /*
  * GOBJECT stuff
  */
 
+static void
+finalize(GObject *object)
+{
+	ConboyXmlStoragePlugin *self = CONBOY_XML_STORAGE_PLUGIN(object);
+
+	g_hash_table_destroy(self->pending);
+	g_hash_table_destroy(self->known);
+	g_async_queue_unref(self->queue);
+	g_mutex_free(self->lock);
+	g_mutex_free(self->io_lock);
+	g_cond_free(self->idle);
+
+	G_OBJECT_CLASS(conboy_xml_storage_plugin_parent_class)->finalize(object);
+}
+
 static void
 dispose(GObject *object)
 {
 	ConboyXmlStoragePlugin *self = CONBOY_XML_STORAGE_PLUGIN(object);
 
+#ifdef WITH_GIO
+	if (self->monitor != NULL) {
+		g_file_monitor_cancel(G_FILE_MONITOR(self->monitor));
+		g_object_unref(self->monitor);
+		self->monitor = NULL;
+	}
+#endif
+
+	/* Write everything that is still queued and stop the writer */
+	if (self->writer != NULL) {
+		g_async_queue_push(self->queue, self);
+		g_thread_join(self->writer);
+		self->writer = NULL;
+	}
+
 	g_free(self->path);
 	self->path = NULL;
 
@@ -467,23 +1250,38 @@ static void
 conboy_xml_storage_plugin_class_init (ConboyXmlStoragePluginClass *klass)
 {
 	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	ConboyPluginClass *plugin_class = CONBOY_PLUGIN_CLASS(klass);
 	ConboyStoragePluginClass *storage_class = CONBOY_STORAGE_PLUGIN_CLASS(klass);
 
 	object_class->dispose =	dispose;
+	object_class->finalize = finalize;
+
+	plugin_class->get_widget = get_widget;
 
 	storage_class->load = load;
 	storage_class->save = save;
 	storage_class->delete = delete;
 	storage_class->list = list;
 	storage_class->list_ids = list_ids;
+	storage_class->sync = sync_pending;
+	storage_class->load_many = load_many;
+	storage_class->list_changed_since = list_changed_since;
 
 }
 
 static void
 conboy_xml_storage_plugin_init (ConboyXmlStoragePlugin *self)
 {
-	CONBOY_PLUGIN(self)->has_settings = FALSE;
-	self->path = g_strconcat(g_get_home_dir(), "/.conboy/", NULL);
+	CONBOY_PLUGIN(self)->has_settings = TRUE;
+	self->path = conboy_storage_plugin_get_notes_dir();
+	self->compress = use_compression();
+
+	self->queue = g_async_queue_new();
+	self->lock = g_mutex_new();
+	self->io_lock = g_mutex_new();
+	self->idle = g_cond_new();
+	self->pending = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_object_unref);
+	self->known = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
 }
 
 
@@ -37,6 +37,20 @@ struct _ConboyXmlStoragePlugin {
 	ConboyStoragePlugin parent;
 	/*<private>*/
 	gchar *path;
+	gboolean compress;     /* write .note.gz files */
+
+	/* background writer */
+	GThread *writer;
+	GAsyncQueue *queue;    /* guids of notes to write */
+	GMutex *lock;          /* protects pending and writing */
+	GMutex *io_lock;       /* held while a file is read, written or deleted */
+	GCond *idle;           /* signaled after each write */
+	GHashTable *pending;   /* guid -> snapshot of the note to write */
+	const gchar *writing;  /* guid of the note being written or NULL */
+
+	/* directory monitoring, only with gio */
+	GObject *monitor;
+	GHashTable *known;     /* guid -> KnownFile, last seen stat of each file, protected by lock */
 };
 
 struct _ConboyXmlStoragePluginClass {
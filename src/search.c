@@ -21,100 +21,19 @@
 
 
 #include "app_data.h"
-#include "conboy_xml.h"
+#include "conboy_storage.h"
 #include "search.h"
 
-/**
- * Returns a new gchar* which contains only the text, but no xml tags anymore.
- * Free the return value when not needed anymore.
- */
-static gchar*
-strip_tags(const gchar *xml_string)
+static void
+add_storage_match(gpointer key, gpointer value, gpointer user_data)
 {
-	int ret;
-	GString *result = g_string_new("");
-	xmlTextReader *reader = conboy_xml_get_reader_for_memory(xml_string);
-	
-	ret = xmlTextReaderRead(reader);
-	while (ret == 1) {
-		int type = xmlTextReaderNodeType(reader);
-		const xmlChar *value = xmlTextReaderConstValue(reader);
-		 
-		if (type == XML_TEXT_NODE || type == XML_DTD_NODE) { 
-			g_string_append(result, value);
-		}
-		
-		ret = xmlTextReaderRead(reader);
-	}
-	
-	if (ret != 0) {
-		g_printerr("ERROR: Failed to strip tags from xml string.\n");
-	}
-	
-	/* Returns the gchar array and frees the rest */
-	return g_string_free(result, FALSE);
-}
-
-/* TODO: Clean up the g_free() mess */
-static gint
-find_match_count(const gchar *xml_string, gchar **words)
-{
-	gint matches = 0;
-	gint i;
-	gchar *note_content = strip_tags(xml_string);
-	gchar *u_note_content = g_utf8_casefold(note_content, -1);
-	g_free(note_content);
-	
-	for (i = 0; words[i] != NULL; i++) {
-		
-		gchar *u_word = g_utf8_casefold(words[i], -1);
-		gchar *u_found = u_note_content;
-		
-		gboolean current_word_found = FALSE;	
-		
-		if (strcmp("", u_word) == 0) {
-			g_free(u_word);
-			continue;
-		}
-		
-		/* Find all occurences of word */
-		while((u_found = strstr(u_found, u_word)) != NULL) {
-			matches++;
-			current_word_found = TRUE;
-			u_found = u_found + strlen(u_word);
-		}
-		
-		/* If we didn't have at least one hit for all words, we return 0 hits, because we want "AND" search, not "OR". */
-		if (current_word_found == FALSE) {
-			g_free(u_note_content);
-			g_free(u_word);
-			return 0;
-		}
-		g_free(u_word);
-	}
-	
-	g_free(u_note_content);
-	
-	return matches;
-}
+	AppData *app_data = app_data_get();
+	ConboyNote *note = conboy_note_store_find_by_guid(app_data->note_store, key);
 
-/**
- * Returns only TRUE if all words appear in the content.
- */
-/*
-static gboolean
-has_match(gchar *content, gchar **words)
-{
-	gint i;
-	for (i = 0; words[i] != NULL; i++) {
-		if (strcmp(content, words[i])) {
-			continue;
-		}
-		return FALSE;
+	if (note != NULL) {
+		g_hash_table_insert((GHashTable*) user_data, note, value);
 	}
-	return TRUE;
 }
-*/
 
 /**
  * Returns a hashtable with pointers to notes as keys and an int as value.
@@ -123,6 +42,9 @@ has_match(gchar *content, gchar **words)
  * 
  * The query it cut into seperate words on whitespaces.
  * 
+ * If the storage backend has a full text index, it is used. Otherwise
+ * ConboyStorage keeps an inverted index of all notes.
+ * 
  * You have to free the hash table after using it.
  */
 void
@@ -131,34 +53,22 @@ search(const gchar *query, GHashTable *result)
 	GTimer *timer = g_timer_new();
 	g_timer_start(timer);
 	AppData *app_data = app_data_get();
-	GtkTreeIter iter;
-	GtkTreeModel *model = GTK_TREE_MODEL(app_data->note_store);
+	GHashTable *matches;
+	GList *notes;
 	
 	g_assert(result != NULL);
 	g_hash_table_remove_all(result);
 	
 	gchar **words = g_strsplit_set(query, "' ''\t''\n'", -1);
 	
-	gboolean valid = gtk_tree_model_get_iter_first(model, &iter);
-
-	while (valid) {
-		gint match_count = 0;
-		ConboyNote *note;
-		gtk_tree_model_get(model, &iter, NOTE_COLUMN, &note, -1);
-		
-		gchar *content;
-		g_object_get(note, "content", &content, NULL);
-		if (content != NULL) {
-			match_count = find_match_count(content, words);
-		}
-		
-			
-		if (match_count > 0) {
-			g_hash_table_insert(result, note, GINT_TO_POINTER(match_count));
-		}
-		
-		valid = gtk_tree_model_iter_next(model, &iter);
+	/* guid -> number of hits */
+	matches = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	notes = conboy_note_store_get_all(app_data->note_store);
+	if (conboy_storage_search(app_data->storage, words, notes, matches)) {
+		g_hash_table_foreach(matches, add_storage_match, result);
 	}
+	g_list_free(notes);
+	g_hash_table_destroy(matches);
 	
 	g_strfreev(words);
 	
@@ -47,6 +47,8 @@ typedef struct {
 	GtkTreeViewColumn  *change_date_column;
 	GHashTable         *search_result;
 	GtkTreeModelFilter *filtered_model;
+	GtkTreeSortable    *sorted_model;
+	GtkTreeView        *tree;
 } SearchWindowData;
 
 /**
@@ -200,18 +202,18 @@ gboolean on_key_pressed(GtkWidget *widget, GdkEventKey *event, gpointer user_dat
 
 #ifdef HILDON_HAS_APP_MENU
 static
-void on_sort_by_date_changed(GtkToggleButton *button, GtkTreeSortable *sortable)
+void on_sort_by_date_changed(GtkToggleButton *button, SearchWindowData *data)
 {
 	if (gtk_toggle_button_get_active(button)) {
-		gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(sortable), CHANGE_DATE_COLUMN, GTK_SORT_DESCENDING);
+		gtk_tree_sortable_set_sort_column_id(data->sorted_model, CHANGE_DATE_COLUMN, GTK_SORT_DESCENDING);
 	}
 }
 
 static
-void on_sort_by_title_changed(GtkToggleButton *button, GtkTreeSortable *sortable)
+void on_sort_by_title_changed(GtkToggleButton *button, SearchWindowData *data)
 {
 	if (gtk_toggle_button_get_active(button)) {
-		gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(sortable), TITLE_COLUMN, GTK_SORT_ASCENDING);
+		gtk_tree_sortable_set_sort_column_id(data->sorted_model, TITLE_COLUMN, GTK_SORT_ASCENDING);
 	}
 }
 #endif
@@ -284,7 +286,7 @@ static
 gint compare_dates(GtkTreeModel *model, GtkTreeIter *a, GtkTreeIter *b, gpointer user_data)
 {
 	ConboyNote *note_a, *note_b;
-	gint date_a, date_b;
+	gint result;
 
 	if (a == NULL || b == NULL) {
 		return 0;
@@ -294,13 +296,66 @@ gint compare_dates(GtkTreeModel *model, GtkTreeIter *a, GtkTreeIter *b, gpointer
 	gtk_tree_model_get(model, b, NOTE_COLUMN, &note_b, -1);
 
 	if (note_a == NULL || note_b == NULL) {
-		return 0;
+		result = 0;
+	} else if (note_a->last_change_date == note_b->last_change_date) {
+		result = 0;
+	} else {
+		/* Read the field directly. Going through g_object_get() is too slow for sorting */
+		result = (note_a->last_change_date > note_b->last_change_date) ? 1 : -1;
 	}
 
-	g_object_get(note_a, "change-date", &date_a, NULL);
-	g_object_get(note_b, "change-date", &date_b, NULL);
+	if (note_a) g_object_unref(note_a);
+	if (note_b) g_object_unref(note_b);
+
+	return result;
+}
+
+/*
+ * Wraps the note store into a filter and a sort model. The returned model
+ * is owned by the caller. The wrappers are also stored in window_data.
+ */
+static GtkTreeModel*
+create_sorted_model(SearchWindowData *window_data, ConboyNoteStore *store)
+{
+	GtkTreeModel *filtered_store;
+	GtkTreeModel *sorted_store;
+
+	/* Add filter wrapper */
+	filtered_store = gtk_tree_model_filter_new(GTK_TREE_MODEL(store), NULL);
+	gtk_tree_model_filter_set_visible_func(GTK_TREE_MODEL_FILTER(filtered_store), is_row_visible, window_data, NULL);
+	/* Add sort wrapper */
+	sorted_store = gtk_tree_model_sort_new_with_model(filtered_store);
+	gtk_tree_sortable_set_sort_func(GTK_TREE_SORTABLE(sorted_store), TITLE_COLUMN, compare_titles, NULL, NULL);
+	gtk_tree_sortable_set_sort_func(GTK_TREE_SORTABLE(sorted_store), CHANGE_DATE_COLUMN, compare_dates, NULL, NULL);
+	g_object_unref(filtered_store);
+
+	window_data->filtered_model = GTK_TREE_MODEL_FILTER(filtered_store);
+	window_data->sorted_model = GTK_TREE_SORTABLE(sorted_store);
 
-	return date_a - date_b;
+	return sorted_store;
+}
+
+/*
+ * The note store was reloaded in one go (e.g. after switching the storage
+ * plugin). Instead of following thousands of row signals, the view gets
+ * a fresh set of wrapper models.
+ */
+static void
+on_note_store_reset(ConboyNoteStore *store, SearchWindowData *window_data)
+{
+	gint sort_column;
+	GtkSortType sort_order;
+	GtkTreeModel *sorted_store;
+
+	if (!gtk_tree_sortable_get_sort_column_id(window_data->sorted_model, &sort_column, &sort_order)) {
+		sort_column = CHANGE_DATE_COLUMN;
+		sort_order = GTK_SORT_DESCENDING;
+	}
+
+	sorted_store = create_sorted_model(window_data, store);
+	gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(sorted_store), sort_column, sort_order);
+	gtk_tree_view_set_model(window_data->tree, sorted_store);
+	g_object_unref(sorted_store);
 }
 
 static
@@ -322,7 +377,6 @@ HildonWindow* search_window_create(SearchWindowData *window_data)
 #endif
 	GtkTreeSelection *selection;
 	ConboyNoteStore *store;
-	GtkTreeModel *filtered_store;
 	GtkTreeModel *sorted_store;
 	GtkCellRenderer *renderer;
 	GtkTreeViewColumn *title_column;
@@ -431,13 +485,8 @@ HildonWindow* search_window_create(SearchWindowData *window_data)
 
 	/* LIST STORE */
 	store = app_data->note_store;
-	/* Add filter wrapper */
-	filtered_store = gtk_tree_model_filter_new(GTK_TREE_MODEL(store), NULL);
-	gtk_tree_model_filter_set_visible_func(GTK_TREE_MODEL_FILTER(filtered_store), is_row_visible, window_data, NULL);
-	/* Add sort wrapper */
-	sorted_store = gtk_tree_model_sort_new_with_model(filtered_store);
-	gtk_tree_sortable_set_sort_func(GTK_TREE_SORTABLE(sorted_store), TITLE_COLUMN, compare_titles, NULL, NULL);
-	gtk_tree_sortable_set_sort_func(GTK_TREE_SORTABLE(sorted_store), CHANGE_DATE_COLUMN, compare_dates, NULL, NULL);
+	/* Add filter and sort wrapper */
+	sorted_store = create_sorted_model(window_data, store);
 
 	/* TREE VIEW */
 #ifdef HILDON_HAS_APP_MENU
@@ -448,7 +497,6 @@ HildonWindow* search_window_create(SearchWindowData *window_data)
 	gtk_tree_view_set_headers_visible(GTK_TREE_VIEW(tree), TRUE);
 #endif
 	g_object_unref(sorted_store);
-	g_object_unref(filtered_store);
 	g_object_unref(store);
 
 	gtk_widget_show(tree);
@@ -498,7 +546,7 @@ HildonWindow* search_window_create(SearchWindowData *window_data)
 	window_data->change_date_column = change_date_column;
 	window_data->hbox = hbox;
 	window_data->search_field = search_field;
-	window_data->filtered_model = GTK_TREE_MODEL_FILTER(filtered_store);
+	window_data->tree = GTK_TREE_VIEW(tree);
 
 
 	/* CONNECT SIGNALS */
@@ -512,12 +560,13 @@ HildonWindow* search_window_create(SearchWindowData *window_data)
 	g_signal_connect(screen, "size-changed", G_CALLBACK(on_orientation_changed), window_data);
 	/*g_signal_connect(new_note_action, "activate", G_CALLBACK(on_new_note_action_activated), win);*/
 	g_signal_connect(fullscreen_action, "activate", G_CALLBACK(on_fullscreen_button_clicked), win);
+	g_signal_connect(store, "reset", G_CALLBACK(on_note_store_reset), window_data);
 
 	gconf_client_notify_add(app_data->client, SETTINGS_SCROLLBAR_SIZE, on_scrollbar_settings_changed, scrolledwindow, NULL, NULL);
 
 #ifdef HILDON_HAS_APP_MENU
-	g_signal_connect(button_sort_by_title, "toggled", G_CALLBACK(on_sort_by_title_changed), sorted_store);
-	g_signal_connect(button_sort_by_date, "toggled", G_CALLBACK(on_sort_by_date_changed), sorted_store);
+	g_signal_connect(button_sort_by_title, "toggled", G_CALLBACK(on_sort_by_title_changed), window_data);
+	g_signal_connect(button_sort_by_date, "toggled", G_CALLBACK(on_sort_by_date_changed), window_data);
 	#ifdef WITH_HE
 	/* Add transparent fullscreen button */
 	HeFullscreenButton *but = he_fullscreen_button_new(GTK_WINDOW(win));
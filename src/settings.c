@@ -42,6 +42,48 @@ settings_load_use_auto_portrait_mode()
 	return gconf_client_get_bool(app_data->client, SETTINGS_USE_AUTO_PORTRAIT, NULL);
 }
 
+void
+settings_save_compress_notes(gboolean compress)
+{
+	AppData *app_data = app_data_get();
+	gconf_client_set_bool(app_data->client, SETTINGS_COMPRESS_NOTES, compress, NULL);
+}
+
+gboolean
+settings_load_compress_notes()
+{
+	AppData *app_data = app_data_get();
+	return gconf_client_get_bool(app_data->client, SETTINGS_COMPRESS_NOTES, NULL);
+}
+
+void
+settings_save_evernote_url(const gchar *url)
+{
+	AppData *app_data = app_data_get();
+	gconf_client_set_string(app_data->client, SETTINGS_EVERNOTE_URL, url, NULL);
+}
+
+gchar*
+settings_load_evernote_url()
+{
+	AppData *app_data = app_data_get();
+	return gconf_client_get_string(app_data->client, SETTINGS_EVERNOTE_URL, NULL);
+}
+
+void
+settings_save_evernote_token(const gchar *token)
+{
+	AppData *app_data = app_data_get();
+	gconf_client_set_string(app_data->client, SETTINGS_EVERNOTE_TOKEN, token, NULL);
+}
+
+gchar*
+settings_load_evernote_token()
+{
+	AppData *app_data = app_data_get();
+	return gconf_client_get_string(app_data->client, SETTINGS_EVERNOTE_TOKEN, NULL);
+}
+
 void
 settings_save_last_open_note(const gchar *guid)
 {
@@ -45,6 +45,9 @@
 #define SETTINGS_LAST_SCROLL_POSITION SETTINGS_ROOT"/last_scroll_position"
 #define SETTINGS_LAST_OPEN_NOTE      SETTINGS_ROOT"/last_open_note"
 #define SETTINGS_USE_AUTO_PORTRAIT   SETTINGS_ROOT"/use_auto_portrait_mode"
+#define SETTINGS_COMPRESS_NOTES      SETTINGS_ROOT"/compress_notes"
+#define SETTINGS_EVERNOTE_URL        SETTINGS_ROOT"/evernote_url"
+#define SETTINGS_EVERNOTE_TOKEN      SETTINGS_ROOT"/evernote_token"
 
 typedef enum {
 	SETTINGS_SCROLLBAR_SIZE_SMALL,
@@ -66,6 +69,15 @@ typedef enum {
 void settings_save_use_auto_portrait_mode(gboolean use);
 gboolean settings_load_use_auto_portrait_mode(void);
 
+void settings_save_compress_notes(gboolean compress);
+gboolean settings_load_compress_notes(void);
+
+void settings_save_evernote_url(const gchar *url);
+gchar* settings_load_evernote_url(void);
+
+void settings_save_evernote_token(const gchar *token);
+gchar* settings_load_evernote_token(void);
+
 void settings_save_last_open_note(const gchar *guid);
 gchar* settings_load_last_open_note(void);
 